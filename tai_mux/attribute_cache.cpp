@@ -0,0 +1,164 @@
+#include "attribute_cache.hpp"
+#include "logger.hpp"
+#include "json.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+
+namespace tai::mux {
+
+    using json = nlohmann::json;
+
+    AttributeCache::AttributeCache(std::chrono::milliseconds default_ttl, const std::map<std::string, std::chrono::milliseconds>& ttls) : m_default_ttl(default_ttl), m_ttls(ttls) {}
+
+    // the configuration file looks like
+    // { "default": 1000, "attributes": { "TAI_MODULE_ATTR_VENDOR_NAME": -1, "TAI_MODULE_ATTR_TEMP": 0 } }
+    std::unique_ptr<AttributeCache> AttributeCache::from_env() {
+        auto e = std::getenv(TAI_MUX_ATTR_CACHE_TTL_MS.c_str());
+        auto config_file = std::getenv(TAI_MUX_ATTR_CACHE_CONFIG.c_str());
+        if ( e == nullptr && config_file == nullptr ) {
+            return nullptr;
+        }
+        std::chrono::milliseconds default_ttl(0);
+        if ( e != nullptr ) {
+            default_ttl = std::chrono::milliseconds(std::strtol(e, nullptr, 0));
+        }
+        std::map<std::string, std::chrono::milliseconds> ttls;
+        if ( config_file != nullptr ) {
+            std::ifstream ifs(config_file);
+            if ( !ifs ) {
+                TAI_ERROR("failed to open %s", config_file);
+                return nullptr;
+            }
+            try {
+                auto c = json::parse(ifs);
+                if ( c.contains("default") ) {
+                    default_ttl = std::chrono::milliseconds(c["default"].get<int64_t>());
+                }
+                if ( c.contains("attributes") ) {
+                    for ( auto& v : c["attributes"].items() ) {
+                        ttls[v.key()] = std::chrono::milliseconds(v.value().get<int64_t>());
+                    }
+                }
+            } catch (const std::exception& e) {
+                TAI_ERROR("failed to parse %s: %s", config_file, e.what());
+                return nullptr;
+            }
+        }
+        TAI_INFO("attribute cache enabled. default ttl: %ld ms", static_cast<long>(default_ttl.count()));
+        return std::make_unique<AttributeCache>(default_ttl, ttls);
+    }
+
+    std::chrono::milliseconds AttributeCache::ttl(const tai_attr_metadata_t* const meta) {
+        {
+            std::shared_lock<std::shared_mutex> lk(m_ttl_mutex);
+            auto it = m_ttl_cache.find(meta);
+            if ( it != m_ttl_cache.end() ) {
+                return it->second;
+            }
+        }
+        std::chrono::milliseconds ttl(0);
+        auto it = meta->attridname != nullptr ? m_ttls.find(meta->attridname) : m_ttls.end();
+        if ( it != m_ttls.end() ) {
+            ttl = it->second;
+        } else if ( meta->flags & TAI_ATTR_FLAGS_CREATE_ONLY ) {
+            ttl = std::chrono::milliseconds(-1);
+        } else if ( meta->flags & TAI_ATTR_FLAGS_READ_ONLY ) {
+            ttl = m_default_ttl;
+        }
+        std::unique_lock<std::shared_mutex> lk(m_ttl_mutex);
+        m_ttl_cache[meta] = ttl;
+        return ttl;
+    }
+
+    AttributeCache::S_Object AttributeCache::find(tai_object_id_t oid) {
+        std::shared_lock<std::shared_mutex> lk(m_mutex);
+        auto it = m_map.find(oid);
+        if ( it == m_map.end() ) {
+            return nullptr;
+        }
+        return it->second;
+    }
+
+    bool AttributeCache::get(tai_object_id_t oid, const tai_attr_metadata_t* const meta, tai_attribute_t* const attr, uint64_t* const generation) {
+        if ( ttl(meta).count() == 0 ) {
+            return false;
+        }
+        auto o = find(oid);
+        if ( !o ) {
+            std::unique_lock<std::shared_mutex> lk(m_mutex);
+            auto& v = m_map[oid];
+            if ( !v ) {
+                v = std::make_shared<Object>();
+            }
+            o = v;
+        }
+        std::unique_lock<std::mutex> lk(o->mutex);
+        // the entry stays after a miss so that invalidate() can bump its generation
+        auto& e = o->entries[attr->id];
+        if ( e.attr && Clock::now() < e.expiry ) {
+            if ( tai_metadata_deepcopy_attr_value(meta, e.attr->raw(), attr) == TAI_STATUS_SUCCESS ) {
+                return true;
+            }
+        }
+        *generation = o->generation + e.generation;
+        return false;
+    }
+
+    void AttributeCache::put(tai_object_id_t oid, uint64_t generation, const tai_attr_metadata_t* const meta, const tai_attribute_t* const attr) {
+        auto t = ttl(meta);
+        if ( t.count() == 0 ) {
+            return;
+        }
+        auto expiry = t.count() < 0 ? Clock::time_point::max() : Clock::now() + t;
+        auto a = std::make_shared<Attribute>(meta, attr);
+        // the object is gone when it has been removed since get()
+        auto o = find(oid);
+        if ( !o ) {
+            return;
+        }
+        std::unique_lock<std::mutex> lk(o->mutex);
+        auto it = o->entries.find(attr->id);
+        if ( it == o->entries.end() || o->generation + it->second.generation != generation ) {
+            return;
+        }
+        auto& e = it->second;
+        e.attr = a;
+        e.expiry = expiry;
+        e.create_only = meta->flags & TAI_ATTR_FLAGS_CREATE_ONLY;
+    }
+
+    void AttributeCache::invalidate(tai_object_id_t oid) {
+        auto o = find(oid);
+        if ( !o ) {
+            return;
+        }
+        std::unique_lock<std::mutex> lk(o->mutex);
+        o->generation++;
+        for ( auto& v : o->entries ) {
+            if ( !v.second.create_only ) {
+                v.second.attr = nullptr;
+            }
+        }
+    }
+
+    void AttributeCache::invalidate(tai_object_id_t oid, tai_attr_id_t id) {
+        auto o = find(oid);
+        if ( !o ) {
+            return;
+        }
+        std::unique_lock<std::mutex> lk(o->mutex);
+        auto it = o->entries.find(id);
+        if ( it != o->entries.end() ) {
+            it->second.attr = nullptr;
+            it->second.generation++;
+        }
+    }
+
+    void AttributeCache::remove(tai_object_id_t oid) {
+        std::unique_lock<std::shared_mutex> lk(m_mutex);
+        m_map.erase(oid);
+    }
+
+}
@@ -0,0 +1,120 @@
+#ifndef __ATTRIBUTE_CACHE_HPP__
+#define __ATTRIBUTE_CACHE_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "tai.h"
+#include "attribute.hpp"
+
+namespace tai::mux {
+
+    // default time to live of cached read-only attributes in milliseconds
+    const std::string TAI_MUX_ATTR_CACHE_TTL_MS = "TAI_MUX_ATTR_CACHE_TTL_MS";
+    // JSON file with the time to live of each attribute, see README.md
+    const std::string TAI_MUX_ATTR_CACHE_CONFIG = "TAI_MUX_ATTR_CACHE_CONFIG";
+
+    // cache of attribute values read from the TAI libraries, keyed by muxed OID and attribute id
+    //
+    // the time to live of an attribute is, in order of precedence
+    // - the one in the configuration file, looked up by the attribute name
+    // - forever for CREATE_ONLY attributes since they can't change
+    // - the default for READ_ONLY attributes
+    // - not cached otherwise
+    // 0 means not cached and a negative value means forever.
+    class AttributeCache {
+        public:
+            AttributeCache(std::chrono::milliseconds default_ttl, const std::map<std::string, std::chrono::milliseconds>& ttls);
+
+            // returns nullptr unless TAI_MUX_ATTR_CACHE_TTL_MS or TAI_MUX_ATTR_CACHE_CONFIG is set
+            static std::unique_ptr<AttributeCache> from_env();
+
+            // copies the cached value to attr. returns false when it isn't
+            // cached or attr can't hold it. attr->value may be modified then.
+            // on a miss *generation is set to what put() needs for the value
+            // read from the TAI library
+            bool get(tai_object_id_t oid, const tai_attr_metadata_t* const meta, tai_attribute_t* const attr, uint64_t* const generation);
+
+            // no-op for attributes which aren't cached, and for values read
+            // before the attribute or the object was invalidated or removed
+            void put(tai_object_id_t oid, uint64_t generation, const tai_attr_metadata_t* const meta, const tai_attribute_t* const attr);
+
+            // discards the attributes which can change by setting an attribute
+            // of the object. CREATE_ONLY attributes are kept
+            void invalidate(tai_object_id_t oid);
+            void invalidate(tai_object_id_t oid, tai_attr_id_t id);
+
+            // discards everything of a removed object
+            void remove(tai_object_id_t oid);
+
+            // counts a read of count attributes of which hits were cached
+            void record(uint32_t hits, uint32_t count) {
+                if ( hits == count ) {
+                    m_hit.fetch_add(1, std::memory_order_relaxed);
+                } else if ( hits > 0 ) {
+                    m_partial_hit.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    m_miss.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            uint64_t hit() const {
+                return m_hit.load(std::memory_order_relaxed);
+            }
+
+            uint64_t partial_hit() const {
+                return m_partial_hit.load(std::memory_order_relaxed);
+            }
+
+            uint64_t miss() const {
+                return m_miss.load(std::memory_order_relaxed);
+            }
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            std::chrono::milliseconds ttl(const tai_attr_metadata_t* const meta);
+
+            // the generation of an entry is bumped when it is invalidated, the
+            // one of an object when the object is. put() compares their sum
+            struct Entry {
+                S_Attribute attr; // null when not cached
+                Clock::time_point expiry;
+                bool create_only = false;
+                uint64_t generation = 0;
+            };
+
+            struct Object {
+                std::mutex mutex; // guards the members below
+                uint64_t generation = 0;
+                std::unordered_map<tai_attr_id_t, Entry> entries;
+            };
+            using S_Object = std::shared_ptr<Object>;
+
+            S_Object find(tai_object_id_t oid);
+
+            const std::chrono::milliseconds m_default_ttl;
+            const std::map<std::string, std::chrono::milliseconds> m_ttls; // by attribute name
+
+            std::shared_mutex m_ttl_mutex; // guards m_ttl_cache
+            std::unordered_map<const tai_attr_metadata_t*, std::chrono::milliseconds> m_ttl_cache;
+
+            // the attributes of an object are guarded by the lock of the object,
+            // so the notifications of different objects don't contend
+            std::shared_mutex m_mutex; // guards m_map
+            std::unordered_map<tai_object_id_t, S_Object> m_map;
+
+            std::atomic<uint64_t> m_hit {0};
+            std::atomic<uint64_t> m_partial_hit {0};
+            std::atomic<uint64_t> m_miss {0};
+    };
+
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "call_executor.hpp"
+#include "logger.hpp"
+
+#include <cstdlib>
+
+namespace tai::mux {
+
+    thread_local const CallExecutor* CallExecutor::s_current = nullptr;
+
+    CallExecutor::CallExecutor(const std::string& name, size_t threads) : m_name(name) {
+        for ( size_t i = 0; i < threads; i++ ) {
+            m_threads.emplace_back(&CallExecutor::loop, this);
+        }
+    }
+
+    CallExecutor::~CallExecutor() {
+        stop();
+    }
+
+    std::unique_ptr<CallExecutor> CallExecutor::from_env(const std::string& name) {
+        auto e = std::getenv(TAI_MUX_WORKER_THREADS.c_str());
+        if ( e == nullptr ) {
+            return nullptr;
+        }
+        auto threads = std::strtoul(e, nullptr, 0);
+        if ( threads == 0 ) {
+            return nullptr;
+        }
+        TAI_INFO("%s: calling with %lu worker threads", name.c_str(), threads);
+        return std::make_unique<CallExecutor>(name, threads);
+    }
+
+    std::chrono::milliseconds CallExecutor::timeout_from_env() {
+        auto e = std::getenv(TAI_MUX_CALL_TIMEOUT_MS.c_str());
+        if ( e == nullptr ) {
+            return std::chrono::milliseconds(0);
+        }
+        return std::chrono::milliseconds(std::strtoul(e, nullptr, 0));
+    }
+
+    std::future<tai_status_t> CallExecutor::submit(std::function<tai_status_t()> fn) {
+        auto task = std::make_shared<std::packaged_task<tai_status_t()>>(std::move(fn));
+        auto f = task->get_future();
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            if ( m_stop ) {
+                lk.unlock();
+                (*task)();
+                return f;
+            }
+            m_queue.emplace_back(task);
+        }
+        m_cv.notify_one();
+        return f;
+    }
+
+    tai_status_t CallExecutor::call(std::function<tai_status_t()> fn, std::chrono::milliseconds timeout) {
+        auto f = submit(std::move(fn));
+        if ( timeout.count() > 0 && f.wait_for(timeout) == std::future_status::timeout ) {
+            m_timed_out.fetch_add(1, std::memory_order_relaxed);
+            TAI_WARN("%s: call didn't finish in %ld ms, continuing in the background", m_name.c_str(), static_cast<long>(timeout.count()));
+            return TAI_STATUS_FAILURE;
+        }
+        return f.get();
+    }
+
+    void CallExecutor::stop() {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        for ( auto& th : m_threads ) {
+            if ( th.joinable() ) {
+                th.join();
+            }
+        }
+    }
+
+    void CallExecutor::loop() {
+        s_current = this;
+        while ( true ) {
+            std::shared_ptr<std::packaged_task<tai_status_t()>> task;
+            {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                m_cv.wait(lk, [this]{ return m_stop || !m_queue.empty(); });
+                if ( m_queue.empty() ) {
+                    return;
+                }
+                task = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            (*task)();
+        }
+    }
+
+}
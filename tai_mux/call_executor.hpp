@@ -0,0 +1,75 @@
+#ifndef __CALL_EXECUTOR_HPP__
+#define __CALL_EXECUTOR_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tai.h"
+
+namespace tai::mux {
+
+    // number of threads calling into each TAI library. 0 (default) calls on the caller's thread
+    const std::string TAI_MUX_WORKER_THREADS = "TAI_MUX_WORKER_THREADS";
+    // how long a get/set waits for the TAI library when worker threads are used. 0 (default) waits forever
+    const std::string TAI_MUX_CALL_TIMEOUT_MS = "TAI_MUX_CALL_TIMEOUT_MS";
+
+    // runs the calls into one TAI library on its own threads
+    //
+    // a library blocking in a call only stalls its own queue. callers waiting
+    // with a timeout get TAI_STATUS_FAILURE when it expires and the call keeps
+    // running in the background, so everything it touches must be owned by fn.
+    class CallExecutor {
+        public:
+            CallExecutor(const std::string& name, size_t threads);
+            ~CallExecutor();
+
+            // returns nullptr unless worker threads are enabled by TAI_MUX_WORKER_THREADS
+            static std::unique_ptr<CallExecutor> from_env(const std::string& name);
+
+            // the timeout configured by TAI_MUX_CALL_TIMEOUT_MS
+            static std::chrono::milliseconds timeout_from_env();
+
+            // a zero timeout waits until fn returns
+            tai_status_t call(std::function<tai_status_t()> fn, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+            // queues fn without waiting for it. runs it on the caller's thread once stopped
+            std::future<tai_status_t> submit(std::function<tai_status_t()> fn);
+
+            // waits for the queued calls and stops the threads. later calls run on the caller's thread
+            void stop();
+
+            // whether the current thread is one of the threads of this executor
+            bool runs_here() const {
+                return s_current == this;
+            }
+
+            uint64_t timed_out() const {
+                return m_timed_out.load(std::memory_order_relaxed);
+            }
+
+        private:
+            void loop();
+
+            static thread_local const CallExecutor* s_current;
+
+            const std::string m_name;
+            std::mutex m_mutex; // guards m_queue and m_stop
+            std::condition_variable m_cv;
+            std::deque<std::shared_ptr<std::packaged_task<tai_status_t()>>> m_queue;
+            bool m_stop = false;
+            std::vector<std::thread> m_threads;
+            std::atomic<uint64_t> m_timed_out {0};
+    };
+
+};
+
+#endif
@@ -8,6 +8,8 @@ typedef enum _tai_mux_platform_adapter_type_t
     TAI_MUX_PLATFORM_ADAPTER_TYPE_UNKNOWN,
     TAI_MUX_PLATFORM_ADAPTER_TYPE_STATIC,
     TAI_MUX_PLATFORM_ADAPTER_TYPE_EXEC,
+    TAI_MUX_PLATFORM_ADAPTER_TYPE_EEPROM,
+    TAI_MUX_PLATFORM_ADAPTER_TYPE_PLUGIN,
     TAI_MUX_PLATFORM_ADAPTER_TYPE_MAX,
 } tai_mux_platform_adapter_type_t;
 
@@ -37,6 +39,106 @@ typedef enum _mux_module_attr_t
      */
     TAI_MODULE_ATTR_MUX_REAL_OID,
 
+    /**
+     * @brief Number of metadata lookups served from the cache of the loaded TAI library
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_METADATA_CACHE_HIT,
+
+    /**
+     * @brief Number of metadata lookups which missed the cache of the loaded TAI library
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_METADATA_CACHE_MISS,
+
+    /**
+     * @brief Number of notifications waiting in the asynchronous dispatch queue
+     *
+     * Always 0 unless TAI_MUX_NOTIFICATION_QUEUE_SIZE is set
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_NOTIFICATION_QUEUE_DEPTH,
+
+    /**
+     * @brief Number of notifications discarded because the dispatch queue was full
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_NOTIFICATION_DROPPED,
+
+    /**
+     * @brief Number of attribute values overwritten by a newer value while the dispatch queue was full
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_NOTIFICATION_COALESCED,
+
+    /**
+     * @brief Number of attribute reads served from the attribute cache
+     *
+     * Always 0 unless the attribute cache is enabled
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_HIT,
+
+    /**
+     * @brief Number of attribute reads which missed the attribute cache
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_MISS,
+
+    /**
+     * @brief Latency of the calls into the loaded TAI library in JSON
+     *
+     * Histograms per API and object type. Always {} unless TAI_MUX_LATENCY_STATS is true
+     *
+     * @type #tai_char_list_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_LATENCY_STATS,
+
+    /**
+     * @brief Number of notification contexts of removed objects and disabled notifications not freed yet
+     *
+     * A context is freed once no callback of the TAI libraries can still be using it
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_NOTIFICATION_CONTEXTS_PENDING,
+
+    /**
+     * @brief Number of notifications merged into a later one by the notification coalescing and rate limiting
+     *
+     * Always 0 unless TAI_MUX_NOTIFICATION_COALESCE_WINDOW or TAI_MUX_NOTIFICATION_RATE_LIMIT is set
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_NOTIFICATION_SUPPRESSED,
+
+    /**
+     * @brief Number of reads of which only some attributes were in the attribute cache
+     *
+     * Such reads go to the TAI library and aren't counted in TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_HIT
+     *
+     * @type uint64_t
+     * @flags READ_ONLY
+     */
+    TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_PARTIAL_HIT,
+
 } mux_module_attr_t;
 
 #endif
@@ -0,0 +1,327 @@
+#include "eeprom_platform_adapter.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace tai::mux {
+
+    // offsets of the 16 byte ASCII fields in the first 256 bytes of the EEPROM
+    struct EEPROMLayout {
+        off_t vendor_name;
+        off_t vendor_pn;
+        off_t vendor_sn;
+    };
+
+    static const size_t EEPROM_FIELD_SIZE = 16;
+
+    static const EEPROMLayout* eeprom_layout(uint8_t identifier) {
+        static const EEPROMLayout sff8472 = {20, 40, 68};   // SFP
+        static const EEPROMLayout sff8636 = {148, 168, 196}; // QSFP, upper page 00h
+        static const EEPROMLayout cmis = {129, 148, 166};    // upper page 00h
+        switch (identifier) {
+        case 0x03:
+            return &sff8472;
+        case 0x0c: // QSFP
+        case 0x0d: // QSFP+
+        case 0x11: // QSFP28
+            return &sff8636;
+        case 0x18: // QSFP-DD
+        case 0x19: // OSFP
+        case 0x1e: // QSFP+ or later with CMIS
+            return &cmis;
+        default:
+            return nullptr;
+        }
+    }
+
+    // the fields are padded with spaces
+    static int read_field(int fd, off_t offset, std::string& field) {
+        char buf[EEPROM_FIELD_SIZE];
+        if ( pread(fd, buf, sizeof(buf), offset) != static_cast<ssize_t>(sizeof(buf)) ) {
+            return -1;
+        }
+        field.assign(buf, sizeof(buf));
+        auto pos = field.find_last_not_of(" \0", std::string::npos, 2);
+        field.erase(pos == std::string::npos ? 0 : pos + 1);
+        return 0;
+    }
+
+    bool EEPROMPlatformAdapter::read_info(const std::string& path, bool full, EEPROMInfo& info) {
+        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if ( fd < 0 ) {
+            return false;
+        }
+        uint8_t identifier = 0;
+        auto present = pread(fd, &identifier, 1, 0) == 1 && identifier != 0x00 && identifier != 0xff;
+        info = EEPROMInfo{identifier};
+        auto layout = eeprom_layout(identifier);
+        if ( present && layout != nullptr ) {
+            if ( read_field(fd, layout->vendor_sn, info.vendor_sn) < 0 || (full && (read_field(fd, layout->vendor_name, info.vendor_name) < 0 || read_field(fd, layout->vendor_pn, info.vendor_pn) < 0)) ) {
+                TAI_WARN("failed to read %s: %s", path.c_str(), std::strerror(errno));
+                present = false;
+            }
+        }
+        close(fd);
+        return present;
+    }
+
+    bool EEPROMRule::match(const EEPROMInfo& info) const {
+        if ( !identifiers.empty() && std::find(identifiers.begin(), identifiers.end(), info.identifier) == identifiers.end() ) {
+            return false;
+        }
+        if ( !vendor_name.empty() && fnmatch(vendor_name.c_str(), info.vendor_name.c_str(), 0) != 0 ) {
+            return false;
+        }
+        if ( !vendor_pn.empty() && fnmatch(vendor_pn.c_str(), info.vendor_pn.c_str(), 0) != 0 ) {
+            return false;
+        }
+        return true;
+    }
+
+    // takes a number or a string like "0x19". anything which isn't a whole
+    // number from 0 to 255 is refused instead of being truncated
+    static uint8_t to_identifier(const json& v) {
+        if ( v.is_string() ) {
+            auto str = v.get<std::string>();
+            char* end = nullptr;
+            errno = 0;
+            auto n = std::strtoul(str.c_str(), &end, 0);
+            if ( str.empty() || !std::isdigit(static_cast<unsigned char>(str[0])) || *end != '\0' || errno != 0 || n > 0xff ) {
+                throw std::invalid_argument("invalid identifier: " + str);
+            }
+            return static_cast<uint8_t>(n);
+        }
+        if ( !v.is_number_unsigned() || v.get<uint64_t>() > 0xff ) {
+            throw std::invalid_argument("invalid identifier: " + v.dump());
+        }
+        return v.get<uint8_t>();
+    }
+
+    static int read_config(const std::string& config_file, std::map<std::string, std::string>& eeproms, std::vector<EEPROMRule>& rules) {
+        std::ifstream ifs(config_file);
+        if ( !ifs ) {
+            return -1;
+        }
+        std::istreambuf_iterator<char> it(ifs), last;
+        std::string config(it, last);
+        try {
+            auto c = json::parse(config);
+            for ( auto& v : c.at("eeproms").items() ) {
+                eeproms[v.key()] = v.value().get<std::string>();
+            }
+            for ( auto& r : c.at("rules") ) {
+                EEPROMRule rule;
+                if ( r.contains("identifier") ) {
+                    auto& id = r["identifier"];
+                    if ( id.is_array() ) {
+                        for ( auto& v : id ) {
+                            rule.identifiers.emplace_back(to_identifier(v));
+                        }
+                    } else {
+                        rule.identifiers.emplace_back(to_identifier(id));
+                    }
+                }
+                rule.vendor_name = r.value("vendor-name", "");
+                rule.vendor_pn = r.value("vendor-pn", "");
+                rule.library = r.at("library").get<std::string>();
+                rules.emplace_back(rule);
+            }
+        } catch (const std::exception& e) {
+            TAI_ERROR("failed to parse %s: %s", config_file.c_str(), e.what());
+            return -1;
+        }
+        return 0;
+    }
+
+    EEPROMPlatformAdapter::EEPROMPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services) : m_loader(flags, &m_services) {
+        std::string config_file = TAI_MUX_EEPROM_DEFAULT_CONFIG;
+        auto e = std::getenv(TAI_MUX_EEPROM_CONFIG_FILE.c_str());
+        if ( e != nullptr ) {
+            config_file = e;
+        }
+
+        m_services.module_presence = nullptr;
+        if ( services != nullptr ) {
+            m_services.get_module_io_handler = services->get_module_io_handler;
+        }
+
+        if ( read_config(config_file, m_eeproms, m_rules) != 0 ) {
+            TAI_ERROR("failed to read %s", config_file.c_str());
+            throw Exception(TAI_STATUS_FAILURE);
+        }
+
+        if ( services != nullptr && services->module_presence != nullptr ) {
+            m_module_presence = services->module_presence;
+
+            auto interval = TAI_MUX_EEPROM_DEFAULT_PRESENCE_INTERVAL;
+            e = std::getenv(TAI_MUX_EEPROM_PRESENCE_INTERVAL.c_str());
+            if ( e != nullptr ) {
+                interval = std::max(std::atoi(e), 0);
+            }
+            // poll() takes the timeout as an int
+            m_interval_ms = std::min(interval, std::numeric_limits<int>::max() / 1000) * 1000;
+
+            refresh_presence();
+
+            if ( m_interval_ms > 0 ) {
+                m_monitor_event = eventfd(0, EFD_CLOEXEC);
+                if ( m_monitor_event < 0 ) {
+                    TAI_ERROR("eventfd failed: %s", std::strerror(errno));
+                } else {
+                    m_th = std::thread(&EEPROMPlatformAdapter::monitor_loop, this);
+                }
+            }
+        }
+    }
+
+    EEPROMPlatformAdapter::~EEPROMPlatformAdapter() {
+        if ( m_th.joinable() ) {
+            uint64_t v = 1;
+            if ( write(m_monitor_event, &v, sizeof(v)) < 0 ) {
+                TAI_WARN("failed to stop the presence monitor: %s", std::strerror(errno));
+            }
+            m_th.join();
+        }
+        if ( m_monitor_event >= 0 ) {
+            close(m_monitor_event);
+        }
+        std::unordered_set<S_ModuleAdapter> set;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            set = m_retired;
+        }
+        for ( auto& ma : list_module_adapters() ) {
+            set.emplace(ma);
+        }
+        for ( auto& ma : set ) {
+            ma->tai_api_uninitialize();
+        }
+    }
+
+    void EEPROMPlatformAdapter::refresh_presence() {
+        for ( const auto& v : m_eeproms ) {
+            const auto& location = v.first;
+            EEPROMInfo info;
+            auto present = read_info(v.second, false, info);
+            auto it = m_present.find(location);
+            auto was_present = it != m_present.end();
+            auto swapped = was_present && present && ( it->second.identifier != info.identifier || it->second.vendor_sn != info.vendor_sn );
+            if ( was_present && ( !present || swapped ) ) {
+                TAI_INFO("module %s: removed", location.c_str());
+                m_present.erase(it);
+                forget(location);
+                m_module_presence(false, const_cast<char*>(location.c_str()));
+            }
+            if ( present && ( !was_present || swapped ) ) {
+                TAI_INFO("module %s: added, identifier: 0x%02x", location.c_str(), info.identifier);
+                m_present[location] = info;
+                m_module_presence(true, const_cast<char*>(location.c_str()));
+            }
+        }
+    }
+
+    void EEPROMPlatformAdapter::monitor_loop() {
+        struct pollfd fd = {m_monitor_event, POLLIN, 0};
+        while ( true ) {
+            auto n = poll(&fd, 1, m_interval_ms);
+            if ( n < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                TAI_ERROR("poll failed: %s", std::strerror(errno));
+                break;
+            }
+            if ( fd.revents & POLLIN ) {
+                break;
+            }
+            refresh_presence();
+        }
+    }
+
+    void EEPROMPlatformAdapter::forget(const std::string& location) {
+        {
+            std::unique_lock<std::mutex> lk(m_decision_mutex);
+            m_decisions.erase(location);
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        auto it = m_ma_map.find(location);
+        if ( it == m_ma_map.end() ) {
+            return;
+        }
+        auto ma = it->second;
+        m_ma_map.erase(it);
+        for ( const auto& v : m_ma_map ) {
+            if ( v.second == ma ) {
+                return;
+            }
+        }
+        m_retired.emplace(ma);
+    }
+
+    // only the identifier and the serial number are read when the module is
+    // the one the last decision was made for
+    int EEPROMPlatformAdapter::resolve(const std::string& location, std::string& lib) {
+        auto it = m_eeproms.find(location);
+        if ( it == m_eeproms.end() ) {
+            TAI_ERROR("no EEPROM for %s", location.c_str());
+            return -1;
+        }
+        EEPROMInfo info;
+        if ( !read_info(it->second, false, info) ) {
+            TAI_ERROR("no module in %s", location.c_str());
+            return -1;
+        }
+        std::unique_lock<std::mutex> lk(m_decision_mutex);
+        auto d = m_decisions.find(location);
+        if ( d != m_decisions.end() && !info.vendor_sn.empty() && d->second.identifier == info.identifier && d->second.vendor_sn == info.vendor_sn ) {
+            lib = d->second.library;
+            return 0;
+        }
+        if ( !read_info(it->second, true, info) ) {
+            TAI_ERROR("no module in %s", location.c_str());
+            return -1;
+        }
+        for ( const auto& rule : m_rules ) {
+            if ( rule.match(info) ) {
+                TAI_INFO("%s: identifier: 0x%02x, vendor: %s, part number: %s, library: %s", location.c_str(), info.identifier, info.vendor_name.c_str(), info.vendor_pn.c_str(), rule.library.c_str());
+                m_decisions[location] = Decision{info.identifier, info.vendor_sn, rule.library};
+                lib = rule.library;
+                return 0;
+            }
+        }
+        TAI_ERROR("no rule matches the module in %s: identifier: 0x%02x, vendor: %s, part number: %s", location.c_str(), info.identifier, info.vendor_name.c_str(), info.vendor_pn.c_str());
+        m_decisions.erase(location);
+        return -1;
+    }
+
+    S_ModuleAdapter EEPROMPlatformAdapter::get_module_adapter(const std::string& location) {
+        std::string lib;
+        if ( resolve(location, lib) != 0 ) {
+            return nullptr;
+        }
+        S_ModuleAdapter ma;
+        try {
+            ma = m_loader.load(lib);
+        } catch (const std::exception& e) {
+            TAI_ERROR("failed to load %s: %s", lib.c_str(), e.what());
+            return nullptr;
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_ma_map[location] = ma;
+        m_retired.erase(ma);
+        ma->acquire();
+        return ma;
+    }
+
+}
@@ -0,0 +1,121 @@
+#ifndef __EEPROM_PLATFORM_ADAPTER_HPP__
+#define __EEPROM_PLATFORM_ADAPTER_HPP__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "platform_adapter.hpp"
+#include "module_adapter.hpp"
+#include "tai.h"
+#include "json.hpp"
+
+namespace tai::mux {
+
+    using json = nlohmann::json;
+
+    const std::string TAI_MUX_EEPROM_CONFIG_FILE = "TAI_MUX_EEPROM_CONFIG_FILE";
+    const std::string TAI_MUX_EEPROM_DEFAULT_CONFIG = "/etc/tai/mux/eeprom.json";
+    // the EEPROMs are read every this many seconds and the modules which were
+    // plugged in, pulled out or swapped are reported through module_presence. 0 disables it
+    const std::string TAI_MUX_EEPROM_PRESENCE_INTERVAL = "TAI_MUX_EEPROM_PRESENCE_INTERVAL";
+    const int TAI_MUX_EEPROM_DEFAULT_PRESENCE_INTERVAL = 1;
+
+    // the fields of a module's EEPROM a library is chosen by. the strings are
+    // empty when the layout of the identifier isn't known
+    struct EEPROMInfo {
+        uint8_t identifier; // SFF-8024
+        std::string vendor_name;
+        std::string vendor_pn;
+        std::string vendor_sn;
+    };
+
+    // a rule of the configuration. identifiers matches any identifier when
+    // empty, and the strings are fnmatch(3) patterns matching anything when empty
+    struct EEPROMRule {
+        std::vector<uint8_t> identifiers;
+        std::string vendor_name;
+        std::string vendor_pn;
+        std::string library;
+
+        bool match(const EEPROMInfo& info) const;
+    };
+
+    // chooses the library of a module from the identifier, vendor name and
+    // vendor part number in its EEPROM, read from sysfs
+    //
+    // {
+    //     "eeproms": { "1": "/sys/bus/i2c/devices/11-0050/eeprom" },
+    //     "rules": [
+    //         { "identifier": [24, "0x19"], "vendor-pn": "ABC-*", "library": "libtai-a.so" },
+    //         { "vendor-name": "ACME", "library": "libtai-b.so" }
+    //     ]
+    // }
+    //
+    // the first matching rule wins. the decision for a location is kept as
+    // long as the serial number of its module is the same, and dropped when
+    // the module is pulled out.
+    class EEPROMPlatformAdapter : public PlatformAdapter {
+        public:
+            EEPROMPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services);
+            ~EEPROMPlatformAdapter();
+            S_ModuleAdapter get_module_adapter(const std::string& location);
+            const std::unordered_set<S_ModuleAdapter> list_module_adapters() {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                std::unordered_set<S_ModuleAdapter> set;
+                for ( auto m : m_ma_map ) {
+                    set.emplace(m.second);
+                }
+                return set;
+            }
+
+            virtual tai_mux_platform_adapter_type_t type() const {
+                return TAI_MUX_PLATFORM_ADAPTER_TYPE_EEPROM;
+            }
+
+            // returns false when no module is plugged in. the vendor name and
+            // part number are only read when full is true
+            static bool read_info(const std::string& path, bool full, EEPROMInfo& info);
+
+        private:
+            int resolve(const std::string& location, std::string& lib);
+
+            // reads the identifier and serial number of every module and
+            // reports the ones which appeared, disappeared or were swapped
+            void refresh_presence();
+            void monitor_loop();
+            // drops what was decided for the module which was in location
+            void forget(const std::string& location);
+
+            std::map<std::string, std::string> m_eeproms; // location to EEPROM file
+            std::vector<EEPROMRule> m_rules;
+
+            struct Decision {
+                uint8_t identifier;
+                std::string vendor_sn;
+                std::string library;
+            };
+            std::map<std::string, Decision> m_decisions; // by location
+            std::mutex m_decision_mutex; // guards m_decisions
+
+            std::map<std::string, S_ModuleAdapter> m_ma_map;
+            // adapters no location maps to anymore, uninitialized with the others
+            std::unordered_set<S_ModuleAdapter> m_retired;
+            tai_service_method_table_t m_services;
+            ModuleAdapterLoader m_loader;
+            std::mutex m_mutex; // guards m_ma_map and m_retired
+
+            // presence monitor. the members below are only touched by m_th once it is started
+            tai_module_presence_fn m_module_presence = nullptr;
+            std::map<std::string, EEPROMInfo> m_present; // the locations reported present
+            int m_interval_ms = 0;
+            std::thread m_th;
+            int m_monitor_event = -1; // wakes up m_th to stop it
+    };
+
+};
+
+#endif
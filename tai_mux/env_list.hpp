@@ -0,0 +1,29 @@
+#ifndef __ENV_LIST_HPP__
+#define __ENV_LIST_HPP__
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace tai::mux {
+
+    // whether name is in the comma separated list held by the environment
+    // variable env, e.g. TAI_MUX_ISOLATED_LIBRARIES=libtai-a.so,libtai-b.so
+    inline bool env_list_contains(const std::string& env, const std::string& name) {
+        auto e = std::getenv(env.c_str());
+        if ( e == nullptr ) {
+            return false;
+        }
+        std::stringstream ss(e);
+        std::string item;
+        while ( std::getline(ss, item, ',') ) {
+            if ( item == name ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "epoch_reclaimer.hpp"
+
+namespace tai::mux {
+
+    // how often the objects held back by a guard are checked again
+    static const auto RECLAIM_RETRY_INTERVAL = std::chrono::milliseconds(100);
+
+    EpochReclaimer::~EpochReclaimer() {
+        stop();
+        auto r = m_records.load(std::memory_order_acquire);
+        while ( r != nullptr ) {
+            auto next = r->next;
+            delete r;
+            r = next;
+        }
+    }
+
+    void EpochReclaimer::stop() {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if ( m_thread.joinable() ) {
+            m_thread.join();
+        }
+    }
+
+    EpochReclaimer::Record* EpochReclaimer::enter() {
+        auto epoch = m_epoch.load(std::memory_order_seq_cst);
+        auto state = epoch << 1 | 1;
+        auto head = m_records.load(std::memory_order_acquire);
+        Record* record = nullptr;
+        for ( auto r = head; r != nullptr; r = r->next ) {
+            uint64_t free = 0;
+            if ( r->state.load(std::memory_order_relaxed) == 0 && r->state.compare_exchange_strong(free, state, std::memory_order_seq_cst) ) {
+                record = r;
+                break;
+            }
+        }
+        if ( record == nullptr ) {
+            record = new Record();
+            record->state.store(state, std::memory_order_seq_cst);
+            record->next = head;
+            while ( !m_records.compare_exchange_weak(record->next, record, std::memory_order_seq_cst) );
+        }
+        // the epoch may have advanced twice before the record was visible to
+        // try_advance(). the guard is only taken once it published the
+        // current epoch, which can't advance past it anymore
+        while ( true ) {
+            auto current = m_epoch.load(std::memory_order_seq_cst);
+            if ( current == epoch ) {
+                return record;
+            }
+            epoch = current;
+            record->state.store(epoch << 1 | 1, std::memory_order_seq_cst);
+        }
+    }
+
+    void EpochReclaimer::synchronize() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        auto target = m_epoch.load(std::memory_order_seq_cst) + 2;
+        while ( true ) {
+            for ( int i = 0; i < 2 && try_advance(); i++ );
+            if ( m_epoch.load(std::memory_order_seq_cst) >= target ) {
+                return;
+            }
+            lk.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            lk.lock();
+        }
+    }
+
+    bool EpochReclaimer::try_advance() {
+        auto epoch = m_epoch.load(std::memory_order_seq_cst);
+        for ( auto r = m_records.load(std::memory_order_acquire); r != nullptr; r = r->next ) {
+            auto state = r->state.load(std::memory_order_seq_cst);
+            if ( (state & 1) && (state >> 1) != epoch ) {
+                return false;
+            }
+        }
+        m_epoch.store(epoch + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    void EpochReclaimer::collect(std::vector<std::shared_ptr<void>>& freed) {
+        // without guards held the epoch moves on twice and the objects are
+        // freed once their grace period passed
+        for ( int i = 0; i < 2 && try_advance(); i++ );
+        auto epoch = m_epoch.load(std::memory_order_relaxed);
+        auto now = clock::now();
+        auto it = m_retired.begin();
+        for ( ; it != m_retired.end() && it->epoch + 2 <= epoch && it->deadline <= now; it++ ) {
+            freed.emplace_back(std::move(it->object));
+        }
+        m_retired.erase(m_retired.begin(), it);
+    }
+
+    void EpochReclaimer::retire(std::shared_ptr<void> object) {
+        std::vector<std::shared_ptr<void>> freed;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_retired.emplace_back(Retired{m_epoch.load(std::memory_order_seq_cst), clock::now() + m_grace_period, std::move(object)});
+            collect(freed);
+            if ( !m_retired.empty() && !m_stop ) {
+                if ( !m_thread.joinable() ) {
+                    m_thread = std::thread(&EpochReclaimer::loop, this);
+                }
+                m_cv.notify_one();
+            }
+        }
+        // the objects are destroyed without holding m_mutex
+    }
+
+    void EpochReclaimer::loop() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while ( !m_stop ) {
+            if ( m_retired.empty() ) {
+                m_cv.wait(lk);
+                continue;
+            }
+            // the oldest object is held back either by its grace period or by a guard
+            auto now = clock::now();
+            auto deadline = m_retired.front().deadline;
+            m_cv.wait_until(lk, deadline > now ? deadline : now + RECLAIM_RETRY_INTERVAL);
+            if ( m_stop ) {
+                break;
+            }
+            std::vector<std::shared_ptr<void>> freed;
+            collect(freed);
+            lk.unlock();
+            freed.clear();
+            lk.lock();
+        }
+    }
+
+    size_t EpochReclaimer::pending() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        return m_retired.size();
+    }
+
+};
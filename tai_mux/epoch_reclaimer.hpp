@@ -0,0 +1,104 @@
+#ifndef __EPOCH_RECLAIMER_HPP__
+#define __EPOCH_RECLAIMER_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tai::mux {
+
+    const std::string TAI_MUX_NOTIFICATION_GRACE_PERIOD_MS = "TAI_MUX_NOTIFICATION_GRACE_PERIOD_MS";
+    const int TAI_MUX_DEFAULT_NOTIFICATION_GRACE_PERIOD_MS = 1000;
+
+    // epoch based reclamation of objects the threads of the TAI libraries can
+    // still be using after they are unlinked
+    //
+    // a thread holds a Guard while it uses such an object. an object is
+    // retired once no new thread can reach it, and it is freed after the
+    // global epoch advanced twice. the epoch only advances when every guard
+    // has observed the current one, so the guards which were held when the
+    // object was retired are gone by then.
+    //
+    // a guard can only be taken once the thread got to our code. a thread of
+    // a TAI library may have picked up the object before it was retired and
+    // not called us yet, so an object is also kept for a grace period after
+    // it is retired. the objects which can't be freed by retire() are freed by
+    // a thread started on demand.
+    //
+    // a guard claims a free record with a CAS and publishes the epoch in it,
+    // so entering doesn't lock. records are allocated when every one of them
+    // is in use and kept until the reclaimer is destroyed.
+    class EpochReclaimer {
+        private:
+            // 0 when free, otherwise the epoch of the guard << 1 | 1
+            struct alignas(64) Record {
+                std::atomic<uint64_t> state {0};
+                Record* next = nullptr;
+            };
+
+        public:
+            using clock = std::chrono::steady_clock;
+
+            class Guard {
+                public:
+                    Guard(EpochReclaimer& r) : m_record(r.enter()) {}
+                    ~Guard() {
+                        m_record->state.store(0, std::memory_order_release);
+                    }
+                    Guard(const Guard&) = delete;
+                    Guard& operator=(const Guard&) = delete;
+                private:
+                    Record* m_record;
+            };
+
+            EpochReclaimer(std::chrono::milliseconds grace_period = std::chrono::milliseconds(0)) : m_grace_period(grace_period) {}
+            // frees the retired objects, no guard may be held
+            ~EpochReclaimer();
+
+            // stops the thread freeing the objects. the ones retired later
+            // are only freed by retire() or the destructor
+            void stop();
+
+            // returns once the guards held now are gone. the caller must not hold one
+            void synchronize();
+
+            // frees the object once the guards held now are gone and the grace
+            // period passed. the objects retired earlier which are safe to free
+            // are freed on the way
+            void retire(std::shared_ptr<void> object);
+
+            // the number of retired objects not freed yet
+            size_t pending();
+
+        private:
+            struct Retired {
+                uint64_t epoch;
+                clock::time_point deadline;
+                std::shared_ptr<void> object;
+            };
+
+            Record* enter();
+            // called with m_mutex held
+            bool try_advance();
+            // called with m_mutex held. moves the objects safe to free to freed
+            void collect(std::vector<std::shared_ptr<void>>& freed);
+            void loop();
+
+            const std::chrono::milliseconds m_grace_period;
+            std::atomic<uint64_t> m_epoch {0};
+            std::atomic<Record*> m_records {nullptr};
+            std::mutex m_mutex; // guards m_retired, m_stop and m_thread, and serializes advancing the epoch
+            std::vector<Retired> m_retired; // in the order they were retired
+            std::condition_variable m_cv;
+            bool m_stop = false;
+            std::thread m_thread;
+    };
+
+};
+
+#endif
@@ -1,7 +1,19 @@
 #include "exec_platform_adapter.hpp"
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <sstream>
+#include <csignal>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 namespace tai::mux {
 
@@ -23,13 +35,18 @@ namespace tai::mux {
         return WEXITSTATUS(pclose(pipe));
     }
 
-    static int exec_script(const std::string& arg, std::string& output) {
-        std::stringstream ss;
+    static std::string exec_script_path() {
         std::string script = TAI_MUX_EXEC_DEFAULT_SCRIPT;
         auto e = std::getenv(TAI_MUX_EXEC_SCRIPT.c_str());
         if ( e != nullptr ) {
             script = e;
         }
+        return script;
+    }
+
+    static int exec_script(const std::string& arg, std::string& output) {
+        std::stringstream ss;
+        auto script = exec_script_path();
         ss << script;
         ss << " ";
         ss << arg;
@@ -42,37 +59,452 @@ namespace tai::mux {
         return 0;
     }
 
-    ExecPlatformAdapter::ExecPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services) : m_flags(flags) {
+    // how long a script which was asked to exit has before it is killed
+    static const auto EXEC_STOP_TIMEOUT = std::chrono::seconds(1);
+
+    ExecCoprocess::ExecCoprocess(const std::string& script, int timeout_ms) : m_script(script), m_timeout_ms(timeout_ms), m_pid(-1), m_fd(-1) {
+        if ( start() != 0 ) {
+            throw Exception(TAI_STATUS_FAILURE);
+        }
+    }
+
+    ExecCoprocess::~ExecCoprocess() {
+        stop();
+    }
+
+    // the script talks over a socket instead of pipes so that writes to a dead
+    // script fail with EPIPE (MSG_NOSIGNAL) instead of raising SIGPIPE in the host
+    int ExecCoprocess::start() {
+        int fds[2];
+        if ( socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0 ) {
+            TAI_ERROR("socketpair failed: %s", std::strerror(errno));
+            return -1;
+        }
+        auto cmd = m_script + " serve";
+        auto pid = fork();
+        if ( pid < 0 ) {
+            TAI_ERROR("fork failed: %s", std::strerror(errno));
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        if ( pid == 0 ) {
+            // the script and its children are killed together by stop()
+            setpgid(0, 0);
+            dup2(fds[1], STDIN_FILENO);
+            dup2(fds[1], STDOUT_FILENO);
+            execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        setpgid(pid, pid); // in case the child hasn't run yet
+        close(fds[1]);
+        m_pid = pid;
+        m_fd = fds[0];
+        m_buffer.clear();
+        TAI_DEBUG("started %s (pid: %d)", m_script.c_str(), pid);
+        return 0;
+    }
+
+    void ExecCoprocess::stop() {
+        if ( m_fd >= 0 ) {
+            close(m_fd); // the script sees EOF on stdin and exits
+            m_fd = -1;
+        }
+        if ( m_pid <= 0 ) {
+            return;
+        }
+        auto deadline = clock::now() + EXEC_STOP_TIMEOUT;
+        while ( waitpid(m_pid, nullptr, WNOHANG) == 0 ) {
+            if ( clock::now() > deadline ) {
+                TAI_WARN("%s (pid: %d) didn't exit, killing it", m_script.c_str(), m_pid);
+                kill(-m_pid, SIGKILL);
+                waitpid(m_pid, nullptr, 0);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        m_pid = -1;
+    }
+
+    // returns -2 when no line arrives by deadline
+    int ExecCoprocess::read_line(std::string& line, clock::time_point deadline) {
+        while ( true ) {
+            auto pos = m_buffer.find('\n');
+            if ( pos != std::string::npos ) {
+                line = m_buffer.substr(0, pos);
+                m_buffer.erase(0, pos + 1);
+                rtrim(line);
+                return 0;
+            }
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+            if ( timeout <= 0 ) {
+                return -2;
+            }
+            struct pollfd pfd = {m_fd, POLLIN, 0};
+            auto ret = poll(&pfd, 1, timeout);
+            if ( ret < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( ret < 0 ) {
+                return -1;
+            }
+            if ( ret == 0 ) {
+                return -2;
+            }
+            char buf[1024];
+            auto n = read(m_fd, buf, sizeof(buf));
+            if ( n < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( n <= 0 ) {
+                return -1;
+            }
+            m_buffer.append(buf, n);
+        }
+    }
+
+    int ExecCoprocess::request_once(const std::string& req, bool multiline, std::vector<std::string>& lines) {
+        if ( m_fd < 0 ) {
+            return -1;
+        }
+        auto msg = req + "\n";
+        size_t sent = 0;
+        while ( sent < msg.size() ) {
+            auto n = send(m_fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+            if ( n < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( n <= 0 ) {
+                return -1;
+            }
+            sent += n;
+        }
+        lines.clear();
+        std::string line;
+        auto deadline = clock::now() + std::chrono::milliseconds(m_timeout_ms);
+        while ( true ) {
+            auto ret = read_line(line, deadline);
+            if ( ret < 0 ) {
+                return ret;
+            }
+            if ( !multiline ) {
+                lines.emplace_back(line);
+                return 0;
+            }
+            if ( lines.empty() && line.compare(0, 4, "err ") == 0 ) {
+                lines.emplace_back(line);
+                return 1;
+            }
+            if ( line == "." ) {
+                return 0;
+            }
+            lines.emplace_back(line);
+        }
+    }
+
+    int ExecCoprocess::request(const std::string& req, bool multiline, std::vector<std::string>& lines) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        auto ret = request_once(req, multiline, lines);
+        if ( ret >= 0 ) {
+            return ret;
+        }
+        // a hung script is only restarted, the request isn't sent again so
+        // that the caller isn't blocked for another timeout
+        auto timed_out = ret == -2;
+        if ( timed_out ) {
+            TAI_ERROR("%s didn't answer '%s' in %d ms, restarting", m_script.c_str(), req.c_str(), m_timeout_ms);
+            kill(-m_pid, SIGKILL);
+        } else {
+            TAI_WARN("%s is not responding, restarting", m_script.c_str());
+        }
+        stop();
+        if ( start() != 0 || timed_out ) {
+            return -1;
+        }
+        return request_once(req, multiline, lines);
+    }
+
+    ExecPlatformAdapter::ExecPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services) : m_flags(flags), m_loader(flags, &m_services) {
 
         m_services.module_presence = nullptr;
         if ( services != nullptr ) {
             m_services.get_module_io_handler = services->get_module_io_handler;
         }
 
+        auto mode = std::getenv(TAI_MUX_EXEC_MODE.c_str());
+        if ( mode != nullptr && std::string(mode) == "coprocess" ) {
+            auto timeout_ms = TAI_MUX_EXEC_DEFAULT_TIMEOUT_MS;
+            auto e = std::getenv(TAI_MUX_EXEC_TIMEOUT_MS.c_str());
+            if ( e != nullptr && std::atoi(e) > 0 ) {
+                timeout_ms = std::atoi(e);
+            }
+            m_coprocess = std::make_unique<ExecCoprocess>(exec_script_path(), timeout_ms);
+        }
+
         if ( services != nullptr && services->module_presence != nullptr ) {
-            std::string output;
-            auto ret = exec_script("list", output);
-            if ( ret != 0 ) {
+            m_module_presence = services->module_presence;
+
+            auto e = std::getenv(TAI_MUX_EXEC_PRESENCE_INTERVAL.c_str());
+            if ( e != nullptr ) {
+                auto interval = std::strtoul(e, nullptr, 0);
+                if ( interval == 0 ) {
+                    TAI_WARN("invalid presence interval: %s, the modules are not listed periodically", e);
+                } else {
+                    // poll() takes the timeout as an int
+                    const unsigned long max = std::numeric_limits<int>::max() / 1000;
+                    if ( interval > max ) {
+                        TAI_WARN("presence interval %s is too long, using %lu", e, max);
+                        interval = max;
+                    }
+                    m_interval_ms = static_cast<int>(interval * 1000);
+                }
+            }
+            // watched before the first listing so that no change is missed
+            e = std::getenv(TAI_MUX_EXEC_PRESENCE_WATCH.c_str());
+            if ( e != nullptr ) {
+                m_watch_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+                if ( m_watch_fd < 0 ) {
+                    TAI_ERROR("inotify_init1 failed: %s", std::strerror(errno));
+                } else if ( inotify_add_watch(m_watch_fd, e, IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0 ) {
+                    TAI_ERROR("failed to watch %s: %s", e, std::strerror(errno));
+                    close(m_watch_fd);
+                    m_watch_fd = -1;
+                }
+            }
+
+            if ( refresh_presence() != 0 ) {
+                if ( m_watch_fd >= 0 ) {
+                    close(m_watch_fd);
+                }
                 throw Exception(TAI_STATUS_FAILURE);
             }
-            TAI_DEBUG("result of list: %s", output.c_str());
-            std::stringstream ss(output);
-            std::string location;
-            while(getline(ss, location)) {
-                services->module_presence(true, const_cast<char*>(location.c_str()));
+
+            if ( m_interval_ms > 0 || m_watch_fd >= 0 ) {
+                m_monitor_event = eventfd(0, EFD_CLOEXEC);
+                if ( m_monitor_event < 0 ) {
+                    TAI_ERROR("eventfd failed: %s", std::strerror(errno));
+                } else {
+                    m_th = std::thread(&ExecPlatformAdapter::monitor_loop, this);
+                }
             }
         }
    }
 
     ExecPlatformAdapter::~ExecPlatformAdapter() {
-        for ( auto& m : m_ma_map ) {
-            m.second->tai_api_uninitialize();
+        if ( m_th.joinable() ) {
+            uint64_t v = 1;
+            if ( write(m_monitor_event, &v, sizeof(v)) < 0 ) {
+                TAI_WARN("failed to stop the presence monitor: %s", std::strerror(errno));
+            }
+            m_th.join();
+        }
+        if ( m_monitor_event >= 0 ) {
+            close(m_monitor_event);
+        }
+        if ( m_watch_fd >= 0 ) {
+            close(m_watch_fd);
+        }
+        for ( auto& ma : list_module_adapters() ) {
+            ma->tai_api_uninitialize();
+        }
+    }
+
+    int ExecPlatformAdapter::list(std::vector<std::string>& locations) {
+        if ( m_coprocess ) {
+            return m_coprocess->request("list", true, locations);
+        }
+        std::string output;
+        auto ret = exec_script("list", output);
+        if ( ret != 0 ) {
+            return ret;
         }
+        TAI_DEBUG("result of list: %s", output.c_str());
+        std::stringstream ss(output);
+        std::string location;
+        while(getline(ss, location)) {
+            locations.emplace_back(location);
+        }
+        return 0;
+    }
+
+    // only the coprocess can tell that nothing changed, a script executed for
+    // every request is asked for the whole list
+    int ExecPlatformAdapter::list_changed(std::vector<std::string>& locations, bool* changed) {
+        *changed = true;
+        if ( !m_coprocess || !m_list_changed ) {
+            return list(locations);
+        }
+        std::vector<std::string> lines;
+        auto ret = m_coprocess->request(m_list_token.empty() ? "list-changed" : "list-changed " + m_list_token, true, lines);
+        if ( ret < 0 ) {
+            return ret;
+        }
+        if ( ret == 0 && lines.size() == 1 && lines.front() == "unchanged" ) {
+            *changed = false;
+            return 0;
+        }
+        if ( ret != 0 || lines.empty() || lines.front().compare(0, 8, "changed ") != 0 ) {
+            TAI_INFO("%s doesn't support list-changed, listing every module", exec_script_path().c_str());
+            m_list_changed = false;
+            return list(locations);
+        }
+        m_list_token = lines.front().substr(8);
+        locations.assign(lines.begin() + 1, lines.end());
+        return 0;
+    }
+
+    int ExecPlatformAdapter::refresh_presence() {
+        std::vector<std::string> locations;
+        bool changed;
+        if ( list_changed(locations, &changed) != 0 ) {
+            TAI_WARN("failed to list the modules");
+            return -1;
+        }
+        if ( !changed ) {
+            return 0;
+        }
+        // a line is a location, optionally followed by what identifies the
+        // module in it. a module swapped for another one is reported removed
+        // and added even when the location is listed both times
+        std::map<std::string, std::string> present;
+        for ( const auto& line : locations ) {
+            auto pos = line.find(' ');
+            if ( pos == std::string::npos ) {
+                present[line] = "";
+            } else {
+                present[line.substr(0, pos)] = line.substr(pos + 1);
+            }
+        }
+        std::vector<std::string> removed, added;
+        for ( const auto& v : m_present ) {
+            auto it = present.find(v.first);
+            if ( it == present.end() || it->second != v.second ) {
+                removed.emplace_back(v.first);
+            }
+        }
+        for ( const auto& v : present ) {
+            auto it = m_present.find(v.first);
+            if ( it == m_present.end() || it->second != v.second ) {
+                added.emplace_back(v.first);
+            }
+        }
+        m_present.swap(present);
+        if ( removed.empty() && added.empty() ) {
+            return 0;
+        }
+        TAI_INFO("modules: %lu removed, %lu added", removed.size(), added.size());
+        for ( const auto& location : removed ) {
+            // another kind of module can be inserted there
+            invalidate(location);
+            m_module_presence(false, const_cast<char*>(location.c_str()));
+        }
+        for ( const auto& location : added ) {
+            m_module_presence(true, const_cast<char*>(location.c_str()));
+        }
+        return 0;
+    }
+
+    // events come in bursts while a module is inserted, they are drained
+    // before the modules are listed
+    void ExecPlatformAdapter::monitor_loop() {
+        struct pollfd fds[] = {{m_monitor_event, POLLIN, 0}, {m_watch_fd, POLLIN, 0}};
+        alignas(struct inotify_event) char buf[4096];
+        while ( true ) {
+            auto n = poll(fds, m_watch_fd < 0 ? 1 : 2, m_interval_ms);
+            if ( n < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                TAI_ERROR("poll failed: %s", std::strerror(errno));
+                break;
+            }
+            if ( fds[0].revents & POLLIN ) {
+                break;
+            }
+            if ( m_watch_fd >= 0 && (fds[1].revents & POLLIN) ) {
+                while ( read(m_watch_fd, buf, sizeof(buf)) > 0 );
+            }
+            refresh_presence();
+        }
+    }
+
+    // in coprocess mode, the first resolution asks the script for every location
+    // at once and later ones are answered from the cache. a script which fails
+    // 'resolve-all' is only sent 'resolve' afterwards. the requests are sent
+    // without m_lib_cache_mutex, an answer which raced with invalidate() isn't cached
+    int ExecPlatformAdapter::resolve(const std::string& location, std::string& lib) {
+        if ( !m_coprocess ) {
+            return exec_script(location, lib);
+        }
+        uint64_t generation;
+        bool all;
+        {
+            std::unique_lock<std::mutex> lk(m_lib_cache_mutex);
+            auto it = m_lib_cache.find(location);
+            if ( it != m_lib_cache.end() ) {
+                lib = it->second;
+                return 0;
+            }
+            generation = m_lib_cache_generation;
+            all = m_resolve_all && !m_resolved_all;
+        }
+
+        if ( all ) {
+            std::vector<std::string> lines;
+            auto ret = m_coprocess->request("resolve-all", true, lines);
+            std::unique_lock<std::mutex> lk(m_lib_cache_mutex);
+            if ( ret != 0 ) {
+                TAI_INFO("resolve-all failed on %s, resolving one location at a time", exec_script_path().c_str());
+                m_resolve_all = false;
+            } else if ( generation == m_lib_cache_generation ) {
+                for ( const auto& line : lines ) {
+                    auto pos = line.find(' ');
+                    if ( pos == std::string::npos ) {
+                        continue;
+                    }
+                    m_lib_cache[line.substr(0, pos)] = line.substr(pos + 1);
+                }
+                m_resolved_all = true;
+                auto it = m_lib_cache.find(location);
+                if ( it != m_lib_cache.end() ) {
+                    lib = it->second;
+                    return 0;
+                }
+            }
+        }
+
+        std::vector<std::string> lines;
+        auto ret = m_coprocess->request("resolve " + location, false, lines);
+        if ( ret != 0 ) {
+            return ret;
+        }
+        auto& line = lines.front();
+        if ( line.compare(0, 3, "ok ") != 0 ) {
+            TAI_ERROR("failed to resolve %s: %s", location.c_str(), line.c_str());
+            return -1;
+        }
+        lib = line.substr(3);
+        std::unique_lock<std::mutex> lk(m_lib_cache_mutex);
+        if ( generation == m_lib_cache_generation ) {
+            m_lib_cache[location] = lib;
+        }
+        return 0;
+    }
+
+    void ExecPlatformAdapter::invalidate(const std::string& location) {
+        std::unique_lock<std::mutex> lk(m_lib_cache_mutex);
+        m_lib_cache_generation++;
+        if ( location.empty() ) {
+            m_lib_cache.clear();
+            m_resolved_all = false;
+            return;
+        }
+        m_lib_cache.erase(location);
     }
 
     S_ModuleAdapter ExecPlatformAdapter::get_module_adapter(const std::string& location) {
         std::string lib;
-        auto ret = exec_script(location, lib);
+        auto ret = resolve(location, lib);
         if ( ret != 0 ) {
             TAI_ERROR("script failed: %d", ret);
             return nullptr;
@@ -81,17 +513,13 @@ namespace tai::mux {
             TAI_ERROR("no library found");
             return nullptr;
         }
-        auto dl = ModuleAdapter::dl_address(lib);
-        S_ModuleAdapter ma;
-        TAI_DEBUG("dl: %p, lib: %s", dl, lib.c_str());
-        if ( dl == 0 ) {
-            ma = std::make_shared<ModuleAdapter>(lib, m_flags, &m_services);
-            dl = ModuleAdapter::dl_address(lib);
-            m_lib_map[dl] = ma;
-        } else {
-            ma = m_lib_map[dl];
-        }
+        // loading happens outside m_mutex so that modules using different
+        // libraries can be brought up in parallel
+        auto ma = m_loader.load(lib);
+        TAI_DEBUG("lib: %s", lib.c_str());
+        std::unique_lock<std::mutex> lk(m_mutex);
         m_ma_map[location] = ma;
+        ma->acquire();
         return ma;
     }
 }
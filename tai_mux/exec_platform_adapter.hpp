@@ -1,11 +1,15 @@
 #ifndef __EXEC_PLATFORM_ADAPTER_HPP__
 #define __EXEC_PLATFORM_ADAPTER_HPP__
 
+#include <chrono>
 #include <thread>
 #include <map>
 #include <cstdlib>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <sys/types.h>
 
 #include "platform_adapter.hpp"
 #include "module_adapter.hpp"
@@ -18,6 +22,58 @@ namespace tai::mux {
 
     const std::string TAI_MUX_EXEC_SCRIPT = "TAI_MUX_EXEC_SCRIPT";
     const std::string TAI_MUX_EXEC_DEFAULT_SCRIPT = "/etc/tai/mux/exec.sh";
+    const std::string TAI_MUX_EXEC_MODE = "TAI_MUX_EXEC_MODE";
+    // how long the coprocess has to answer a request before it is killed and restarted
+    const std::string TAI_MUX_EXEC_TIMEOUT_MS = "TAI_MUX_EXEC_TIMEOUT_MS";
+    const int TAI_MUX_EXEC_DEFAULT_TIMEOUT_MS = 30000;
+    // when set, the modules are listed again every this many seconds and the changes are reported through module_presence
+    const std::string TAI_MUX_EXEC_PRESENCE_INTERVAL = "TAI_MUX_EXEC_PRESENCE_INTERVAL";
+    // when set, the modules are also listed again when an entry of this directory changes, e.g. a file touched by a udev rule
+    const std::string TAI_MUX_EXEC_PRESENCE_WATCH = "TAI_MUX_EXEC_PRESENCE_WATCH";
+
+    // a long-lived instance of the exec script started with 'serve' as the first argument
+    //
+    // requests and responses are newline terminated lines on the script's
+    // stdin and stdout.
+    //
+    // - 'list': one location per line, followed by a line with a single '.'.
+    //   a location can be followed by a space and what identifies the module
+    //   in it, e.g. its serial number
+    // - 'list-changed [<token>]': 'unchanged' when the modules are the same as
+    //   when token was answered, otherwise 'changed <token>' and one location
+    //   per line. followed by a line with a single '.'
+    // - 'resolve <location>': 'ok <library>' or 'err <reason>'
+    // - 'resolve-all': '<location> <library>' per line, followed by a line with a single '.'
+    //
+    // a request the script doesn't support is answered with a single 'err <reason>' line
+    //
+    // a script which doesn't answer within timeout_ms is killed and restarted
+    class ExecCoprocess {
+        public:
+            using clock = std::chrono::steady_clock;
+
+            ExecCoprocess(const std::string& script, int timeout_ms = TAI_MUX_EXEC_DEFAULT_TIMEOUT_MS);
+            ~ExecCoprocess();
+
+            // sends req and reads the response. the script is restarted once if it died
+            // multiline responses are read until the '.' line, which isn't included in lines
+            // returns 1 when a multiline request is answered with an 'err' line, which is in lines
+            int request(const std::string& req, bool multiline, std::vector<std::string>& lines);
+
+        private:
+            int start();
+            void stop();
+            // returns -2 when the script didn't answer in time
+            int request_once(const std::string& req, bool multiline, std::vector<std::string>& lines);
+            int read_line(std::string& line, clock::time_point deadline);
+
+            const std::string m_script;
+            const int m_timeout_ms;
+            pid_t m_pid;
+            int m_fd;
+            std::string m_buffer;
+            std::mutex m_mutex;
+    };
 
     class ExecPlatformAdapter : public PlatformAdapter {
         public:
@@ -25,6 +81,7 @@ namespace tai::mux {
             ~ExecPlatformAdapter();
             S_ModuleAdapter get_module_adapter(const std::string& location);
             const std::unordered_set<S_ModuleAdapter> list_module_adapters() {
+                std::unique_lock<std::mutex> lk(m_mutex);
                 std::unordered_set<S_ModuleAdapter> set;
                 for ( auto m : m_ma_map ) {
                     set.emplace(m.second);
@@ -35,12 +92,48 @@ namespace tai::mux {
             virtual tai_mux_platform_adapter_type_t type() const  {
                 return TAI_MUX_PLATFORM_ADAPTER_TYPE_EXEC;
             }
+
+            // drops the cached library of location, or of all locations when location is empty
+            void invalidate(const std::string& location = "");
         private:
-            std::map<uint64_t, S_ModuleAdapter> m_lib_map;
+            int list(std::vector<std::string>& locations);
+            // like list() but *changed is false, and locations empty, when the
+            // script tells the modules didn't change since the last call
+            int list_changed(std::vector<std::string>& locations, bool* changed);
+            int resolve(const std::string& location, std::string& lib);
+
+            // lists the modules and reports the ones which appeared or disappeared
+            int refresh_presence();
+            void monitor_loop();
+
+            // null unless TAI_MUX_EXEC_MODE is 'coprocess'
+            std::unique_ptr<ExecCoprocess> m_coprocess;
+            // location to library name answered by m_coprocess. only invalidated
+            // by the presence monitor, without it a location keeps its library
+            // until the TAI adapter host restarts
+            std::map<std::string, std::string> m_lib_cache;
+            uint64_t m_lib_cache_generation = 0; // bumped by invalidate()
+            bool m_resolved_all = false; // m_lib_cache holds the answer of 'resolve-all'
+            bool m_resolve_all = true; // false once 'resolve-all' failed on m_coprocess
+            std::mutex m_lib_cache_mutex; // guards the members above
+
             std::map<std::string, S_ModuleAdapter> m_ma_map;
-            std::thread m_th;
             tai_service_method_table_t m_services;
             const uint64_t m_flags;
+            ModuleAdapterLoader m_loader;
+            std::mutex m_mutex; // guards m_ma_map
+
+            // presence monitor, only used when TAI_MUX_EXEC_PRESENCE_INTERVAL or
+            // TAI_MUX_EXEC_PRESENCE_WATCH is set. the members below are only
+            // touched by m_th once it is started
+            tai_module_presence_fn m_module_presence = nullptr;
+            std::map<std::string, std::string> m_present; // the locations reported present, to what identifies their module
+            std::string m_list_token; // answered by the last 'list-changed'
+            bool m_list_changed = true; // false once m_coprocess turns out not to support 'list-changed'
+            int m_interval_ms = -1;
+            int m_watch_fd = -1; // inotify on TAI_MUX_EXEC_PRESENCE_WATCH
+            std::thread m_th;
+            int m_monitor_event = -1; // wakes up m_th to stop it
     };
 
 };
@@ -0,0 +1,414 @@
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ipc.hpp"
+
+// runs one TAI library for libtai-mux.so, see ipc.hpp and remote_library.hpp
+//
+// usage: tai-mux-host library shm-fd request-fd response-fd notification-fd parent-fd alive-fd
+//
+// started by libtai-mux.so with the descriptors already open. the library is
+// loaded here and called with the attributes pointing into the shared slots.
+// the host exits when libtai-mux.so closes parent-fd or goes away.
+
+using namespace tai::mux;
+
+typedef tai_status_t (*tai_api_initialize_fn) (uint64_t, const tai_service_method_table_t *);
+typedef tai_status_t (*tai_api_uninitialize_fn) (void);
+typedef tai_status_t (*tai_api_query_fn) (tai_api_t, void**);
+typedef tai_status_t (*tai_log_set_fn) (tai_api_t, tai_log_level_t, tai_log_fn);
+typedef tai_object_type_t (*tai_object_type_query_fn) (tai_object_id_t);
+typedef tai_object_id_t (*tai_module_id_query_fn) (tai_object_id_t);
+typedef const tai_attr_metadata_t* (*tai_metadata_get_attr_metadata_fn) (tai_object_type_t, tai_attr_id_t);
+
+static const char* s_name;
+
+static tai_api_initialize_fn s_tai_api_initialize;
+static tai_api_uninitialize_fn s_tai_api_uninitialize;
+static tai_api_query_fn s_tai_api_query;
+static tai_log_set_fn s_tai_log_set;
+static tai_object_type_query_fn s_tai_object_type_query;
+static tai_module_id_query_fn s_tai_module_id_query;
+static tai_metadata_get_attr_metadata_fn s_get_attr_metadata;
+
+static tai_module_api_t* s_module_api;
+static tai_network_interface_api_t* s_netif_api;
+static tai_host_interface_api_t* s_hostif_api;
+static tai_meta_api_t* s_meta_api;
+
+// the library logs on its own, presence and module I/O belong to libtai-mux.so
+static tai_service_method_table_t s_services;
+
+static IPCRegion* s_region;
+static int s_response_fd;
+static int s_notification_fd;
+static std::mutex s_ring_mutex;
+
+static void signal_fd(int fd) {
+    uint64_t v = 1;
+    while ( write(fd, &v, sizeof(v)) < 0 && errno == EINTR );
+}
+
+static void drain_fd(int fd) {
+    uint64_t v;
+    while ( read(fd, &v, sizeof(v)) < 0 && errno == EINTR );
+}
+
+static const tai_attr_metadata_t* attr_metadata(tai_object_type_t type, tai_attr_id_t id) {
+    if ( s_meta_api != nullptr && s_meta_api->get_attr_metadata != nullptr ) {
+        tai_metadata_key_t key{.type=type};
+        return s_meta_api->get_attr_metadata(&key, id);
+    }
+    return s_get_attr_metadata != nullptr ? s_get_attr_metadata(type, id) : nullptr;
+}
+
+// appends a notification to the ring. the notification is dropped when the
+// ring is full, libtai-mux.so reports the number of dropped ones
+static void on_notification(void* context, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs) {
+    auto type = s_tai_object_type_query(oid);
+    // attributes of an unknown type can't be encoded
+    std::vector<tai_attribute_t> known;
+    std::vector<tai_attr_value_type_t> types;
+    for ( uint32_t i = 0; i < count; i++ ) {
+        auto meta = attr_metadata(type, attrs[i].id);
+        if ( meta != nullptr ) {
+            known.emplace_back(attrs[i]);
+            types.emplace_back(meta->attrvaluetype);
+        }
+    }
+    auto size = wire_encode(nullptr, 0, known.size(), known.data(), types.data(), true);
+    auto need = sizeof(IPCNotification) + size;
+
+    auto& h = s_region->header;
+    auto ring = s_region->ring;
+    std::unique_lock<std::mutex> lk(s_ring_mutex);
+    auto head = h.ring_head.load(std::memory_order_relaxed);
+    auto tail = h.ring_tail.load(std::memory_order_seq_cst);
+    auto room = TAI_MUX_IPC_RING_SIZE - head % TAI_MUX_IPC_RING_SIZE;
+    // a record doesn't wrap, the rest of the ring is skipped
+    auto pad = room < need ? room : 0;
+    if ( need > TAI_MUX_IPC_RING_SIZE || head + pad + need - tail > TAI_MUX_IPC_RING_SIZE ) {
+        h.ring_dropped.fetch_add(1);
+        return;
+    }
+    auto next = head;
+    if ( pad > 0 ) {
+        if ( pad >= sizeof(IPCNotification) ) {
+            IPCNotification n{pad, 0, TAI_NULL_OBJECT_ID};
+            std::memcpy(ring + next % TAI_MUX_IPC_RING_SIZE, &n, sizeof(n));
+        }
+        next += pad;
+    }
+    auto pos = next % TAI_MUX_IPC_RING_SIZE;
+    IPCNotification n{need, reinterpret_cast<uint64_t>(context), oid};
+    std::memcpy(ring + pos, &n, sizeof(n));
+    wire_encode(ring + pos + sizeof(n), size, known.size(), known.data(), types.data(), true);
+    h.ring_head.store(next + need, std::memory_order_seq_cst);
+    // libtai-mux.so is only woken up when it has drained the ring
+    if ( h.ring_tail.load(std::memory_order_seq_cst) == head ) {
+        signal_fd(s_notification_fd);
+    }
+}
+
+static tai_status_t initialize(uint64_t flags) {
+    auto status = s_tai_api_initialize(flags, &s_services);
+    if ( status != TAI_STATUS_SUCCESS ) {
+        return status;
+    }
+    if ( s_tai_api_query(TAI_API_MODULE, (void**)(&s_module_api)) != TAI_STATUS_SUCCESS ||
+         s_tai_api_query(TAI_API_NETWORKIF, (void**)(&s_netif_api)) != TAI_STATUS_SUCCESS ||
+         s_tai_api_query(TAI_API_HOSTIF, (void**)(&s_hostif_api)) != TAI_STATUS_SUCCESS ) {
+        return TAI_STATUS_FAILURE;
+    }
+    if ( s_tai_api_query(TAI_API_META, (void**)(&s_meta_api)) != TAI_STATUS_SUCCESS ) {
+        s_meta_api = nullptr;
+    }
+    return TAI_STATUS_SUCCESS;
+}
+
+static tai_status_t create_object(IPCSlot& slot, const WireAttributes& w) {
+    tai_object_id_t oid = TAI_NULL_OBJECT_ID;
+    auto status = TAI_STATUS_NOT_SUPPORTED;
+    switch (slot.type) {
+    case TAI_OBJECT_TYPE_MODULE:
+        if ( s_module_api != nullptr && s_module_api->create_module != nullptr ) {
+            status = s_module_api->create_module(&oid, w.count, w.attrs);
+        }
+        break;
+    case TAI_OBJECT_TYPE_NETWORKIF:
+        if ( s_netif_api != nullptr && s_netif_api->create_network_interface != nullptr ) {
+            status = s_netif_api->create_network_interface(&oid, slot.arg, w.count, w.attrs);
+        }
+        break;
+    case TAI_OBJECT_TYPE_HOSTIF:
+        if ( s_hostif_api != nullptr && s_hostif_api->create_host_interface != nullptr ) {
+            status = s_hostif_api->create_host_interface(&oid, slot.arg, w.count, w.attrs);
+        }
+        break;
+    default:
+        break;
+    }
+    slot.oid = oid;
+    return status;
+}
+
+static tai_status_t remove_object(IPCSlot& slot) {
+    switch (slot.type) {
+    case TAI_OBJECT_TYPE_MODULE:
+        if ( s_module_api != nullptr && s_module_api->remove_module != nullptr ) {
+            return s_module_api->remove_module(slot.oid);
+        }
+        break;
+    case TAI_OBJECT_TYPE_NETWORKIF:
+        if ( s_netif_api != nullptr && s_netif_api->remove_network_interface != nullptr ) {
+            return s_netif_api->remove_network_interface(slot.oid);
+        }
+        break;
+    case TAI_OBJECT_TYPE_HOSTIF:
+        if ( s_hostif_api != nullptr && s_hostif_api->remove_host_interface != nullptr ) {
+            return s_hostif_api->remove_host_interface(slot.oid);
+        }
+        break;
+    default:
+        break;
+    }
+    return TAI_STATUS_NOT_SUPPORTED;
+}
+
+static tai_status_t set_attributes(IPCSlot& slot, const WireAttributes& w) {
+    switch (slot.type) {
+    case TAI_OBJECT_TYPE_MODULE:
+        if ( s_module_api != nullptr && s_module_api->set_module_attributes != nullptr ) {
+            return s_module_api->set_module_attributes(slot.oid, w.count, w.attrs);
+        }
+        break;
+    case TAI_OBJECT_TYPE_NETWORKIF:
+        if ( s_netif_api != nullptr && s_netif_api->set_network_interface_attributes != nullptr ) {
+            return s_netif_api->set_network_interface_attributes(slot.oid, w.count, w.attrs);
+        }
+        break;
+    case TAI_OBJECT_TYPE_HOSTIF:
+        if ( s_hostif_api != nullptr && s_hostif_api->set_host_interface_attributes != nullptr ) {
+            return s_hostif_api->set_host_interface_attributes(slot.oid, w.count, w.attrs);
+        }
+        break;
+    default:
+        break;
+    }
+    return TAI_STATUS_NOT_SUPPORTED;
+}
+
+static tai_status_t get_attributes(IPCSlot& slot, const WireAttributes& w) {
+    switch (slot.type) {
+    case TAI_OBJECT_TYPE_MODULE:
+        if ( s_module_api != nullptr && s_module_api->get_module_attributes != nullptr ) {
+            return s_module_api->get_module_attributes(slot.oid, w.count, w.attrs);
+        }
+        break;
+    case TAI_OBJECT_TYPE_NETWORKIF:
+        if ( s_netif_api != nullptr && s_netif_api->get_network_interface_attributes != nullptr ) {
+            return s_netif_api->get_network_interface_attributes(slot.oid, w.count, w.attrs);
+        }
+        break;
+    case TAI_OBJECT_TYPE_HOSTIF:
+        if ( s_hostif_api != nullptr && s_hostif_api->get_host_interface_attributes != nullptr ) {
+            return s_hostif_api->get_host_interface_attributes(slot.oid, w.count, w.attrs);
+        }
+        break;
+    default:
+        break;
+    }
+    return TAI_STATUS_NOT_SUPPORTED;
+}
+
+static tai_status_t clear_attributes(IPCSlot& slot) {
+    uint32_t count;
+    std::memcpy(&count, slot.data, sizeof(count));
+    if ( sizeof(count) + sizeof(tai_attr_id_t) * uint64_t(count) > slot.size ) {
+        return TAI_STATUS_FAILURE;
+    }
+    if ( s_hostif_api == nullptr || s_hostif_api->clear_host_interface_attributes == nullptr ) {
+        return TAI_STATUS_NOT_SUPPORTED;
+    }
+    return s_hostif_api->clear_host_interface_attributes(slot.oid, count, reinterpret_cast<tai_attr_id_t*>(slot.data + sizeof(count)));
+}
+
+// runs the call of a slot with its attributes bound in place
+static void run(IPCSlot& slot) {
+    WireAttributes w;
+    auto size = slot.size;
+    switch (slot.op) {
+    case IPCOp::INITIALIZE:
+        slot.status = initialize(slot.arg);
+        break;
+    case IPCOp::UNINITIALIZE:
+        slot.status = s_tai_api_uninitialize();
+        slot.state.store(IPC_SLOT_RESPONSE, std::memory_order_release);
+        signal_fd(s_response_fd);
+        _exit(0);
+    case IPCOp::LOG_SET:
+        slot.status = s_tai_log_set(static_cast<tai_api_t>(slot.arg >> 32), static_cast<tai_log_level_t>(slot.arg & 0xffffffff), nullptr);
+        break;
+    case IPCOp::OBJECT_TYPE_QUERY:
+        slot.arg = s_tai_object_type_query(slot.oid);
+        slot.status = TAI_STATUS_SUCCESS;
+        break;
+    case IPCOp::MODULE_ID_QUERY:
+        slot.arg = s_tai_module_id_query(slot.oid);
+        slot.status = TAI_STATUS_SUCCESS;
+        break;
+    case IPCOp::CREATE:
+    case IPCOp::SET:
+    case IPCOp::GET:
+        if ( size > sizeof(slot.data) || !wire_bind(slot.data, size, on_notification, w) ) {
+            slot.status = TAI_STATUS_FAILURE;
+            break;
+        }
+        if ( slot.op == IPCOp::CREATE ) {
+            slot.status = create_object(slot, w);
+        } else if ( slot.op == IPCOp::SET ) {
+            slot.status = set_attributes(slot, w);
+        } else {
+            slot.status = get_attributes(slot, w);
+        }
+        wire_unbind(slot.data, size, w);
+        break;
+    case IPCOp::REMOVE:
+        slot.status = remove_object(slot);
+        break;
+    case IPCOp::CLEAR:
+        slot.status = clear_attributes(slot);
+        break;
+    default:
+        slot.status = TAI_STATUS_NOT_SUPPORTED;
+        break;
+    }
+    slot.state.store(IPC_SLOT_RESPONSE, std::memory_order_release);
+    signal_fd(s_response_fd);
+}
+
+// one worker per slot, so that a call blocked in the library only holds its own slot
+class Worker {
+    public:
+        Worker(IPCSlot& slot) : m_slot(slot), m_pending(false), m_thread(&Worker::loop, this) {}
+
+        void post() {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_pending = true;
+            m_cv.notify_one();
+        }
+
+    private:
+        void loop() {
+            while ( true ) {
+                {
+                    std::unique_lock<std::mutex> lk(m_mutex);
+                    m_cv.wait(lk, [&]() { return m_pending; });
+                    m_pending = false;
+                }
+                run(m_slot);
+            }
+        }
+
+        IPCSlot& m_slot;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_pending;
+        std::thread m_thread;
+};
+
+template<typename T>
+static bool load(void* dl, const char* name, T& f) {
+    f = reinterpret_cast<T>(dlsym(dl, name));
+    if ( f == nullptr ) {
+        std::fprintf(stderr, "tai-mux-host: %s undefined in %s\n", name, s_name);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if ( argc != 8 ) {
+        std::fprintf(stderr, "usage: %s library shm-fd request-fd response-fd notification-fd parent-fd alive-fd\n", argv[0]);
+        return 1;
+    }
+    s_name = argv[1];
+    auto shm_fd = std::atoi(argv[2]);
+    auto request_fd = std::atoi(argv[3]);
+    s_response_fd = std::atoi(argv[4]);
+    s_notification_fd = std::atoi(argv[5]);
+    auto parent_fd = std::atoi(argv[6]);
+    // alive-fd is only held open, libtai-mux.so sees it hang up when this process exits
+
+    auto addr = mmap(nullptr, sizeof(IPCRegion), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if ( addr == MAP_FAILED ) {
+        std::fprintf(stderr, "tai-mux-host: mmap: %s\n", strerror(errno));
+        return 1;
+    }
+    close(shm_fd);
+    s_region = static_cast<IPCRegion*>(addr);
+    auto& h = s_region->header;
+    if ( std::memcmp(h.magic, IPC_MAGIC, sizeof(IPC_MAGIC)) != 0 || h.version != IPC_VERSION || h.num_slots != TAI_MUX_IPC_NUM_SLOTS ) {
+        std::fprintf(stderr, "tai-mux-host: libtai-mux.so speaks another version\n");
+        return 1;
+    }
+
+    auto dl = dlopen(s_name, RTLD_NOW | RTLD_DEEPBIND);
+    if ( dl == nullptr ) {
+        std::fprintf(stderr, "tai-mux-host: %s\n", dlerror());
+        return 1;
+    }
+    if ( !load(dl, "tai_api_initialize", s_tai_api_initialize) ||
+         !load(dl, "tai_api_uninitialize", s_tai_api_uninitialize) ||
+         !load(dl, "tai_api_query", s_tai_api_query) ||
+         !load(dl, "tai_log_set", s_tai_log_set) ||
+         !load(dl, "tai_object_type_query", s_tai_object_type_query) ||
+         !load(dl, "tai_module_id_query", s_tai_module_id_query) ) {
+        return 1;
+    }
+    // the value types of notifications when the library has no meta api
+    s_get_attr_metadata = reinterpret_cast<tai_metadata_get_attr_metadata_fn>(dlsym(dl, "tai_metadata_get_attr_metadata"));
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for ( auto& slot : s_region->slots ) {
+        workers.emplace_back(std::make_unique<Worker>(slot));
+    }
+
+    pollfd fds[] = {{request_fd, POLLIN, 0}, {parent_fd, POLLIN, 0}};
+    while ( true ) {
+        if ( poll(fds, 2, -1) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            std::fprintf(stderr, "tai-mux-host: poll: %s\n", strerror(errno));
+            _exit(1);
+        }
+        // libtai-mux.so is gone or done with this process. the library
+        // isn't uninitialized, its threads may be stuck
+        if ( fds[1].revents != 0 ) {
+            _exit(0);
+        }
+        if ( fds[0].revents & POLLIN ) {
+            drain_fd(request_fd);
+            for ( uint32_t i = 0; i < TAI_MUX_IPC_NUM_SLOTS; i++ ) {
+                uint32_t expected = IPC_SLOT_REQUEST;
+                if ( s_region->slots[i].state.compare_exchange_strong(expected, IPC_SLOT_RUNNING) ) {
+                    workers[i]->post();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,315 @@
+#include "ipc.hpp"
+
+#include <cstring>
+#include <type_traits>
+
+namespace tai::mux {
+
+    static size_t align8(size_t n) {
+        return (n + 7) & ~size_t(7);
+    }
+
+    // calls f with the list of value when type is a list of scalars
+    template<typename F>
+    static bool with_list(tai_attr_value_type_t type, tai_attribute_value_t& value, F&& f) {
+        switch (type) {
+        case TAI_ATTR_VALUE_TYPE_OBJLIST:
+            f(value.objlist);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_CHARLIST:
+            f(value.charlist);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_U8LIST:
+            f(value.u8list);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_S8LIST:
+            f(value.s8list);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_U16LIST:
+            f(value.u16list);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_S16LIST:
+            f(value.s16list);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_U32LIST:
+            f(value.u32list);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_S32LIST:
+            f(value.s32list);
+            return true;
+        case TAI_ATTR_VALUE_TYPE_FLOATLIST:
+            f(value.floatlist);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    template<typename T>
+    static T* to_offset(size_t off) {
+        return reinterpret_cast<T*>(static_cast<uintptr_t>(off));
+    }
+
+    // appends to buf, or only counts the size when buf is null
+    class WireWriter {
+        public:
+            WireWriter(uint8_t* buf, size_t cap) : m_buf(buf), m_cap(cap), m_size(0), m_ok(true) {}
+
+            // returns the offset of n bytes, 8 byte aligned
+            size_t reserve(size_t n) {
+                auto off = align8(m_size);
+                if ( m_buf != nullptr && off + n > m_cap ) {
+                    m_ok = false;
+                    return 0;
+                }
+                m_size = off + n;
+                return off;
+            }
+
+            void write(size_t off, const void* src, size_t n) {
+                if ( m_buf != nullptr && m_ok && n > 0 ) {
+                    std::memcpy(m_buf + off, src, n);
+                }
+            }
+
+            size_t size() const {
+                return m_ok ? align8(m_size) : 0;
+            }
+
+        private:
+            uint8_t* m_buf;
+            size_t m_cap;
+            size_t m_size;
+            bool m_ok;
+    };
+
+    size_t wire_encode(uint8_t* buf, size_t cap, uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types, bool elements) {
+        WireWriter w(buf, cap);
+        auto header = w.reserve(2 * sizeof(uint32_t));
+        w.write(header, &count, sizeof(count));
+        auto type_off = w.reserve(sizeof(uint32_t) * count);
+        auto attr_off = w.reserve(sizeof(tai_attribute_t) * count);
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto type = types[i];
+            uint32_t t = type;
+            w.write(type_off + i * sizeof(uint32_t), &t, sizeof(t));
+            auto a = attrs[i];
+            auto list = [&](auto& l) {
+                using T = std::remove_pointer_t<decltype(l.list)>;
+                if ( l.list == nullptr ) {
+                    l.list = nullptr;
+                    return;
+                }
+                auto off = w.reserve(sizeof(T) * l.count);
+                if ( elements ) {
+                    w.write(off, l.list, sizeof(T) * l.count);
+                }
+                l.list = to_offset<T>(off);
+            };
+            if ( with_list(type, a.value, list) ) {
+                // done
+            } else if ( type == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                auto& l = a.value.objmaplist;
+                if ( l.list != nullptr ) {
+                    auto src = l.list;
+                    auto off = w.reserve(sizeof(tai_object_map_t) * l.count);
+                    for ( uint32_t j = 0; j < l.count; j++ ) {
+                        auto m = src[j];
+                        list(m.value);
+                        w.write(off + j * sizeof(m), &m, sizeof(m));
+                    }
+                    l.list = to_offset<tai_object_map_t>(off);
+                }
+            } else if ( type == TAI_ATTR_VALUE_TYPE_ATTRLIST ) {
+                std::memset(&a.value, 0, sizeof(a.value));
+            } else if ( type == TAI_ATTR_VALUE_TYPE_NOTIFICATION ) {
+                if ( a.value.notification.notify != nullptr ) {
+                    a.value.notification.notify = to_offset<std::remove_pointer_t<tai_notification_fn>>(1);
+                }
+            }
+            w.write(attr_off + i * sizeof(a), &a, sizeof(a));
+        }
+        return w.size();
+    }
+
+    bool wire_bind(uint8_t* buf, size_t size, tai_notification_fn notify, WireAttributes& wire) {
+        if ( size < 2 * sizeof(uint32_t) ) {
+            return false;
+        }
+        std::memcpy(&wire.count, buf, sizeof(wire.count));
+        auto type_off = 2 * sizeof(uint32_t);
+        auto attr_off = align8(type_off + sizeof(uint32_t) * wire.count);
+        if ( attr_off + sizeof(tai_attribute_t) * uint64_t(wire.count) > size ) {
+            return false;
+        }
+        wire.types = reinterpret_cast<tai_attr_value_type_t*>(buf + type_off);
+        wire.attrs = reinterpret_cast<tai_attribute_t*>(buf + attr_off);
+
+        bool ok = true;
+        auto list = [&](auto& l) {
+            using T = std::remove_pointer_t<decltype(l.list)>;
+            auto off = reinterpret_cast<uintptr_t>(l.list);
+            if ( off == 0 ) {
+                return;
+            }
+            // the count of a get may exceed the buffer when the TAI library
+            // reports a buffer overflow, it is kept for the caller
+            if ( off < attr_off || off + sizeof(T) * uint64_t(l.count) > size ) {
+                l.list = nullptr;
+                ok = false;
+                return;
+            }
+            l.list = reinterpret_cast<T*>(buf + off);
+        };
+        for ( uint32_t i = 0; i < wire.count; i++ ) {
+            auto type = wire.types[i];
+            auto& value = wire.attrs[i].value;
+            if ( with_list(type, value, list) ) {
+                continue;
+            }
+            if ( type == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                auto& l = value.objmaplist;
+                list(l);
+                for ( uint32_t j = 0; l.list != nullptr && j < l.count; j++ ) {
+                    list(l.list[j].value);
+                }
+            } else if ( type == TAI_ATTR_VALUE_TYPE_NOTIFICATION ) {
+                if ( value.notification.notify != nullptr && notify != nullptr ) {
+                    value.notification.notify = notify;
+                }
+            }
+        }
+        return ok;
+    }
+
+    void wire_unbind(uint8_t* buf, size_t size, const WireAttributes& wire) {
+        auto inside = [&](const void* p) {
+            auto b = reinterpret_cast<const uint8_t*>(p);
+            return b >= buf && b < buf + size;
+        };
+        // a list the TAI library pointed somewhere else is dropped
+        auto list = [&](auto& l) {
+            using T = std::remove_pointer_t<decltype(l.list)>;
+            if ( l.list != nullptr ) {
+                l.list = inside(l.list) ? to_offset<T>(reinterpret_cast<uint8_t*>(l.list) - buf) : nullptr;
+            }
+        };
+        for ( uint32_t i = 0; i < wire.count; i++ ) {
+            auto type = wire.types[i];
+            auto& value = wire.attrs[i].value;
+            if ( with_list(type, value, list) ) {
+                continue;
+            }
+            if ( type == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                auto& l = value.objmaplist;
+                // the count exceeds the maps after a buffer overflow
+                for ( uint32_t j = 0; l.list != nullptr && j < l.count && inside(&l.list[j]) && inside(reinterpret_cast<uint8_t*>(&l.list[j + 1]) - 1); j++ ) {
+                    list(l.list[j].value);
+                }
+                list(l);
+            } else if ( type == TAI_ATTR_VALUE_TYPE_NOTIFICATION ) {
+                if ( value.notification.notify != nullptr ) {
+                    value.notification.notify = to_offset<std::remove_pointer_t<tai_notification_fn>>(1);
+                }
+            }
+        }
+    }
+
+    // the caller's list keeps its buffer. the elements are copied when they fit
+    template<typename L>
+    static void copy_list(const L& src, L& dst) {
+        auto capacity = dst.count;
+        dst.count = src.count;
+        if ( dst.list != nullptr && src.list != nullptr && src.count <= capacity ) {
+            std::memcpy(dst.list, src.list, sizeof(*src.list) * src.count);
+        }
+    }
+
+    void wire_copy_out(const WireAttributes& wire, uint32_t count, tai_attribute_t* attrs) {
+        for ( uint32_t i = 0; i < count && i < wire.count; i++ ) {
+            auto type = wire.types[i];
+            auto& src = wire.attrs[i].value;
+            auto& dst = attrs[i].value;
+            switch (type) {
+            case TAI_ATTR_VALUE_TYPE_OBJLIST:
+                copy_list(src.objlist, dst.objlist);
+                break;
+            case TAI_ATTR_VALUE_TYPE_CHARLIST:
+                copy_list(src.charlist, dst.charlist);
+                break;
+            case TAI_ATTR_VALUE_TYPE_U8LIST:
+                copy_list(src.u8list, dst.u8list);
+                break;
+            case TAI_ATTR_VALUE_TYPE_S8LIST:
+                copy_list(src.s8list, dst.s8list);
+                break;
+            case TAI_ATTR_VALUE_TYPE_U16LIST:
+                copy_list(src.u16list, dst.u16list);
+                break;
+            case TAI_ATTR_VALUE_TYPE_S16LIST:
+                copy_list(src.s16list, dst.s16list);
+                break;
+            case TAI_ATTR_VALUE_TYPE_U32LIST:
+                copy_list(src.u32list, dst.u32list);
+                break;
+            case TAI_ATTR_VALUE_TYPE_S32LIST:
+                copy_list(src.s32list, dst.s32list);
+                break;
+            case TAI_ATTR_VALUE_TYPE_FLOATLIST:
+                copy_list(src.floatlist, dst.floatlist);
+                break;
+            case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+                {
+                    auto capacity = dst.objmaplist.count;
+                    dst.objmaplist.count = src.objmaplist.count;
+                    if ( dst.objmaplist.list == nullptr || src.objmaplist.list == nullptr || src.objmaplist.count > capacity ) {
+                        break;
+                    }
+                    for ( uint32_t j = 0; j < src.objmaplist.count; j++ ) {
+                        dst.objmaplist.list[j].key = src.objmaplist.list[j].key;
+                        copy_list(src.objmaplist.list[j].value, dst.objmaplist.list[j].value);
+                    }
+                }
+                break;
+            case TAI_ATTR_VALUE_TYPE_ATTRLIST:
+                break;
+            case TAI_ATTR_VALUE_TYPE_NOTIFICATION:
+                // the handler of the host process means nothing here
+                dst.notification.notify = nullptr;
+                dst.notification.context = nullptr;
+                break;
+            default:
+                dst = src;
+                break;
+            }
+        }
+    }
+
+    void map_oids(uint32_t count, tai_attribute_t* attrs, const tai_attr_value_type_t* types, const std::function<tai_object_id_t(tai_object_id_t)>& map) {
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto& value = attrs[i].value;
+            switch (types[i]) {
+            case TAI_ATTR_VALUE_TYPE_OID:
+                value.oid = map(value.oid);
+                break;
+            case TAI_ATTR_VALUE_TYPE_OBJLIST:
+                for ( uint32_t j = 0; value.objlist.list != nullptr && j < value.objlist.count; j++ ) {
+                    value.objlist.list[j] = map(value.objlist.list[j]);
+                }
+                break;
+            case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+                for ( uint32_t j = 0; value.objmaplist.list != nullptr && j < value.objmaplist.count; j++ ) {
+                    auto& m = value.objmaplist.list[j];
+                    m.key = map(m.key);
+                    for ( uint32_t k = 0; m.value.list != nullptr && k < m.value.count; k++ ) {
+                        m.value.list[k] = map(m.value.list[k]);
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,133 @@
+#ifndef __IPC_HPP__
+#define __IPC_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "tai.h"
+
+namespace tai::mux {
+
+    // shared memory between libtai-mux.so and a tai-mux-host process which
+    // runs one TAI library
+    //
+    // | IPCHeader | IPCSlot * TAI_MUX_IPC_NUM_SLOTS | notification ring |
+    //
+    // each slot carries one call at a time. libtai-mux.so claims a free slot,
+    // writes the request, marks it REQUEST and signals the request eventfd.
+    // the host runs the call with the attributes pointing into the slot, so
+    // the TAI library reads and writes the lists in place. it marks the slot
+    // RESPONSE and signals the response eventfd.
+    //
+    // notifications are appended to the ring by the host. the notification
+    // eventfd is only signaled when the ring was empty, so a burst of
+    // notifications is consumed with a single wakeup.
+
+    const char IPC_MAGIC[8] = {'T', 'A', 'I', 'M', 'U', 'X', 'S', 'M'};
+    const uint32_t IPC_VERSION = 1;
+
+    static const uint32_t TAI_MUX_IPC_NUM_SLOTS = 16;
+    static const size_t TAI_MUX_IPC_SLOT_SIZE = 64 * 1024;
+    static const size_t TAI_MUX_IPC_RING_SIZE = 1024 * 1024;
+
+    enum class IPCOp : uint32_t {
+        INITIALIZE,        // arg: flags
+        UNINITIALIZE,      // the host exits after responding
+        LOG_SET,           // arg: api << 32 | level
+        OBJECT_TYPE_QUERY, // oid -> arg
+        MODULE_ID_QUERY,   // oid -> arg
+        CREATE,            // type, arg: module oid, attributes -> oid
+        REMOVE,            // type, oid
+        SET,               // type, oid, attributes
+        GET,               // type, oid, attributes -> attributes
+        CLEAR,             // oid, attribute ids
+    };
+
+    enum IPCSlotState : uint32_t {
+        IPC_SLOT_FREE,
+        IPC_SLOT_CLAIMED,  // being written by libtai-mux.so
+        IPC_SLOT_REQUEST,
+        IPC_SLOT_RUNNING,  // being run by the host
+        IPC_SLOT_RESPONSE,
+    };
+
+    struct IPCSlot {
+        std::atomic<uint32_t> state;
+        IPCOp op;
+        tai_object_type_t type;
+        tai_status_t status;
+        tai_object_id_t oid;
+        uint64_t arg;
+        uint64_t size; // bytes used in data
+        alignas(8) uint8_t data[TAI_MUX_IPC_SLOT_SIZE];
+    };
+
+    struct IPCHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_slots;
+        alignas(64) std::atomic<uint64_t> ring_head; // advanced by the host
+        alignas(64) std::atomic<uint64_t> ring_tail; // advanced by libtai-mux.so
+        std::atomic<uint64_t> ring_dropped;          // notifications which didn't fit
+    };
+
+    struct IPCRegion {
+        IPCHeader header;
+        IPCSlot slots[TAI_MUX_IPC_NUM_SLOTS];
+        alignas(64) uint8_t ring[TAI_MUX_IPC_RING_SIZE];
+    };
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free, "atomics in shared memory must be lock free");
+
+    // a record in the notification ring, followed by the attributes in the
+    // wire format. records don't wrap: a record with a zero context pads to
+    // the end of the ring, and less room than this header is skipped
+    struct IPCNotification {
+        uint64_t size;    // including this header, a multiple of 8
+        uint64_t context; // the context libtai-mux.so set the handler with
+        tai_object_id_t oid;
+    };
+
+    // wire format of attributes, position independent so that it can be
+    // copied as a whole
+    //
+    // u32 count | u32 pad | u32 value type * count (padded to 8) | tai_attribute_t * count | list elements
+    //
+    // the list pointers hold the offset of the elements from the start of the
+    // encoding, 0 for a null list. a notification handler keeps its context,
+    // and its function is 1 when it is set. nested attribute lists aren't
+    // carried, their count is 0.
+    struct WireAttributes {
+        uint32_t count;
+        tai_attr_value_type_t* types;
+        tai_attribute_t* attrs;
+    };
+
+    // returns the size of the encoding, or 0 when it doesn't fit in cap. buf
+    // can be null to get the size. the list elements are only copied when
+    // elements is true, the space for them is reserved anyway so that the
+    // encoding can be used as the buffer of a get
+    size_t wire_encode(uint8_t* buf, size_t cap, uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types, bool elements);
+
+    // turns the offsets into pointers into buf in place. a notification
+    // handler which is set gets notify as its function unless notify is null.
+    // returns false when a list is out of buf, the list is null then but keeps
+    // its count
+    bool wire_bind(uint8_t* buf, size_t size, tai_notification_fn notify, WireAttributes& wire);
+
+    // turns the pointers of a bound encoding back into offsets
+    void wire_unbind(uint8_t* buf, size_t size, const WireAttributes& wire);
+
+    // copies the values of a bound encoding to the caller's attributes of a
+    // get. lists are copied when they fit in the caller's buffers, otherwise
+    // only the count is, like a TAI library reports a buffer overflow
+    void wire_copy_out(const WireAttributes& wire, uint32_t count, tai_attribute_t* attrs);
+
+    // applies map to every OID in the values of attrs
+    void map_oids(uint32_t count, tai_attribute_t* attrs, const tai_attr_value_type_t* types, const std::function<tai_object_id_t(tai_object_id_t)>& map);
+
+};
+
+#endif
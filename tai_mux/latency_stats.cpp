@@ -0,0 +1,195 @@
+#include "latency_stats.hpp"
+#include "logger.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tai::mux {
+
+    uint64_t LatencyHistogram::percentile(double p) const {
+        auto count = m_count.load(std::memory_order_relaxed);
+        if ( count == 0 ) {
+            return 0;
+        }
+        auto target = static_cast<uint64_t>(count * p / 100.0);
+        if ( target == 0 ) {
+            target = 1;
+        }
+        uint64_t sum = 0;
+        for ( int i = 0; i < NUM_BUCKETS; i++ ) {
+            sum += m_buckets[i].load(std::memory_order_relaxed);
+            if ( sum >= target ) {
+                return upper_bound(i);
+            }
+        }
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    std::string LatencyHistogram::to_json() const {
+        std::stringstream ss;
+        ss << "{\"count\": " << count();
+        ss << ", \"sum_ns\": " << m_sum.load(std::memory_order_relaxed);
+        ss << ", \"max_ns\": " << m_max.load(std::memory_order_relaxed);
+        ss << ", \"p50_ns\": " << percentile(50);
+        ss << ", \"p90_ns\": " << percentile(90);
+        ss << ", \"p99_ns\": " << percentile(99);
+        ss << ", \"buckets\": [";
+        bool first = true;
+        for ( int i = 0; i < NUM_BUCKETS; i++ ) {
+            auto v = m_buckets[i].load(std::memory_order_relaxed);
+            if ( v == 0 ) {
+                continue;
+            }
+            if ( !first ) {
+                ss << ", ";
+            }
+            first = false;
+            ss << "[" << upper_bound(i) << ", " << v << "]";
+        }
+        ss << "]}";
+        return ss.str();
+    }
+
+    static bool enabled() {
+        auto e = std::getenv(TAI_MUX_LATENCY_STATS.c_str());
+        return e != nullptr && std::string(e) == "true";
+    }
+
+    std::unique_ptr<LatencyStats> LatencyStats::from_env() {
+        if ( !enabled() ) {
+            return nullptr;
+        }
+        return std::make_unique<LatencyStats>();
+    }
+
+    std::string LatencyStats::to_json() const {
+        static const char* apis[] = {"create", "remove", "get", "set", "get_capabilities", "convert_oid"};
+        static const char* types[] = {"module", "netif", "hostif", "other"};
+        std::stringstream ss;
+        ss << "{";
+        bool first = true;
+        for ( int i = 0; i < static_cast<int>(LatencyApi::MAX); i++ ) {
+            for ( int j = 0; j < NUM_OBJECT_TYPES; j++ ) {
+                auto& h = m_histograms[i][j];
+                if ( h.count() == 0 ) {
+                    continue;
+                }
+                if ( !first ) {
+                    ss << ", ";
+                }
+                first = false;
+                ss << "\"" << apis[i] << "/" << types[j] << "\": " << h.to_json();
+            }
+        }
+        ss << "}";
+        return ss.str();
+    }
+
+    // only one dumper exists at a time, the signal handler can't have a context
+    static int s_dump_pipe[2] = {-1, -1};
+    static struct sigaction s_old_action;
+
+    static void on_sigusr1(int) {
+        auto saved = errno;
+        char c = 'd';
+        if ( write(s_dump_pipe[1], &c, 1) < 0 ) {
+            // the pipe is full, a dump is already pending
+        }
+        errno = saved;
+    }
+
+    LatencyDumper::LatencyDumper(const std::string& path, std::function<std::string()> dump) : m_path(path), m_dump(dump) {
+        if ( pipe2(s_dump_pipe, O_CLOEXEC) < 0 ) {
+            TAI_ERROR("pipe2 failed: %s", std::strerror(errno));
+            return;
+        }
+        // the signal handler must never block
+        fcntl(s_dump_pipe[1], F_SETFL, fcntl(s_dump_pipe[1], F_GETFL) | O_NONBLOCK);
+        struct sigaction sa = {};
+        sa.sa_handler = on_sigusr1;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, &s_old_action);
+        m_th = std::thread(&LatencyDumper::loop, this);
+    }
+
+    LatencyDumper::~LatencyDumper() {
+        if ( !m_th.joinable() ) {
+            return;
+        }
+        sigaction(SIGUSR1, &s_old_action, nullptr);
+        char c = 'q';
+        while ( write(s_dump_pipe[1], &c, 1) < 0 && errno == EAGAIN ) {
+            usleep(1000);
+        }
+        m_th.join();
+        close(s_dump_pipe[0]);
+        close(s_dump_pipe[1]);
+        s_dump_pipe[0] = s_dump_pipe[1] = -1;
+    }
+
+    std::unique_ptr<LatencyDumper> LatencyDumper::from_env(std::function<std::string()> dump) {
+        auto e = std::getenv(TAI_MUX_LATENCY_STATS_FILE.c_str());
+        if ( !enabled() || e == nullptr || *e == '\0' ) {
+            return nullptr;
+        }
+        return std::make_unique<LatencyDumper>(e, dump);
+    }
+
+    void LatencyDumper::loop() {
+        auto fd = s_dump_pipe[0];
+        while ( true ) {
+            char c;
+            auto n = read(fd, &c, 1);
+            if ( n < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( n <= 0 || c == 'q' ) {
+                return;
+            }
+            write_file();
+        }
+    }
+
+    void LatencyDumper::write_file() {
+        auto tmp = m_path + ".tmp";
+        // a leftover of an earlier dump which failed halfway
+        unlink(tmp.c_str());
+        auto fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if ( fd < 0 ) {
+            TAI_ERROR("failed to open %s: %s", tmp.c_str(), std::strerror(errno));
+            return;
+        }
+        auto data = m_dump() + "\n";
+        const char* p = data.c_str();
+        size_t left = data.size();
+        while ( left > 0 ) {
+            auto n = write(fd, p, left);
+            if ( n < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( n <= 0 ) {
+                TAI_ERROR("failed to write %s: %s", tmp.c_str(), std::strerror(errno));
+                close(fd);
+                unlink(tmp.c_str());
+                return;
+            }
+            p += n;
+            left -= n;
+        }
+        close(fd);
+        if ( rename(tmp.c_str(), m_path.c_str()) < 0 ) {
+            TAI_ERROR("failed to rename %s to %s: %s", tmp.c_str(), m_path.c_str(), std::strerror(errno));
+            unlink(tmp.c_str());
+            return;
+        }
+        TAI_INFO("latency stats written to %s", m_path.c_str());
+    }
+
+}
@@ -0,0 +1,168 @@
+#ifndef __LATENCY_STATS_HPP__
+#define __LATENCY_STATS_HPP__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "tai.h"
+
+namespace tai::mux {
+
+    // when set to "true", the latency of the calls into the TAI libraries is recorded
+    const std::string TAI_MUX_LATENCY_STATS = "TAI_MUX_LATENCY_STATS";
+    // where the latency stats are written on SIGUSR1. SIGUSR1 is left alone unless it is set
+    const std::string TAI_MUX_LATENCY_STATS_FILE = "TAI_MUX_LATENCY_STATS_FILE";
+
+    // log-linear histogram of latencies in nanoseconds
+    //
+    // each power of two is split into 8 buckets, so a recorded value is off
+    // by at most 12.5%. recording is a few relaxed atomic increments.
+    class LatencyHistogram {
+        public:
+            void record(uint64_t ns) {
+                m_buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+                m_count.fetch_add(1, std::memory_order_relaxed);
+                m_sum.fetch_add(ns, std::memory_order_relaxed);
+                auto max = m_max.load(std::memory_order_relaxed);
+                while ( ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed) );
+            }
+
+            uint64_t count() const {
+                return m_count.load(std::memory_order_relaxed);
+            }
+
+            // the upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+            uint64_t percentile(double p) const;
+
+            // {"count": .., "sum_ns": .., "max_ns": .., "p50_ns": .., "p90_ns": .., "p99_ns": .., "buckets": [[upper_ns, count], ..]}
+            std::string to_json() const;
+
+        private:
+            static const int SUB_BITS = 3;
+            static const int SUB_BUCKETS = 1 << SUB_BITS;
+            // values above 2^40 ns (~18 minutes) go to the last bucket
+            static const int MAX_SHIFT = 40 - SUB_BITS;
+            static const int NUM_BUCKETS = (MAX_SHIFT + 2) * SUB_BUCKETS;
+
+            static int bucket(uint64_t ns) {
+                if ( ns < SUB_BUCKETS ) {
+                    return static_cast<int>(ns);
+                }
+                int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+                if ( shift > MAX_SHIFT ) {
+                    return NUM_BUCKETS - 1;
+                }
+                return (shift + 1) * SUB_BUCKETS + static_cast<int>((ns >> shift) - SUB_BUCKETS);
+            }
+
+            static uint64_t upper_bound(int bucket) {
+                if ( bucket < SUB_BUCKETS ) {
+                    return bucket;
+                }
+                int shift = bucket / SUB_BUCKETS - 1;
+                uint64_t m = bucket % SUB_BUCKETS + SUB_BUCKETS;
+                return ((m + 1) << shift) - 1;
+            }
+
+            std::array<std::atomic<uint64_t>, NUM_BUCKETS> m_buckets {};
+            std::atomic<uint64_t> m_count {0};
+            std::atomic<uint64_t> m_sum {0};
+            std::atomic<uint64_t> m_max {0};
+    };
+
+    enum class LatencyApi {
+        CREATE,
+        REMOVE,
+        GET,
+        SET,
+        GET_CAPABILITIES,
+        CONVERT_OID,
+        MAX,
+    };
+
+    // latency histograms of one TAI library per API and object type
+    class LatencyStats {
+        public:
+            // returns nullptr unless TAI_MUX_LATENCY_STATS is set to "true"
+            static std::unique_ptr<LatencyStats> from_env();
+
+            void record(LatencyApi api, tai_object_type_t type, uint64_t ns) {
+                m_histograms[static_cast<int>(api)][object_index(type)].record(ns);
+            }
+
+            // {"get/module": {...}, "set/netif": {...}, ..}, APIs which weren't called are omitted
+            std::string to_json() const;
+
+        private:
+            static const int NUM_OBJECT_TYPES = 4; // module, netif, hostif and the rest
+
+            static int object_index(tai_object_type_t type) {
+                switch (type) {
+                case TAI_OBJECT_TYPE_MODULE:
+                    return 0;
+                case TAI_OBJECT_TYPE_NETWORKIF:
+                    return 1;
+                case TAI_OBJECT_TYPE_HOSTIF:
+                    return 2;
+                default:
+                    return 3;
+                }
+            }
+
+            std::array<std::array<LatencyHistogram, NUM_OBJECT_TYPES>, static_cast<int>(LatencyApi::MAX)> m_histograms;
+    };
+
+    // records the time until it goes out of scope. does nothing when stats is null
+    class LatencyTimer {
+        public:
+            LatencyTimer(LatencyStats* stats, LatencyApi api, tai_object_type_t type) : m_stats(stats), m_api(api), m_type(type) {
+                if ( m_stats != nullptr ) {
+                    m_start = std::chrono::steady_clock::now();
+                }
+            }
+
+            ~LatencyTimer() {
+                if ( m_stats != nullptr ) {
+                    auto d = std::chrono::steady_clock::now() - m_start;
+                    m_stats->record(m_api, m_type, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+                }
+            }
+
+        private:
+            LatencyStats* const m_stats;
+            const LatencyApi m_api;
+            const tai_object_type_t m_type;
+            std::chrono::steady_clock::time_point m_start;
+    };
+
+    // writes the output of dump to a file when the process receives SIGUSR1
+    //
+    // the signal handler only writes to a pipe, the file is written by a thread.
+    // the output goes to a new file next to path which is then renamed to path,
+    // so a symbolic link at path is replaced instead of being followed
+    class LatencyDumper {
+        public:
+            LatencyDumper(const std::string& path, std::function<std::string()> dump);
+            ~LatencyDumper();
+
+            // returns nullptr unless TAI_MUX_LATENCY_STATS is set to "true"
+            // and TAI_MUX_LATENCY_STATS_FILE is set
+            static std::unique_ptr<LatencyDumper> from_env(std::function<std::string()> dump);
+
+        private:
+            void loop();
+            void write_file();
+
+            const std::string m_path;
+            std::function<std::string()> m_dump;
+            std::thread m_th;
+    };
+
+};
+
+#endif
@@ -1,7 +1,11 @@
 #include "module_adapter.hpp"
 #include "exception.hpp"
+#include "attribute.hpp"
+#include "env_list.hpp"
 
 #include <dlfcn.h>
+#include <algorithm>
+#include <cstdlib>
 
 #define LOAD_TAI_API(name)                            \
     m_ ## name = (name ## _fn) dlsym(m_dl, #name);    \
@@ -11,11 +15,25 @@
 
 namespace tai::mux {
 
-    ModuleAdapter::ModuleAdapter(const std::string& name, uint64_t flags, const tai_service_method_table_t* services) : m_name(name) {
-        m_dl = dlopen(name.c_str(), RTLD_NOW | RTLD_DEEPBIND);
+    const std::string TAI_MUX_REENTRANT_LIBRARIES = "TAI_MUX_REENTRANT_LIBRARIES";
+
+    // TAI_MUX_REENTRANT_LIBRARIES is a comma separated list of libraries whose
+    // create/remove can be called concurrently
+    static bool is_reentrant(const std::string& name) {
+        return env_list_contains(TAI_MUX_REENTRANT_LIBRARIES, name);
+    }
+
+    ModuleAdapter::ModuleAdapter(const std::string& name, uint64_t flags, const tai_service_method_table_t* services) : m_reentrant(is_reentrant(name)), m_name(name) {
+        // an isolated library is only opened here for its generated metadata.
+        // RTLD_LAZY leaves its functions unbound since none of them is called
+        // in this process. its static constructors and the ones of its
+        // dependencies still run here, see TAI_MUX_ISOLATED_LIBRARIES in README.md
+        auto remote = RemoteLibrary::enabled(name);
+        m_dl = dlopen(name.c_str(), (remote ? RTLD_LAZY : RTLD_NOW) | RTLD_DEEPBIND);
         if ( m_dl == nullptr ) {
-            TAI_ERROR("dlerror: %s", dlerror());
-            throw std::runtime_error(dlerror());
+            std::string err = dlerror();
+            TAI_ERROR("dlerror: %s", err.c_str());
+            throw std::runtime_error(err);
         }
         LOAD_TAI_API(tai_api_initialize)
         LOAD_TAI_API(tai_api_uninitialize)
@@ -24,6 +42,33 @@ namespace tai::mux {
         LOAD_TAI_API(tai_object_type_query)
         LOAD_TAI_API(tai_module_id_query)
 
+        m_metadata_get_attr_metadata = tai_metadata_get_attr_metadata;
+        m_metadata_get_object_type_info = tai_metadata_get_object_type_info;
+        m_metadata_all_object_type_infos = tai_metadata_all_object_type_infos;
+
+        if ( remote ) {
+            load_library_metadata();
+            m_module_api = nullptr;
+            m_netif_api = nullptr;
+            m_hostif_api = nullptr;
+            m_meta_api = nullptr;
+            m_remote = std::make_unique<RemoteLibrary>(name, flags, [this](tai_object_type_t type, tai_attr_id_t id) {
+                return get_attr_metadata(type, id);
+            });
+        } else {
+            initialize(name, flags, services);
+        }
+
+        merge_metadata();
+        classify_attributes();
+
+        m_latency = LatencyStats::from_env();
+        m_executor = CallExecutor::from_env(name);
+        m_call_timeout = CallExecutor::timeout_from_env();
+
+    }
+
+    void ModuleAdapter::initialize(const std::string& name, uint64_t flags, const tai_service_method_table_t* services) {
         auto status = tai_api_initialize(flags, services);
         if ( status != TAI_STATUS_SUCCESS ) {
             throw Exception(status);
@@ -48,15 +93,305 @@ namespace tai::mux {
         if ( status != TAI_STATUS_SUCCESS ) {
             TAI_WARN("no meta api: %s", name.c_str());
         }
+    }
+
+    const tai_attr_metadata_t ModuleAdapter::s_meta_absent {};
+
+    // the metadata generated for the library is linked into it, the
+    // symbols are missing when it was built without the framework
+    void ModuleAdapter::load_library_metadata() {
+        auto get_attr_metadata = (tai_metadata_get_attr_metadata_fn) dlsym(m_dl, "tai_metadata_get_attr_metadata");
+        auto get_object_type_info = (tai_metadata_get_object_type_info_fn) dlsym(m_dl, "tai_metadata_get_object_type_info");
+        auto all_object_type_infos = (const tai_object_type_info_t* const*) dlsym(m_dl, "tai_metadata_all_object_type_infos");
+        if ( get_attr_metadata == nullptr || get_object_type_info == nullptr || all_object_type_infos == nullptr ) {
+            TAI_WARN("no generated metadata in %s, using the one of libtai-mux.so", m_name.c_str());
+            return;
+        }
+        m_metadata_get_attr_metadata = get_attr_metadata;
+        m_metadata_get_object_type_info = get_object_type_info;
+        m_metadata_all_object_type_infos = all_object_type_infos;
+    }
 
+    // owns deep copies of the attributes of a call which may outlive the caller
+    struct CallAttributes {
+        std::vector<S_Attribute> attrs;
+        std::vector<tai_attribute_t> raw;
+    };
+
+    // returns nullptr when the metadata of an attribute is unknown, the
+    // attributes can't be copied then
+    static std::shared_ptr<CallAttributes> copy_call_attributes(ModuleAdapter* adapter, tai_object_type_t type, uint32_t count, const tai_attribute_t *list) {
+        auto c = std::make_shared<CallAttributes>();
+        c->attrs.reserve(count);
+        c->raw.reserve(count);
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto meta = adapter->get_attr_metadata(type, list[i].id);
+            if ( meta == nullptr ) {
+                return nullptr;
+            }
+            c->attrs.emplace_back(std::make_shared<Attribute>(meta, &list[i]));
+            c->raw.emplace_back(*c->attrs.back()->raw());
+        }
+        return c;
+    }
+
+    tai_status_t ModuleAdapter::call_set_attributes(tai_object_type_t type, tai_object_id_t oid, uint32_t count, const tai_attribute_t *list) {
+        auto c = copy_call_attributes(this, type, count, list);
+        if ( c == nullptr ) {
+            return m_executor->call([=]{ return set_attributes(type, oid, count, list); });
+        }
+        return m_executor->call([=]{ return set_attributes(type, oid, c->raw.size(), c->raw.data()); }, m_call_timeout);
+    }
+
+    // values of these types are a count followed by a pointer to the elements,
+    // so the count can be accessed through any of them
+    static bool is_list(const tai_attr_metadata_t* const meta) {
+        switch (meta->attrvaluetype) {
+        case TAI_ATTR_VALUE_TYPE_OBJLIST:
+        case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+        case TAI_ATTR_VALUE_TYPE_CHARLIST:
+        case TAI_ATTR_VALUE_TYPE_U8LIST:
+        case TAI_ATTR_VALUE_TYPE_S8LIST:
+        case TAI_ATTR_VALUE_TYPE_U16LIST:
+        case TAI_ATTR_VALUE_TYPE_S16LIST:
+        case TAI_ATTR_VALUE_TYPE_U32LIST:
+        case TAI_ATTR_VALUE_TYPE_S32LIST:
+        case TAI_ATTR_VALUE_TYPE_FLOATLIST:
+        case TAI_ATTR_VALUE_TYPE_ATTRLIST:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // the TAI library fills the copies. they are copied back to the caller's
+    // buffers only when the call succeeded in time. on a buffer overflow only
+    // the required sizes are copied back, the buffers are left untouched
+    //
+    // attributes whose metadata is unknown can't be copied. the call is then
+    // made on the caller's buffers and waits for the TAI library without a timeout
+    tai_status_t ModuleAdapter::call_get_attributes(tai_object_type_t type, tai_object_id_t oid, uint32_t count, tai_attribute_t *list) {
+        auto c = copy_call_attributes(this, type, count, list);
+        if ( c == nullptr ) {
+            return m_executor->call([=]{ return get_attributes(type, oid, count, list); });
+        }
+        auto ret = m_executor->call([=]{ return get_attributes(type, oid, c->raw.size(), c->raw.data()); }, m_call_timeout);
+        if ( ret == TAI_STATUS_BUFFER_OVERFLOW ) {
+            for ( uint32_t i = 0; i < count; i++ ) {
+                if ( is_list(c->attrs[i]->metadata()) ) {
+                    list[i].value.u32list.count = c->raw[i].value.u32list.count;
+                }
+            }
+            return ret;
+        }
+        if ( ret != TAI_STATUS_SUCCESS ) {
+            return ret;
+        }
+        // the copy into the caller's buffers fails when a list doesn't fit. the
+        // other attributes are still copied so that every list gets its count
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto status = tai_metadata_deepcopy_attr_value(c->attrs[i]->metadata(), &c->raw[i], &list[i]);
+            if ( status != TAI_STATUS_SUCCESS && ret == TAI_STATUS_SUCCESS ) {
+                ret = status;
+            }
+        }
+        return ret;
+    }
+
+    const tai_attr_metadata_t* ModuleAdapter::load_attr_metadata(tai_object_type_t type, tai_attr_id_t attr_id) {
+        tai_metadata_key_t key{.type=type};
+        auto meta = get_attr_metadata(&key, attr_id);
+        if ( attr_id < TAI_MUX_METADATA_CACHE_DENSE_SIZE ) {
+            m_meta_dense[type][attr_id].store(meta == nullptr ? &s_meta_absent : meta, std::memory_order_release);
+        } else {
+            std::unique_lock<std::shared_mutex> lk(m_meta_sparse_mutex);
+            m_meta_sparse[meta_cache_key(type, attr_id)] = meta;
+        }
+        return meta;
+    }
+
+    // the attributes implemented by libtai-mux.so itself
+    static bool is_mux_attr(tai_object_type_t type, tai_attr_id_t id) {
+        switch (type) {
+        case TAI_OBJECT_TYPE_MODULE:
+            return TAI_MODULE_ATTR_CUSTOM_MUX_START <= id && id <= TAI_MODULE_ATTR_CUSTOM_MUX_END;
+        case TAI_OBJECT_TYPE_NETWORKIF:
+            return TAI_NETWORK_INTERFACE_ATTR_CUSTOM_MUX_START <= id && id <= TAI_NETWORK_INTERFACE_ATTR_CUSTOM_MUX_END;
+        case TAI_OBJECT_TYPE_HOSTIF:
+            return TAI_HOST_INTERFACE_ATTR_CUSTOM_MUX_START <= id && id <= TAI_HOST_INTERFACE_ATTR_CUSTOM_MUX_END;
+        default:
+            return false;
+        }
+    }
+
+    // the library doesn't know the mux custom attributes, they come from the
+    // metadata libtai-mux.so is built with
+    void ModuleAdapter::merge_metadata() {
+        for ( auto type : {TAI_OBJECT_TYPE_MODULE, TAI_OBJECT_TYPE_NETWORKIF, TAI_OBJECT_TYPE_HOSTIF} ) {
+            tai_metadata_key_t key{.type=type};
+            uint32_t count = 0;
+            const tai_attr_metadata_t* const* list = nullptr;
+            if ( list_library_metadata(&key, &count, &list) != TAI_STATUS_SUCCESS ) {
+                TAI_WARN("failed to list metadata of object type %d: %s", type, m_name.c_str());
+                continue;
+            }
+            auto& merged = m_meta_lists[type];
+            for ( uint32_t i = 0; list != nullptr && i < count; i++ ) {
+                auto meta = list[i];
+                if ( meta != nullptr && meta->objecttype == type && !is_mux_attr(type, meta->attrid) ) {
+                    merged.emplace_back(meta);
+                }
+            }
+            auto info = tai_metadata_all_object_type_infos[type];
+            for ( size_t i = 0; info != nullptr && i < info->attrmetadatalength; i++ ) {
+                auto meta = info->attrmetadata[i];
+                if ( meta != nullptr && is_mux_attr(type, meta->attrid) ) {
+                    merged.emplace_back(meta);
+                }
+            }
+            std::sort(merged.begin(), merged.end(), [](const tai_attr_metadata_t* a, const tai_attr_metadata_t* b) {
+                return a->attrid < b->attrid;
+            });
+            m_meta_listed[type] = true;
+        }
+    }
+
+    // standard and custom attributes are classified alike from the listed
+    // metadata, so the custom attributes of each library are covered
+    void ModuleAdapter::classify_attributes() {
+        for ( auto type : {TAI_OBJECT_TYPE_MODULE, TAI_OBJECT_TYPE_NETWORKIF, TAI_OBJECT_TYPE_HOSTIF} ) {
+            for ( auto meta : m_meta_lists[type] ) {
+                auto c = has_oid(meta->attrvaluetype) ? OIDClass::OID : OIDClass::NONE;
+                if ( meta->attrid < TAI_MUX_METADATA_CACHE_DENSE_SIZE ) {
+                    m_oid_dense[type][meta->attrid] = c;
+                } else {
+                    m_oid_sparse[meta_cache_key(type, meta->attrid)] = c;
+                }
+            }
+        }
     }
 
     ModuleAdapter::~ModuleAdapter() {
+        // a call still running on a worker thread would execute unmapped code
+        if ( m_executor ) {
+            m_executor->stop();
+        }
+        m_remote.reset();
         dlclose(m_dl);
     }
 
     uint64_t ModuleAdapter::dl_address(const std::string& name) {
-        return (uint64_t)dlopen(name.c_str(), RTLD_NOW | RTLD_NOLOAD);
+        // RTLD_LAZY so that the binding of an isolated library isn't changed
+        auto dl = dlopen(name.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+        if ( dl == nullptr ) {
+            return 0;
+        }
+        // RTLD_NOLOAD still takes a reference. drop it, the handle stays
+        // valid as long as the library is loaded by a ModuleAdapter
+        dlclose(dl);
+        return (uint64_t)dl;
+    }
+
+    S_ModuleAdapter ModuleAdapterLoader::load(const std::string& name) {
+        std::promise<S_ModuleAdapter> promise;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            auto it = m_adapters.find(name);
+            if ( it != m_adapters.end() ) {
+                auto f = it->second;
+                lk.unlock();
+                return f.get();
+            }
+            // the same library may already be loaded under another name
+            auto dl = ModuleAdapter::dl_address(name);
+            auto d = m_dl_map.find(dl);
+            if ( dl != 0 && d != m_dl_map.end() ) {
+                promise.set_value(d->second);
+                m_adapters[name] = promise.get_future().share();
+                return d->second;
+            }
+            m_adapters[name] = promise.get_future().share();
+        }
+
+        S_ModuleAdapter ma;
+        try {
+            ma = std::make_shared<ModuleAdapter>(name, m_flags, m_services);
+        } catch (...) {
+            {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                m_adapters.erase(name);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_dl_map[ModuleAdapter::dl_address(name)] = ma;
+        }
+        promise.set_value(ma);
+        return ma;
+    }
+
+    std::vector<S_ModuleAdapter> ModuleAdapterLoader::load_all(const std::vector<std::string>& names) {
+        std::vector<std::future<S_ModuleAdapter>> futures;
+        for ( const auto& name : names ) {
+            futures.emplace_back(std::async(std::launch::async, &ModuleAdapterLoader::load, this, name));
+        }
+        // wait for every load before propagating an error so that no thread outlives this call
+        for ( auto& f : futures ) {
+            f.wait();
+        }
+        std::vector<S_ModuleAdapter> adapters;
+        for ( auto& f : futures ) {
+            adapters.emplace_back(f.get());
+        }
+        return adapters;
+    }
+
+    std::vector<S_ModuleAdapter> ModuleAdapterLoader::try_load_all(const std::vector<std::string>& names) {
+        std::vector<std::future<S_ModuleAdapter>> futures;
+        for ( const auto& name : names ) {
+            futures.emplace_back(std::async(std::launch::async, &ModuleAdapterLoader::load, this, name));
+        }
+        std::vector<S_ModuleAdapter> adapters;
+        for ( size_t i = 0; i < futures.size(); i++ ) {
+            try {
+                adapters.emplace_back(futures[i].get());
+            } catch (const std::exception& e) {
+                TAI_ERROR("failed to load %s: %s", names[i].c_str(), e.what());
+                adapters.emplace_back(nullptr);
+            }
+        }
+        return adapters;
+    }
+
+    void ModuleAdapterLoader::unload(const S_ModuleAdapter& adapter) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for ( auto it = m_adapters.begin(); it != m_adapters.end(); ) {
+            auto& f = it->second;
+            if ( f.wait_for(std::chrono::seconds(0)) == std::future_status::ready && f.get() == adapter ) {
+                it = m_adapters.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for ( auto it = m_dl_map.begin(); it != m_dl_map.end(); ) {
+            if ( it->second == adapter ) {
+                it = m_dl_map.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool ModuleAdapterLoader::is_loaded(const S_ModuleAdapter& adapter) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for ( const auto& v : m_dl_map ) {
+            if ( v.second == adapter ) {
+                return true;
+            }
+        }
+        return false;
     }
 
 }
@@ -2,8 +2,19 @@
 #define __MODULE_ADAPTER_HPP__
 
 #include "tai.h"
+#include "call_executor.hpp"
+#include "latency_stats.hpp"
+#include "remote_library.hpp"
 #include <string>
 #include <memory>
+#include <atomic>
+#include <array>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <future>
+#include <map>
+#include <vector>
 
 namespace tai::mux {
 
@@ -13,6 +24,30 @@ namespace tai::mux {
     typedef tai_status_t (*tai_log_set_fn) (tai_api_t, tai_log_level_t, tai_log_fn);
     typedef tai_object_type_t (*tai_object_type_query_fn) (tai_object_id_t);
     typedef tai_object_id_t (*tai_module_id_query_fn) (tai_object_id_t);
+    typedef const tai_attr_metadata_t* (*tai_metadata_get_attr_metadata_fn) (tai_object_type_t, tai_attr_id_t);
+    typedef const tai_object_type_info_t* (*tai_metadata_get_object_type_info_fn) (tai_object_type_t);
+
+    // attribute ids below this are cached in a flat array, the rest in a hash map
+    static const tai_attr_id_t TAI_MUX_METADATA_CACHE_DENSE_SIZE = 1024;
+
+    // only values of these types need translation between muxed and real OIDs
+    inline bool has_oid(tai_attr_value_type_t type) {
+        switch (type) {
+        case TAI_ATTR_VALUE_TYPE_OID:
+        case TAI_ATTR_VALUE_TYPE_OBJLIST:
+        case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+        case TAI_ATTR_VALUE_TYPE_NOTIFICATION:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    enum class OIDClass : uint8_t {
+        UNKNOWN, // not listed by the library, the metadata must be looked up
+        NONE,    // never carries OIDs
+        OID,     // may carry OIDs
+    };
 
     // corresponds to one dynamic library
     class ModuleAdapter {
@@ -32,19 +67,44 @@ namespace tai::mux {
                 return m_tai_api_query(tai_api_id, api_method_table);
             }
             tai_status_t tai_api_uninitialize(void) {
+                if ( m_executor ) {
+                    m_executor->stop();
+                }
+                if ( m_remote ) {
+                    return m_remote->uninitialize();
+                }
                 return m_tai_api_uninitialize();
             }
+            // an isolated library logs to the stderr of its host process, log_fn isn't used
             tai_status_t tai_log_set(tai_api_t tai_api_id, tai_log_level_t log_level, tai_log_fn log_fn) {
+                if ( m_remote ) {
+                    return m_remote->log_set(tai_api_id, log_level);
+                }
                 return m_tai_log_set(tai_api_id, log_level, log_fn);
             }
             tai_object_type_t tai_object_type_query(tai_object_id_t tai_object_id) {
+                if ( m_remote ) {
+                    return m_remote->object_type_query(tai_object_id);
+                }
                 return m_tai_object_type_query(tai_object_id);
             }
             tai_object_id_t tai_module_id_query(tai_object_id_t tai_object_id) {
+                if ( m_remote ) {
+                    return m_remote->module_id_query(tai_object_id);
+                }
                 return m_tai_module_id_query(tai_object_id);
             }
 
+            // null unless the library is in TAI_MUX_ISOLATED_LIBRARIES
+            RemoteLibrary* remote() const {
+                return m_remote.get();
+            }
+
             tai_status_t set_attributes(tai_object_type_t type, tai_object_id_t oid, uint32_t count, const tai_attribute_t *list) {
+                LatencyTimer t(timed(), LatencyApi::SET, type);
+                if ( offload() ) {
+                    return call_set_attributes(type, oid, count, list);
+                }
                 switch (type) {
                 case TAI_OBJECT_TYPE_MODULE:
                     return set_module_attributes(oid, count, list);
@@ -58,6 +118,10 @@ namespace tai::mux {
             }
 
             tai_status_t get_attributes(tai_object_type_t type, tai_object_id_t oid, uint32_t count, tai_attribute_t *list) {
+                LatencyTimer t(timed(), LatencyApi::GET, type);
+                if ( offload() ) {
+                    return call_get_attributes(type, oid, count, list);
+                }
                 switch (type) {
                 case TAI_OBJECT_TYPE_MODULE:
                     return get_module_attributes(oid, count, list);
@@ -71,6 +135,14 @@ namespace tai::mux {
             }
 
             tai_status_t get_capabilities(tai_object_type_t type, tai_object_id_t oid, uint32_t count, tai_attribute_capability_t *list) {
+                LatencyTimer t(timed(), LatencyApi::GET_CAPABILITIES, type);
+                if ( offload() ) {
+                    return m_executor->call([=]{ return get_capabilities(type, oid, count, list); });
+                }
+                // capabilities point into the memory of the library, they can't cross the process boundary
+                if ( m_remote ) {
+                    return TAI_STATUS_NOT_SUPPORTED;
+                }
                 switch (type) {
                 case TAI_OBJECT_TYPE_MODULE:
                     if ( m_module_api == nullptr || m_module_api->get_module_capabilities == nullptr ) {
@@ -96,24 +168,46 @@ namespace tai::mux {
                 _Out_ tai_object_id_t          *module_id,
                 _In_ uint32_t                   attr_count,
                 _In_ const tai_attribute_t     *attr_list) {
-                if ( m_module_api == nullptr || m_module_api->create_module == nullptr ) {
+                LatencyTimer t(timed(), LatencyApi::CREATE, TAI_OBJECT_TYPE_MODULE);
+                if ( !m_remote && ( m_module_api == nullptr || m_module_api->create_module == nullptr ) ) {
                     return TAI_STATUS_FAILURE;
                 }
-                return m_module_api->create_module(module_id, attr_count, attr_list);
+                // no timeout, the caller must know whether the object exists
+                if ( offload() ) {
+                    return m_executor->call([=]{ return create_module(module_id, attr_count, attr_list); });
+                }
+                auto lk = serialize();
+                m_live_objects.fetch_add(1, std::memory_order_relaxed);
+                if ( m_remote ) {
+                    return created(m_remote->create(TAI_OBJECT_TYPE_MODULE, module_id, TAI_NULL_OBJECT_ID, attr_count, attr_list));
+                }
+                return created(m_module_api->create_module(module_id, attr_count, attr_list));
             }
 
             tai_status_t remove_module(
                 _In_ tai_object_id_t module_id) {
-                if ( m_module_api == nullptr || m_module_api->remove_module == nullptr ) {
+                LatencyTimer t(timed(), LatencyApi::REMOVE, TAI_OBJECT_TYPE_MODULE);
+                if ( !m_remote && ( m_module_api == nullptr || m_module_api->remove_module == nullptr ) ) {
                     return TAI_STATUS_FAILURE;
                 }
-                return m_module_api->remove_module(module_id);
+                // no timeout, the caller must know whether the object exists
+                if ( offload() ) {
+                    return m_executor->call([=]{ return remove_module(module_id); });
+                }
+                auto lk = serialize();
+                if ( m_remote ) {
+                    return removed(m_remote->remove(TAI_OBJECT_TYPE_MODULE, module_id));
+                }
+                return removed(m_module_api->remove_module(module_id));
             }
 
             tai_status_t set_module_attributes(
                 _In_ tai_object_id_t module_id,
                 _In_ uint32_t attr_count,
                 _In_ const tai_attribute_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->set(TAI_OBJECT_TYPE_MODULE, module_id, attr_count, attr_list);
+                }
                 if ( m_module_api == nullptr || m_module_api->set_module_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -124,6 +218,9 @@ namespace tai::mux {
                 _In_ tai_object_id_t module_id,
                 _In_ uint32_t attr_count,
                 _In_ tai_attribute_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->get(TAI_OBJECT_TYPE_MODULE, module_id, attr_count, attr_list);
+                }
                 if ( m_module_api == nullptr || m_module_api->get_module_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -135,24 +232,46 @@ namespace tai::mux {
                 _In_ tai_object_id_t module_id,
                 _In_ uint32_t attr_count,
                 _In_ const tai_attribute_t *attr_list) {
-                if ( m_netif_api == nullptr || m_netif_api->create_network_interface == nullptr ) {
+                LatencyTimer t(timed(), LatencyApi::CREATE, TAI_OBJECT_TYPE_NETWORKIF);
+                if ( !m_remote && ( m_netif_api == nullptr || m_netif_api->create_network_interface == nullptr ) ) {
                     return TAI_STATUS_FAILURE;
                 }
-                return m_netif_api->create_network_interface(network_interface_id, module_id, attr_count, attr_list);
+                // no timeout, the caller must know whether the object exists
+                if ( offload() ) {
+                    return m_executor->call([=]{ return create_network_interface(network_interface_id, module_id, attr_count, attr_list); });
+                }
+                auto lk = serialize();
+                m_live_objects.fetch_add(1, std::memory_order_relaxed);
+                if ( m_remote ) {
+                    return created(m_remote->create(TAI_OBJECT_TYPE_NETWORKIF, network_interface_id, module_id, attr_count, attr_list));
+                }
+                return created(m_netif_api->create_network_interface(network_interface_id, module_id, attr_count, attr_list));
             }
 
             tai_status_t remove_network_interface(
                 _In_ tai_object_id_t network_interface_id) {
-                if ( m_netif_api == nullptr || m_netif_api->remove_network_interface == nullptr ) {
+                LatencyTimer t(timed(), LatencyApi::REMOVE, TAI_OBJECT_TYPE_NETWORKIF);
+                if ( !m_remote && ( m_netif_api == nullptr || m_netif_api->remove_network_interface == nullptr ) ) {
                     return TAI_STATUS_FAILURE;
                 }
-                return m_netif_api->remove_network_interface(network_interface_id);
+                // no timeout, the caller must know whether the object exists
+                if ( offload() ) {
+                    return m_executor->call([=]{ return remove_network_interface(network_interface_id); });
+                }
+                auto lk = serialize();
+                if ( m_remote ) {
+                    return removed(m_remote->remove(TAI_OBJECT_TYPE_NETWORKIF, network_interface_id));
+                }
+                return removed(m_netif_api->remove_network_interface(network_interface_id));
             }
 
             tai_status_t set_network_interface_attributes(
                 _In_ tai_object_id_t network_interface_id,
                 _In_ uint32_t attr_count,
                 _In_ const tai_attribute_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->set(TAI_OBJECT_TYPE_NETWORKIF, network_interface_id, attr_count, attr_list);
+                }
                 if ( m_netif_api == nullptr || m_netif_api->set_network_interface_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -163,6 +282,9 @@ namespace tai::mux {
                 _In_ tai_object_id_t network_interface_id,
                 _In_ uint32_t attr_count,
                 _In_ tai_attribute_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->get(TAI_OBJECT_TYPE_NETWORKIF, network_interface_id, attr_count, attr_list);
+                }
                 if ( m_netif_api == nullptr || m_netif_api->get_network_interface_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -174,24 +296,46 @@ namespace tai::mux {
                 _In_ tai_object_id_t module_id,
                 _In_ uint32_t attr_count,
                 _In_ const tai_attribute_t *attr_list) {
-                if ( m_hostif_api == nullptr || m_hostif_api->create_host_interface == nullptr ) {
+                LatencyTimer t(timed(), LatencyApi::CREATE, TAI_OBJECT_TYPE_HOSTIF);
+                if ( !m_remote && ( m_hostif_api == nullptr || m_hostif_api->create_host_interface == nullptr ) ) {
                     return TAI_STATUS_FAILURE;
                 }
-                return m_hostif_api->create_host_interface(host_interface_id, module_id, attr_count, attr_list);
+                // no timeout, the caller must know whether the object exists
+                if ( offload() ) {
+                    return m_executor->call([=]{ return create_host_interface(host_interface_id, module_id, attr_count, attr_list); });
+                }
+                auto lk = serialize();
+                m_live_objects.fetch_add(1, std::memory_order_relaxed);
+                if ( m_remote ) {
+                    return created(m_remote->create(TAI_OBJECT_TYPE_HOSTIF, host_interface_id, module_id, attr_count, attr_list));
+                }
+                return created(m_hostif_api->create_host_interface(host_interface_id, module_id, attr_count, attr_list));
             }
 
             tai_status_t remove_host_interface(
                 _In_ tai_object_id_t host_interface_id) {
-                if ( m_hostif_api == nullptr || m_hostif_api->remove_host_interface == nullptr ) {
+                LatencyTimer t(timed(), LatencyApi::REMOVE, TAI_OBJECT_TYPE_HOSTIF);
+                if ( !m_remote && ( m_hostif_api == nullptr || m_hostif_api->remove_host_interface == nullptr ) ) {
                     return TAI_STATUS_FAILURE;
                 }
-                return m_hostif_api->remove_host_interface(host_interface_id);
+                // no timeout, the caller must know whether the object exists
+                if ( offload() ) {
+                    return m_executor->call([=]{ return remove_host_interface(host_interface_id); });
+                }
+                auto lk = serialize();
+                if ( m_remote ) {
+                    return removed(m_remote->remove(TAI_OBJECT_TYPE_HOSTIF, host_interface_id));
+                }
+                return removed(m_hostif_api->remove_host_interface(host_interface_id));
             }
 
             tai_status_t set_host_interface_attributes(
                 _In_ tai_object_id_t host_interface_id,
                 _In_ uint32_t attr_count,
                 _In_ const tai_attribute_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->set(TAI_OBJECT_TYPE_HOSTIF, host_interface_id, attr_count, attr_list);
+                }
                 if ( m_hostif_api == nullptr || m_hostif_api->set_host_interface_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -202,6 +346,9 @@ namespace tai::mux {
                 _In_ tai_object_id_t host_interface_id,
                 _In_ uint32_t attr_count,
                 _In_ tai_attribute_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->get(TAI_OBJECT_TYPE_HOSTIF, host_interface_id, attr_count, attr_list);
+                }
                 if ( m_hostif_api == nullptr || m_hostif_api->get_host_interface_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -212,6 +359,9 @@ namespace tai::mux {
                 _In_ tai_object_id_t host_interface_id,
                 _In_ uint32_t attr_count,
                 _In_ tai_attr_id_t *attr_list) {
+                if ( m_remote ) {
+                    return m_remote->clear(host_interface_id, attr_count, attr_list);
+                }
                 if ( m_hostif_api == nullptr || m_hostif_api->clear_host_interface_attributes == nullptr ) {
                     return TAI_STATUS_FAILURE;
                 }
@@ -222,51 +372,269 @@ namespace tai::mux {
                 _In_ const tai_metadata_key_t * const key,
                 _Out_ uint32_t *count,
                 _Out_ const tai_attr_metadata_t * const **list) {
-                if ( m_meta_api == nullptr || m_meta_api->list_metadata == nullptr ) {
-                    auto type = key->type;
-                    if ( key->oid != TAI_NULL_OBJECT_ID ) {
-                        type = tai_object_type_query(key->oid);
-                    }
-                    auto info = tai_metadata_all_object_type_infos[type];
-                    if ( info == nullptr ) {
-                        *count = tai_metadata_attr_sorted_by_id_name_count;
-                        *list = tai_metadata_attr_sorted_by_id_name;
-                        return TAI_STATUS_SUCCESS;
-                    }
-                    *count = info->attrmetadatalength;
-                    *list = info->attrmetadata;
+                auto type = library_object_type(key);
+                if ( list_metadata(type, count, list) == TAI_STATUS_SUCCESS ) {
                     return TAI_STATUS_SUCCESS;
                 }
-                // TODO list_metadata is not returning mux custom attributes
-                return m_meta_api->list_metadata(key, count, list);
+                // the list of the library lives in the library as well
+                m_pinned.store(true, std::memory_order_relaxed);
+                return list_library_metadata(key, count, list);
+            }
+
+            // metadata of the library merged with the mux custom attributes of the
+            // object type, sorted by attr id. the list is built when the library is
+            // loaded and stays valid as long as the library is loaded. the caller
+            // may keep it forever, so the library is pinned once it is handed out
+            tai_status_t list_metadata(
+                _In_ tai_object_type_t type,
+                _Out_ uint32_t *count,
+                _Out_ const tai_attr_metadata_t * const **list) {
+                if ( type <= TAI_OBJECT_TYPE_NULL || type >= TAI_OBJECT_TYPE_MAX || !m_meta_listed[type] ) {
+                    return TAI_STATUS_ITEM_NOT_FOUND;
+                }
+                m_pinned.store(true, std::memory_order_relaxed);
+                *count = m_meta_lists[type].size();
+                *list = m_meta_lists[type].data();
+                return TAI_STATUS_SUCCESS;
             }
 
             const tai_attr_metadata_t* get_attr_metadata(
                 _In_ const tai_metadata_key_t * const key,
                 _In_ tai_attr_id_t attr_id) {
                 if ( m_meta_api == nullptr || m_meta_api->get_attr_metadata == nullptr || ( TAI_MODULE_ATTR_CUSTOM_MUX_START <= attr_id && attr_id <= TAI_MODULE_ATTR_CUSTOM_MUX_END )) {
-                    auto type = key->type;
-                    if ( key->oid != TAI_NULL_OBJECT_ID ) {
-                        type = tai_object_type_query(key->oid);
+                    auto type = library_object_type(key);
+                    if ( TAI_MODULE_ATTR_CUSTOM_MUX_START <= attr_id && attr_id <= TAI_MODULE_ATTR_CUSTOM_MUX_END ) {
+                        return tai_metadata_get_attr_metadata(type, attr_id);
                     }
-                    return tai_metadata_get_attr_metadata(type, attr_id);
+                    return m_metadata_get_attr_metadata(type, attr_id);
                 }
                 return m_meta_api->get_attr_metadata(key, attr_id);
             }
 
+            // cached metadata lookup used by the hot paths of the mux
+            //
+            // metadata of a library doesn't change once it is loaded, so the result of
+            // get_attr_metadata() is cached per (object type, attr id). the standard
+            // attribute range is held in a flat array read without locking, custom
+            // ranges go to a hash map guarded by a reader-writer lock.
+            const tai_attr_metadata_t* get_attr_metadata(tai_object_type_t type, tai_attr_id_t attr_id) {
+                if ( type <= TAI_OBJECT_TYPE_NULL || type >= TAI_OBJECT_TYPE_MAX ) {
+                    return nullptr;
+                }
+                if ( attr_id < TAI_MUX_METADATA_CACHE_DENSE_SIZE ) {
+                    auto meta = m_meta_dense[type][attr_id].load(std::memory_order_acquire);
+                    if ( meta != nullptr ) {
+                        m_meta_cache_hit.fetch_add(1, std::memory_order_relaxed);
+                        return meta == &s_meta_absent ? nullptr : meta;
+                    }
+                } else {
+                    std::shared_lock<std::shared_mutex> lk(m_meta_sparse_mutex);
+                    auto it = m_meta_sparse.find(meta_cache_key(type, attr_id));
+                    if ( it != m_meta_sparse.end() ) {
+                        m_meta_cache_hit.fetch_add(1, std::memory_order_relaxed);
+                        return it->second;
+                    }
+                }
+                m_meta_cache_miss.fetch_add(1, std::memory_order_relaxed);
+                return load_attr_metadata(type, attr_id);
+            }
+
+            // classification of an attribute by the metadata listed when the library
+            // was loaded. it never changes afterwards, so it is read without locking
+            OIDClass oid_class(tai_object_type_t type, tai_attr_id_t attr_id) const {
+                if ( type <= TAI_OBJECT_TYPE_NULL || type >= TAI_OBJECT_TYPE_MAX ) {
+                    return OIDClass::UNKNOWN;
+                }
+                if ( attr_id < TAI_MUX_METADATA_CACHE_DENSE_SIZE ) {
+                    return m_oid_dense[type][attr_id];
+                }
+                auto it = m_oid_sparse.find(meta_cache_key(type, attr_id));
+                return it == m_oid_sparse.end() ? OIDClass::UNKNOWN : it->second;
+            }
+
+            // true when every attribute is known to carry no OIDs
+            bool none_has_oid(tai_object_type_t type, uint32_t count, const tai_attribute_t* const attrs) const {
+                for ( uint32_t i = 0; i < count; i++ ) {
+                    if ( oid_class(type, attrs[i].id) != OIDClass::NONE ) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            uint64_t metadata_cache_hit() const {
+                return m_meta_cache_hit.load(std::memory_order_relaxed);
+            }
+
+            uint64_t metadata_cache_miss() const {
+                return m_meta_cache_miss.load(std::memory_order_relaxed);
+            }
+
             const tai_object_type_info_t* get_object_info(
                 _In_ const tai_metadata_key_t *const key) {
                 if ( m_meta_api == nullptr || m_meta_api->get_object_info == nullptr ) {
-                    auto type = key->type;
-                    if ( key->oid != TAI_NULL_OBJECT_ID ) {
-                        type = tai_object_type_query(key->oid);
-                    }
-                    return tai_metadata_get_object_type_info(type);
+                    auto type = library_object_type(key);
+                    return m_metadata_get_object_type_info(type);
                 }
                 return m_meta_api->get_object_info(key);
            }
 
+            // whether create/remove can run concurrently, see TAI_MUX_REENTRANT_LIBRARIES
+            bool reentrant() const {
+                return m_reentrant;
+            }
+
+            // null unless TAI_MUX_LATENCY_STATS is enabled
+            LatencyStats* latency() const {
+                return m_latency.get();
+            }
+
+            // number of objects created through this library and not removed yet,
+            // including the ones being created and the pending acquire() calls
+            uint64_t live_objects() const {
+                return m_live_objects.load(std::memory_order_relaxed);
+            }
+
+            // taken by get_module_adapter() of the platform adapter under its map
+            // lock, so that the library can't be unloaded before the caller creates
+            // its object. the caller releases it once the creation finished
+            void acquire() {
+                m_live_objects.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void release() {
+                m_live_objects.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            // true once a merged metadata list has been handed out. a pinned
+            // library must not be unloaded since the list may still be in use
+            bool pinned() const {
+                return m_pinned.load(std::memory_order_relaxed);
+            }
+
         private:
+            // true when the call has to be handed to the worker threads of this library
+            bool offload() const {
+                return m_executor && !m_executor->runs_here();
+            }
+
+            // get/set on the worker threads with a timeout. the attributes are
+            // copied since the call may outlive the caller's buffers
+            tai_status_t call_set_attributes(tai_object_type_t type, tai_object_id_t oid, uint32_t count, const tai_attribute_t *list);
+            tai_status_t call_get_attributes(tai_object_type_t type, tai_object_id_t oid, uint32_t count, tai_attribute_t *list);
+
+            // calls are timed where the caller enters, the time spent in the
+            // queue of the worker threads is included
+            LatencyStats* timed() const {
+                return m_executor && m_executor->runs_here() ? nullptr : m_latency.get();
+            }
+
+            std::unique_ptr<LatencyStats> m_latency;
+
+            // null unless the library is in TAI_MUX_ISOLATED_LIBRARIES. the
+            // library is loaded here only for its generated metadata then, it
+            // is initialized and called in the host process
+            std::unique_ptr<RemoteLibrary> m_remote;
+
+            // null unless TAI_MUX_WORKER_THREADS is set
+            std::unique_ptr<CallExecutor> m_executor;
+            std::chrono::milliseconds m_call_timeout;
+
+            // create/remove calls into one library are serialized unless it is known
+            // to be reentrant. calls into different libraries never block each other
+            std::unique_lock<std::mutex> serialize() {
+                if ( m_reentrant ) {
+                    return std::unique_lock<std::mutex>(m_serialize_mutex, std::defer_lock);
+                }
+                return std::unique_lock<std::mutex>(m_serialize_mutex);
+            }
+
+            bool m_reentrant;
+            std::mutex m_serialize_mutex;
+
+            tai_status_t created(tai_status_t ret) {
+                if ( ret != TAI_STATUS_SUCCESS ) {
+                    m_live_objects.fetch_sub(1, std::memory_order_relaxed);
+                }
+                return ret;
+            }
+
+            tai_status_t removed(tai_status_t ret) {
+                if ( ret == TAI_STATUS_SUCCESS ) {
+                    m_live_objects.fetch_sub(1, std::memory_order_relaxed);
+                }
+                return ret;
+            }
+
+            std::atomic<uint64_t> m_live_objects {0};
+            std::atomic<bool> m_pinned {false};
+
+            const tai_attr_metadata_t* load_attr_metadata(tai_object_type_t type, tai_attr_id_t attr_id);
+
+            // the object type of a metadata key given to this library. key->oid is
+            // an OID of the library, so it is asked to the library itself and
+            // never to the tai_object_type_query() of libtai-mux.so
+            tai_object_type_t library_object_type(const tai_metadata_key_t * const key) {
+                if ( key->oid == TAI_NULL_OBJECT_ID ) {
+                    return key->type;
+                }
+                if ( m_remote ) {
+                    return m_remote->object_type_query(key->oid);
+                }
+                return m_tai_object_type_query(key->oid);
+            }
+
+            // the metadata listed by the library itself, without the mux custom attributes
+            tai_status_t list_library_metadata(
+                _In_ const tai_metadata_key_t * const key,
+                _Out_ uint32_t *count,
+                _Out_ const tai_attr_metadata_t * const **list) {
+                if ( m_meta_api == nullptr || m_meta_api->list_metadata == nullptr ) {
+                    auto type = library_object_type(key);
+                    auto info = m_metadata_all_object_type_infos[type];
+                    if ( info == nullptr ) {
+                        *count = tai_metadata_attr_sorted_by_id_name_count;
+                        *list = tai_metadata_attr_sorted_by_id_name;
+                        return TAI_STATUS_SUCCESS;
+                    }
+                    *count = info->attrmetadatalength;
+                    *list = info->attrmetadata;
+                    return TAI_STATUS_SUCCESS;
+                }
+                return m_meta_api->list_metadata(key, count, list);
+            }
+
+            // initializes the library in this process and queries its apis
+            void initialize(const std::string& name, uint64_t flags, const tai_service_method_table_t* services);
+
+            // points the m_metadata_* tables to the ones of the library
+            void load_library_metadata();
+
+            // fills m_meta_lists, called once from the constructor
+            void merge_metadata();
+
+            // fills m_oid_dense and m_oid_sparse from m_meta_lists, called once from the constructor
+            void classify_attributes();
+
+            static uint64_t meta_cache_key(tai_object_type_t type, tai_attr_id_t attr_id) {
+                return uint64_t(type) << 32 | attr_id;
+            }
+
+            // marks a dense cache entry whose attribute doesn't exist
+            static const tai_attr_metadata_t s_meta_absent;
+
+            std::array<std::array<std::atomic<const tai_attr_metadata_t*>, TAI_MUX_METADATA_CACHE_DENSE_SIZE>, TAI_OBJECT_TYPE_MAX> m_meta_dense {};
+            std::shared_mutex m_meta_sparse_mutex;
+            std::unordered_map<uint64_t, const tai_attr_metadata_t*> m_meta_sparse;
+            std::atomic<uint64_t> m_meta_cache_hit {0};
+            std::atomic<uint64_t> m_meta_cache_miss {0};
+
+            std::array<std::vector<const tai_attr_metadata_t*>, TAI_OBJECT_TYPE_MAX> m_meta_lists;
+            std::array<bool, TAI_OBJECT_TYPE_MAX> m_meta_listed {};
+
+            std::array<std::array<OIDClass, TAI_MUX_METADATA_CACHE_DENSE_SIZE>, TAI_OBJECT_TYPE_MAX> m_oid_dense {};
+            std::unordered_map<uint64_t, OIDClass> m_oid_sparse;
+
             void* m_dl;
             const std::string m_name;
             tai_api_initialize_fn    m_tai_api_initialize;
@@ -280,9 +648,72 @@ namespace tai::mux {
             tai_host_interface_api_t*    m_hostif_api;
             tai_network_interface_api_t* m_netif_api;
             tai_meta_api_t*              m_meta_api;
+
+            // used when the library has no meta api. the tables of the library
+            // itself when it is isolated, since its meta api can't be called
+            // across the process boundary, the ones of libtai-mux.so otherwise
+            tai_metadata_get_attr_metadata_fn    m_metadata_get_attr_metadata;
+            tai_metadata_get_object_type_info_fn m_metadata_get_object_type_info;
+            const tai_object_type_info_t* const* m_metadata_all_object_type_infos;
     };
 
     using S_ModuleAdapter = std::shared_ptr<ModuleAdapter>;
 
+    // releases a library returned by PlatformAdapter::get_module_adapter()
+    class ModuleAdapterGuard {
+        public:
+            ModuleAdapterGuard() {}
+            explicit ModuleAdapterGuard(const S_ModuleAdapter& adapter) {
+                reset(adapter);
+            }
+            ~ModuleAdapterGuard() {
+                reset(nullptr);
+            }
+            ModuleAdapterGuard(const ModuleAdapterGuard&) = delete;
+            ModuleAdapterGuard& operator=(const ModuleAdapterGuard&) = delete;
+
+            void reset(const S_ModuleAdapter& adapter) {
+                if ( m_adapter ) {
+                    m_adapter->release();
+                }
+                m_adapter = adapter;
+            }
+        private:
+            S_ModuleAdapter m_adapter;
+    };
+
+    // loads each TAI library once
+    //
+    // different libraries are loaded and initialized in parallel. concurrent
+    // requests for a library which is being loaded wait for the same load.
+    class ModuleAdapterLoader {
+        public:
+            ModuleAdapterLoader(uint64_t flags, const tai_service_method_table_t* services) : m_flags(flags), m_services(services) {}
+
+            // throws when the library can't be loaded or initialized
+            S_ModuleAdapter load(const std::string& name);
+
+            // loads the libraries in parallel. the result is in the order of names
+            std::vector<S_ModuleAdapter> load_all(const std::vector<std::string>& names);
+
+            // like load_all(), but a library which can't be loaded is logged and
+            // returned as nullptr instead of failing the whole call
+            std::vector<S_ModuleAdapter> try_load_all(const std::vector<std::string>& names);
+
+            // forgets the adapter so that the next load() of its library loads it again.
+            // the library is closed when the last reference to the adapter is dropped
+            void unload(const S_ModuleAdapter& adapter);
+
+            // whether adapter is the one load() returns for its library
+            bool is_loaded(const S_ModuleAdapter& adapter);
+
+        private:
+            const uint64_t m_flags;
+            const tai_service_method_table_t* m_services;
+            std::mutex m_mutex;
+            std::map<std::string, std::shared_future<S_ModuleAdapter>> m_adapters; // by library name
+            std::map<uint64_t, S_ModuleAdapter> m_dl_map; // by dlopen() handle
+    };
+
 };
 #endif
@@ -1,8 +1,9 @@
 #include "mux.hpp"
 #include <iostream>
+#include <future>
+#include <sstream>
 #include "taimetadata.h"
-#include "static_platform_adapter.hpp"
-#include "exec_platform_adapter.hpp"
+#include "platform_adapter_plugin.hpp"
 
 namespace tai::mux {
 
@@ -32,34 +33,99 @@ namespace tai::mux {
         if (pa) {
             pa_name = std::string(pa);
         }
-        if (pa_name == "static") {
-            m_pa = std::make_shared<StaticPlatformAdapter>(0, services);
-        } else if (pa_name == "exec") {
-            m_pa = std::make_shared<ExecPlatformAdapter>(0, services);
-        } else {
+        m_pa = create_platform_adapter(pa_name, 0, services);
+        if (m_pa == nullptr) {
             TAI_ERROR("unsupported platform_adapter: %s", pa_name.c_str());
             throw Exception(TAI_STATUS_NOT_SUPPORTED);
         }
+        m_latency_dumper = LatencyDumper::from_env([this]{
+            std::stringstream ss;
+            ss << "{";
+            bool first = true;
+            for ( const auto& a : m_pa->list_module_adapters() ) {
+                if ( !first ) {
+                    ss << ", ";
+                }
+                first = false;
+                ss << "\"" << a->name() << "\": " << (a->latency() ? a->latency()->to_json() : "{}");
+            }
+            ss << "}";
+            return ss.str();
+        });
+        auto threads = TAI_MUX_DEFAULT_BULK_THREADS;
+        auto e = std::getenv(TAI_MUX_BULK_THREADS.c_str());
+        if ( e != nullptr ) {
+            threads = std::strtoul(e, nullptr, 0);
+        }
+        m_bulk_executor = std::make_unique<CallExecutor>("bulk", threads);
+        if ( threads == 0 ) {
+            // the groups run one after another on the caller's thread
+            m_bulk_executor->stop();
+        }
+        s_instance.store(this, std::memory_order_release);
     }
 
+    Platform::~Platform() {
+        auto p = this;
+        s_instance.compare_exchange_strong(p, nullptr, std::memory_order_acq_rel);
+    }
+
+    std::atomic<Platform*> Platform::s_instance {nullptr};
+
     tai_status_t Platform::create(tai_object_type_t type, tai_object_id_t module_id, uint32_t count, const tai_attribute_t * const list, tai_object_id_t *id) {
+        if ( !m_pa->tracing() ) {
+            return create_object(type, module_id, count, list, id);
+        }
+        auto start = TraceWriter::clock::now();
+        auto ret = create_object(type, module_id, count, list, id);
+        auto oid = ret == TAI_STATUS_SUCCESS ? *id : TAI_NULL_OBJECT_ID;
+        m_pa->trace(TraceApi::CREATE, type, oid, module_id, ret, start, count, list);
+        return ret;
+    }
+
+    // removes the object from the TAI library which created it
+    static tai_status_t remove_from_adapter(tai_object_type_t type, const std::shared_ptr<tai::framework::BaseObject>& obj) {
+        switch (type) {
+        case TAI_OBJECT_TYPE_MODULE:
+            return static_cast<Module*>(obj.get())->remove();
+        case TAI_OBJECT_TYPE_NETWORKIF:
+            return static_cast<NetIf*>(obj.get())->remove();
+        case TAI_OBJECT_TYPE_HOSTIF:
+            return static_cast<HostIf*>(obj.get())->remove();
+        default:
+            return TAI_STATUS_INVALID_OBJECT_ID;
+        }
+    }
+
+    tai_status_t Platform::create_object(tai_object_type_t type, tai_object_id_t module_id, uint32_t count, const tai_attribute_t * const list, tai_object_id_t *id) {
         std::shared_ptr<tai::framework::BaseObject> obj;
         try {
             switch (type) {
             case TAI_OBJECT_TYPE_MODULE:
-                obj = std::make_shared<Module>(count, list, m_pa, m_log_setting);
+                {
+                    log_setting setting;
+                    {
+                        std::shared_lock<std::shared_mutex> lk(m_mutex);
+                        setting = m_log_setting;
+                    }
+                    obj = std::make_shared<Module>(count, list, m_pa, setting);
+                }
                 break;
             case TAI_OBJECT_TYPE_NETWORKIF:
             case TAI_OBJECT_TYPE_HOSTIF:
                 {
-                    auto it = m_objects.find(module_id);
-                    if ( it == m_objects.end() ) {
-                        return TAI_STATUS_UNINITIALIZED;
+                    std::shared_ptr<tai::framework::BaseObject> parent;
+                    {
+                        std::shared_lock<std::shared_mutex> lk(m_mutex);
+                        parent = m_table.get(OIDAllocator::index_of(module_id), module_id);
+                        if ( parent == nullptr ) {
+                            return TAI_STATUS_UNINITIALIZED;
+                        }
                     }
-                    if ( it->second->type() != TAI_OBJECT_TYPE_MODULE ) {
+                    if ( parent->type() != TAI_OBJECT_TYPE_MODULE ) {
                         return TAI_STATUS_INVALID_OBJECT_ID;
                     }
-                    auto module = std::dynamic_pointer_cast<Module>(it->second);
+                    auto module = std::static_pointer_cast<Module>(parent);
                     if ( type == TAI_OBJECT_TYPE_NETWORKIF ) {
                         obj = std::make_shared<NetIf>(module, count, list, m_pa);
                     } else {
@@ -77,85 +143,73 @@ namespace tai::mux {
         }
 
         auto oid = obj->id();
-        auto it = m_objects.find(oid);
-        if ( it != m_objects.end() ) {
-            return TAI_STATUS_ITEM_ALREADY_EXISTS;
+        {
+            std::unique_lock<std::shared_mutex> lk(m_mutex);
+            if ( m_table.insert(OIDAllocator::index_of(oid), oid, type, type == TAI_OBJECT_TYPE_MODULE ? oid : module_id, obj) ) {
+                m_objects[oid] = obj;
+                *id = oid;
+                return TAI_STATUS_SUCCESS;
+            }
         }
-        m_objects[oid] = obj;
-        *id = oid;
-        return TAI_STATUS_SUCCESS;
+        // nobody can reach the object, undo what its constructor did
+        auto ret = remove_from_adapter(type, obj);
+        if ( ret != TAI_STATUS_SUCCESS ) {
+            TAI_WARN("failed to remove 0x%lx after a failed create: %d", oid, ret);
+        }
+        m_pa->remove_mapping(oid);
+        return TAI_STATUS_ITEM_ALREADY_EXISTS;
     }
 
     tai_status_t Platform::remove(tai_object_id_t id) {
-        auto it = m_objects.find(id);
-        if ( it == m_objects.end() ) {
-            return TAI_STATUS_ITEM_NOT_FOUND;
+        if ( !m_pa->tracing() ) {
+            return remove_object(id);
         }
         auto type = get_object_type(id);
-        tai_status_t ret;
-        switch (type) {
-        case TAI_OBJECT_TYPE_MODULE:
-            {
-                auto m = std::dynamic_pointer_cast<Module>(it->second);
-                ret = m->remove();
-            }
-            break;
-        case TAI_OBJECT_TYPE_NETWORKIF:
-            {
-                auto m = std::dynamic_pointer_cast<NetIf>(it->second);
-                ret = m->remove();
-            }
-            break;
-        case TAI_OBJECT_TYPE_HOSTIF:
-            {
-                auto m = std::dynamic_pointer_cast<HostIf>(it->second);
-                ret = m->remove();
+        auto start = TraceWriter::clock::now();
+        auto ret = remove_object(id);
+        m_pa->trace(TraceApi::REMOVE, type, id, TAI_NULL_OBJECT_ID, ret, start, 0, nullptr);
+        return ret;
+    }
+
+    tai_status_t Platform::remove_object(tai_object_id_t id) {
+        std::shared_ptr<tai::framework::BaseObject> obj;
+        auto type = TAI_OBJECT_TYPE_NULL;
+        {
+            std::shared_lock<std::shared_mutex> lk(m_mutex);
+            obj = m_table.get(OIDAllocator::index_of(id), id);
+            if ( obj == nullptr ) {
+                return TAI_STATUS_ITEM_NOT_FOUND;
             }
-            break;
-        default:
-            ret = TAI_STATUS_INVALID_OBJECT_ID;
+            m_table.find(OIDAllocator::index_of(id), id, &type, nullptr);
         }
-
+        // the type in the table is the one the object was created as
+        auto ret = remove_from_adapter(type, obj);
         if ( ret != TAI_STATUS_SUCCESS ) {
             return ret;
         }
-        m_objects.erase(it);
+        {
+            std::unique_lock<std::shared_mutex> lk(m_mutex);
+            m_table.erase(OIDAllocator::index_of(id), id);
+            m_objects.erase(id);
+        }
         m_pa->remove_mapping(id);
         return TAI_STATUS_SUCCESS;
     }
 
+    // called on every API call, read from m_table without locking
     tai_object_type_t Platform::get_object_type(tai_object_id_t id) {
-        auto it = m_objects.find(id);
-        if ( it == m_objects.end() ) {
-            return TAI_OBJECT_TYPE_NULL;
+        auto type = TAI_OBJECT_TYPE_NULL;
+        if ( m_table.find(OIDAllocator::index_of(id), id, &type, nullptr) ) {
+            return type;
         }
-        return it->second->type();
+        // an object which is being created is only known to m_pa
+        return m_pa->get_object_type(id);
     }
 
     tai_object_id_t Platform::get_module_id(tai_object_id_t id) {
-        auto it = m_objects.find(id);
-        if ( it == m_objects.end() ) {
-            return TAI_NULL_OBJECT_ID;
-        }
-        switch (it->second->type()) {
-        case TAI_OBJECT_TYPE_MODULE:
-            {
-                auto m = std::dynamic_pointer_cast<Module>(it->second);
-                return m->id();
-            }
-        case TAI_OBJECT_TYPE_NETWORKIF:
-            {
-                auto m = std::dynamic_pointer_cast<NetIf>(it->second);
-                return m->module_id();
-            }
-        case TAI_OBJECT_TYPE_HOSTIF:
-            {
-                auto m = std::dynamic_pointer_cast<HostIf>(it->second);
-                return m->module_id();
-            }
-        default:
-            return TAI_NULL_OBJECT_ID;
-        }
+        tai_object_id_t module_id = TAI_NULL_OBJECT_ID;
+        m_table.find(OIDAllocator::index_of(id), id, nullptr, &module_id);
+        return module_id;
     }
 
     tai_status_t Platform::set_log(tai_api_t api, tai_log_level_t level, tai_log_fn log_fn) {
@@ -170,15 +224,17 @@ namespace tai::mux {
                 return ret;
             }
         }
+        std::unique_lock<std::shared_mutex> lk(m_mutex);
         m_log_setting[api] = {level, log_fn};
         return TAI_STATUS_SUCCESS;
     }
 
-    tai_status_t Platform::get_ma_and_meta_key(const tai_metadata_key_t *const key, tai_metadata_key_t& new_key, S_ModuleAdapter *ma) {
+    tai_status_t Platform::get_ma_and_meta_key(const tai_metadata_key_t *const key, tai_metadata_key_t& new_key, S_ModuleAdapter *ma, ModuleAdapterGuard& guard) {
         new_key = *key;
         if ( key->location.count > 0 ) {
             std::string loc(key->location.list, key->location.count);
             *ma = m_pa->get_module_adapter(loc);
+            guard.reset(*ma);
         } else if ( key->oid != TAI_NULL_OBJECT_ID ) {
             tai_object_id_t real_id;
             if ( m_pa->get_mapping(key->oid, ma, &real_id) < 0 ) {
@@ -191,13 +247,23 @@ namespace tai::mux {
 
     tai_status_t Platform::list_metadata(const tai_metadata_key_t *const key, uint32_t *count, const tai_attr_metadata_t *const **list) {
         S_ModuleAdapter ma;
+        ModuleAdapterGuard guard;
         tai_metadata_key_t new_key;
-        auto ret = get_ma_and_meta_key(key, new_key, &ma);
+        auto ret = get_ma_and_meta_key(key, new_key, &ma, guard);
         if ( ret != TAI_STATUS_SUCCESS ) {
             return ret;
         }
 
         if ( ma ) {
+            // the type is encoded in the muxed OID, so the merged list of the
+            // library is found without calling into it
+            auto type = key->type;
+            if ( key->oid != TAI_NULL_OBJECT_ID ) {
+                type = get_object_type(key->oid);
+            }
+            if ( ma->list_metadata(type, count, list) == TAI_STATUS_SUCCESS ) {
+                return TAI_STATUS_SUCCESS;
+            }
             return ma->list_metadata(&new_key, count, list);
         }
 
@@ -215,21 +281,27 @@ namespace tai::mux {
 
     const tai_attr_metadata_t* Platform::get_attr_metadata(const tai_metadata_key_t *const key, tai_attr_id_t attr_id) {
         S_ModuleAdapter ma;
+        ModuleAdapterGuard guard;
         tai_metadata_key_t new_key;
-        auto ret = get_ma_and_meta_key(key, new_key, &ma);
+        auto ret = get_ma_and_meta_key(key, new_key, &ma, guard);
         if ( ret != TAI_STATUS_SUCCESS ) {
             return nullptr;
         }
         if ( ma ) {
-            return ma->get_attr_metadata(&new_key, attr_id);
+            auto type = key->type;
+            if ( key->oid != TAI_NULL_OBJECT_ID ) {
+                type = get_object_type(key->oid);
+            }
+            return ma->get_attr_metadata(type, attr_id);
         }
         return tai_metadata_get_attr_metadata(new_key.type, attr_id);
     }
 
     const tai_object_type_info_t* Platform::get_object_info(const tai_metadata_key_t *const key) {
         S_ModuleAdapter ma;
+        ModuleAdapterGuard guard;
         tai_metadata_key_t new_key;
-        auto ret = get_ma_and_meta_key(key, new_key, &ma);
+        auto ret = get_ma_and_meta_key(key, new_key, &ma, guard);
         if ( ret != TAI_STATUS_SUCCESS ) {
             return nullptr;
         }
@@ -239,6 +311,61 @@ namespace tai::mux {
         return tai_metadata_get_object_type_info(key->type);
     }
 
+    // requests are grouped by TAI library. the groups run in parallel on
+    // m_bulk_executor so that the whole call takes as long as the slowest TAI
+    // library, as long as there are enough threads
+    tai_status_t Platform::get_attributes_bulk(uint32_t count, tai_mux_get_request_t* const requests) {
+        std::map<ModuleAdapter*, std::vector<std::pair<std::shared_ptr<tai::framework::BaseObject>, tai_mux_get_request_t*>>> groups;
+        {
+            std::shared_lock<std::shared_mutex> lk(m_mutex);
+            for ( uint32_t i = 0; i < count; i++ ) {
+                auto req = &requests[i];
+                auto obj = m_table.get(OIDAllocator::index_of(req->oid), req->oid);
+                S_ModuleAdapter adapter;
+                if ( obj == nullptr || m_pa->get_mapping(req->oid, &adapter, nullptr) != 0 ) {
+                    req->status = TAI_STATUS_ITEM_NOT_FOUND;
+                    continue;
+                }
+                groups[adapter.get()].emplace_back(std::move(obj), req);
+            }
+        }
+
+        auto run = [](const std::vector<std::pair<std::shared_ptr<tai::framework::BaseObject>, tai_mux_get_request_t*>>& group) {
+            for ( auto& v : group ) {
+                auto req = v.second;
+                req->status = v.first->get_attributes(req->attr_count, req->attr_list);
+            }
+            return TAI_STATUS_SUCCESS;
+        };
+
+        std::vector<std::future<tai_status_t>> futures;
+        // the submitted groups live on this stack, so every task is waited for
+        // even when run() or submit() throws on the caller's thread
+        struct Waiter {
+            std::vector<std::future<tai_status_t>>& futures;
+            ~Waiter() {
+                for ( auto& f : futures ) {
+                    if ( f.valid() ) {
+                        f.wait();
+                    }
+                }
+            }
+        } waiter{futures};
+        for ( auto it = groups.begin(); it != groups.end(); ++it ) {
+            // the caller's thread takes the last group
+            if ( std::next(it) == groups.end() ) {
+                run(it->second);
+                break;
+            }
+            auto group = &it->second;
+            futures.emplace_back(m_bulk_executor->submit([run, group]{ return run(*group); }));
+        }
+        for ( auto& f : futures ) {
+            f.get();
+        }
+        return TAI_STATUS_SUCCESS;
+    }
+
     tai_status_t attribute_getter(tai_attribute_t* const attribute, void* user) {
         auto ctx = reinterpret_cast<context*>(user);
         auto pa = ctx->pa;
@@ -262,6 +389,28 @@ namespace tai::mux {
             .set_getter(&mux::attribute_getter),
         mux::M(TAI_MODULE_ATTR_MUX_REAL_OID)
             .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_METADATA_CACHE_HIT)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_METADATA_CACHE_MISS)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_NOTIFICATION_QUEUE_DEPTH)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_NOTIFICATION_DROPPED)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_NOTIFICATION_COALESCED)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_HIT)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_MISS)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_LATENCY_STATS)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_NOTIFICATION_CONTEXTS_PENDING)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_NOTIFICATION_SUPPRESSED)
+            .set_getter(&mux::attribute_getter),
+        mux::M(TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_PARTIAL_HIT)
+            .set_getter(&mux::attribute_getter),
     };
 
     Module::Module(uint32_t count, const tai_attribute_t *list, S_PlatformAdapter platform, const log_setting& log_setting) : Object(platform) {
@@ -274,6 +423,8 @@ namespace tai::mux {
         if ( adapter == nullptr ) {
             throw Exception(TAI_STATUS_FAILURE);
         }
+        // held until create_module() counted the module
+        ModuleAdapterGuard guard(adapter);
         for (auto const& v : log_setting) {
             auto ret = adapter->tai_log_set(v.first, v.second.first, v.second.second);
             if ( ret != TAI_STATUS_SUCCESS ) {
@@ -285,7 +436,7 @@ namespace tai::mux {
         if ( ret != TAI_STATUS_SUCCESS ) {
             throw Exception(ret);
         }
-        if ( platform->create_mapping(&m_context.oid, m_adapter, m_real_id) != 0 ) {
+        if ( platform->create_mapping(&m_context.oid, TAI_OBJECT_TYPE_MODULE, m_adapter, m_real_id) != 0 ) {
             throw Exception(TAI_STATUS_FAILURE);
         }
         m_context.type = TAI_OBJECT_TYPE_MODULE;
@@ -305,7 +456,7 @@ namespace tai::mux {
         if ( ret != TAI_STATUS_SUCCESS ) {
             throw Exception(ret);
         }
-        if ( platform->create_mapping(&m_context.oid, m_adapter, m_real_id) != 0 ) {
+        if ( platform->create_mapping(&m_context.oid, TAI_OBJECT_TYPE_NETWORKIF, m_adapter, m_real_id) != 0 ) {
             throw Exception(TAI_STATUS_FAILURE);
         }
         m_context.type = TAI_OBJECT_TYPE_NETWORKIF;
@@ -325,9 +476,20 @@ namespace tai::mux {
         if ( ret != TAI_STATUS_SUCCESS ) {
             throw Exception(ret);
         }
-        if ( platform->create_mapping(&m_context.oid, m_adapter, m_real_id) != 0 ) {
+        if ( platform->create_mapping(&m_context.oid, TAI_OBJECT_TYPE_HOSTIF, m_adapter, m_real_id) != 0 ) {
             throw Exception(TAI_STATUS_FAILURE);
         }
         m_context.type = TAI_OBJECT_TYPE_HOSTIF;
     }
 };
+
+tai_status_t tai_mux_get_attributes_bulk(uint32_t count, tai_mux_get_request_t *requests) {
+    auto platform = tai::mux::Platform::instance();
+    if ( platform == nullptr ) {
+        return TAI_STATUS_UNINITIALIZED;
+    }
+    if ( count > 0 && requests == nullptr ) {
+        return TAI_STATUS_INVALID_PARAMETER;
+    }
+    return platform->get_attributes_bulk(count, requests);
+}
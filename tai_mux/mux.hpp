@@ -4,19 +4,28 @@
 #include <string>
 #include "platform_adapter.hpp"
 #include "module_adapter.hpp"
+#include "object_table.hpp"
 #include "tai.h"
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 
 #include "platform.hpp"
+#include "tai_mux.h"
 
 namespace tai::mux {
 
     using namespace tai::framework;
     using log_setting = std::map<tai_api_t, std::pair<tai_log_level_t, tai_log_fn>>;
 
+    // number of threads running the per library groups of tai_mux_get_attributes_bulk()
+    const std::string TAI_MUX_BULK_THREADS = "TAI_MUX_BULK_THREADS";
+    const size_t TAI_MUX_DEFAULT_BULK_THREADS = 4;
+
     class Platform : public tai::framework::Platform {
         public:
             Platform(const tai_service_method_table_t * services);
+            ~Platform();
             tai_status_t create(tai_object_type_t type, tai_object_id_t module_id, uint32_t count, const tai_attribute_t * const list, tai_object_id_t *id);
             tai_status_t remove(tai_object_id_t id);
             tai_object_type_t get_object_type(tai_object_id_t id);
@@ -26,12 +35,33 @@ namespace tai::mux {
             tai_status_t list_metadata(const tai_metadata_key_t *const key, uint32_t *count, const tai_attr_metadata_t *const **list);
             const tai_attr_metadata_t* get_attr_metadata(const tai_metadata_key_t *const key, tai_attr_id_t attr_id);
             const tai_object_type_info_t* get_object_info(const tai_metadata_key_t *const key);
+
+            // see tai_mux_get_attributes_bulk()
+            tai_status_t get_attributes_bulk(uint32_t count, tai_mux_get_request_t* const requests);
+
+            // the initialized instance, used by the entry points which aren't part of the TAI API
+            static Platform* instance() {
+                return s_instance.load(std::memory_order_acquire);
+            }
         private:
+            static std::atomic<Platform*> s_instance;
+
+            tai_status_t create_object(tai_object_type_t type, tai_object_id_t module_id, uint32_t count, const tai_attribute_t * const list, tai_object_id_t *id);
+            tai_status_t remove_object(tai_object_id_t id);
 
-            tai_status_t get_ma_and_meta_key(const tai_metadata_key_t *const key, tai_metadata_key_t& new_key, S_ModuleAdapter *ma);
+            tai_status_t get_ma_and_meta_key(const tai_metadata_key_t *const key, tai_metadata_key_t& new_key, S_ModuleAdapter *ma, ModuleAdapterGuard& guard);
 
             S_PlatformAdapter m_pa;
+            // declared after m_pa so that it stops before m_pa is destroyed
+            std::unique_ptr<LatencyDumper> m_latency_dumper;
+            // runs the groups of get_attributes_bulk(), also stopped before m_pa is destroyed
+            std::unique_ptr<CallExecutor> m_bulk_executor;
             log_setting m_log_setting;
+            // guards m_objects, m_table and m_log_setting. m_table is also read without it
+            // vendor library calls are made without holding it
+            std::shared_mutex m_mutex;
+            // the objects of m_objects, indexed by OID
+            ObjectTable<tai::framework::BaseObject, TAI_MUX_NUM_MAX_OBJECT> m_table;
     };
 
     class Module;
@@ -0,0 +1,306 @@
+#include "notification_dispatcher.hpp"
+#include "logger.hpp"
+
+#include <cstdlib>
+#include <chrono>
+
+namespace tai::mux {
+
+    // upper bound of the time the dispatcher sleeps when it misses a wake up
+    static const auto DISPATCHER_POLL_INTERVAL = std::chrono::milliseconds(100);
+
+    // values of these types hold no pointers and are copied as they are
+    static bool is_flat(const tai_attr_metadata_t* const meta) {
+        switch (meta->attrvaluetype) {
+        case TAI_ATTR_VALUE_TYPE_BOOLDATA:
+        case TAI_ATTR_VALUE_TYPE_CHARDATA:
+        case TAI_ATTR_VALUE_TYPE_U8:
+        case TAI_ATTR_VALUE_TYPE_S8:
+        case TAI_ATTR_VALUE_TYPE_U16:
+        case TAI_ATTR_VALUE_TYPE_S16:
+        case TAI_ATTR_VALUE_TYPE_U32:
+        case TAI_ATTR_VALUE_TYPE_S32:
+        case TAI_ATTR_VALUE_TYPE_U64:
+        case TAI_ATTR_VALUE_TYPE_S64:
+        case TAI_ATTR_VALUE_TYPE_FLT:
+        case TAI_ATTR_VALUE_TYPE_PTR:
+        case TAI_ATTR_VALUE_TYPE_OID:
+        case TAI_ATTR_VALUE_TYPE_U32RANGE:
+        case TAI_ATTR_VALUE_TYPE_S32RANGE:
+        case TAI_ATTR_VALUE_TYPE_NOTIFICATION:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    NotificationDispatcher::NotificationDispatcher(size_t size, OverflowPolicy policy, std::chrono::milliseconds delay) : m_queue(size), m_pool(size), m_policy(policy), m_delay(delay) {
+        for ( size_t i = 0; i < size; i++ ) {
+            if ( !m_pool.push(new PendingNotification()) ) {
+                break;
+            }
+        }
+        m_th = std::thread(&NotificationDispatcher::loop, this);
+    }
+
+    NotificationDispatcher::~NotificationDispatcher() {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_th.join();
+        PendingNotification* n;
+        while ( m_queue.pop(n) ) {
+            delete n;
+        }
+        while ( m_pool.pop(n) ) {
+            delete n;
+        }
+    }
+
+    std::unique_ptr<NotificationDispatcher> NotificationDispatcher::from_env() {
+        auto e = std::getenv(TAI_MUX_NOTIFICATION_QUEUE_SIZE.c_str());
+        if ( e == nullptr ) {
+            return nullptr;
+        }
+        auto size = std::strtoul(e, nullptr, 0);
+        if ( size == 0 ) {
+            return nullptr;
+        }
+        auto policy = OverflowPolicy::DROP_OLDEST;
+        e = std::getenv(TAI_MUX_NOTIFICATION_OVERFLOW_POLICY.c_str());
+        if ( e != nullptr ) {
+            std::string p(e);
+            if ( p == "coalesce" ) {
+                policy = OverflowPolicy::COALESCE;
+            } else if ( p != "drop-oldest" ) {
+                TAI_WARN("unknown notification overflow policy: %s, using drop-oldest", e);
+            }
+        }
+        auto delay = 0;
+        e = std::getenv(TAI_MUX_NOTIFICATION_DISPATCH_DELAY_MS.c_str());
+        if ( e != nullptr && std::atoi(e) > 0 ) {
+            delay = std::atoi(e);
+            TAI_WARN("every notification is delayed by %d ms", delay);
+        }
+        TAI_INFO("asynchronous notification dispatch enabled. queue size: %lu", size);
+        return std::make_unique<NotificationDispatcher>(size, policy, std::chrono::milliseconds(delay));
+    }
+
+    // the pool only runs dry when notifications arrive faster than the
+    // dispatcher thread recycles them
+    PendingNotification* NotificationDispatcher::acquire() {
+        PendingNotification* n;
+        if ( m_pool.pop(n) ) {
+            return n;
+        }
+        return new PendingNotification();
+    }
+
+    void NotificationDispatcher::release(PendingNotification* n) {
+        n->attrs.clear();
+        n->owned.clear();
+        if ( !m_pool.push(n) ) {
+            delete n;
+        }
+    }
+
+    void NotificationDispatcher::enqueue(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas) {
+        // counted before the sequence number is taken, so that the forgotten
+        // entries aren't pruned while a notification older than them is on its way
+        m_enqueuing.fetch_add(1, std::memory_order_seq_cst);
+        auto n = acquire();
+        n->notify_id = notify_id;
+        n->handler = handler;
+        n->oid = oid;
+        n->seq = m_seq.fetch_add(1, std::memory_order_seq_cst);
+        for ( uint32_t i = 0; i < count; i++ ) {
+            if ( metas[i] == nullptr || is_flat(metas[i]) ) {
+                n->attrs.emplace_back(attrs[i]);
+                n->owned.emplace_back(nullptr);
+                continue;
+            }
+            auto a = std::make_shared<Attribute>(metas[i], &attrs[i]);
+            n->attrs.emplace_back(*a->raw());
+            n->owned.emplace_back(std::move(a));
+        }
+
+        if ( m_policy == OverflowPolicy::COALESCE && m_coalescing.load(std::memory_order_acquire) ) {
+            coalesce(n);
+        } else {
+            while ( !m_queue.push(n) ) {
+                if ( m_policy == OverflowPolicy::COALESCE ) {
+                    coalesce(n);
+                    break;
+                }
+                PendingNotification* oldest;
+                if ( m_queue.pop(oldest) ) {
+                    release(oldest);
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+        m_enqueuing.fetch_sub(1, std::memory_order_seq_cst);
+        wake();
+    }
+
+    void NotificationDispatcher::forget(tai_object_id_t oid, tai_attr_id_t notify_id) {
+        auto key = std::make_pair(oid, notify_id);
+        {
+            std::unique_lock<std::mutex> lk(m_coalesce_mutex);
+            m_coalesce_map.erase(key);
+        }
+        std::unique_lock<std::mutex> lk(m_forget_mutex);
+        m_forgotten[key] = m_seq.load(std::memory_order_seq_cst);
+        wait_delivery(oid, notify_id, false, lk);
+    }
+
+    void NotificationDispatcher::forget(tai_object_id_t oid) {
+        {
+            std::unique_lock<std::mutex> lk(m_coalesce_mutex);
+            auto begin = m_coalesce_map.lower_bound(std::make_pair(oid, 0));
+            auto it = begin;
+            while ( it != m_coalesce_map.end() && it->first.first == oid ) {
+                it++;
+            }
+            m_coalesce_map.erase(begin, it);
+        }
+        std::unique_lock<std::mutex> lk(m_forget_mutex);
+        m_forgotten_objects[oid] = m_seq.load(std::memory_order_seq_cst);
+        wait_delivery(oid, 0, true, lk);
+    }
+
+    // the handler may call back into libtai-mux.so and forget itself
+    void NotificationDispatcher::wait_delivery(tai_object_id_t oid, tai_attr_id_t notify_id, bool any, std::unique_lock<std::mutex>& lk) {
+        if ( std::this_thread::get_id() == m_th.get_id() ) {
+            return;
+        }
+        m_forget_cv.wait(lk, [&]{
+            return !m_delivering || m_delivering_key.first != oid || ( !any && m_delivering_key.second != notify_id );
+        });
+    }
+
+    bool NotificationDispatcher::forgotten(const PendingNotification& n) {
+        auto o = m_forgotten_objects.find(n.oid);
+        if ( o != m_forgotten_objects.end() && n.seq < o->second ) {
+            return true;
+        }
+        auto it = m_forgotten.find(std::make_pair(n.oid, n.notify_id));
+        return it != m_forgotten.end() && n.seq < it->second;
+    }
+
+    // a notification enqueued after an entry was added is never dropped by
+    // it, so the entries go once every older notification is gone
+    void NotificationDispatcher::prune_forgotten() {
+        std::unique_lock<std::mutex> lk(m_forget_mutex);
+        if ( m_forgotten.empty() && m_forgotten_objects.empty() ) {
+            return;
+        }
+        if ( m_enqueuing.load(std::memory_order_seq_cst) == 0 && m_queue.size() == 0 && !m_coalescing.load(std::memory_order_acquire) ) {
+            m_forgotten.clear();
+            m_forgotten_objects.clear();
+        }
+    }
+
+    // the mutex is only taken when the dispatcher is about to sleep or sleeping
+    void NotificationDispatcher::wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ( m_sleeping.load(std::memory_order_relaxed) ) {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_cv.notify_one();
+        }
+    }
+
+    // the values of n are moved into the map and n goes back to the pool.
+    // an owned list value keeps its storage alive as long as it is in the map
+    void NotificationDispatcher::coalesce(PendingNotification* n) {
+        {
+            std::unique_lock<std::mutex> lk(m_coalesce_mutex);
+            auto key = std::make_pair(n->oid, n->notify_id);
+            auto c_it = m_coalesce_map.find(key);
+            if ( c_it == m_coalesce_map.end() ) {
+                c_it = m_coalesce_map.emplace(key, Coalesced{}).first;
+            }
+            auto& c = c_it->second;
+            c.handler = n->handler;
+            c.seq = n->seq;
+            for ( size_t i = 0; i < n->attrs.size(); i++ ) {
+                auto value = std::make_pair(n->attrs[i], std::move(n->owned[i]));
+                auto it = c.attrs.find(n->attrs[i].id);
+                if ( it != c.attrs.end() ) {
+                    it->second = std::move(value);
+                    m_coalesced.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    c.attrs.emplace(n->attrs[i].id, std::move(value));
+                }
+            }
+            m_coalescing.store(true, std::memory_order_release);
+        }
+        release(n);
+    }
+
+    void NotificationDispatcher::flush_coalesced() {
+        std::map<std::pair<tai_object_id_t, tai_attr_id_t>, Coalesced> map;
+        {
+            std::unique_lock<std::mutex> lk(m_coalesce_mutex);
+            map.swap(m_coalesce_map);
+            m_coalescing.store(false, std::memory_order_release);
+        }
+        PendingNotification n;
+        for ( auto& v : map ) {
+            n.notify_id = v.first.second;
+            n.handler = v.second.handler;
+            n.oid = v.first.first;
+            n.seq = v.second.seq;
+            n.attrs.clear();
+            for ( auto& a : v.second.attrs ) {
+                n.attrs.emplace_back(a.second.first);
+            }
+            deliver(n);
+        }
+    }
+
+    void NotificationDispatcher::deliver(const PendingNotification& n) {
+        if ( m_delay.count() > 0 ) {
+            std::this_thread::sleep_for(m_delay);
+        }
+        {
+            std::unique_lock<std::mutex> lk(m_forget_mutex);
+            if ( forgotten(n) ) {
+                return;
+            }
+            m_delivering = true;
+            m_delivering_key = std::make_pair(n.oid, n.notify_id);
+        }
+        n.handler.notify(n.handler.context, n.oid, n.attrs.size(), n.attrs.data());
+        {
+            std::unique_lock<std::mutex> lk(m_forget_mutex);
+            m_delivering = false;
+        }
+        m_forget_cv.notify_all();
+    }
+
+    void NotificationDispatcher::loop() {
+        while ( !m_stop ) {
+            PendingNotification* p;
+            while ( m_queue.pop(p) ) {
+                deliver(*p);
+                release(p);
+            }
+            if ( m_coalescing.load(std::memory_order_acquire) ) {
+                flush_coalesced();
+                continue;
+            }
+            prune_forgotten();
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if ( !m_stop && m_queue.size() == 0 && !m_coalescing.load(std::memory_order_acquire) ) {
+                m_cv.wait_for(lk, DISPATCHER_POLL_INTERVAL);
+            }
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+}
@@ -0,0 +1,215 @@
+#ifndef __NOTIFICATION_DISPATCHER_HPP__
+#define __NOTIFICATION_DISPATCHER_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+#include "tai.h"
+#include "attribute.hpp"
+
+namespace tai::mux {
+
+    const std::string TAI_MUX_NOTIFICATION_QUEUE_SIZE = "TAI_MUX_NOTIFICATION_QUEUE_SIZE";
+    const std::string TAI_MUX_NOTIFICATION_OVERFLOW_POLICY = "TAI_MUX_NOTIFICATION_OVERFLOW_POLICY";
+    // delays every delivery by this many milliseconds, to test the overflow policies with a slow host
+    const std::string TAI_MUX_NOTIFICATION_DISPATCH_DELAY_MS = "TAI_MUX_NOTIFICATION_DISPATCH_DELAY_MS";
+
+    enum class OverflowPolicy {
+        DROP_OLDEST, // discard the oldest queued notification
+        COALESCE,    // keep only the latest value per (object, attribute) until the queue drains
+    };
+
+    // bounded lock-free queue (Dmitry Vyukov's MPMC ring)
+    //
+    // the dispatcher thread is the only regular consumer. producers also pop
+    // from it to make room when the drop-oldest policy is used.
+    template<typename T>
+    class BoundedQueue {
+        public:
+            BoundedQueue(size_t size) {
+                size_t capacity = 2;
+                while ( capacity < size ) {
+                    capacity <<= 1;
+                }
+                m_mask = capacity - 1;
+                m_cells.reset(new Cell[capacity]);
+                for ( size_t i = 0; i < capacity; i++ ) {
+                    m_cells[i].seq.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            bool push(T v) {
+                auto pos = m_tail.load(std::memory_order_relaxed);
+                Cell* cell;
+                while ( true ) {
+                    cell = &m_cells[pos & m_mask];
+                    auto seq = cell->seq.load(std::memory_order_acquire);
+                    auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                    if ( diff == 0 ) {
+                        if ( m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ) {
+                            break;
+                        }
+                    } else if ( diff < 0 ) {
+                        return false; // full
+                    } else {
+                        pos = m_tail.load(std::memory_order_relaxed);
+                    }
+                }
+                cell->data = std::move(v);
+                cell->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop(T& v) {
+                auto pos = m_head.load(std::memory_order_relaxed);
+                Cell* cell;
+                while ( true ) {
+                    cell = &m_cells[pos & m_mask];
+                    auto seq = cell->seq.load(std::memory_order_acquire);
+                    auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                    if ( diff == 0 ) {
+                        if ( m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ) {
+                            break;
+                        }
+                    } else if ( diff < 0 ) {
+                        return false; // empty
+                    } else {
+                        pos = m_head.load(std::memory_order_relaxed);
+                    }
+                }
+                v = std::move(cell->data);
+                cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+
+            size_t size() const {
+                auto tail = m_tail.load(std::memory_order_relaxed);
+                auto head = m_head.load(std::memory_order_relaxed);
+                return tail > head ? tail - head : 0;
+            }
+
+        private:
+            struct Cell {
+                std::atomic<size_t> seq;
+                T data;
+            };
+            std::unique_ptr<Cell[]> m_cells;
+            size_t m_mask;
+            alignas(64) std::atomic<size_t> m_tail {0};
+            alignas(64) std::atomic<size_t> m_head {0};
+    };
+
+    // a translated notification waiting for delivery
+    //
+    // the buffers of the TAI library are only valid during its callback.
+    // scalar values are copied into attrs as they are, and only list values
+    // are deep copied into owned[i] which attrs[i] then points to. instances
+    // are recycled through a pool so the scalar case doesn't allocate
+    struct PendingNotification {
+        tai_attr_id_t notify_id; // the notification attribute it came through
+        tai_notification_handler_t handler;
+        tai_object_id_t oid;
+        uint64_t seq; // the order it was enqueued in, to tell which ones were forgotten
+        std::vector<tai_attribute_t> attrs;
+        std::vector<S_Attribute> owned; // null for scalar values
+    };
+
+    // delivers notifications to the host from a dedicated thread so that a slow
+    // host handler doesn't stall the threads of the TAI libraries
+    class NotificationDispatcher {
+        public:
+            NotificationDispatcher(size_t size, OverflowPolicy policy, std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+            ~NotificationDispatcher();
+
+            // returns nullptr unless asynchronous dispatch is enabled by TAI_MUX_NOTIFICATION_QUEUE_SIZE
+            static std::unique_ptr<NotificationDispatcher> from_env();
+
+            // called from the TAI library threads, metas[i] is the metadata of attrs[i].
+            // notify_id is the notification attribute it came through
+            void enqueue(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas);
+
+            // drops the notifications enqueued so far for a notification
+            // attribute which was cleared or replaced, or for a removed
+            // object. a delivery of them in progress is waited for, unless
+            // called from the handler itself, so the handler they were sent
+            // to is never called afterwards
+            void forget(tai_object_id_t oid, tai_attr_id_t notify_id);
+            void forget(tai_object_id_t oid);
+
+            uint64_t depth() const {
+                return m_queue.size();
+            }
+
+            uint64_t dropped() const {
+                return m_dropped.load(std::memory_order_relaxed);
+            }
+
+            uint64_t coalesced() const {
+                return m_coalesced.load(std::memory_order_relaxed);
+            }
+
+        private:
+            PendingNotification* acquire();
+            void release(PendingNotification* n);
+            void coalesce(PendingNotification* n);
+            void flush_coalesced();
+            void deliver(const PendingNotification& n);
+            // called with m_forget_mutex held
+            bool forgotten(const PendingNotification& n);
+            void wait_delivery(tai_object_id_t oid, tai_attr_id_t notify_id, bool any, std::unique_lock<std::mutex>& lk);
+            void prune_forgotten();
+            void wake();
+            void loop();
+
+            BoundedQueue<PendingNotification*> m_queue;
+            BoundedQueue<PendingNotification*> m_pool; // recycled notifications
+            const OverflowPolicy m_policy;
+            const std::chrono::milliseconds m_delay;
+
+            // notifications merged while the queue was full, keyed by object and
+            // notification attribute then attribute, like NotificationLimiter
+            struct Coalesced {
+                tai_notification_handler_t handler;
+                uint64_t seq; // of the latest notification merged
+                std::map<tai_attr_id_t, std::pair<tai_attribute_t, S_Attribute>> attrs; // the value and its storage, if any
+            };
+            std::mutex m_coalesce_mutex;
+            std::map<std::pair<tai_object_id_t, tai_attr_id_t>, Coalesced> m_coalesce_map;
+            // set while m_coalesce_map has entries. producers keep merging into the map
+            // instead of the queue until it is flushed so that the order of values
+            // for an object is preserved
+            std::atomic<bool> m_coalescing {false};
+
+            std::atomic<uint64_t> m_seq {0};
+            std::atomic<uint64_t> m_enqueuing {0}; // enqueue() calls in progress
+
+            // what forget() was called for, with the value of m_seq then. the
+            // notifications enqueued before that are dropped. emptied when no
+            // notification is left in the queue
+            std::mutex m_forget_mutex; // guards the members below
+            std::condition_variable m_forget_cv;
+            std::map<std::pair<tai_object_id_t, tai_attr_id_t>, uint64_t> m_forgotten;
+            std::map<tai_object_id_t, uint64_t> m_forgotten_objects;
+            bool m_delivering = false;
+            std::pair<tai_object_id_t, tai_attr_id_t> m_delivering_key;
+
+            std::atomic<uint64_t> m_dropped {0};
+            std::atomic<uint64_t> m_coalesced {0};
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::atomic<bool> m_sleeping {false};
+            std::atomic<bool> m_stop {false};
+            std::thread m_th;
+    };
+
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "notification_limiter.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace tai::mux {
+
+    // upper bound of the time the limiter thread sleeps, idle entries are dropped when it wakes up
+    static const auto LIMITER_POLL_INTERVAL = std::chrono::seconds(1);
+
+    NotificationLimiter::NotificationLimiter(clock::duration window, double rate, double burst, Sink sink) : m_window(window), m_rate(rate), m_burst(burst), m_sink(sink) {
+        m_th = std::thread(&NotificationLimiter::loop, this);
+    }
+
+    NotificationLimiter::~NotificationLimiter() {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_th.join();
+    }
+
+    std::unique_ptr<NotificationLimiter> NotificationLimiter::from_env(Sink sink) {
+        unsigned long window = 0;
+        double rate = 0, burst = 0;
+        auto e = std::getenv(TAI_MUX_NOTIFICATION_COALESCE_WINDOW.c_str());
+        if ( e != nullptr ) {
+            window = std::strtoul(e, nullptr, 0);
+        }
+        e = std::getenv(TAI_MUX_NOTIFICATION_RATE_LIMIT.c_str());
+        if ( e != nullptr ) {
+            rate = std::max(std::strtod(e, nullptr), 0.0);
+        }
+        if ( window == 0 && rate == 0 ) {
+            return nullptr;
+        }
+        e = std::getenv(TAI_MUX_NOTIFICATION_BURST.c_str());
+        if ( e != nullptr ) {
+            burst = std::strtod(e, nullptr);
+        }
+        burst = std::max(burst, 1.0);
+        TAI_INFO("notification limiter enabled. coalescing window: %lu ms, rate limit: %.1f/s, burst: %.1f", window, rate, burst);
+        return std::make_unique<NotificationLimiter>(std::chrono::milliseconds(window), rate, burst, sink);
+    }
+
+    bool NotificationLimiter::take(tai_object_id_t oid, clock::time_point now, clock::time_point* next) {
+        if ( m_rate == 0 ) {
+            return true;
+        }
+        auto it = m_buckets.find(oid);
+        if ( it == m_buckets.end() ) {
+            it = m_buckets.emplace(oid, Bucket{m_burst, now}).first;
+        }
+        auto& b = it->second;
+        b.tokens = std::min(m_burst, b.tokens + std::chrono::duration<double>(now - b.last).count() * m_rate);
+        b.last = now;
+        if ( b.tokens >= 1 ) {
+            b.tokens -= 1;
+            return true;
+        }
+        *next = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((1 - b.tokens) / m_rate));
+        return false;
+    }
+
+    bool NotificationLimiter::admit(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas) {
+        auto now = clock::now();
+        std::unique_lock<std::mutex> lk(m_mutex);
+        auto it = m_entries.find(key(oid, notify_id));
+        if ( it == m_entries.end() ) {
+            it = m_entries.emplace(key(oid, notify_id), Entry{}).first;
+        }
+        auto& e = it->second;
+        auto held = !e.attrs.empty() || e.flushing;
+        auto next = now;
+        if ( !held && now >= e.window_end && take(oid, now, &next) ) {
+            e.window_end = now + m_window;
+            return true;
+        }
+        if ( held ) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        }
+        e.handler = handler;
+        for ( uint32_t i = 0; i < count; i++ ) {
+            e.attrs[attrs[i].id] = std::make_shared<Attribute>(metas[i], &attrs[i]);
+        }
+        if ( !held ) {
+            e.due = std::max(e.window_end, next);
+            lk.unlock();
+            m_cv.notify_one();
+        }
+        return false;
+    }
+
+    void NotificationLimiter::forget(tai_object_id_t oid) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        auto begin = m_entries.lower_bound(key(oid, 0));
+        auto it = begin;
+        while ( it != m_entries.end() && it->first.first == oid ) {
+            it++;
+        }
+        m_entries.erase(begin, it);
+        m_buckets.erase(oid);
+    }
+
+    void NotificationLimiter::forget(tai_object_id_t oid, tai_attr_id_t notify_id) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        // one being flushed is delivered, then the loop finds it gone
+        m_entries.erase(key(oid, notify_id));
+    }
+
+    void NotificationLimiter::loop() {
+        struct Ready {
+            key k;
+            tai_notification_handler_t handler;
+            std::map<tai_attr_id_t, S_Attribute> attrs;
+        };
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while ( !m_stop ) {
+            auto now = clock::now();
+            auto wake = now + LIMITER_POLL_INTERVAL;
+            std::vector<Ready> ready;
+            for ( auto it = m_entries.begin(); it != m_entries.end(); ) {
+                auto& e = it->second;
+                if ( e.attrs.empty() ) {
+                    if ( !e.flushing && now >= e.window_end ) {
+                        it = m_entries.erase(it);
+                        continue;
+                    }
+                    it++;
+                    continue;
+                }
+                if ( e.due <= now && !e.flushing ) {
+                    if ( take(it->first.first, now, &e.due) ) {
+                        // the notifications coming meanwhile are held back
+                        // so that they aren't delivered before this one
+                        e.flushing = true;
+                        e.window_end = now + m_window;
+                        ready.emplace_back(Ready{it->first, e.handler, std::move(e.attrs)});
+                        e.attrs.clear();
+                        it++;
+                        continue;
+                    }
+                }
+                wake = std::min(wake, e.due);
+                it++;
+            }
+            if ( ready.empty() ) {
+                // the buckets which are full again are the same as new ones
+                for ( auto it = m_buckets.begin(); it != m_buckets.end(); ) {
+                    if ( it->second.tokens + std::chrono::duration<double>(now - it->second.last).count() * m_rate >= m_burst ) {
+                        it = m_buckets.erase(it);
+                    } else {
+                        it++;
+                    }
+                }
+                m_cv.wait_until(lk, wake);
+                continue;
+            }
+
+            // the host handler can call back into libtai-mux.so
+            lk.unlock();
+            std::vector<tai_attribute_t> raw;
+            std::vector<const tai_attr_metadata_t*> metas;
+            for ( auto& r : ready ) {
+                raw.clear();
+                metas.clear();
+                for ( auto& a : r.attrs ) {
+                    raw.emplace_back(*a.second->raw());
+                    metas.emplace_back(a.second->metadata());
+                }
+                m_sink(r.k.second, r.handler, r.k.first, raw.size(), raw.data(), metas.data());
+            }
+            lk.lock();
+            for ( auto& r : ready ) {
+                auto it = m_entries.find(r.k);
+                if ( it == m_entries.end() ) {
+                    continue;
+                }
+                it->second.flushing = false;
+                if ( !it->second.attrs.empty() ) {
+                    it->second.due = std::max(it->second.due, it->second.window_end);
+                }
+            }
+        }
+    }
+
+};
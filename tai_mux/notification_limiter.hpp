@@ -0,0 +1,103 @@
+#ifndef __NOTIFICATION_LIMITER_HPP__
+#define __NOTIFICATION_LIMITER_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "tai.h"
+#include "attribute.hpp"
+
+namespace tai::mux {
+
+    // notifications of an object are merged for this many milliseconds after one is delivered
+    const std::string TAI_MUX_NOTIFICATION_COALESCE_WINDOW = "TAI_MUX_NOTIFICATION_COALESCE_WINDOW";
+    // notifications delivered per second per object
+    const std::string TAI_MUX_NOTIFICATION_RATE_LIMIT = "TAI_MUX_NOTIFICATION_RATE_LIMIT";
+    // notifications an object can deliver in a row before the rate limit applies
+    const std::string TAI_MUX_NOTIFICATION_BURST = "TAI_MUX_NOTIFICATION_BURST";
+
+    // bounds the notifications the host receives per object
+    //
+    // a notification is delivered right away when its (object, notification
+    // attribute) has nothing held back, is out of its coalescing window and
+    // the object has a token left in its bucket. otherwise it is merged into
+    // the held back one, keeping the latest value of each attribute, and a
+    // thread delivers that once the window is over and a token is available.
+    //
+    // notifications are merged per (object, notification attribute) like
+    // NotificationDispatcher does, so what passes here isn't merged across
+    // handlers there either.
+    class NotificationLimiter {
+        public:
+            using clock = std::chrono::steady_clock;
+            // hands a notification to the host, metas[i] is the metadata of attrs[i]
+            using Sink = std::function<void(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas)>;
+
+            // rate is in notifications per second, 0 for no rate limit
+            NotificationLimiter(clock::duration window, double rate, double burst, Sink sink);
+            ~NotificationLimiter();
+
+            // returns nullptr unless a coalescing window or a rate limit is set
+            static std::unique_ptr<NotificationLimiter> from_env(Sink sink);
+
+            // called from the TAI library threads. returns true when the
+            // notification is to be delivered by the caller, false when it is
+            // held back. notify_id is the notification attribute it came through
+            bool admit(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas);
+
+            // drops what is held back for a removed object
+            void forget(tai_object_id_t oid);
+            // drops what is held back for a notification attribute which was cleared or replaced
+            void forget(tai_object_id_t oid, tai_attr_id_t notify_id);
+
+            // notifications merged into another one
+            uint64_t suppressed() const {
+                return m_suppressed.load(std::memory_order_relaxed);
+            }
+
+        private:
+            struct Bucket {
+                double tokens;
+                clock::time_point last;
+            };
+
+            struct Entry {
+                tai_notification_handler_t handler;
+                std::map<tai_attr_id_t, S_Attribute> attrs; // held back, latest value per attribute
+                clock::time_point window_end;
+                clock::time_point due; // when attrs can be delivered, valid unless attrs is empty
+                bool flushing = false; // the limiter thread is delivering what was held back
+            };
+
+            using key = std::pair<tai_object_id_t, tai_attr_id_t>;
+
+            // takes a token of oid if there is one. otherwise *next is set to
+            // when there will be
+            bool take(tai_object_id_t oid, clock::time_point now, clock::time_point* next);
+            void loop();
+
+            const clock::duration m_window;
+            const double m_rate;
+            const double m_burst;
+            Sink m_sink;
+
+            std::mutex m_mutex; // guards m_entries, m_buckets and m_stop
+            std::condition_variable m_cv;
+            std::map<key, Entry> m_entries;
+            std::map<tai_object_id_t, Bucket> m_buckets;
+            bool m_stop = false;
+
+            std::atomic<uint64_t> m_suppressed {0};
+            std::thread m_th;
+    };
+
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __OBJECT_TABLE_HPP__
+#define __OBJECT_TABLE_HPP__
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "tai.h"
+
+namespace tai::mux {
+
+    static const uint32_t TAI_MUX_OBJECT_TABLE_CHUNK_SIZE = 1024;
+
+    // objects indexed by the index part of their muxed OID, see OIDAllocator
+    //
+    // the object type and the module OID are held inline, so looking them up
+    // is one array access without locking, RTTI or touching a refcount. they
+    // are asked for on every API call.
+    //
+    // writers are serialized by the caller. an entry is published by storing
+    // its OID last and retired by clearing the OID first, and a reader checks
+    // the OID again after reading the fields, so it never returns the fields
+    // of another object which reused the index. the chunks are allocated as
+    // the indices grow and kept until the table is destroyed.
+    template<typename T, uint32_t Size>
+    class ObjectTable {
+        public:
+            ObjectTable() {}
+
+            ~ObjectTable() {
+                for ( auto& c : m_chunks ) {
+                    delete c.load(std::memory_order_relaxed);
+                }
+            }
+
+            // returns false when the entry at index isn't oid. type and module_id can be null
+            bool find(uint32_t index, tai_object_id_t oid, tai_object_type_t* type, tai_object_id_t* module_id) const {
+                auto e = entry(index);
+                if ( e == nullptr || e->oid.load(std::memory_order_acquire) != oid ) {
+                    return false;
+                }
+                auto t = e->type.load(std::memory_order_relaxed);
+                auto m = e->module_id.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if ( e->oid.load(std::memory_order_relaxed) != oid ) {
+                    return false;
+                }
+                if ( type != nullptr ) {
+                    *type = t;
+                }
+                if ( module_id != nullptr ) {
+                    *module_id = m;
+                }
+                return true;
+            }
+
+            // the object itself. the caller holds a lock the writers exclude
+            std::shared_ptr<T> get(uint32_t index, tai_object_id_t oid) const {
+                auto e = entry(index);
+                if ( e == nullptr || e->oid.load(std::memory_order_acquire) != oid ) {
+                    return nullptr;
+                }
+                return e->object;
+            }
+
+            // returns false when index is out of range or in use
+            bool insert(uint32_t index, tai_object_id_t oid, tai_object_type_t type, tai_object_id_t module_id, std::shared_ptr<T> object) {
+                if ( index >= Size ) {
+                    return false;
+                }
+                auto& c = m_chunks[index / TAI_MUX_OBJECT_TABLE_CHUNK_SIZE];
+                auto chunk = c.load(std::memory_order_relaxed);
+                if ( chunk == nullptr ) {
+                    chunk = new Chunk();
+                    c.store(chunk, std::memory_order_release);
+                }
+                auto& e = (*chunk)[index % TAI_MUX_OBJECT_TABLE_CHUNK_SIZE];
+                if ( e.oid.load(std::memory_order_relaxed) != TAI_NULL_OBJECT_ID ) {
+                    return false;
+                }
+                e.type.store(type, std::memory_order_relaxed);
+                e.module_id.store(module_id, std::memory_order_relaxed);
+                e.object = std::move(object);
+                e.oid.store(oid, std::memory_order_release);
+                return true;
+            }
+
+            // returns the object, null when the entry at index isn't oid
+            std::shared_ptr<T> erase(uint32_t index, tai_object_id_t oid) {
+                auto e = entry(index);
+                if ( e == nullptr || e->oid.load(std::memory_order_relaxed) != oid ) {
+                    return nullptr;
+                }
+                e->oid.store(TAI_NULL_OBJECT_ID, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                e->type.store(TAI_OBJECT_TYPE_NULL, std::memory_order_relaxed);
+                e->module_id.store(TAI_NULL_OBJECT_ID, std::memory_order_relaxed);
+                return std::move(e->object);
+            }
+
+        private:
+            struct Entry {
+                std::atomic<tai_object_id_t> oid {TAI_NULL_OBJECT_ID};
+                std::atomic<tai_object_type_t> type {TAI_OBJECT_TYPE_NULL};
+                std::atomic<tai_object_id_t> module_id {TAI_NULL_OBJECT_ID};
+                std::shared_ptr<T> object;
+            };
+
+            using Chunk = std::array<Entry, TAI_MUX_OBJECT_TABLE_CHUNK_SIZE>;
+
+            Entry* entry(uint32_t index) const {
+                if ( index >= Size ) {
+                    return nullptr;
+                }
+                auto chunk = m_chunks[index / TAI_MUX_OBJECT_TABLE_CHUNK_SIZE].load(std::memory_order_acquire);
+                return chunk == nullptr ? nullptr : &(*chunk)[index % TAI_MUX_OBJECT_TABLE_CHUNK_SIZE];
+            }
+
+            std::array<std::atomic<Chunk*>, (Size + TAI_MUX_OBJECT_TABLE_CHUNK_SIZE - 1) / TAI_MUX_OBJECT_TABLE_CHUNK_SIZE> m_chunks {};
+    };
+
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef __OID_MAP_HPP__
+#define __OID_MAP_HPP__
+
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <shared_mutex>
+#include <mutex>
+#include <array>
+
+#include "tai.h"
+
+namespace tai::mux {
+
+    static const size_t TAI_MUX_OID_MAP_NUM_SHARDS = 16;
+
+    // bidirectional index between muxed OIDs and (adapter, real OID) pairs
+    //
+    // both directions are hash lookups. the reverse index is keyed by the raw
+    // adapter pointer so that lookups don't touch the shared_ptr refcount.
+    // the forward index keeps the owning shared_ptr which keeps the raw
+    // pointer valid as long as the entry exists.
+    //
+    // the table is safe for concurrent use. each direction is split into
+    // shards guarded by a reader-writer lock, so lookups from notification
+    // threads and the host thread only take a shared lock on one shard and
+    // never serialize against each other. create/remove take the exclusive
+    // lock of the shards they touch.
+    template<typename Adapter>
+    class OIDMapping {
+        public:
+            using S_Adapter = std::shared_ptr<Adapter>;
+
+            // returns false when id is not mapped
+            // adapter is only copied (and its refcount bumped) when requested
+            bool find(tai_object_id_t id, tai_object_id_t *real_id, S_Adapter *adapter) const {
+                auto& shard = m_forward[forward_shard(id)];
+                std::shared_lock<std::shared_mutex> lk(shard.mutex);
+                auto it = shard.map.find(id);
+                if ( it == shard.map.end() ) {
+                    return false;
+                }
+                if ( real_id != nullptr ) {
+                    *real_id = it->second.real_id;
+                }
+                if ( adapter != nullptr ) {
+                    *adapter = it->second.adapter;
+                }
+                return true;
+            }
+
+            tai_object_id_t find_reverse(tai_object_id_t real_id, const Adapter* adapter) const {
+                auto key = ReverseKey{adapter, real_id};
+                auto& shard = m_reverse[reverse_shard(key)];
+                std::shared_lock<std::shared_mutex> lk(shard.mutex);
+                auto it = shard.map.find(key);
+                if ( it == shard.map.end() ) {
+                    return TAI_NULL_OBJECT_ID;
+                }
+                return it->second;
+            }
+
+            bool insert(tai_object_id_t id, const S_Adapter& adapter, tai_object_id_t real_id) {
+                auto key = ReverseKey{adapter.get(), real_id};
+                {
+                    auto& shard = m_reverse[reverse_shard(key)];
+                    std::unique_lock<std::shared_mutex> lk(shard.mutex);
+                    if ( !shard.map.emplace(key, id).second ) {
+                        return false;
+                    }
+                }
+                auto& shard = m_forward[forward_shard(id)];
+                std::unique_lock<std::shared_mutex> lk(shard.mutex);
+                if ( !shard.map.emplace(id, Entry{real_id, adapter}).second ) {
+                    lk.unlock();
+                    auto& r = m_reverse[reverse_shard(key)];
+                    std::unique_lock<std::shared_mutex> rlk(r.mutex);
+                    r.map.erase(key);
+                    return false;
+                }
+                return true;
+            }
+
+            bool erase(tai_object_id_t id) {
+                Entry entry;
+                {
+                    auto& shard = m_forward[forward_shard(id)];
+                    std::unique_lock<std::shared_mutex> lk(shard.mutex);
+                    auto it = shard.map.find(id);
+                    if ( it == shard.map.end() ) {
+                        return false;
+                    }
+                    entry = std::move(it->second);
+                    shard.map.erase(it);
+                }
+                auto key = ReverseKey{entry.adapter.get(), entry.real_id};
+                auto& shard = m_reverse[reverse_shard(key)];
+                std::unique_lock<std::shared_mutex> lk(shard.mutex);
+                shard.map.erase(key);
+                return true;
+            }
+
+            size_t size() const {
+                size_t size = 0;
+                for ( auto& shard : m_forward ) {
+                    std::shared_lock<std::shared_mutex> lk(shard.mutex);
+                    size += shard.map.size();
+                }
+                return size;
+            }
+
+        private:
+            struct Entry {
+                tai_object_id_t real_id;
+                S_Adapter adapter;
+            };
+
+            struct ReverseKey {
+                const Adapter* adapter;
+                tai_object_id_t real_id;
+                bool operator==(const ReverseKey& rhs) const {
+                    return adapter == rhs.adapter && real_id == rhs.real_id;
+                }
+            };
+
+            struct ReverseKeyHash {
+                size_t operator()(const ReverseKey& k) const {
+                    auto h = std::hash<const Adapter*>()(k.adapter);
+                    return h ^ (std::hash<tai_object_id_t>()(k.real_id) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+                }
+            };
+
+            template<typename K, typename V, typename H = std::hash<K>>
+            struct Shard {
+                mutable std::shared_mutex mutex;
+                std::unordered_map<K, V, H> map;
+            };
+
+            // mix the bits so that sequential OIDs and aligned pointers spread over all shards
+            static size_t mix(uint64_t v) {
+                v ^= v >> 33;
+                v *= 0xff51afd7ed558ccdULL;
+                v ^= v >> 33;
+                return static_cast<size_t>(v % TAI_MUX_OID_MAP_NUM_SHARDS);
+            }
+
+            static size_t forward_shard(tai_object_id_t id) {
+                return mix(id);
+            }
+
+            static size_t reverse_shard(const ReverseKey& key) {
+                return mix(ReverseKeyHash()(key));
+            }
+
+            std::array<Shard<tai_object_id_t, Entry>, TAI_MUX_OID_MAP_NUM_SHARDS> m_forward;
+            std::array<Shard<ReverseKey, tai_object_id_t, ReverseKeyHash>, TAI_MUX_OID_MAP_NUM_SHARDS> m_reverse;
+    };
+
+};
+
+#endif
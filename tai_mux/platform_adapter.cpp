@@ -1,47 +1,171 @@
 #include "platform_adapter.hpp"
 #include "module_adapter.hpp"
+#include "small_vector.hpp"
+#include "epoch_reclaimer.hpp"
+#include "taimetadata.h"
 #include <algorithm>
+#include <cstdlib>
 #include <cstring>
 
 namespace tai::mux {
 
+    // the notification contexts are retired here instead of being freed. it is
+    // shared by the PlatformAdapters since the callback can't reach the
+    // PlatformAdapter of a context before it is in a critical section.
+    // it is never destroyed, the threads of a TAI library may outlive us, but
+    // its thread is stopped when libtai-mux.so is unloaded
+    static EpochReclaimer& reclaimer() {
+        static EpochReclaimer* r = [] {
+            auto grace = TAI_MUX_DEFAULT_NOTIFICATION_GRACE_PERIOD_MS;
+            auto e = std::getenv(TAI_MUX_NOTIFICATION_GRACE_PERIOD_MS.c_str());
+            if ( e != nullptr && std::atoi(e) >= 0 ) {
+                grace = std::atoi(e);
+            }
+            return new EpochReclaimer(std::chrono::milliseconds(grace));
+        }();
+        return *r;
+    }
+
+    __attribute__((destructor)) static void stop_reclaimer() {
+        reclaimer().stop();
+    }
+
+    // disabled first, so that a callback which got the context before it was
+    // retired and enters after the guards were checked does nothing
+    static void retire(S_NotificationContext&& n) {
+        n->disable();
+        reclaimer().retire(std::move(n));
+    }
+
     static void notification_callback(void* context, tai_object_id_t oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
         if ( context == nullptr || attr_list == nullptr ) {
             return;
         }
+        EpochReclaimer::Guard g(reclaimer());
         auto ctx = static_cast<NotificationContext*>(context);
-        if ( ctx->pa != nullptr ) {
-            ctx->pa->notify(ctx, oid, attr_count, attr_list);
+        auto pa = ctx->pa.load(std::memory_order_acquire);
+        if ( pa != nullptr ) {
+            pa->notify(ctx, oid, attr_count, attr_list);
         }
     }
 
+    static bool has_oid(const tai_attr_metadata_t* const meta) {
+        return has_oid(meta->attrvaluetype);
+    }
+
+    // attributes without OIDs are passed to the host as they are. when every
+    // attribute is like that the vendor's list itself is forwarded. otherwise
+    // the list is rebuilt in the scratch buffers of the context: entries are
+    // shallow copies pointing to the vendor's buffers, and only the OID
+    // carrying values get storage of their own to hold the translated OIDs.
     void PlatformAdapter::notify(NotificationContext* ctx, tai_object_id_t real_oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
         auto oid = ctx->muxed_oid;
-        std::vector<S_Attribute> attrs;
         S_ModuleAdapter adapter;
         auto ret = get_mapping(oid, &adapter, nullptr);
         if ( ret < 0 ) {
             return;
         }
-        for (int i = 0; i < static_cast<int>(attr_count); i++) {
-            auto src = attr_list[i];
-            tai_metadata_key_t key{.oid=real_oid};
-            auto meta = adapter->get_attr_metadata(&key, src.id);
+
+        std::unique_lock<std::mutex> lk(ctx->mutex);
+        auto& scratch = ctx->scratch;
+        scratch.metas.resize(attr_count);
+
+        bool passthrough = true;
+        size_t num_oids = 0, num_maps = 0;
+        for (uint32_t i = 0; i < attr_count; i++) {
+            auto& src = attr_list[i];
+            auto meta = adapter->get_attr_metadata(ctx->object_type, src.id);
+            scratch.metas[i] = meta;
+            if ( m_attr_cache ) {
+                m_attr_cache->invalidate(oid, src.id);
+            }
+            if ( meta == nullptr ) {
+                passthrough = false;
+                continue;
+            }
+            if ( !has_oid(meta) ) {
+                continue;
+            }
+            passthrough = false;
+            if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJLIST ) {
+                num_oids += src.value.objlist.count;
+            } else if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                num_maps += src.value.objmaplist.count;
+                for (uint32_t j = 0; j < src.value.objmaplist.count; j++) {
+                    num_oids += src.value.objmaplist.list[j].value.count;
+                }
+            }
+        }
+
+        if ( passthrough ) {
+            deliver(ctx, oid, attr_count, attr_list, scratch.metas.data());
+            return;
+        }
+
+        // size the buffers up front, the translated lists point into them
+        scratch.attrs.clear();
+        scratch.attrs.reserve(attr_count);
+        scratch.attr_metas.clear();
+        if ( scratch.oids.size() < num_oids ) {
+            scratch.oids.resize(num_oids);
+        }
+        if ( scratch.maps.size() < num_maps ) {
+            scratch.maps.resize(num_maps);
+        }
+        auto oids = scratch.oids.data();
+        auto maps = scratch.maps.data();
+
+        for (uint32_t i = 0; i < attr_count; i++) {
+            auto& src = attr_list[i];
+            auto meta = scratch.metas[i];
             if ( meta == nullptr ) {
                 continue;
             }
-            auto dst = std::make_shared<Attribute>(meta, src);
-            auto ret = convert_oid(ctx->object_type, oid, dst, dst, true);
+            scratch.attrs.emplace_back(src);
+            scratch.attr_metas.emplace_back(meta);
+            if ( !has_oid(meta) ) {
+                continue;
+            }
+            auto& dst = scratch.attrs.back();
+            if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJLIST ) {
+                dst.value.objlist.list = oids;
+                oids += src.value.objlist.count;
+            } else if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                dst.value.objmaplist.list = maps;
+                for (uint32_t j = 0; j < src.value.objmaplist.count; j++) {
+                    maps[j].value.count = src.value.objmaplist.list[j].value.count;
+                    maps[j].value.list = oids;
+                    oids += maps[j].value.count;
+                }
+                maps += src.value.objmaplist.count;
+            }
+            auto ret = convert_oid(ctx->object_type, oid, adapter, meta, &src, &dst, true);
             if ( ret != TAI_STATUS_SUCCESS ) {
                 TAI_ERROR("failed to convert oid of attribute: %d", src.id);
-                continue;
+                scratch.attrs.pop_back();
+                scratch.attr_metas.pop_back();
             }
-            attrs.emplace_back(dst);
         }
-        std::vector<tai_attribute_t> raw_attrs;
-        std::transform(attrs.begin(), attrs.end(), std::back_inserter(raw_attrs), [](S_Attribute a) { return *a->raw(); });
-        std::unique_lock<std::mutex> lk(ctx->mutex);
-        ctx->real_handler.notify(ctx->real_handler.context, oid, raw_attrs.size(), raw_attrs.data());
+        deliver(ctx, oid, scratch.attrs.size(), scratch.attrs.data(), scratch.attr_metas.data());
+    }
+
+    void PlatformAdapter::deliver(NotificationContext* ctx, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas) {
+        auto handler = ctx->handler();
+        if ( handler.notify == nullptr ) {
+            return;
+        }
+        if ( m_limiter && !m_limiter->admit(ctx->notify_id, handler, oid, count, attrs, metas) ) {
+            return;
+        }
+        dispatch(ctx->notify_id, handler, oid, count, attrs, metas);
+    }
+
+    void PlatformAdapter::dispatch(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas) {
+        if ( m_dispatcher ) {
+            m_dispatcher->enqueue(notify_id, handler, oid, count, attrs, metas);
+            return;
+        }
+        handler.notify(handler.context, oid, count, attrs);
     }
 
     tai_status_t PlatformAdapter::convert_oid(const tai_object_type_t& type, const tai_object_id_t& id, const S_ConstAttribute src, const S_Attribute dst, bool reversed) {
@@ -49,17 +173,20 @@ namespace tai::mux {
     }
 
     tai_status_t PlatformAdapter::convert_oid(const tai_object_type_t& type, const tai_object_id_t& id, const tai_attribute_t * const src, tai_attribute_t * const dst, bool reversed) {
-        const tai_object_map_list_t *oml;
         S_ModuleAdapter adapter;
-        tai_object_id_t real_id;
-        if ( get_mapping(id, &adapter, &real_id) != 0 ) {
+        if ( get_mapping(id, &adapter, nullptr) != 0 ) {
             return TAI_STATUS_FAILURE;
         }
-        tai_metadata_key_t key{.oid=real_id};
-        auto meta = adapter->get_attr_metadata(&key, src->id);
+        auto meta = adapter->get_attr_metadata(type, src->id);
         if ( meta == nullptr ) {
             return TAI_STATUS_FAILURE;
         }
+        return convert_oid(type, id, adapter, meta, src, dst, reversed);
+    }
+
+    tai_status_t PlatformAdapter::convert_oid(const tai_object_type_t& type, const tai_object_id_t& id, const S_ModuleAdapter& adapter, const tai_attr_metadata_t* const meta, const tai_attribute_t * const src, tai_attribute_t * const dst, bool reversed) {
+        LatencyTimer t(adapter->latency(), LatencyApi::CONVERT_OID, type);
+        const tai_object_map_list_t *oml;
 
         auto convert = [&](tai_object_id_t s) -> tai_object_id_t {
             if ( reversed ) {
@@ -106,30 +233,41 @@ namespace tai::mux {
             {
                 auto key = notification_key(id, src->id);
                 if ( reversed ) {
-                    if ( m_notification_map.find(key) != m_notification_map.end() ) {
-                        auto n = m_notification_map[key];
-                        dst->value.notification.context = n->real_handler.context;
-                        dst->value.notification.notify = n->real_handler.notify;
+                    S_NotificationContext n;
+                    {
+                        std::shared_lock<std::shared_mutex> lk(m_notification_mutex);
+                        auto it = m_notification_map.find(key);
+                        if ( it != m_notification_map.end() ) {
+                            n = it->second;
+                        }
+                    }
+                    if ( n ) {
+                        dst->value.notification = n->handler();
                     }
                     break;
                 }
 
                 if ( src->value.notification.notify != nullptr ) {
-                    if ( m_notification_map.find(key) == m_notification_map.end() ) {
-                        m_notification_map[key] = std::make_shared<NotificationContext>();
+                    S_NotificationContext n;
+                    {
+                        std::unique_lock<std::shared_mutex> lk(m_notification_mutex);
+                        auto& v = m_notification_map[key];
+                        if ( !v ) {
+                            v = std::make_shared<NotificationContext>();
+                        }
+                        n = v;
                     }
-                    auto n = m_notification_map[key];
-                    std::unique_lock<std::mutex> lk(n->mutex);
+                    std::unique_lock<std::mutex> lk(n->handler_mutex);
                     n->pa = this;
                     n->real_handler = src->value.notification;
                     n->muxed_oid = id;
                     n->object_type = type;
+                    n->notify_id = src->id;
                     dst->value.notification.context = static_cast<void*>(n.get());
                     dst->value.notification.notify = notification_callback;
                 } else {
-                    // notification context cleanup can't be handled here since the callback can still get
-                    // called by the underneath TAI library.
-                    // we'll clean the context after disabling the callback
+                    // the context is retired by forward_set() once the TAI
+                    // library has disabled the callback
                 }
             }
         default:
@@ -138,27 +276,72 @@ namespace tai::mux {
         return TAI_STATUS_SUCCESS;
     }
 
-    tai_status_t PlatformAdapter::get(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_t* const attrs) {
+    tai_status_t PlatformAdapter::forward_get(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_t* const attrs) {
         S_ModuleAdapter adapter;
         tai_object_id_t real_id;
         if ( get_mapping(id, &adapter, &real_id) != 0 ) {
             return TAI_STATUS_FAILURE;
         }
+        // the request is served from the cache only when every attribute is
+        // cached. otherwise the whole request goes to the TAI library
+        std::vector<uint64_t> generations;
+        if ( m_attr_cache && count > 0 ) {
+            std::vector<tai_attribute_value_t> values(count);
+            generations.resize(count);
+            uint32_t hits = 0;
+            {
+                // keeps remove_mapping() from discarding the cache of the
+                // object before get() has looked it up
+                std::shared_lock<std::shared_mutex> lk(m_oid_mutex);
+                if ( !m_oid_allocator.is_valid(id) ) {
+                    return TAI_STATUS_FAILURE;
+                }
+                for ( uint32_t i = 0; i < count; i++ ) {
+                    values[i] = attrs[i].value;
+                    auto meta = adapter->get_attr_metadata(type, attrs[i].id);
+                    if ( meta != nullptr && m_attr_cache->get(id, meta, &attrs[i], &generations[i]) ) {
+                        hits++;
+                    }
+                }
+            }
+            m_attr_cache->record(hits, count);
+            if ( hits == count ) {
+                return TAI_STATUS_SUCCESS;
+            }
+            for ( uint32_t i = 0; i < count; i++ ) {
+                attrs[i].value = values[i];
+            }
+        }
         auto ret = adapter->get_attributes(type, real_id, count, attrs);
         if ( ret != TAI_STATUS_SUCCESS ) {
             return ret;
         }
+        // attributes known to carry no OIDs are returned without looking up
+        // their metadata, unless it is needed by the cache
+        if ( !m_attr_cache && adapter->none_has_oid(type, count, attrs) ) {
+            return TAI_STATUS_SUCCESS;
+        }
         for (int i = 0; i < static_cast<int>(count); i++ ) {
             auto attribute = &attrs[i];
-            auto ret = convert_oid(type, id, attribute, attribute, true);
+            if ( !m_attr_cache && adapter->oid_class(type, attribute->id) == OIDClass::NONE ) {
+                continue;
+            }
+            auto meta = adapter->get_attr_metadata(type, attribute->id);
+            if ( meta == nullptr ) {
+                return TAI_STATUS_FAILURE;
+            }
+            auto ret = convert_oid(type, id, adapter, meta, attribute, attribute, true);
             if ( ret != TAI_STATUS_SUCCESS ) {
                 return ret;
             }
+            if ( m_attr_cache ) {
+                m_attr_cache->put(id, generations[i], meta, attribute);
+            }
         }
         return TAI_STATUS_SUCCESS;
     }
 
-    tai_status_t PlatformAdapter::get_capability(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_capability_t* const caps) {
+    tai_status_t PlatformAdapter::forward_get_capability(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_capability_t* const caps) {
         S_ModuleAdapter adapter;
         tai_object_id_t real_id;
         if ( get_mapping(id, &adapter, &real_id) != 0 ) {
@@ -167,46 +350,200 @@ namespace tai::mux {
         return adapter->get_capabilities(type, real_id, count, caps);
     }
 
-    tai_status_t PlatformAdapter::set(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, const tai_attribute_t* const attrs) {
+    tai_status_t PlatformAdapter::forward_set(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, const tai_attribute_t* const attrs) {
         S_ModuleAdapter adapter;
         tai_object_id_t real_id;
         if ( get_mapping(id, &adapter, &real_id) != 0 ) {
             return TAI_STATUS_FAILURE;
         }
-        std::vector<S_Attribute> ptrs;
-        std::vector<tai_attribute_t> inputs;
-        std::vector<notification_key> keys_to_remove;
+        // nothing to translate, the host's list is passed to the library as it is
+        if ( adapter->none_has_oid(type, count, attrs) ) {
+            auto ret = adapter->set_attributes(type, real_id, count, attrs);
+            // setting an attribute may change others of the object
+            if ( m_attr_cache ) {
+                m_attr_cache->invalidate(id);
+            }
+            return ret;
+        }
 
-        for (int i = 0; i < static_cast<int>(count); i++ ) {
-            auto attribute = &attrs[i];
-            tai_metadata_key_t key{.oid=real_id};
-            auto meta = adapter->get_attr_metadata(&key, attribute->id);
+        // entries are shallow copies of the host's attributes, which keep
+        // pointing to its lists. only the values carrying OIDs get storage of
+        // their own to hold the translated OIDs
+        SmallVector<const tai_attr_metadata_t*, TAI_MUX_SET_INLINE_ATTRS> metas(count);
+        std::vector<notification_key> keys_to_remove;
+        std::vector<tai_attr_id_t> notify_ids;
+        size_t num_oids = 0, num_maps = 0;
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto& src = attrs[i];
+            if ( adapter->oid_class(type, src.id) == OIDClass::NONE ) {
+                continue;
+            }
+            auto meta = adapter->get_attr_metadata(type, src.id);
             if ( meta == nullptr ) {
                 return TAI_STATUS_FAILURE;
             }
-            auto attr = std::make_shared<Attribute>(meta, attribute);
-            ptrs.emplace_back(attr); // just for memory management
-            auto ret = convert_oid(type, id, attribute, const_cast<tai_attribute_t* const>(attr->raw()), false);
+            metas[i] = meta;
+            if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJLIST ) {
+                num_oids += src.value.objlist.count;
+            } else if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                num_maps += src.value.objmaplist.count;
+                for ( uint32_t j = 0; j < src.value.objmaplist.count; j++ ) {
+                    num_oids += src.value.objmaplist.list[j].value.count;
+                }
+            }
+        }
+
+        SmallVector<tai_attribute_t, TAI_MUX_SET_INLINE_ATTRS> inputs(count);
+        SmallVector<tai_object_id_t, TAI_MUX_SET_INLINE_OIDS> oid_buf(num_oids);
+        SmallVector<tai_object_map_t, TAI_MUX_SET_INLINE_ATTRS> map_buf(num_maps);
+        auto oids = oid_buf.data();
+        auto maps = map_buf.data();
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto& src = attrs[i];
+            auto meta = metas[i];
+            inputs[i] = src;
+            if ( meta == nullptr || !has_oid(meta) ) {
+                continue;
+            }
+            auto& dst = inputs[i];
+            if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJLIST ) {
+                dst.value.objlist.list = oids;
+                oids += src.value.objlist.count;
+            } else if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_OBJMAPLIST ) {
+                dst.value.objmaplist.list = maps;
+                for ( uint32_t j = 0; j < src.value.objmaplist.count; j++ ) {
+                    maps[j].value.count = src.value.objmaplist.list[j].value.count;
+                    maps[j].value.list = oids;
+                    oids += maps[j].value.count;
+                }
+                maps += src.value.objmaplist.count;
+            }
+            auto ret = convert_oid(type, id, adapter, meta, &src, &dst, false);
             if ( ret != TAI_STATUS_SUCCESS ) {
                 return ret;
             }
-            inputs.emplace_back(*attr->raw());
-            if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_NOTIFICATION && attribute->value.notification.notify == nullptr ) {
-                keys_to_remove.emplace_back(notification_key(id, attribute->id));
+            if ( meta->attrvaluetype == TAI_ATTR_VALUE_TYPE_NOTIFICATION ) {
+                notify_ids.emplace_back(src.id);
+                if ( src.value.notification.notify == nullptr ) {
+                    keys_to_remove.emplace_back(notification_key(id, src.id));
+                }
             }
         }
 
-        auto ret = adapter->set_attributes(type, real_id, inputs.size(), inputs.data());
+        auto ret = adapter->set_attributes(type, real_id, count, inputs.data());
+        // setting an attribute may change others of the object
+        if ( m_attr_cache ) {
+            m_attr_cache->invalidate(id);
+        }
         if ( ret != TAI_STATUS_SUCCESS ) {
             return ret;
         }
+        // what is held back or queued was meant for the previous handler
+        for ( auto notify_id : notify_ids ) {
+            if ( m_limiter ) {
+                m_limiter->forget(id, notify_id);
+            }
+            if ( m_dispatcher ) {
+                m_dispatcher->forget(id, notify_id);
+            }
+        }
 
-        for ( auto& key : keys_to_remove ) {
-            m_notification_map.erase(key);
+        std::vector<S_NotificationContext> retired;
+        {
+            std::unique_lock<std::shared_mutex> lk(m_notification_mutex);
+            for ( auto& key : keys_to_remove ) {
+                auto it = m_notification_map.find(key);
+                if ( it != m_notification_map.end() ) {
+                    retired.emplace_back(std::move(it->second));
+                    m_notification_map.erase(it);
+                }
+            }
+        }
+        for ( auto& n : retired ) {
+            retire(std::move(n));
         }
         return TAI_STATUS_SUCCESS;
     }
 
+    void PlatformAdapter::retire_notifications(tai_object_id_t id) {
+        std::vector<S_NotificationContext> retired;
+        {
+            std::unique_lock<std::shared_mutex> lk(m_notification_mutex);
+            auto begin = m_notification_map.lower_bound(notification_key(id, 0));
+            auto it = begin;
+            for ( ; it != m_notification_map.end() && it->first.first == id; it++ ) {
+                retired.emplace_back(std::move(it->second));
+            }
+            m_notification_map.erase(begin, it);
+        }
+        for ( auto& n : retired ) {
+            retire(std::move(n));
+        }
+    }
+
+    PlatformAdapter::~PlatformAdapter() {
+        // a TAI library which is still loaded may call back with them
+        for ( auto& v : m_notification_map ) {
+            retire(std::move(v.second));
+        }
+        // the callbacks which already got here are using this
+        reclaimer().synchronize();
+    }
+
+    tai_status_t PlatformAdapter::get(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_t* const attrs) {
+        if ( !m_trace ) {
+            return forward_get(type, id, count, attrs);
+        }
+        auto start = TraceWriter::clock::now();
+        auto ret = forward_get(type, id, count, attrs);
+        trace(TraceApi::GET, type, id, TAI_NULL_OBJECT_ID, ret, start, count, attrs);
+        return ret;
+    }
+
+    tai_status_t PlatformAdapter::set(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, const tai_attribute_t* const attrs) {
+        if ( !m_trace ) {
+            return forward_set(type, id, count, attrs);
+        }
+        auto start = TraceWriter::clock::now();
+        auto ret = forward_set(type, id, count, attrs);
+        trace(TraceApi::SET, type, id, TAI_NULL_OBJECT_ID, ret, start, count, attrs);
+        return ret;
+    }
+
+    tai_status_t PlatformAdapter::get_capability(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_capability_t* const caps) {
+        if ( !m_trace ) {
+            return forward_get_capability(type, id, count, caps);
+        }
+        auto start = TraceWriter::clock::now();
+        auto ret = forward_get_capability(type, id, count, caps);
+        std::vector<tai_attribute_t> attrs(count);
+        for ( uint32_t i = 0; i < count; i++ ) {
+            attrs[i].id = caps[i].id;
+        }
+        trace(TraceApi::GET_CAPABILITIES, type, id, TAI_NULL_OBJECT_ID, ret, start, count, attrs.data());
+        return ret;
+    }
+
+    void PlatformAdapter::trace(TraceApi api, tai_object_type_t type, tai_object_id_t oid, tai_object_id_t module_id, tai_status_t status, TraceWriter::clock::time_point start, uint32_t count, const tai_attribute_t* const attrs) {
+        if ( !m_trace ) {
+            return;
+        }
+        S_ModuleAdapter adapter;
+        if ( get_mapping(oid, &adapter, nullptr) != 0 ) {
+            get_mapping(module_id, &adapter, nullptr);
+        }
+        std::vector<tai_attr_value_type_t> types(count, TAI_ATTR_VALUE_TYPE_UNSPECIFIED);
+        if ( api != TraceApi::GET_CAPABILITIES ) {
+            for ( uint32_t i = 0; i < count; i++ ) {
+                auto meta = adapter ? adapter->get_attr_metadata(type, attrs[i].id) : tai_metadata_get_attr_metadata(type, attrs[i].id);
+                if ( meta != nullptr ) {
+                    types[i] = meta->attrvaluetype;
+                }
+            }
+        }
+        m_trace->write(api, type, oid, module_id, status, start, count, attrs, types.data());
+    }
+
     tai_status_t PlatformAdapter::get_mux_attribute(const tai_object_type_t& type, const tai_object_id_t& id, tai_attribute_t* const attr) {
         S_ModuleAdapter adapter;
         tai_object_id_t real_id;
@@ -233,6 +570,47 @@ namespace tai::mux {
             case TAI_MODULE_ATTR_MUX_REAL_OID:
                 attr->value.oid = real_id;
                 break;
+            case TAI_MODULE_ATTR_MUX_LATENCY_STATS:
+                {
+                    auto n = adapter->latency() ? adapter->latency()->to_json() : std::string("{}");
+                    auto v = attr->value.charlist.count;
+                    attr->value.charlist.count = n.size() + 1;
+                    if ( v < (n.size() + 1) ) {
+                        return TAI_STATUS_BUFFER_OVERFLOW;
+                    }
+                    std::strncpy(attr->value.charlist.list, n.c_str(), v);
+                    break;
+                }
+            case TAI_MODULE_ATTR_MUX_METADATA_CACHE_HIT:
+                attr->value.u64 = adapter->metadata_cache_hit();
+                break;
+            case TAI_MODULE_ATTR_MUX_METADATA_CACHE_MISS:
+                attr->value.u64 = adapter->metadata_cache_miss();
+                break;
+            case TAI_MODULE_ATTR_MUX_NOTIFICATION_QUEUE_DEPTH:
+                attr->value.u64 = m_dispatcher ? m_dispatcher->depth() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_NOTIFICATION_DROPPED:
+                attr->value.u64 = m_dispatcher ? m_dispatcher->dropped() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_NOTIFICATION_COALESCED:
+                attr->value.u64 = m_dispatcher ? m_dispatcher->coalesced() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_HIT:
+                attr->value.u64 = m_attr_cache ? m_attr_cache->hit() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_MISS:
+                attr->value.u64 = m_attr_cache ? m_attr_cache->miss() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_ATTRIBUTE_CACHE_PARTIAL_HIT:
+                attr->value.u64 = m_attr_cache ? m_attr_cache->partial_hit() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_NOTIFICATION_SUPPRESSED:
+                attr->value.u64 = m_limiter ? m_limiter->suppressed() : 0;
+                break;
+            case TAI_MODULE_ATTR_MUX_NOTIFICATION_CONTEXTS_PENDING:
+                attr->value.u64 = reclaimer().pending();
+                break;
             default:
                 return TAI_STATUS_ATTR_NOT_SUPPORTED_0;
             }
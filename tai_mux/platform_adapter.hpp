@@ -4,15 +4,24 @@
 #include <string>
 #include <unordered_set>
 #include <memory>
-#include <bitset>
+#include <vector>
+#include <deque>
+#include <stdexcept>
 #include <map>
+#include <atomic>
 #include <mutex>
+#include <shared_mutex>
 
 #include "tai.h"
 #include "attribute.hpp"
 #include "logger.hpp"
 
 #include "fsm.hpp"
+#include "oid_map.hpp"
+#include "notification_dispatcher.hpp"
+#include "notification_limiter.hpp"
+#include "attribute_cache.hpp"
+#include "trace.hpp"
 
 namespace tai::mux {
 
@@ -24,84 +33,195 @@ namespace tai::mux {
 
     using notification_key = std::pair<tai_object_id_t, tai_attr_id_t>;
 
+    // buffers reused by every notification forwarded through one context
+    // so that the notification path doesn't allocate once they are warmed up
+    struct NotificationScratch {
+        std::vector<const tai_attr_metadata_t*> metas;
+        std::vector<tai_attribute_t> attrs;
+        std::vector<const tai_attr_metadata_t*> attr_metas; // metadata of attrs, for asynchronous dispatch
+        std::vector<tai_object_id_t> oids;
+        std::vector<tai_object_map_t> maps;
+    };
+
     struct NotificationContext {
-        PlatformAdapter *pa;
+        std::atomic<PlatformAdapter*> pa {nullptr}; // null once it is retired
         tai_notification_handler_t real_handler;
         tai_object_id_t muxed_oid;
         tai_object_type_t object_type;
-        std::mutex mutex;
+        tai_attr_id_t notify_id; // the notification attribute of the object
+        std::mutex handler_mutex; // guards real_handler, never held while taking another lock
+        std::mutex mutex; // serializes delivery through this context and guards scratch
+        NotificationScratch scratch;
+
+        tai_notification_handler_t handler() {
+            std::unique_lock<std::mutex> lk(handler_mutex);
+            return real_handler;
+        }
+
+        // a callback of the TAI library coming after this doesn't reach the
+        // PlatformAdapter nor the handler of the host
+        void disable() {
+            std::unique_lock<std::mutex> lk(handler_mutex);
+            real_handler.notify = nullptr;
+            real_handler.context = nullptr;
+            pa.store(nullptr, std::memory_order_release);
+        }
     };
 
     using S_NotificationContext = std::shared_ptr<NotificationContext>;
 
-    static const int TAI_MUX_NUM_MAX_OBJECT = 256;
+    // layout of a muxed OID
+    //
+    // | 63 .. 48    | 47 .. 32   | 31 .. 0 |
+    // | object type | generation | index   |
+    //
+    // the generation of an index is bumped every time it is freed so a stale
+    // OID of a removed object never aliases a newly created object
+    const uint8_t OBJECT_TYPE_SHIFT = 48;
+    const uint8_t GENERATION_SHIFT = 32;
+
+    static const uint32_t TAI_MUX_NUM_MAX_OBJECT = 1 << 20;
+
+    // a freed index is not handed out again until this many indices are waiting
+    // in the free list. together with the generation this keeps late
+    // notifications for removed objects from being routed to new objects
+    static const uint32_t TAI_MUX_OID_REUSE_DELAY = 64;
+
+    // sets with up to this many attributes and OIDs to translate are
+    // forwarded without allocating
+    static const size_t TAI_MUX_SET_INLINE_ATTRS = 16;
+    static const size_t TAI_MUX_SET_INLINE_OIDS = 32;
 
     class OIDAllocator {
         public:
-            tai_object_id_t next() {
-                // TAI_NULL_OBJECT_ID == 0, start from i = 1
-                for (int i = 1; i < TAI_MUX_NUM_MAX_OBJECT; i++) {
-                    if ( !m_bitset.test(i) ) {
-                        m_bitset.set(i);
-                        return tai_object_id_t(i);
-                    }
+            tai_object_id_t next(tai_object_type_t type) {
+                uint32_t index;
+                if ( m_free.size() > TAI_MUX_OID_REUSE_DELAY || ( m_slots.size() >= TAI_MUX_NUM_MAX_OBJECT && !m_free.empty() ) ) {
+                    index = m_free.front();
+                    m_free.pop_front();
+                } else if ( m_slots.size() < TAI_MUX_NUM_MAX_OBJECT ) {
+                    index = m_slots.size();
+                    m_slots.emplace_back();
+                } else {
+                    throw std::runtime_error("OID max reach");
                 }
-                throw std::runtime_error("OID max reach");
+                auto& slot = m_slots[index];
+                slot.used = true;
+                slot.type = type;
+                return encode(type, slot.generation, index);
             }
+
             void free(tai_object_id_t oid) {
-                m_bitset.reset(oid);
+                if ( !is_valid(oid) ) {
+                    return;
+                }
+                auto index = index_of(oid);
+                auto& slot = m_slots[index];
+                slot.used = false;
+                slot.generation++;
+                m_free.push_back(index);
             }
+
+            bool is_valid(tai_object_id_t oid) const {
+                auto index = index_of(oid);
+                if ( index >= m_slots.size() ) {
+                    return false;
+                }
+                auto& slot = m_slots[index];
+                return slot.used && slot.generation == generation_of(oid) && slot.type == object_type(oid);
+            }
+
+            static tai_object_type_t object_type(tai_object_id_t oid) {
+                return static_cast<tai_object_type_t>(oid >> OBJECT_TYPE_SHIFT);
+            }
+
+            static uint32_t index_of(tai_object_id_t oid) {
+                return static_cast<uint32_t>(oid);
+            }
+
         private:
-            std::bitset<TAI_MUX_NUM_MAX_OBJECT> m_bitset;
+            struct Slot {
+                uint16_t generation = 0;
+                tai_object_type_t type = TAI_OBJECT_TYPE_NULL;
+                bool used = false;
+            };
+
+            static tai_object_id_t encode(tai_object_type_t type, uint16_t generation, uint32_t index) {
+                return static_cast<tai_object_id_t>(uint64_t(type) << OBJECT_TYPE_SHIFT | uint64_t(generation) << GENERATION_SHIFT | index);
+            }
+
+            static uint16_t generation_of(tai_object_id_t oid) {
+                return static_cast<uint16_t>(oid >> GENERATION_SHIFT);
+            }
+
+            std::vector<Slot> m_slots;
+            std::deque<uint32_t> m_free;
     };
 
     class PlatformAdapter {
         public:
+            // the returned library is acquired, see ModuleAdapter::acquire(). the
+            // caller releases it, usually with a ModuleAdapterGuard
             virtual S_ModuleAdapter get_module_adapter(const std::string& location) = 0;
 
             /** @brief return the set of loaded module adapters. */
             virtual const std::unordered_set<S_ModuleAdapter> list_module_adapters() = 0;
-            PlatformAdapter(){}
-            virtual ~PlatformAdapter(){}
+            PlatformAdapter() : m_dispatcher(NotificationDispatcher::from_env()), m_limiter(NotificationLimiter::from_env([this](tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas) { dispatch(notify_id, handler, oid, count, attrs, metas); })), m_attr_cache(AttributeCache::from_env()), m_trace(TraceWriter::from_env()) {}
+            virtual ~PlatformAdapter();
 
             virtual tai_mux_platform_adapter_type_t type() const = 0;
 
+            // get_mapping(), get_reverse_mapping() and get_object_type() can be called
+            // concurrently from the host thread and the notification threads of the
+            // TAI libraries. they only take reader locks.
             int get_mapping(const tai_object_id_t& id, S_ModuleAdapter *adapter, tai_object_id_t *real_id) {
-                if ( m_map.find(id) == m_map.end() ) {
+                if ( !m_map.find(id, real_id, adapter) ) {
                     return -1;
                 }
-                auto pair = m_map[id];
-                if ( adapter != nullptr ) {
-                    *adapter = pair.second;
-                }
-                if ( real_id != nullptr ) {
-                    *real_id = pair.first;
-                }
                 return 0;
             };
 
-            tai_object_id_t get_reverse_mapping(const tai_object_id_t real_id, S_ModuleAdapter adapter) {
-                for ( auto p : m_map ) {
-                    if ( p.second.first == real_id && p.second.second == adapter ) {
-                        return p.first;
-                    }
+            tai_object_id_t get_reverse_mapping(const tai_object_id_t real_id, const S_ModuleAdapter& adapter) {
+                return m_map.find_reverse(real_id, adapter.get());
+            }
+
+            // muxed OIDs carry their object type, see OIDAllocator
+            tai_object_type_t get_object_type(const tai_object_id_t& id) const {
+                std::shared_lock<std::shared_mutex> lk(m_oid_mutex);
+                if ( !m_oid_allocator.is_valid(id) ) {
+                    return TAI_OBJECT_TYPE_NULL;
                 }
-                return TAI_NULL_OBJECT_ID;
+                return OIDAllocator::object_type(id);
             }
 
-            int create_mapping(tai_object_id_t *id, S_ModuleAdapter adapter, const tai_object_id_t& real_id) {
-                auto value = std::pair<tai_object_id_t, S_ModuleAdapter>(real_id, adapter);
-                *id = m_oid_allocator.next();
-                m_map[*id] = value;
+            int create_mapping(tai_object_id_t *id, tai_object_type_t type, S_ModuleAdapter adapter, const tai_object_id_t& real_id) {
+                std::unique_lock<std::shared_mutex> lk(m_oid_mutex);
+                auto oid = m_oid_allocator.next(type);
+                if ( !m_map.insert(oid, adapter, real_id) ) {
+                    m_oid_allocator.free(oid);
+                    return -1;
+                }
+                *id = oid;
                 return 0;
             }
 
             virtual int remove_mapping(tai_object_id_t id) {
-                if ( m_map.find(id) == m_map.end() ) {
+                std::unique_lock<std::shared_mutex> lk(m_oid_mutex);
+                if ( !m_map.erase(id) ) {
                     return 0;
                 }
-                m_map.erase(id);
                 m_oid_allocator.free(id);
+                if ( m_attr_cache ) {
+                    m_attr_cache->remove(id);
+                }
+                lk.unlock();
+                if ( m_limiter ) {
+                    m_limiter->forget(id);
+                }
+                if ( m_dispatcher ) {
+                    m_dispatcher->forget(id);
+                }
+                retire_notifications(id);
                 return 0;
             }
 
@@ -109,20 +229,54 @@ namespace tai::mux {
 
             tai_status_t convert_oid(const tai_object_type_t& type, const tai_object_id_t& id, const S_ConstAttribute src, const S_Attribute dst, bool reversed);
             tai_status_t convert_oid(const tai_object_type_t& type, const tai_object_id_t& id, const tai_attribute_t * const src, tai_attribute_t * const dst, bool reversed);
+            // meta and adapter must be the ones of src and id
+            tai_status_t convert_oid(const tai_object_type_t& type, const tai_object_id_t& id, const S_ModuleAdapter& adapter, const tai_attr_metadata_t* const meta, const tai_attribute_t * const src, tai_attribute_t * const dst, bool reversed);
 
             tai_status_t get(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_t* const attrs);
             tai_status_t set(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, const tai_attribute_t* const attrs);
             tai_status_t get_capability(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_capability_t* const caps);
 
+            bool tracing() const {
+                return m_trace != nullptr;
+            }
+
+            // records a call to the trace. the metadata of attrs is taken from
+            // the TAI library of oid, or of module_id when oid isn't mapped
+            void trace(TraceApi api, tai_object_type_t type, tai_object_id_t oid, tai_object_id_t module_id, tai_status_t status, TraceWriter::clock::time_point start, uint32_t count, const tai_attribute_t* const attrs);
+
             virtual tai_status_t get_mux_attribute(const tai_object_type_t& type, const tai_object_id_t& oid, tai_attribute_t* const attribute);
             virtual tai_status_t set_mux_attribute(const tai_object_type_t& type, const tai_object_id_t& oid, const tai_attribute_t* const attribute, tai::framework::FSMState* state);
 
         private:
+            tai_status_t forward_get(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_t* const attrs);
+            tai_status_t forward_set(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, const tai_attribute_t* const attrs);
+            tai_status_t forward_get_capability(const tai_object_type_t& type, const tai_object_id_t& id, uint32_t count, tai_attribute_capability_t* const caps);
+
+            // unlinks the notification contexts of a removed object and frees
+            // them once no callback of the TAI library can be using them
+            void retire_notifications(tai_object_id_t id);
+
+            // hands a translated notification to the host, unless m_limiter holds it back
+            void deliver(NotificationContext* ctx, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas);
+            // directly or through m_dispatcher
+            void dispatch(tai_attr_id_t notify_id, const tai_notification_handler_t& handler, tai_object_id_t oid, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_metadata_t* const* metas);
+
             PlatformAdapter(const PlatformAdapter&){}
             void operator = (const PlatformAdapter&){}
+            mutable std::shared_mutex m_oid_mutex; // guards m_oid_allocator
             OIDAllocator m_oid_allocator;
-            std::map<tai_object_id_t, std::pair<tai_object_id_t, S_ModuleAdapter>> m_map;
+            OIDMapping<ModuleAdapter> m_map;
+            std::shared_mutex m_notification_mutex; // guards m_notification_map
             std::map<notification_key, S_NotificationContext> m_notification_map;
+            // null unless asynchronous notification dispatch is enabled
+            std::unique_ptr<NotificationDispatcher> m_dispatcher;
+            // null unless notifications are coalesced or rate limited. declared
+            // after m_dispatcher so that it stops before m_dispatcher is destroyed
+            std::unique_ptr<NotificationLimiter> m_limiter;
+            // null unless the attribute cache is enabled
+            std::unique_ptr<AttributeCache> m_attr_cache;
+            // null unless the calls are recorded
+            std::unique_ptr<TraceWriter> m_trace;
     };
 
     using S_PlatformAdapter = std::shared_ptr<PlatformAdapter>;
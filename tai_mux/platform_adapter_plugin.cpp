@@ -0,0 +1,62 @@
+#include "platform_adapter_plugin.hpp"
+#include "static_platform_adapter.hpp"
+#include "exec_platform_adapter.hpp"
+#include "eeprom_platform_adapter.hpp"
+
+#include <dlfcn.h>
+
+namespace tai::mux {
+
+    static const std::string PLUGIN_PREFIX = "libtai-mux-pa-";
+    static const std::string PLUGIN_SUFFIX = ".so";
+
+    static S_PlatformAdapter load_plugin(const std::string& name, uint64_t flags, const tai_service_method_table_t* services) {
+        auto path = name;
+        auto has_suffix = name.size() >= PLUGIN_SUFFIX.size() && name.compare(name.size() - PLUGIN_SUFFIX.size(), PLUGIN_SUFFIX.size(), PLUGIN_SUFFIX) == 0;
+        if ( !has_suffix ) {
+            path = PLUGIN_PREFIX + name + PLUGIN_SUFFIX;
+        }
+        auto dl = dlopen(path.c_str(), RTLD_NOW);
+        if ( dl == nullptr ) {
+            TAI_ERROR("failed to load the platform adapter %s: %s", path.c_str(), dlerror());
+            return nullptr;
+        }
+        auto version = reinterpret_cast<tai_mux_platform_adapter_version_fn>(dlsym(dl, "tai_mux_platform_adapter_version"));
+        auto create = reinterpret_cast<tai_mux_platform_adapter_create_fn>(dlsym(dl, "tai_mux_platform_adapter_create"));
+        if ( version == nullptr || create == nullptr ) {
+            TAI_ERROR("%s is not a platform adapter plugin", path.c_str());
+            dlclose(dl);
+            return nullptr;
+        }
+        auto v = version();
+        if ( v != TAI_MUX_PLATFORM_ADAPTER_PLUGIN_VERSION ) {
+            TAI_ERROR("%s is built for plugin version %u, expected %u", path.c_str(), v, TAI_MUX_PLATFORM_ADAPTER_PLUGIN_VERSION);
+            dlclose(dl);
+            return nullptr;
+        }
+        auto pa = create(flags, services);
+        if ( pa == nullptr ) {
+            TAI_ERROR("failed to create the platform adapter of %s", path.c_str());
+            dlclose(dl);
+            return nullptr;
+        }
+        TAI_INFO("loaded the platform adapter %s", path.c_str());
+        // the code of the adapter lives in dl, so it is closed after the adapter is gone
+        return S_PlatformAdapter(pa, [dl](PlatformAdapter* p) {
+            delete p;
+            dlclose(dl);
+        });
+    }
+
+    S_PlatformAdapter create_platform_adapter(const std::string& name, uint64_t flags, const tai_service_method_table_t* services) {
+        if ( name == "static" ) {
+            return std::make_shared<StaticPlatformAdapter>(flags, services);
+        } else if ( name == "exec" ) {
+            return std::make_shared<ExecPlatformAdapter>(flags, services);
+        } else if ( name == "eeprom" ) {
+            return std::make_shared<EEPROMPlatformAdapter>(flags, services);
+        }
+        return load_plugin(name, flags, services);
+    }
+
+}
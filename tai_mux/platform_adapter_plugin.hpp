@@ -0,0 +1,53 @@
+#ifndef __PLATFORM_ADAPTER_PLUGIN_HPP__
+#define __PLATFORM_ADAPTER_PLUGIN_HPP__
+
+#include <string>
+
+#include "platform_adapter.hpp"
+#include "tai.h"
+
+// a platform adapter plugin is a shared object which derives a class from
+// tai::mux::PlatformAdapter and exports it with TAI_MUX_PLATFORM_ADAPTER_PLUGIN.
+// it is built against the headers of libtai-mux.so and linked against it, so
+// it can only be loaded by the libtai-mux.so of the same version.
+//
+// class MyPlatformAdapter : public tai::mux::PlatformAdapter {
+//     public:
+//         MyPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services);
+//         ...
+// };
+//
+// TAI_MUX_PLATFORM_ADAPTER_PLUGIN(MyPlatformAdapter)
+
+namespace tai::mux {
+
+    // bumped whenever PlatformAdapter changes in a way plugins can see
+    const uint32_t TAI_MUX_PLATFORM_ADAPTER_PLUGIN_VERSION = 2;
+
+    // 'static', 'exec' and 'eeprom' are built in. any other name is loaded
+    // from libtai-mux-pa-<name>.so, or from name itself when it ends with
+    // '.so'. returns nullptr when the plugin can't be loaded
+    S_PlatformAdapter create_platform_adapter(const std::string& name, uint64_t flags, const tai_service_method_table_t* services);
+
+};
+
+extern "C" {
+    typedef uint32_t (*tai_mux_platform_adapter_version_fn)(void);
+    // returns nullptr on failure
+    typedef tai::mux::PlatformAdapter* (*tai_mux_platform_adapter_create_fn)(uint64_t flags, const tai_service_method_table_t* services);
+}
+
+#define TAI_MUX_PLATFORM_ADAPTER_PLUGIN(T) \
+    extern "C" uint32_t tai_mux_platform_adapter_version(void) { \
+        return tai::mux::TAI_MUX_PLATFORM_ADAPTER_PLUGIN_VERSION; \
+    } \
+    extern "C" tai::mux::PlatformAdapter* tai_mux_platform_adapter_create(uint64_t flags, const tai_service_method_table_t* services) { \
+        try { \
+            return new T(flags, services); \
+        } catch (const std::exception& e) { \
+            TAI_ERROR("failed to create the platform adapter: %s", e.what()); \
+            return nullptr; \
+        } \
+    }
+
+#endif
@@ -0,0 +1,850 @@
+#include "remote_library.hpp"
+#include "small_vector.hpp"
+#include "exception.hpp"
+#include "logger.hpp"
+#include "env_list.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace tai::mux {
+
+    static const size_t TAI_MUX_REMOTE_INLINE_ATTRS = 16;
+    // how long a host process gets to exit before it is killed
+    static const auto TAI_MUX_HOST_EXIT_TIMEOUT = std::chrono::seconds(1);
+    static const auto TAI_MUX_HOST_RESTART_INTERVAL = std::chrono::seconds(1);
+
+    static void signal_fd(int fd) {
+        uint64_t v = 1;
+        while ( write(fd, &v, sizeof(v)) < 0 && errno == EINTR );
+    }
+
+    static void drain_fd(int fd) {
+        uint64_t v;
+        while ( read(fd, &v, sizeof(v)) < 0 && errno == EINTR );
+    }
+
+    static void close_fd(int& fd) {
+        if ( fd >= 0 ) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    bool RemoteLibrary::enabled(const std::string& name) {
+        return env_list_contains(TAI_MUX_ISOLATED_LIBRARIES, name);
+    }
+
+    RemoteLibrary::RemoteLibrary(const std::string& name, uint64_t flags, MetadataLookup metadata) : m_name(name), m_flags(flags), m_metadata(metadata), m_call_timeout(TAI_MUX_DEFAULT_HOST_CALL_TIMEOUT_MS), m_generation(0), m_dead(false), m_stopping(false), m_next_alias(UINT64_MAX) {
+        auto e = std::getenv(TAI_MUX_HOST_CALL_TIMEOUT_MS.c_str());
+        if ( e != nullptr && std::atoi(e) >= 0 ) {
+            m_call_timeout = std::chrono::milliseconds(std::atoi(e));
+        }
+        if ( spawn() != 0 ) {
+            throw Exception(TAI_STATUS_FAILURE);
+        }
+        auto status = initialize();
+        if ( status != TAI_STATUS_SUCCESS ) {
+            teardown();
+            throw Exception(status);
+        }
+        m_supervisor = std::thread(&RemoteLibrary::supervise, this);
+    }
+
+    RemoteLibrary::~RemoteLibrary() {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stopping = true;
+            m_cv.notify_all();
+        }
+        if ( m_supervisor.joinable() ) {
+            m_supervisor.join();
+        }
+        teardown();
+    }
+
+    int RemoteLibrary::spawn() {
+        auto& p = m_process;
+        auto shm = memfd_create(("tai-mux-" + m_name).c_str(), MFD_CLOEXEC);
+        if ( shm < 0 ) {
+            TAI_ERROR("memfd_create: %s", strerror(errno));
+            return -1;
+        }
+        if ( ftruncate(shm, sizeof(IPCRegion)) < 0 ) {
+            TAI_ERROR("ftruncate: %s", strerror(errno));
+            close(shm);
+            return -1;
+        }
+        auto addr = mmap(nullptr, sizeof(IPCRegion), PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+        if ( addr == MAP_FAILED ) {
+            TAI_ERROR("mmap: %s", strerror(errno));
+            close(shm);
+            return -1;
+        }
+        p.region = new (addr) IPCRegion();
+        std::memcpy(p.region->header.magic, IPC_MAGIC, sizeof(IPC_MAGIC));
+        p.region->header.version = IPC_VERSION;
+        p.region->header.num_slots = TAI_MUX_IPC_NUM_SLOTS;
+
+        int alive[2] = {-1, -1}, parent[2] = {-1, -1};
+        p.request_fd = eventfd(0, EFD_CLOEXEC);
+        p.response_fd = eventfd(0, EFD_CLOEXEC);
+        p.notification_fd = eventfd(0, EFD_CLOEXEC);
+        p.stop_fd = eventfd(0, EFD_CLOEXEC);
+        if ( p.request_fd < 0 || p.response_fd < 0 || p.notification_fd < 0 || p.stop_fd < 0 || pipe2(alive, O_CLOEXEC) < 0 || pipe2(parent, O_CLOEXEC) < 0 ) {
+            TAI_ERROR("failed to create the descriptors of the host process: %s", strerror(errno));
+            close(shm);
+            close_fd(alive[0]);
+            close_fd(alive[1]);
+            teardown();
+            return -1;
+        }
+
+        // the host gets the write end of alive and the read end of parent,
+        // so that each side sees a hangup when the other one exits
+        auto e = std::getenv(TAI_MUX_HOST_PROGRAM.c_str());
+        std::string program = e != nullptr ? e : TAI_MUX_DEFAULT_HOST_PROGRAM;
+        int fds[] = {shm, p.request_fd, p.response_fd, p.notification_fd, parent[0], alive[1]};
+        std::vector<std::string> args = {program, m_name};
+        for ( auto fd : fds ) {
+            args.emplace_back(std::to_string(fd));
+        }
+        std::vector<char*> argv;
+        for ( auto& a : args ) {
+            argv.emplace_back(const_cast<char*>(a.c_str()));
+        }
+        argv.emplace_back(nullptr);
+
+        p.pid = fork();
+        if ( p.pid == 0 ) {
+            for ( auto fd : fds ) {
+                fcntl(fd, F_SETFD, 0);
+            }
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        auto err = errno;
+        close(shm);
+        close(alive[1]);
+        close(parent[0]);
+        p.alive_fd = alive[0];
+        p.parent_fd = parent[1];
+        if ( p.pid < 0 ) {
+            TAI_ERROR("fork: %s", strerror(err));
+            teardown();
+            return -1;
+        }
+        TAI_INFO("started %s for %s: pid %d", program.c_str(), m_name.c_str(), p.pid);
+
+        p.response_thread = std::thread(&RemoteLibrary::wait_responses, this);
+        p.notification_thread = std::thread(&RemoteLibrary::receive_notifications, this);
+        return 0;
+    }
+
+    void RemoteLibrary::teardown() {
+        auto& p = m_process;
+        if ( p.stop_fd >= 0 ) {
+            signal_fd(p.stop_fd);
+        }
+        if ( p.response_thread.joinable() ) {
+            p.response_thread.join();
+        }
+        if ( p.notification_thread.joinable() ) {
+            p.notification_thread.join();
+        }
+        // the host exits when it sees the hangup, a stuck one is killed
+        close_fd(p.parent_fd);
+        if ( p.pid > 0 ) {
+            auto deadline = std::chrono::steady_clock::now() + TAI_MUX_HOST_EXIT_TIMEOUT;
+            while ( waitpid(p.pid, nullptr, WNOHANG) == 0 ) {
+                if ( std::chrono::steady_clock::now() > deadline ) {
+                    TAI_WARN("killing the host process of %s: pid %d", m_name.c_str(), p.pid);
+                    kill(p.pid, SIGKILL);
+                    waitpid(p.pid, nullptr, 0);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            p.pid = -1;
+        }
+        close_fd(p.request_fd);
+        close_fd(p.response_fd);
+        close_fd(p.notification_fd);
+        close_fd(p.alive_fd);
+        close_fd(p.stop_fd);
+        if ( p.region != nullptr ) {
+            munmap(p.region, sizeof(IPCRegion));
+            p.region = nullptr;
+        }
+    }
+
+    void RemoteLibrary::wait_responses() {
+        auto& p = m_process;
+        pollfd fds[] = {{p.response_fd, POLLIN, 0}, {p.alive_fd, POLLIN, 0}, {p.stop_fd, POLLIN, 0}};
+        while ( true ) {
+            if ( poll(fds, 3, -1) < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                TAI_ERROR("poll: %s", strerror(errno));
+                return;
+            }
+            if ( fds[2].revents != 0 ) {
+                return;
+            }
+            if ( fds[0].revents & POLLIN ) {
+                drain_fd(p.response_fd);
+                std::unique_lock<std::mutex> lk(m_mutex);
+                m_cv.notify_all();
+            }
+            if ( fds[1].revents != 0 ) {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                // already failed by abort_host() when it was killed
+                if ( !m_dead ) {
+                    TAI_ERROR("the host process of %s exited", m_name.c_str());
+                    m_dead = true;
+                    m_generation++;
+                    m_cv.notify_all();
+                }
+                return;
+            }
+        }
+    }
+
+    void RemoteLibrary::receive_notifications() {
+        auto& p = m_process;
+        auto& h = p.region->header;
+        auto ring = p.region->ring;
+        pollfd fds[] = {{p.notification_fd, POLLIN, 0}, {p.stop_fd, POLLIN, 0}};
+        while ( true ) {
+            if ( poll(fds, 2, -1) < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                TAI_ERROR("poll: %s", strerror(errno));
+                return;
+            }
+            if ( fds[1].revents != 0 ) {
+                return;
+            }
+            drain_fd(p.notification_fd);
+
+            // the host signals only when it finds the ring empty, so the ring
+            // is drained until the head stops moving
+            auto tail = h.ring_tail.load(std::memory_order_relaxed);
+            while ( true ) {
+                auto head = h.ring_head.load(std::memory_order_seq_cst);
+                if ( tail == head ) {
+                    break;
+                }
+                auto pos = tail % TAI_MUX_IPC_RING_SIZE;
+                auto room = TAI_MUX_IPC_RING_SIZE - pos;
+                if ( room < sizeof(IPCNotification) ) {
+                    tail += room;
+                    h.ring_tail.store(tail, std::memory_order_seq_cst);
+                    continue;
+                }
+                IPCNotification n;
+                std::memcpy(&n, ring + pos, sizeof(n));
+                if ( n.size < sizeof(n) || n.size > room || n.size % 8 != 0 || n.size > head - tail ) {
+                    TAI_ERROR("corrupted notification ring of %s", m_name.c_str());
+                    h.ring_tail.store(head, std::memory_order_seq_cst);
+                    break;
+                }
+                auto size = n.size - sizeof(n);
+                if ( n.context != 0 ) {
+                    m_notification_buffer.resize(size / 8);
+                    std::memcpy(m_notification_buffer.data(), ring + pos + sizeof(n), size);
+                }
+                // the host can reuse the space while the notification is delivered
+                tail += n.size;
+                h.ring_tail.store(tail, std::memory_order_seq_cst);
+                if ( n.context != 0 ) {
+                    deliver(n.context, n.oid, reinterpret_cast<uint8_t*>(m_notification_buffer.data()), size);
+                }
+            }
+            auto dropped = h.ring_dropped.exchange(0);
+            if ( dropped > 0 ) {
+                TAI_WARN("%lu notifications of %s didn't fit in the ring", dropped, m_name.c_str());
+            }
+        }
+    }
+
+    void RemoteLibrary::deliver(uint64_t context, tai_object_id_t oid, uint8_t* data, size_t size) {
+        WireAttributes wire;
+        if ( !wire_bind(data, size, nullptr, wire) ) {
+            TAI_WARN("dropping a malformed notification of %s", m_name.c_str());
+            return;
+        }
+        tai_notification_handler_t handler;
+        {
+            // notifications still in the ring for a forgotten context are dropped here
+            std::unique_lock<std::mutex> lk(m_handlers_mutex);
+            auto it = m_handlers.find(context);
+            if ( it == m_handlers.end() ) {
+                return;
+            }
+            handler = it->second;
+            m_delivering = context;
+            m_delivering_thread = std::this_thread::get_id();
+        }
+        for ( uint32_t i = 0; i < wire.count; i++ ) {
+            if ( wire.types[i] == TAI_ATTR_VALUE_TYPE_NOTIFICATION ) {
+                wire.attrs[i].value.notification.notify = nullptr;
+            }
+        }
+        map_oids(wire.count, wire.attrs, wire.types, [this](tai_object_id_t id) { return from_host(id); });
+        handler.notify(handler.context, from_host(oid), wire.count, wire.attrs);
+        std::unique_lock<std::mutex> lk(m_handlers_mutex);
+        m_delivering = 0;
+        m_handlers_cv.notify_all();
+    }
+
+    tai_status_t RemoteLibrary::call(IPCOp op, tai_object_type_t type, tai_object_id_t oid, uint64_t arg, const std::function<bool(IPCSlot&)>& fill, const std::function<void(IPCSlot&)>& done) {
+        auto region = m_process.region;
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if ( m_dead || region == nullptr ) {
+            return TAI_STATUS_FAILURE;
+        }
+        auto generation = m_generation;
+        IPCSlot* slot = nullptr;
+        while ( true ) {
+            for ( auto& s : region->slots ) {
+                uint32_t expected = IPC_SLOT_FREE;
+                if ( s.state.compare_exchange_strong(expected, IPC_SLOT_CLAIMED) ) {
+                    slot = &s;
+                    break;
+                }
+            }
+            if ( slot != nullptr ) {
+                break;
+            }
+            m_cv.wait(lk);
+            if ( m_generation != generation ) {
+                return TAI_STATUS_FAILURE;
+            }
+        }
+        lk.unlock();
+
+        auto release = [&]() {
+            slot->state.store(IPC_SLOT_FREE, std::memory_order_release);
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_cv.notify_all();
+        };
+
+        slot->op = op;
+        slot->type = type;
+        slot->oid = oid;
+        slot->arg = arg;
+        slot->size = 0;
+        slot->status = TAI_STATUS_FAILURE;
+        if ( fill && !fill(*slot) ) {
+            TAI_ERROR("the attributes don't fit in a request to %s, the limit is %zu bytes", m_name.c_str(), sizeof(slot->data));
+            release();
+            return TAI_STATUS_NOT_SUPPORTED;
+        }
+        slot->state.store(IPC_SLOT_REQUEST, std::memory_order_release);
+        signal_fd(m_process.request_fd);
+
+        auto responded = [&]() {
+            return slot->state.load(std::memory_order_acquire) == IPC_SLOT_RESPONSE || m_generation != generation;
+        };
+        lk.lock();
+        if ( m_call_timeout.count() == 0 ) {
+            m_cv.wait(lk, responded);
+        } else if ( !m_cv.wait_for(lk, m_call_timeout, responded) ) {
+            abort_host(op);
+        }
+        if ( m_generation != generation ) {
+            // the slot goes away with the region
+            return TAI_STATUS_FAILURE;
+        }
+        lk.unlock();
+
+        if ( done ) {
+            done(*slot);
+        }
+        auto status = slot->status;
+        release();
+        return status;
+    }
+
+    // the process is only killed here. the calls in flight fail right away
+    // and the supervisor tears it down and starts a new one once they have
+    // returned, like when it crashes
+    void RemoteLibrary::abort_host(IPCOp op) {
+        TAI_ERROR("call %u to %s didn't return in %ld ms, killing its host process: pid %d", static_cast<uint32_t>(op), m_name.c_str(), static_cast<long>(m_call_timeout.count()), m_process.pid);
+        if ( m_process.pid > 0 ) {
+            kill(m_process.pid, SIGKILL);
+        }
+        m_dead = true;
+        m_generation++;
+        m_cv.notify_all();
+    }
+
+    int RemoteLibrary::initialize() {
+        return call(IPCOp::INITIALIZE, TAI_OBJECT_TYPE_NULL, TAI_NULL_OBJECT_ID, m_flags, nullptr, nullptr);
+    }
+
+    void RemoteLibrary::supervise() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while ( true ) {
+            m_cv.wait(lk, [&]() { return m_dead || m_stopping; });
+            if ( m_stopping ) {
+                return;
+            }
+            lk.unlock();
+            bool ok = false;
+            {
+                std::unique_lock<std::shared_mutex> calls(m_call_mutex);
+                teardown();
+                if ( spawn() == 0 ) {
+                    {
+                        std::unique_lock<std::mutex> lk(m_mutex);
+                        m_dead = false;
+                    }
+                    ok = initialize() == TAI_STATUS_SUCCESS && restore() == 0;
+                }
+            }
+            lk.lock();
+            if ( ok ) {
+                m_restarts++;
+                TAI_INFO("restarted the host process of %s", m_name.c_str());
+                continue;
+            }
+            TAI_ERROR("failed to restart the host process of %s", m_name.c_str());
+            m_dead = true;
+            m_cv.wait_for(lk, TAI_MUX_HOST_RESTART_INTERVAL, [&]() { return m_stopping; });
+        }
+    }
+
+    // called with m_call_mutex held exclusively, so m_objects only changes here
+    int RemoteLibrary::restore() {
+        for ( auto& l : m_log_levels ) {
+            if ( call(IPCOp::LOG_SET, TAI_OBJECT_TYPE_NULL, TAI_NULL_OBJECT_ID, uint64_t(l.first) << 32 | uint32_t(l.second), nullptr, nullptr) != TAI_STATUS_SUCCESS ) {
+                return -1;
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lk(m_objects_mutex);
+            m_to_host.clear();
+            m_from_host.clear();
+        }
+
+        // the modules first, the other objects are created with their module OID
+        std::vector<tai_object_id_t> order;
+        for ( auto& o : m_objects ) {
+            if ( o.second.type == TAI_OBJECT_TYPE_MODULE ) {
+                order.emplace_back(o.first);
+            }
+        }
+        for ( auto& o : m_objects ) {
+            if ( o.second.type != TAI_OBJECT_TYPE_MODULE ) {
+                order.emplace_back(o.first);
+            }
+        }
+
+        std::vector<tai_object_id_t> failed;
+        for ( auto oid : order ) {
+            auto& o = m_objects[oid];
+            tai_object_id_t id = TAI_NULL_OBJECT_ID;
+            auto status = call(IPCOp::CREATE, o.type, TAI_NULL_OBJECT_ID, to_host(o.module_id), [&](IPCSlot& slot) {
+                return fill_attributes(slot, o.create_attrs.data(), o.create_attrs.size());
+            }, [&](IPCSlot& slot) {
+                id = slot.oid;
+            });
+            if ( status != TAI_STATUS_SUCCESS ) {
+                TAI_ERROR("failed to create 0x%lx of %s again: %d", oid, m_name.c_str(), status);
+                if ( dead() ) {
+                    return -1;
+                }
+                failed.emplace_back(oid);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m_objects_mutex);
+            m_to_host[oid] = id;
+            m_from_host[id] = oid;
+        }
+
+        // an object which couldn't be created is gone for good
+        if ( failed.size() > 0 ) {
+            std::vector<uint64_t> contexts;
+            {
+                std::unique_lock<std::mutex> lk(m_objects_mutex);
+                for ( auto oid : failed ) {
+                    for ( auto& h : m_objects[oid].handlers ) {
+                        contexts.emplace_back(h.second);
+                    }
+                    m_objects.erase(oid);
+                }
+            }
+            forget_handlers(contexts);
+        }
+
+        for ( auto& o : m_objects ) {
+            auto oid = o.first;
+            auto id = to_host(oid);
+            for ( auto& a : o.second.set_attrs ) {
+                auto status = call(IPCOp::SET, o.second.type, id, 0, [&](IPCSlot& slot) {
+                    return fill_attributes(slot, a.second.data(), a.second.size());
+                }, nullptr);
+                if ( status != TAI_STATUS_SUCCESS ) {
+                    TAI_WARN("failed to set attribute %d of 0x%lx of %s again: %d", a.first, oid, m_name.c_str(), status);
+                    if ( dead() ) {
+                        return -1;
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    bool RemoteLibrary::fill_attributes(IPCSlot& slot, const uint8_t* wire, size_t size) {
+        if ( size > sizeof(slot.data) ) {
+            return false;
+        }
+        std::memcpy(slot.data, wire, size);
+        slot.size = size;
+        map_to_host(slot);
+        return true;
+    }
+
+    void RemoteLibrary::map_to_host(IPCSlot& slot) {
+        {
+            std::unique_lock<std::mutex> lk(m_objects_mutex);
+            if ( m_to_host.empty() ) {
+                return;
+            }
+        }
+        WireAttributes w;
+        wire_bind(slot.data, slot.size, nullptr, w);
+        map_oids(w.count, w.attrs, w.types, [this](tai_object_id_t id) { return to_host(id); });
+        wire_unbind(slot.data, slot.size, w);
+    }
+
+    tai_status_t RemoteLibrary::value_types(tai_object_type_t type, uint32_t count, const tai_attribute_t* attrs, tai_attr_value_type_t* types) {
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto meta = m_metadata(type, attrs[i].id);
+            if ( meta == nullptr ) {
+                return TAI_STATUS_ATTR_NOT_SUPPORTED_0 + i;
+            }
+            types[i] = meta->attrvaluetype;
+        }
+        return TAI_STATUS_SUCCESS;
+    }
+
+    void RemoteLibrary::register_handlers(uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types) {
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto& n = attrs[i].value.notification;
+            if ( types[i] == TAI_ATTR_VALUE_TYPE_NOTIFICATION && n.notify != nullptr ) {
+                std::unique_lock<std::mutex> lk(m_handlers_mutex);
+                m_handlers[reinterpret_cast<uint64_t>(n.context)] = n;
+            }
+        }
+    }
+
+    void RemoteLibrary::update_handlers(tai_object_id_t oid, bool ok, uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types) {
+        std::vector<uint64_t> stale;
+        {
+            std::unique_lock<std::mutex> lk(m_objects_mutex);
+            auto it = m_objects.find(oid);
+            for ( uint32_t i = 0; i < count; i++ ) {
+                if ( types[i] != TAI_ATTR_VALUE_TYPE_NOTIFICATION ) {
+                    continue;
+                }
+                auto& n = attrs[i].value.notification;
+                auto context = n.notify != nullptr ? reinterpret_cast<uint64_t>(n.context) : 0;
+                if ( it == m_objects.end() ) {
+                    if ( context != 0 ) {
+                        stale.emplace_back(context);
+                    }
+                    continue;
+                }
+                auto& handlers = it->second.handlers;
+                auto h = handlers.find(attrs[i].id);
+                auto current = h != handlers.end() ? h->second : 0;
+                if ( !ok ) {
+                    // the object keeps the handler it had
+                    if ( context != 0 && context != current ) {
+                        stale.emplace_back(context);
+                    }
+                    continue;
+                }
+                if ( current != 0 && current != context ) {
+                    stale.emplace_back(current);
+                }
+                if ( context == 0 ) {
+                    if ( h != handlers.end() ) {
+                        handlers.erase(h);
+                    }
+                } else if ( h != handlers.end() ) {
+                    h->second = context;
+                } else {
+                    handlers.emplace(attrs[i].id, context);
+                }
+            }
+        }
+        forget_handlers(stale);
+    }
+
+    void RemoteLibrary::forget_handlers(const std::vector<uint64_t>& contexts) {
+        if ( contexts.empty() ) {
+            return;
+        }
+        std::unique_lock<std::mutex> lk(m_handlers_mutex);
+        for ( auto c : contexts ) {
+            m_handlers.erase(c);
+        }
+        // the caller may free a context once this returns, so a delivery in
+        // progress is waited for. unless the handler itself disabled it
+        m_handlers_cv.wait(lk, [&]() {
+            return m_delivering == 0 || m_delivering_thread == std::this_thread::get_id() ||
+                   std::find(contexts.begin(), contexts.end(), m_delivering) == contexts.end();
+        });
+    }
+
+    void RemoteLibrary::record_set(tai_object_id_t oid, uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types) {
+        std::unique_lock<std::mutex> lk(m_objects_mutex);
+        auto it = m_objects.find(oid);
+        if ( it == m_objects.end() ) {
+            return;
+        }
+        for ( uint32_t i = 0; i < count; i++ ) {
+            auto& blob = it->second.set_attrs[attrs[i].id];
+            blob.resize(wire_encode(nullptr, 0, 1, &attrs[i], &types[i], true));
+            wire_encode(blob.data(), blob.size(), 1, &attrs[i], &types[i], true);
+        }
+    }
+
+    tai_object_id_t RemoteLibrary::to_host(tai_object_id_t oid) {
+        std::unique_lock<std::mutex> lk(m_objects_mutex);
+        auto it = m_to_host.find(oid);
+        return it != m_to_host.end() ? it->second : oid;
+    }
+
+    tai_object_id_t RemoteLibrary::from_host(tai_object_id_t oid) {
+        std::unique_lock<std::mutex> lk(m_objects_mutex);
+        auto it = m_from_host.find(oid);
+        return it != m_from_host.end() ? it->second : oid;
+    }
+
+    tai_status_t RemoteLibrary::uninitialize() {
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stopping = true;
+            m_cv.notify_all();
+        }
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        return call(IPCOp::UNINITIALIZE, TAI_OBJECT_TYPE_NULL, TAI_NULL_OBJECT_ID, 0, nullptr, nullptr);
+    }
+
+    tai_status_t RemoteLibrary::log_set(tai_api_t api, tai_log_level_t level) {
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        auto status = call(IPCOp::LOG_SET, TAI_OBJECT_TYPE_NULL, TAI_NULL_OBJECT_ID, uint64_t(api) << 32 | uint32_t(level), nullptr, nullptr);
+        if ( status == TAI_STATUS_SUCCESS ) {
+            std::unique_lock<std::mutex> lk(m_objects_mutex);
+            m_log_levels[api] = level;
+        }
+        return status;
+    }
+
+    tai_object_type_t RemoteLibrary::object_type_query(tai_object_id_t oid) {
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        auto type = TAI_OBJECT_TYPE_NULL;
+        call(IPCOp::OBJECT_TYPE_QUERY, TAI_OBJECT_TYPE_NULL, to_host(oid), 0, nullptr, [&](IPCSlot& slot) {
+            if ( slot.status == TAI_STATUS_SUCCESS ) {
+                type = static_cast<tai_object_type_t>(slot.arg);
+            }
+        });
+        return type;
+    }
+
+    tai_object_id_t RemoteLibrary::module_id_query(tai_object_id_t oid) {
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        tai_object_id_t id = TAI_NULL_OBJECT_ID;
+        call(IPCOp::MODULE_ID_QUERY, TAI_OBJECT_TYPE_NULL, to_host(oid), 0, nullptr, [&](IPCSlot& slot) {
+            if ( slot.status == TAI_STATUS_SUCCESS ) {
+                id = slot.arg;
+            }
+        });
+        return id == TAI_NULL_OBJECT_ID ? id : from_host(id);
+    }
+
+    tai_status_t RemoteLibrary::create(tai_object_type_t type, tai_object_id_t* oid, tai_object_id_t module_id, uint32_t count, const tai_attribute_t* attrs) {
+        SmallVector<tai_attr_value_type_t, TAI_MUX_REMOTE_INLINE_ATTRS> types(count);
+        auto status = value_types(type, count, attrs, types.data());
+        if ( status != TAI_STATUS_SUCCESS ) {
+            return status;
+        }
+        std::vector<uint8_t> wire(wire_encode(nullptr, 0, count, attrs, types.data(), true));
+        wire_encode(wire.data(), wire.size(), count, attrs, types.data(), true);
+        register_handlers(count, attrs, types.data());
+
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        tai_object_id_t id = TAI_NULL_OBJECT_ID;
+        status = call(IPCOp::CREATE, type, TAI_NULL_OBJECT_ID, to_host(module_id), [&](IPCSlot& slot) {
+            return fill_attributes(slot, wire.data(), wire.size());
+        }, [&](IPCSlot& slot) {
+            id = slot.oid;
+        });
+        if ( status != TAI_STATUS_SUCCESS ) {
+            update_handlers(TAI_NULL_OBJECT_ID, false, count, attrs, types.data());
+            return status;
+        }
+
+        std::unique_lock<std::mutex> olk(m_objects_mutex);
+        auto stable = id;
+        // after a restart the new process may hand out an OID one of the
+        // objects of the first run still goes by
+        if ( m_objects.find(stable) != m_objects.end() ) {
+            stable = m_next_alias--;
+        }
+        if ( stable != id || !m_to_host.empty() ) {
+            m_to_host[stable] = id;
+            m_from_host[id] = stable;
+        }
+        m_objects[stable] = Object{type, module_id, std::move(wire), {}, {}};
+        olk.unlock();
+        update_handlers(stable, true, count, attrs, types.data());
+        *oid = stable;
+        return TAI_STATUS_SUCCESS;
+    }
+
+    tai_status_t RemoteLibrary::remove(tai_object_type_t type, tai_object_id_t oid) {
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        auto id = to_host(oid);
+        auto status = call(IPCOp::REMOVE, type, id, 0, nullptr, nullptr);
+        if ( status == TAI_STATUS_SUCCESS ) {
+            std::vector<uint64_t> contexts;
+            {
+                std::unique_lock<std::mutex> olk(m_objects_mutex);
+                auto it = m_objects.find(oid);
+                if ( it != m_objects.end() ) {
+                    for ( auto& h : it->second.handlers ) {
+                        contexts.emplace_back(h.second);
+                    }
+                    m_objects.erase(it);
+                }
+                m_to_host.erase(oid);
+                m_from_host.erase(id);
+            }
+            forget_handlers(contexts);
+        }
+        return status;
+    }
+
+    tai_status_t RemoteLibrary::set(tai_object_type_t type, tai_object_id_t oid, uint32_t count, const tai_attribute_t* attrs) {
+        SmallVector<tai_attr_value_type_t, TAI_MUX_REMOTE_INLINE_ATTRS> types(count);
+        auto status = value_types(type, count, attrs, types.data());
+        if ( status != TAI_STATUS_SUCCESS ) {
+            return status;
+        }
+        register_handlers(count, attrs, types.data());
+
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        // encoded straight into the slot, this is the only copy of the values
+        status = call(IPCOp::SET, type, to_host(oid), 0, [&](IPCSlot& slot) {
+            auto size = wire_encode(slot.data, sizeof(slot.data), count, attrs, types.data(), true);
+            if ( size == 0 ) {
+                return false;
+            }
+            slot.size = size;
+            map_to_host(slot);
+            return true;
+        }, nullptr);
+        if ( status == TAI_STATUS_SUCCESS ) {
+            record_set(oid, count, attrs, types.data());
+        }
+        update_handlers(oid, status == TAI_STATUS_SUCCESS, count, attrs, types.data());
+        return status;
+    }
+
+    tai_status_t RemoteLibrary::get(tai_object_type_t type, tai_object_id_t oid, uint32_t count, tai_attribute_t* attrs) {
+        SmallVector<tai_attr_value_type_t, TAI_MUX_REMOTE_INLINE_ATTRS> types(count);
+        auto status = value_types(type, count, attrs, types.data());
+        if ( status != TAI_STATUS_SUCCESS ) {
+            return status;
+        }
+
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        bool bound = false;
+        status = call(IPCOp::GET, type, to_host(oid), 0, [&](IPCSlot& slot) {
+            // only the room for the lists, the TAI library fills them in the slot
+            auto size = wire_encode(slot.data, sizeof(slot.data), count, attrs, types.data(), false);
+            slot.size = size;
+            return size != 0;
+        }, [&](IPCSlot& slot) {
+            WireAttributes w;
+            bound = slot.size <= sizeof(slot.data) && wire_bind(slot.data, slot.size, nullptr, w) && w.count == count;
+            if ( bound ) {
+                wire_copy_out(w, count, attrs);
+            }
+        });
+        if ( status != TAI_STATUS_SUCCESS && status != TAI_STATUS_BUFFER_OVERFLOW ) {
+            return status;
+        }
+        if ( !bound ) {
+            TAI_ERROR("malformed response from %s", m_name.c_str());
+            return TAI_STATUS_FAILURE;
+        }
+        map_oids(count, attrs, types.data(), [this](tai_object_id_t id) { return from_host(id); });
+        return status;
+    }
+
+    tai_status_t RemoteLibrary::clear(tai_object_id_t oid, uint32_t count, const tai_attr_id_t* ids) {
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex);
+        auto status = call(IPCOp::CLEAR, TAI_OBJECT_TYPE_NULL, to_host(oid), 0, [&](IPCSlot& slot) {
+            auto size = sizeof(uint32_t) + sizeof(tai_attr_id_t) * count;
+            if ( size > sizeof(slot.data) ) {
+                return false;
+            }
+            std::memcpy(slot.data, &count, sizeof(count));
+            std::memcpy(slot.data + sizeof(count), ids, sizeof(tai_attr_id_t) * count);
+            slot.size = size;
+            return true;
+        }, nullptr);
+        if ( status == TAI_STATUS_SUCCESS ) {
+            std::vector<uint64_t> contexts;
+            {
+                std::unique_lock<std::mutex> olk(m_objects_mutex);
+                auto it = m_objects.find(oid);
+                for ( uint32_t i = 0; it != m_objects.end() && i < count; i++ ) {
+                    it->second.set_attrs.erase(ids[i]);
+                    auto h = it->second.handlers.find(ids[i]);
+                    if ( h != it->second.handlers.end() ) {
+                        contexts.emplace_back(h->second);
+                        it->second.handlers.erase(h);
+                    }
+                }
+            }
+            forget_handlers(contexts);
+        }
+        return status;
+    }
+
+    pid_t RemoteLibrary::pid() {
+        std::shared_lock<std::shared_mutex> lk(m_call_mutex, std::try_to_lock);
+        if ( !lk.owns_lock() || dead() ) {
+            return -1;
+        }
+        return m_process.pid;
+    }
+
+    bool RemoteLibrary::dead() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        return m_dead;
+    }
+
+}
@@ -0,0 +1,170 @@
+#ifndef __REMOTE_LIBRARY_HPP__
+#define __REMOTE_LIBRARY_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "tai.h"
+#include "ipc.hpp"
+
+namespace tai::mux {
+
+    // comma separated list of TAI libraries which are run in a host process of their own
+    const std::string TAI_MUX_ISOLATED_LIBRARIES = "TAI_MUX_ISOLATED_LIBRARIES";
+    // the program which runs them, built in host/
+    const std::string TAI_MUX_HOST_PROGRAM = "TAI_MUX_HOST_PROGRAM";
+    const std::string TAI_MUX_DEFAULT_HOST_PROGRAM = "tai-mux-host";
+    // how long a call can take before the host process is killed and restarted, 0 to wait forever
+    const std::string TAI_MUX_HOST_CALL_TIMEOUT_MS = "TAI_MUX_HOST_CALL_TIMEOUT_MS";
+    const int TAI_MUX_DEFAULT_HOST_CALL_TIMEOUT_MS = 30000;
+
+    // the metadata libtai-mux.so knows for an attribute of the library
+    using MetadataLookup = std::function<const tai_attr_metadata_t*(tai_object_type_t, tai_attr_id_t)>;
+
+    // a TAI library running in a tai-mux-host process, so that a crash or a
+    // deadlock in it only takes its own modules down
+    //
+    // calls are passed through the shared memory described in ipc.hpp. the
+    // attributes of a call must fit in a slot (TAI_MUX_IPC_SLOT_SIZE) in the
+    // wire format, bigger calls fail with TAI_STATUS_NOT_SUPPORTED. when the
+    // host process dies or a call doesn't return in time, the calls in flight
+    // fail and it is started again in the background. the objects which existed are created again
+    // with the attributes they were created and last set with. they keep
+    // their OIDs: the OIDs of the new process are translated to the ones of
+    // the first one in both directions.
+    class RemoteLibrary {
+        public:
+            // starts the host process and initializes the library in it. throws on failure
+            RemoteLibrary(const std::string& name, uint64_t flags, MetadataLookup metadata);
+            ~RemoteLibrary();
+
+            // whether name is in TAI_MUX_ISOLATED_LIBRARIES
+            static bool enabled(const std::string& name);
+
+            tai_status_t uninitialize();
+            tai_status_t log_set(tai_api_t api, tai_log_level_t level);
+            tai_object_type_t object_type_query(tai_object_id_t oid);
+            tai_object_id_t module_id_query(tai_object_id_t oid);
+
+            tai_status_t create(tai_object_type_t type, tai_object_id_t* oid, tai_object_id_t module_id, uint32_t count, const tai_attribute_t* attrs);
+            tai_status_t remove(tai_object_type_t type, tai_object_id_t oid);
+            tai_status_t set(tai_object_type_t type, tai_object_id_t oid, uint32_t count, const tai_attribute_t* attrs);
+            tai_status_t get(tai_object_type_t type, tai_object_id_t oid, uint32_t count, tai_attribute_t* attrs);
+            tai_status_t clear(tai_object_id_t oid, uint32_t count, const tai_attr_id_t* ids);
+
+            // number of times the host process was started again
+            uint64_t restarts() const {
+                return m_restarts.load(std::memory_order_relaxed);
+            }
+
+            // pid of the running host process, -1 while it is restarted
+            pid_t pid();
+
+        private:
+            // one run of the host process
+            struct Process {
+                pid_t pid = -1;
+                IPCRegion* region = nullptr;
+                int request_fd = -1;      // eventfd, signaled by libtai-mux.so
+                int response_fd = -1;     // eventfd, signaled by the host
+                int notification_fd = -1; // eventfd, signaled by the host
+                int alive_fd = -1;        // hangs up when the host exits
+                int parent_fd = -1;       // the host exits when this is closed
+                int stop_fd = -1;         // eventfd which stops the threads below
+                std::thread response_thread;
+                std::thread notification_thread;
+            };
+
+            // objects to create again when the host process is restarted.
+            // the attributes are in the wire format with the OIDs of the first run
+            struct Object {
+                tai_object_type_t type;
+                tai_object_id_t module_id;
+                std::vector<uint8_t> create_attrs;
+                std::map<tai_attr_id_t, std::vector<uint8_t>> set_attrs;
+                std::map<tai_attr_id_t, uint64_t> handlers; // notification contexts in m_handlers
+            };
+
+            int spawn();
+            void teardown();
+            int initialize();
+            int restore();
+            void supervise();
+            void wait_responses();
+            void receive_notifications();
+            void deliver(uint64_t context, tai_object_id_t oid, uint8_t* data, size_t size);
+
+            // runs one call in a free slot. fill writes the request and
+            // returns false when it doesn't fit, done reads the response.
+            // the caller holds m_call_mutex
+            tai_status_t call(IPCOp op, tai_object_type_t type, tai_object_id_t oid, uint64_t arg, const std::function<bool(IPCSlot&)>& fill, const std::function<void(IPCSlot&)>& done);
+
+            bool dead();
+
+            // kills a host process which didn't respond in time. the caller holds m_mutex
+            void abort_host(IPCOp op);
+
+            // copies an encoding to the slot with the OIDs of the running host process
+            bool fill_attributes(IPCSlot& slot, const uint8_t* wire, size_t size);
+            void map_to_host(IPCSlot& slot);
+            tai_status_t value_types(tai_object_type_t type, uint32_t count, const tai_attribute_t* attrs, tai_attr_value_type_t* types);
+            // makes the handlers in attrs known before the call, so that
+            // notifications sent while it runs are delivered
+            void register_handlers(uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types);
+            // after the call, records the handlers attrs set to oid and forgets
+            // the ones they replaced or disabled. when the call failed, forgets
+            // the ones register_handlers() added instead
+            void update_handlers(tai_object_id_t oid, bool ok, uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types);
+            // once it returns, no notification is delivered to the contexts
+            void forget_handlers(const std::vector<uint64_t>& contexts);
+            void record_set(tai_object_id_t oid, uint32_t count, const tai_attribute_t* attrs, const tai_attr_value_type_t* types);
+
+            tai_object_id_t to_host(tai_object_id_t oid);
+            tai_object_id_t from_host(tai_object_id_t oid);
+
+            const std::string m_name;
+            const uint64_t m_flags;
+            MetadataLookup m_metadata;
+            std::chrono::milliseconds m_call_timeout;
+
+            Process m_process;
+            // held shared by the calls and exclusively while the host process is restarted
+            std::shared_mutex m_call_mutex;
+
+            std::mutex m_mutex; // guards the fields below and the slot states for m_cv
+            std::condition_variable m_cv;
+            uint64_t m_generation;  // bumped when the host process dies
+            bool m_dead;
+            bool m_stopping;
+            std::thread m_supervisor;
+            std::atomic<uint64_t> m_restarts {0};
+
+            std::mutex m_objects_mutex; // guards the fields below
+            std::unordered_map<tai_object_id_t, Object> m_objects;
+            std::unordered_map<tai_object_id_t, tai_object_id_t> m_to_host;   // empty until the first restart
+            std::unordered_map<tai_object_id_t, tai_object_id_t> m_from_host;
+            std::map<tai_api_t, tai_log_level_t> m_log_levels;
+            uint64_t m_next_alias;
+
+            std::mutex m_handlers_mutex; // guards the fields below
+            std::condition_variable m_handlers_cv;
+            std::unordered_map<uint64_t, tai_notification_handler_t> m_handlers; // by context
+            uint64_t m_delivering = 0; // the context the notification thread is delivering to
+            std::thread::id m_delivering_thread;
+            std::vector<uint64_t> m_notification_buffer; // used by the notification thread only
+    };
+
+};
+
+#endif
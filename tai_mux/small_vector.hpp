@@ -0,0 +1,61 @@
+#ifndef __SMALL_VECTOR_HPP__
+#define __SMALL_VECTOR_HPP__
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace tai::mux {
+
+    // fixed size array of trivially copyable elements which is kept inline
+    // up to N elements and only goes to the heap beyond that. meant for short
+    // lived buffers on the stack of the call paths, so it can't grow after
+    // construction. the elements are value-initialized
+    template<typename T, size_t N>
+    class SmallVector {
+        static_assert(std::is_trivially_copyable<T>::value, "SmallVector only holds trivially copyable types");
+
+        public:
+            explicit SmallVector(size_t size) : m_inline {}, m_size(size) {
+                if ( size > N ) {
+                    m_heap.resize(size);
+                    m_data = m_heap.data();
+                } else {
+                    m_data = m_inline.data();
+                }
+            }
+
+            SmallVector(const SmallVector&) = delete;
+            SmallVector& operator=(const SmallVector&) = delete;
+
+            T* data() {
+                return m_data;
+            }
+
+            const T* data() const {
+                return m_data;
+            }
+
+            size_t size() const {
+                return m_size;
+            }
+
+            T& operator[](size_t i) {
+                return m_data[i];
+            }
+
+            const T& operator[](size_t i) const {
+                return m_data[i];
+            }
+
+        private:
+            std::array<T, N> m_inline;
+            std::vector<T> m_heap;
+            T* m_data;
+            size_t m_size;
+    };
+
+};
+
+#endif
@@ -1,52 +1,405 @@
 #include "static_platform_adapter.hpp"
+#include <algorithm>
+#include <cstring>
 
-namespace tai::mux {
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
 
-    StaticPlatformAdapter::StaticPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services) {
-        std::string config_file = TAI_MUX_STATIC_DEFAULT_CONFIG;
-        auto e = std::getenv(TAI_MUX_STATIC_CONFIG_FILE.c_str());
-        if ( e != nullptr ) {
-            config_file = e;
-        }
+namespace tai::mux {
 
+    // reads the location to library mapping from the configuration file.
+    // returns -1 when the file can't be opened and -2 when it can't be parsed
+    static int read_config(const std::string& config_file, std::map<std::string, std::string>& map) {
         std::ifstream ifs(config_file);
         if ( !ifs ) {
-            return;
+            return -1;
         }
-
         std::istreambuf_iterator<char> it(ifs), last;
         std::string config(it, last);
+        try {
+            auto c = json::parse(config);
+            for ( json::iterator it = c.begin(); it != c.end(); ++it ) {
+                map[it.key()] = it.value().get<std::string>();
+            }
+        } catch (const std::exception& e) {
+            TAI_ERROR("failed to parse %s: %s", config_file.c_str(), e.what());
+            return -2;
+        }
+        return 0;
+    }
 
-        std::map<uint64_t, S_ModuleAdapter> map;
-        auto c = json::parse(config);
+    StaticPlatformAdapter::StaticPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services) : m_loader(flags, &m_services) {
+        m_config_file = TAI_MUX_STATIC_DEFAULT_CONFIG;
+        auto e = std::getenv(TAI_MUX_STATIC_CONFIG_FILE.c_str());
+        if ( e != nullptr ) {
+            m_config_file = e;
+        }
 
         m_services.module_presence = nullptr;
         if ( services != nullptr ) {
             m_services.get_module_io_handler = services->get_module_io_handler;
+            m_module_presence = services->module_presence;
         }
 
-        for ( json::iterator it = c.begin(); it != c.end(); ++it ) {
-            auto location = it.key();
-            auto lib = it.value().get<std::string>();
-            auto dl = ModuleAdapter::dl_address(lib);
-            S_ModuleAdapter ma;
-            if ( dl == 0 ) {
-                ma = std::make_shared<ModuleAdapter>(lib, flags, &m_services);
-                dl = ModuleAdapter::dl_address(lib);
-                map[dl] = ma;
+        e = std::getenv(TAI_MUX_STATIC_LOAD_POLICY.c_str());
+        m_lazy = e != nullptr && std::string(e) == "lazy";
+        if ( e != nullptr && !m_lazy && std::string(e) != "eager" ) {
+            TAI_WARN("unknown load policy: %s, using eager", e);
+        }
+
+        // watched before the first read so that no change is missed
+        e = std::getenv(TAI_MUX_STATIC_WATCH_CONFIG.c_str());
+        if ( e != nullptr && std::string(e) == "true" ) {
+            m_watch_fd = watch_config();
+        }
+
+        // the destructor doesn't run when the constructor throws, so the
+        // watcher is closed here until the constructor finished
+        struct WatchCloser {
+            int& fd;
+            bool done = false;
+            ~WatchCloser() {
+                if ( !done && fd >= 0 ) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+        } watch_closer{m_watch_fd};
+
+        // a missing file means no modules, but a broken one is an error. only
+        // reload() keeps running with the previous configuration
+        if ( read_config(m_config_file, m_lib_map) == -2 ) {
+            throw Exception(TAI_STATUS_FAILURE);
+        }
+
+        if ( !m_lazy ) {
+            // libraries are loaded in parallel, vendor initialization can take long
+            std::vector<std::string> libs;
+            for ( const auto& v : m_lib_map ) {
+                if ( std::find(libs.begin(), libs.end(), v.second) == libs.end() ) {
+                    libs.emplace_back(v.second);
+                }
+            }
+            auto adapters = m_loader.load_all(libs);
+            for ( const auto& v : m_lib_map ) {
+                auto i = std::find(libs.begin(), libs.end(), v.second) - libs.begin();
+                m_ma_map[v.first] = adapters[i];
+            }
+        }
+
+        // presence comes from the configuration even when the libraries aren't loaded yet
+        if ( m_module_presence != nullptr ) {
+            for ( const auto& v : m_lib_map ) {
+                m_module_presence(true, const_cast<char*>(v.first.c_str()));
+            }
+        }
+
+        e = std::getenv(TAI_MUX_STATIC_IDLE_UNLOAD_TIMEOUT.c_str());
+        if ( e != nullptr ) {
+            m_idle_timeout = std::chrono::seconds(std::strtoul(e, nullptr, 0));
+            if ( m_idle_timeout.count() == 0 ) {
+                TAI_WARN("invalid idle unload timeout: %s, idle libraries are kept loaded", e);
             } else {
-                ma = map[dl];
+                m_th = std::thread(&StaticPlatformAdapter::unload_idle_loop, this);
             }
-            m_ma_map[location] = ma;
-            if ( services != nullptr && services->module_presence != nullptr ) {
-                services->module_presence(true, const_cast<char*>(location.c_str()));
+        }
+
+        if ( m_watch_fd >= 0 ) {
+            m_watch_event = eventfd(0, EFD_CLOEXEC);
+            if ( m_watch_event < 0 ) {
+                TAI_ERROR("eventfd failed: %s", std::strerror(errno));
+            } else {
+                m_watch_th = std::thread(&StaticPlatformAdapter::watch_loop, this);
             }
         }
+        watch_closer.done = true;
     }
 
     StaticPlatformAdapter::~StaticPlatformAdapter() {
-        for ( auto& m : m_ma_map ) {
-            m.second->tai_api_uninitialize();
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        if ( m_th.joinable() ) {
+            m_th.join();
+        }
+        if ( m_watch_th.joinable() ) {
+            uint64_t v = 1;
+            if ( write(m_watch_event, &v, sizeof(v)) < 0 ) {
+                TAI_WARN("failed to stop the configuration watcher: %s", std::strerror(errno));
+            }
+            m_watch_th.join();
+        }
+        if ( m_watch_event >= 0 ) {
+            close(m_watch_event);
+        }
+        if ( m_watch_fd >= 0 ) {
+            close(m_watch_fd);
+        }
+        for ( auto& ma : list_module_adapters() ) {
+            ma->tai_api_uninitialize();
+        }
+    }
+
+    S_ModuleAdapter StaticPlatformAdapter::get_module_adapter(const std::string& location) {
+        while ( true ) {
+            std::string lib;
+            {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                auto it = m_ma_map.find(location);
+                if ( it != m_ma_map.end() ) {
+                    m_idle.erase(it->second.get());
+                    it->second->acquire();
+                    return it->second;
+                }
+                auto l = m_lib_map.find(location);
+                if ( l == m_lib_map.end() ) {
+                    return nullptr;
+                }
+                lib = l->second;
+            }
+            // loading happens outside m_mutex so that different libraries can be loaded in parallel
+            S_ModuleAdapter ma;
+            try {
+                ma = m_loader.load(lib);
+            } catch (const std::exception& e) {
+                TAI_ERROR("failed to load %s: %s", lib.c_str(), e.what());
+                return nullptr;
+            }
+            std::unique_lock<std::mutex> lk(m_mutex);
+            // the library may have been unloaded by unload_idle(), or the
+            // location remapped by reload() in the meantime
+            auto l = m_lib_map.find(location);
+            if ( !m_loader.is_loaded(ma) || l == m_lib_map.end() || l->second != lib ) {
+                continue;
+            }
+            m_ma_map[location] = ma;
+            m_idle.erase(ma.get());
+            ma->acquire();
+            return ma;
+        }
+    }
+
+    const std::unordered_set<S_ModuleAdapter> StaticPlatformAdapter::list_module_adapters() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        std::unordered_set<S_ModuleAdapter> set(m_retired);
+        for ( auto m : m_ma_map ) {
+            set.emplace(m.second);
+        }
+        return set;
+    }
+
+    // modules at locations whose library didn't change keep running. modules
+    // at removed or remapped locations are reported absent so that the host
+    // removes them. remapped locations are then reported present again and use
+    // the new library once the host creates the module again
+    int StaticPlatformAdapter::reload() {
+        std::map<std::string, std::string> lib_map;
+        if ( read_config(m_config_file, lib_map) != 0 ) {
+            TAI_WARN("failed to read %s, keeping the current configuration", m_config_file.c_str());
+            return -1;
+        }
+
+        // the libraries of added or remapped locations are loaded in parallel
+        // and outside m_mutex. a library which fails to load is loaded again
+        // by get_module_adapter() when the module is created
+        std::vector<std::string> libs;
+        std::vector<S_ModuleAdapter> loaded;
+        if ( !m_lazy ) {
+            {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                for ( const auto& v : lib_map ) {
+                    auto it = m_lib_map.find(v.first);
+                    if ( ( it == m_lib_map.end() || it->second != v.second ) && std::find(libs.begin(), libs.end(), v.second) == libs.end() ) {
+                        libs.emplace_back(v.second);
+                    }
+                }
+            }
+            loaded = m_loader.try_load_all(libs);
+        }
+
+        std::vector<std::string> removed, added;
+        std::vector<S_ModuleAdapter> idle;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            for ( const auto& v : m_lib_map ) {
+                auto it = lib_map.find(v.first);
+                if ( it == lib_map.end() || it->second != v.second ) {
+                    removed.emplace_back(v.first);
+                }
+            }
+            for ( const auto& v : lib_map ) {
+                auto it = m_lib_map.find(v.first);
+                if ( it == m_lib_map.end() || it->second != v.second ) {
+                    added.emplace_back(v.first);
+                }
+            }
+            if ( removed.empty() && added.empty() && libs.empty() ) {
+                return 0;
+            }
+
+            for ( const auto& location : removed ) {
+                auto it = m_ma_map.find(location);
+                if ( it == m_ma_map.end() ) {
+                    continue;
+                }
+                auto ma = it->second;
+                m_ma_map.erase(it);
+                // the objects created through it keep the library until they are removed
+                if ( std::none_of(m_ma_map.begin(), m_ma_map.end(), [&](const auto& v) { return v.second == ma; }) ) {
+                    m_retired.emplace(ma);
+                }
+            }
+            m_lib_map = lib_map;
+
+            for ( const auto& location : added ) {
+                auto it = std::find(libs.begin(), libs.end(), m_lib_map[location]);
+                if ( it == libs.end() || loaded[it - libs.begin()] == nullptr ) {
+                    continue;
+                }
+                auto ma = loaded[it - libs.begin()];
+                m_ma_map[location] = ma;
+                m_retired.erase(ma);
+            }
+            // a library loaded for a location which was changed again by a
+            // concurrent reload() isn't used. it is unloaded below
+            for ( const auto& ma : loaded ) {
+                if ( ma != nullptr && std::none_of(m_ma_map.begin(), m_ma_map.end(), [&](const auto& v) { return v.second == ma; }) ) {
+                    m_retired.emplace(ma);
+                }
+            }
+
+            for ( auto it = m_retired.begin(); it != m_retired.end(); ) {
+                if ( (*it)->live_objects() == 0 && !(*it)->pinned() ) {
+                    m_loader.unload(*it);
+                    idle.emplace_back(*it);
+                    it = m_retired.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            for ( auto& ma : idle ) {
+                TAI_INFO("unloading unused library: %s", ma->name().c_str());
+                ma->tai_api_uninitialize();
+            }
+        }
+
+        TAI_INFO("reloaded %s: %lu locations removed, %lu added", m_config_file.c_str(), removed.size(), added.size());
+        if ( m_module_presence != nullptr ) {
+            for ( const auto& location : removed ) {
+                m_module_presence(false, const_cast<char*>(location.c_str()));
+            }
+            for ( const auto& location : added ) {
+                m_module_presence(true, const_cast<char*>(location.c_str()));
+            }
+        }
+        return 0;
+    }
+
+    // watches the directory since editors and configuration management tools
+    // usually replace the file instead of writing it in place
+    int StaticPlatformAdapter::watch_config() {
+        auto fd = inotify_init1(IN_CLOEXEC);
+        if ( fd < 0 ) {
+            TAI_ERROR("inotify_init1 failed: %s", std::strerror(errno));
+            return -1;
+        }
+        auto pos = m_config_file.rfind('/');
+        auto dir = pos == std::string::npos ? std::string(".") : m_config_file.substr(0, pos);
+        if ( inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM) < 0 ) {
+            TAI_ERROR("failed to watch %s: %s", dir.c_str(), std::strerror(errno));
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void StaticPlatformAdapter::watch_loop() {
+        auto fd = m_watch_fd;
+        auto pos = m_config_file.rfind('/');
+        auto name = pos == std::string::npos ? m_config_file : m_config_file.substr(pos + 1);
+
+        struct pollfd fds[] = {{m_watch_event, POLLIN, 0}, {fd, POLLIN, 0}};
+        alignas(struct inotify_event) char buf[4096];
+        while ( true ) {
+            if ( poll(fds, 2, -1) < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                TAI_ERROR("poll failed: %s", std::strerror(errno));
+                break;
+            }
+            if ( fds[0].revents & POLLIN ) {
+                break;
+            }
+            auto n = read(fd, buf, sizeof(buf));
+            if ( n <= 0 ) {
+                continue;
+            }
+            bool changed = false;
+            for ( char* p = buf; p < buf + n; ) {
+                auto ev = reinterpret_cast<struct inotify_event*>(p);
+                if ( ev->len > 0 && name == ev->name && !(ev->mask & (IN_DELETE | IN_MOVED_FROM)) ) {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+            if ( changed ) {
+                reload();
+            }
+        }
+    }
+
+    void StaticPlatformAdapter::unload_idle_loop() {
+        auto interval = std::max(m_idle_timeout / 2, std::chrono::seconds(1));
+        while ( true ) {
+            {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                if ( m_cv.wait_for(lk, interval, [this]{ return m_stop; }) ) {
+                    return;
+                }
+            }
+            unload_idle();
+        }
+    }
+
+    // a library is idle when it has no objects and nobody holds it since
+    // get_module_adapter(). both are counted by live_objects(), and the
+    // library is acquired under m_mutex, so it can't be unloaded in between
+    void StaticPlatformAdapter::unload_idle() {
+        auto now = std::chrono::steady_clock::now();
+        // uninitialization is done under m_mutex so that the library isn't loaded
+        // again by get_module_adapter() before it finishes
+        std::unique_lock<std::mutex> lk(m_mutex);
+        std::unordered_set<S_ModuleAdapter> set(m_retired);
+        for ( auto m : m_ma_map ) {
+            set.emplace(m.second);
+        }
+        for ( auto& ma : set ) {
+            if ( ma->live_objects() > 0 || ma->pinned() ) {
+                m_idle.erase(ma.get());
+                continue;
+            }
+            auto it = m_idle.emplace(ma.get(), now).first;
+            if ( now - it->second < m_idle_timeout ) {
+                continue;
+            }
+            TAI_INFO("unloading idle library: %s", ma->name().c_str());
+            m_idle.erase(it);
+            for ( auto m = m_ma_map.begin(); m != m_ma_map.end(); ) {
+                if ( m->second == ma ) {
+                    m = m_ma_map.erase(m);
+                } else {
+                    ++m;
+                }
+            }
+            m_retired.erase(ma);
+            m_loader.unload(ma);
+            ma->tai_api_uninitialize();
         }
     }
 }
@@ -6,6 +6,9 @@
 #include <cstdlib>
 #include <fstream>
 #include <string>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
 
 #include "platform_adapter.hpp"
 #include "module_adapter.hpp"
@@ -19,28 +22,56 @@ namespace tai::mux {
     const std::string TAI_MUX_STATIC_CONFIG_FILE = "TAI_MUX_STATIC_CONFIG_FILE";
     const std::string TAI_MUX_STATIC_DEFAULT_CONFIG = "/etc/tai/mux/static.json";
 
+    // "eager" (default) loads every library in the configuration at startup.
+    // "lazy" loads a library when a module which uses it is created
+    const std::string TAI_MUX_STATIC_LOAD_POLICY = "TAI_MUX_STATIC_LOAD_POLICY";
+    // when set, libraries without objects are unloaded after being idle for this many seconds
+    const std::string TAI_MUX_STATIC_IDLE_UNLOAD_TIMEOUT = "TAI_MUX_STATIC_IDLE_UNLOAD_TIMEOUT";
+    // when set to "true", changes to the configuration file are applied without restarting
+    const std::string TAI_MUX_STATIC_WATCH_CONFIG = "TAI_MUX_STATIC_WATCH_CONFIG";
+
     class StaticPlatformAdapter : public PlatformAdapter {
         public:
             StaticPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services);
             ~StaticPlatformAdapter();
-            S_ModuleAdapter get_module_adapter(const std::string& location) {
-                return m_ma_map[location];
-            };
-            const std::unordered_set<S_ModuleAdapter> list_module_adapters() {
-                std::unordered_set<S_ModuleAdapter> set;
-                for ( auto m : m_ma_map ) {
-                    set.emplace(m.second);
-                }
-                return set;
-            };
+            S_ModuleAdapter get_module_adapter(const std::string& location);
+            const std::unordered_set<S_ModuleAdapter> list_module_adapters();
+
+            // applies the current content of the configuration file
+            int reload();
 
             virtual tai_mux_platform_adapter_type_t type() const  {
                 return TAI_MUX_PLATFORM_ADAPTER_TYPE_STATIC;
             }
         private:
-            std::map<std::string, S_ModuleAdapter> m_ma_map;
+            void unload_idle_loop();
+            void unload_idle();
+            // returns an inotify fd watching the directory of m_config_file, or -1
+            int watch_config();
+            void watch_loop();
+
+            std::string m_config_file;
+            bool m_lazy;
+            std::map<std::string, std::string> m_lib_map; // location to library name, from the configuration
+            std::map<std::string, S_ModuleAdapter> m_ma_map; // location to loaded library
+            // libraries no longer in the configuration which still have objects
+            std::unordered_set<S_ModuleAdapter> m_retired;
+            std::mutex m_mutex; // guards m_lib_map, m_ma_map, m_retired and m_idle
             std::thread m_th;
             tai_service_method_table_t m_services;
+            tai_module_presence_fn m_module_presence = nullptr;
+            ModuleAdapterLoader m_loader;
+
+            // idle unloading, only used when TAI_MUX_STATIC_IDLE_UNLOAD_TIMEOUT is set
+            std::chrono::seconds m_idle_timeout {0};
+            std::map<ModuleAdapter*, std::chrono::steady_clock::time_point> m_idle; // since when a library is idle
+            std::condition_variable m_cv;
+            bool m_stop = false;
+
+            // configuration file watcher, only used when TAI_MUX_STATIC_WATCH_CONFIG is set
+            std::thread m_watch_th;
+            int m_watch_event = -1; // wakes up m_watch_th to stop it
+            int m_watch_fd = -1; // inotify on the directory of m_config_file
     };
 
 };
@@ -0,0 +1,52 @@
+#ifndef __TAI_MUX__
+#define __TAI_MUX__
+
+#include <tai.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A get request of tai_mux_get_attributes_bulk()
+ */
+typedef struct _tai_mux_get_request_t
+{
+    /** @brief The object to get the attributes of */
+    tai_object_id_t oid;
+
+    /** @brief The attributes to get */
+    uint32_t attr_count;
+    tai_attribute_t *attr_list;
+
+    /** @brief The result of the request, set by tai_mux_get_attributes_bulk() */
+    tai_status_t status;
+} tai_mux_get_request_t;
+
+/**
+ * @brief Get the attributes of multiple objects at once
+ *
+ * Requests for objects handled by different TAI libraries are processed in
+ * parallel. Requests for objects of the same TAI library are processed one
+ * after another in the given order.
+ *
+ * @param[in] count The number of requests
+ * @param[inout] requests The requests. The result of each request is set to its status
+ *
+ * @return #TAI_STATUS_SUCCESS when all requests were processed, the status of
+ * each request tells whether it succeeded. #TAI_STATUS_UNINITIALIZED when
+ * libtai-mux.so is not initialized
+ */
+tai_status_t tai_mux_get_attributes_bulk(
+        _In_ uint32_t count,
+        _Inout_ tai_mux_get_request_t *requests);
+
+typedef tai_status_t (*tai_mux_get_attributes_bulk_fn)(
+        _In_ uint32_t count,
+        _Inout_ tai_mux_get_request_t *requests);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __BENCH_HPP__
+#define __BENCH_HPP__
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace bench {
+
+    using clock = std::chrono::steady_clock;
+
+    // run fn() n times and return the average latency in nanoseconds
+    template<typename F>
+    double measure(uint64_t n, F&& fn) {
+        auto start = clock::now();
+        for ( uint64_t i = 0; i < n; i++ ) {
+            fn(i);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        return double(elapsed.count()) / double(n);
+    }
+
+    // results are emitted as one JSON object per line so that they can be
+    // collected and compared by a script
+    inline void report(const std::string& bench, const std::string& variant, uint64_t objects, double ns_per_op) {
+        std::printf("{\"bench\": \"%s\", \"variant\": \"%s\", \"objects\": %lu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}\n",
+                bench.c_str(), variant.c_str(), static_cast<unsigned long>(objects), ns_per_op, 1e9 / ns_per_op);
+        std::fflush(stdout);
+    }
+
+    // keep the optimizer from discarding benchmarked results
+    template<typename T>
+    inline void do_not_optimize(const T& v) {
+        asm volatile("" : : "g"(v) : "memory");
+    }
+
+};
+
+#endif
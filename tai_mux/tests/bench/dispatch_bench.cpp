@@ -0,0 +1,118 @@
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "bench.hpp"
+#include "object_table.hpp"
+
+// compares the per call lookups the TAI framework makes through the mux
+// Platform, get_object_type() and get_module_id(), of a locked std::map with
+// a dynamic_pointer_cast as the mux did before against ObjectTable
+//
+// the objects are modules with two interfaces each, looked up in a
+// scattered order. OIDs are built like OIDAllocator does.
+
+struct FakeObject {
+    virtual ~FakeObject() {}
+    virtual tai_object_type_t type() const = 0;
+};
+
+struct FakeModule : FakeObject {
+    FakeModule(tai_object_id_t id) : id(id) {}
+    tai_object_type_t type() const {
+        return TAI_OBJECT_TYPE_MODULE;
+    }
+    tai_object_id_t id;
+};
+
+struct FakeNetIf : FakeObject {
+    FakeNetIf(std::shared_ptr<FakeModule> module) : module(module) {}
+    tai_object_type_t type() const {
+        return TAI_OBJECT_TYPE_NETWORKIF;
+    }
+    std::shared_ptr<FakeModule> module;
+};
+
+static const uint32_t MAX_OBJECTS = 1 << 20;
+static const uint64_t NUM_ITERATIONS = 1000000;
+
+static tai_object_id_t oid_of(tai_object_type_t type, uint32_t index) {
+    return uint64_t(type) << 48 | index;
+}
+
+static uint32_t index_of(tai_object_id_t oid) {
+    return static_cast<uint32_t>(oid);
+}
+
+static void run(uint32_t modules) {
+    std::shared_mutex mutex;
+    std::map<tai_object_id_t, std::shared_ptr<FakeObject>> map;
+    tai::mux::ObjectTable<FakeObject, MAX_OBJECTS> table;
+    std::vector<tai_object_id_t> oids;
+
+    uint32_t index = 0;
+    for ( uint32_t i = 0; i < modules; i++ ) {
+        auto module_id = oid_of(TAI_OBJECT_TYPE_MODULE, index++);
+        auto module = std::make_shared<FakeModule>(module_id);
+        map[module_id] = module;
+        table.insert(index_of(module_id), module_id, TAI_OBJECT_TYPE_MODULE, module_id, module);
+        oids.emplace_back(module_id);
+        for ( int j = 0; j < 2; j++ ) {
+            auto netif_id = oid_of(TAI_OBJECT_TYPE_NETWORKIF, index++);
+            auto netif = std::make_shared<FakeNetIf>(module);
+            map[netif_id] = netif;
+            table.insert(index_of(netif_id), netif_id, TAI_OBJECT_TYPE_NETWORKIF, module_id, netif);
+            oids.emplace_back(netif_id);
+        }
+    }
+    auto objects = oids.size();
+
+    auto ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto id = oids[(i * 7919) % objects];
+        std::shared_lock<std::shared_mutex> lk(mutex);
+        auto it = map.find(id);
+        tai_object_id_t module_id = TAI_NULL_OBJECT_ID;
+        if ( it != map.end() ) {
+            if ( it->second->type() == TAI_OBJECT_TYPE_MODULE ) {
+                module_id = std::dynamic_pointer_cast<FakeModule>(it->second)->id;
+            } else {
+                module_id = std::dynamic_pointer_cast<FakeNetIf>(it->second)->module->id;
+            }
+        }
+        bench::do_not_optimize(module_id);
+    });
+    bench::report("get_module_id", "map", objects, ns);
+
+    ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto id = oids[(i * 7919) % objects];
+        tai_object_id_t module_id = TAI_NULL_OBJECT_ID;
+        table.find(index_of(id), id, nullptr, &module_id);
+        bench::do_not_optimize(module_id);
+    });
+    bench::report("get_module_id", "object_table", objects, ns);
+
+    ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto id = oids[(i * 7919) % objects];
+        std::shared_lock<std::shared_mutex> lk(mutex);
+        auto it = map.find(id);
+        bench::do_not_optimize(it == map.end() ? TAI_OBJECT_TYPE_NULL : it->second->type());
+    });
+    bench::report("get_object_type", "map", objects, ns);
+
+    ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto id = oids[(i * 7919) % objects];
+        auto type = TAI_OBJECT_TYPE_NULL;
+        table.find(index_of(id), id, &type, nullptr);
+        bench::do_not_optimize(type);
+    });
+    bench::report("get_object_type", "object_table", objects, ns);
+}
+
+int main() {
+    for ( uint32_t modules : {16, 256, 4096} ) {
+        run(modules);
+    }
+    return 0;
+}
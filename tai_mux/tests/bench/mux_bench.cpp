@@ -0,0 +1,385 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "tai.h"
+#include "custom_attrs/mux_module.h"
+#include "../custom_a/module.h"
+
+// measures the overhead of libtai-mux.so against calling a TAI library directly
+//
+// variants
+// - direct: libtai-a.so is called directly
+// - static: libtai-mux.so with the static platform adapter
+// - exec: libtai-mux.so with the exec platform adapter
+// - exec-coprocess: libtai-mux.so with the exec platform adapter in coprocess mode
+// - static-isolated: libtai-mux.so with the static platform adapter, the TAI
+//   libraries run in tai-mux-host processes. set TAI_BENCH_HOST_PROGRAM to the
+//   program (default: ../../host/tai-mux-host). notify is skipped since the
+//   handlers of the TAI library are in the host process
+//
+// benchmarks
+// - startup: loading the library, initializing it and creating a module at
+//   every location. "objects" is the number of locations
+// - create_remove: creating and removing a module
+// - get_*, set_*: getting and setting a scalar (bool), a list (u32 list) and
+//   an OID attribute of a module
+// - notify: delivering a notification from the TAI library to the host
+//
+// the mux platform adapters are configured by this benchmark. libtai-a.so and
+// libtai-b.so are used alternately per location. set TAI_BENCH_LIBRARY and
+// TAI_BENCH_MUX_LIBRARY to choose the libraries (default: libtai-a.so and libtai.so).
+// every measurement runs in its own process so that the libraries start clean.
+// a benchmark which the TAI library doesn't support is skipped.
+
+static const uint64_t NUM_CALLS = 100000;
+static const uint64_t NUM_CREATES = 1000;
+static const uint64_t NUM_NOTIFICATIONS = 1000000;
+static const std::vector<int> STARTUP_LOCATIONS = {1, 4, 16, 64};
+
+static std::string s_dir; // holds the configuration of the platform adapters
+
+typedef tai_status_t (*tai_api_initialize_fn) (uint64_t, const tai_service_method_table_t *);
+typedef tai_status_t (*tai_api_query_fn) (tai_api_t, void**);
+typedef tai_status_t (*tai_api_uninitialize_fn) (void);
+
+static void module_presence(bool present, char* location) {}
+
+struct Library {
+    void* dl = nullptr;
+    tai_api_uninitialize_fn uninitialize = nullptr;
+    tai_module_api_t* module = nullptr;
+    tai_network_interface_api_t* netif = nullptr;
+
+    int load(const std::string& name) {
+        dl = dlopen(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if ( dl == nullptr ) {
+            std::fprintf(stderr, "failed to load %s: %s\n", name.c_str(), dlerror());
+            return -1;
+        }
+        auto initialize = reinterpret_cast<tai_api_initialize_fn>(dlsym(dl, "tai_api_initialize"));
+        auto query = reinterpret_cast<tai_api_query_fn>(dlsym(dl, "tai_api_query"));
+        uninitialize = reinterpret_cast<tai_api_uninitialize_fn>(dlsym(dl, "tai_api_uninitialize"));
+        if ( initialize == nullptr || query == nullptr || uninitialize == nullptr ) {
+            std::fprintf(stderr, "%s is not a TAI library\n", name.c_str());
+            return -1;
+        }
+        tai_service_method_table_t services = {};
+        services.module_presence = module_presence;
+        if ( initialize(0, &services) != TAI_STATUS_SUCCESS ) {
+            std::fprintf(stderr, "failed to initialize %s\n", name.c_str());
+            return -1;
+        }
+        if ( query(TAI_API_MODULE, reinterpret_cast<void**>(&module)) != TAI_STATUS_SUCCESS || module == nullptr ) {
+            return -1;
+        }
+        query(TAI_API_NETWORKIF, reinterpret_cast<void**>(&netif));
+        return 0;
+    }
+
+    tai_status_t create_module(const std::string& location, tai_object_id_t* id) {
+        tai_attribute_t attr;
+        attr.id = TAI_MODULE_ATTR_LOCATION;
+        attr.value.charlist.count = location.size();
+        attr.value.charlist.list = const_cast<char*>(location.c_str());
+        return module->create_module(id, 1, &attr);
+    }
+};
+
+struct Variant {
+    std::string name;
+    bool mux;
+    std::string platform_adapter;
+    std::string exec_mode;
+    bool host_process;
+};
+
+static std::string location_of(int i) {
+    return std::to_string(i);
+}
+
+static std::string library_of(int i) {
+    return i % 2 == 0 ? "libtai-a.so" : "libtai-b.so";
+}
+
+// the static configuration and the exec script both report locations 0 .. n-1
+static int configure(const Variant& v, int n) {
+    if ( !v.mux ) {
+        return 0;
+    }
+    auto config = s_dir + "/static.json";
+    std::ofstream c(config);
+    c << "{";
+    for ( int i = 0; i < n; i++ ) {
+        c << (i > 0 ? ", " : "") << "\"" << location_of(i) << "\": \"" << library_of(i) << "\"";
+    }
+    c << "}\n";
+    c.close();
+
+    auto script = s_dir + "/exec.sh";
+    std::ofstream s(script);
+    s << "#!/bin/sh\n";
+    s << "lib() { if [ $(($1 % 2)) -eq 0 ]; then echo libtai-a.so; else echo libtai-b.so; fi; }\n";
+    s << "case \"$1\" in\n";
+    s << "list) seq 0 " << n - 1 << ";;\n";
+    s << "serve)\n";
+    s << "  while read req loc; do\n";
+    s << "    case \"$req\" in\n";
+    s << "    list) seq 0 " << n - 1 << "; echo .;;\n";
+    s << "    resolve) echo \"ok $(lib $loc)\";;\n";
+    s << "    resolve-all) for l in $(seq 0 " << n - 1 << "); do echo \"$l $(lib $l)\"; done; echo .;;\n";
+    s << "    *) echo \"err unknown request\";;\n";
+    s << "    esac\n";
+    s << "  done;;\n";
+    s << "*) lib $1;;\n";
+    s << "esac\n";
+    s.close();
+    chmod(script.c_str(), 0755);
+
+    setenv("TAI_MUX_PLATFORM_ADAPTER", v.platform_adapter.c_str(), 1);
+    setenv("TAI_MUX_STATIC_CONFIG_FILE", config.c_str(), 1);
+    setenv("TAI_MUX_EXEC_SCRIPT", script.c_str(), 1);
+    if ( v.exec_mode.empty() ) {
+        unsetenv("TAI_MUX_EXEC_MODE");
+    } else {
+        setenv("TAI_MUX_EXEC_MODE", v.exec_mode.c_str(), 1);
+    }
+    if ( v.host_process ) {
+        auto e = std::getenv("TAI_BENCH_HOST_PROGRAM");
+        setenv("TAI_MUX_ISOLATED_LIBRARIES", "libtai-a.so,libtai-b.so", 1);
+        setenv("TAI_MUX_HOST_PROGRAM", e != nullptr ? e : "../../host/tai-mux-host", 1);
+    } else {
+        unsetenv("TAI_MUX_ISOLATED_LIBRARIES");
+    }
+    return 0;
+}
+
+static std::string library(const Variant& v) {
+    auto e = std::getenv(v.mux ? "TAI_BENCH_MUX_LIBRARY" : "TAI_BENCH_LIBRARY");
+    if ( e != nullptr ) {
+        return e;
+    }
+    return v.mux ? "libtai.so" : "libtai-a.so";
+}
+
+// runs fn in a child process and waits for it
+static void isolated(std::function<int()> fn) {
+    std::fflush(stdout);
+    auto pid = fork();
+    if ( pid == 0 ) {
+        auto ret = fn();
+        std::fflush(stdout);
+        _exit(ret);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+static int startup(const Variant& v, int n) {
+    configure(v, n);
+    auto start = bench::clock::now();
+    Library lib;
+    if ( lib.load(library(v)) != 0 ) {
+        return 1;
+    }
+    std::vector<tai_object_id_t> modules;
+    for ( int i = 0; i < n; i++ ) {
+        tai_object_id_t id;
+        if ( lib.create_module(location_of(i), &id) == TAI_STATUS_SUCCESS ) {
+            modules.emplace_back(id);
+        }
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench::clock::now() - start).count();
+    if ( modules.size() != static_cast<size_t>(n) ) {
+        std::fprintf(stderr, "%s: created %zu of %d modules\n", v.name.c_str(), modules.size(), n);
+    }
+    bench::report("startup", v.name, n, double(ns));
+    for ( auto id : modules ) {
+        lib.module->remove_module(id);
+    }
+    lib.uninitialize();
+    return 0;
+}
+
+static void notification_handler(void* context, tai_object_id_t oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
+    auto count = static_cast<uint64_t*>(context);
+    (*count) += attr_count;
+}
+
+// the handler libtai-a.so got for the module. with the mux it is the one
+// installed by the mux, which is found through the real OID of the module
+static int vendor_handler(const Variant& v, Library& lib, tai_object_id_t id, tai_notification_handler_t* handler, tai_object_id_t* real_id) {
+    auto vendor = &lib;
+    Library direct;
+    *real_id = id;
+    if ( v.mux ) {
+        tai_attribute_t attr;
+        attr.id = TAI_MODULE_ATTR_MUX_REAL_OID;
+        if ( lib.module->get_module_attributes(id, 1, &attr) != TAI_STATUS_SUCCESS ) {
+            return -1;
+        }
+        *real_id = attr.value.oid;
+        // the library is already loaded by the mux
+        direct.dl = dlopen("libtai-a.so", RTLD_NOW | RTLD_NOLOAD);
+        if ( direct.dl == nullptr ) {
+            return -1;
+        }
+        auto query = reinterpret_cast<tai_api_query_fn>(dlsym(direct.dl, "tai_api_query"));
+        if ( query == nullptr || query(TAI_API_MODULE, reinterpret_cast<void**>(&direct.module)) != TAI_STATUS_SUCCESS ) {
+            return -1;
+        }
+        vendor = &direct;
+    }
+    tai_attribute_t attr;
+    attr.id = TAI_MODULE_ATTR_NOTIFY;
+    if ( vendor->module->get_module_attributes(*real_id, 1, &attr) != TAI_STATUS_SUCCESS || attr.value.notification.notify == nullptr ) {
+        return -1;
+    }
+    *handler = attr.value.notification;
+    return 0;
+}
+
+static int hot_path(const Variant& v) {
+    configure(v, 2);
+    Library lib;
+    if ( lib.load(library(v)) != 0 ) {
+        return 1;
+    }
+
+    // location 1 uses libtai-b.so with the mux, but is only used for creation
+    auto ns = bench::measure(NUM_CREATES, [&](uint64_t) {
+        tai_object_id_t id;
+        if ( lib.create_module(location_of(1), &id) == TAI_STATUS_SUCCESS ) {
+            lib.module->remove_module(id);
+        }
+    });
+    bench::report("create_remove", v.name, 1, ns);
+
+    tai_object_id_t module_id;
+    if ( lib.create_module(location_of(0), &module_id) != TAI_STATUS_SUCCESS ) {
+        std::fprintf(stderr, "%s: failed to create a module\n", v.name.c_str());
+        return 1;
+    }
+    tai_object_id_t netif_id = TAI_NULL_OBJECT_ID;
+    if ( lib.netif != nullptr ) {
+        tai_attribute_t attr;
+        attr.id = TAI_NETWORK_INTERFACE_ATTR_INDEX;
+        attr.value.u32 = 0;
+        lib.netif->create_network_interface(&netif_id, module_id, 1, &attr);
+    }
+
+    std::vector<uint32_t> values(16, 1), buffer(16);
+    tai_attribute_t scalar, list, oid;
+    scalar.id = TAI_MODULE_ATTR_CUSTOM;
+    scalar.value.booldata = true;
+    list.id = TAI_MODULE_ATTR_CUSTOM_LIST;
+    list.value.u32list.count = values.size();
+    list.value.u32list.list = values.data();
+    oid.id = TAI_MODULE_ATTR_CUSTOM_OID;
+    oid.value.oid = netif_id;
+
+    struct Case {
+        std::string name;
+        tai_attribute_t* attr;
+        bool needs_netif;
+    };
+    for ( auto& c : std::vector<Case>{{"scalar", &scalar, false}, {"list", &list, false}, {"oid", &oid, true}} ) {
+        if ( c.needs_netif && netif_id == TAI_NULL_OBJECT_ID ) {
+            std::fprintf(stderr, "%s: skipping %s, no network interface\n", v.name.c_str(), c.name.c_str());
+            continue;
+        }
+        tai_attribute_t get;
+        get.id = c.attr->id;
+        get.value.u32list.count = buffer.size();
+        get.value.u32list.list = buffer.data();
+        if ( lib.module->set_module_attributes(module_id, 1, c.attr) != TAI_STATUS_SUCCESS ||
+             lib.module->get_module_attributes(module_id, 1, &get) != TAI_STATUS_SUCCESS ) {
+            std::fprintf(stderr, "%s: skipping %s, the attribute isn't supported\n", v.name.c_str(), c.name.c_str());
+            continue;
+        }
+        auto ns = bench::measure(NUM_CALLS, [&](uint64_t) {
+            lib.module->set_module_attributes(module_id, 1, c.attr);
+        });
+        bench::report("set_" + c.name, v.name, 1, ns);
+
+        // the buffer is for the list, the other values just overwrite it
+        ns = bench::measure(NUM_CALLS, [&](uint64_t) {
+            get.value.u32list.count = buffer.size();
+            get.value.u32list.list = buffer.data();
+            lib.module->get_module_attributes(module_id, 1, &get);
+        });
+        bench::report("get_" + c.name, v.name, 1, ns);
+        bench::do_not_optimize(get);
+    }
+
+    // notifications are generated by calling the handler the TAI library got
+    // from the host, or from the mux, as the TAI library would do
+    uint64_t received = 0;
+    tai_attribute_t notify;
+    notify.id = TAI_MODULE_ATTR_NOTIFY;
+    notify.value.notification.context = &received;
+    notify.value.notification.notify = notification_handler;
+    tai_notification_handler_t handler;
+    tai_object_id_t real_id;
+    if ( lib.module->set_module_attributes(module_id, 1, &notify) != TAI_STATUS_SUCCESS || vendor_handler(v, lib, module_id, &handler, &real_id) != 0 ) {
+        std::fprintf(stderr, "%s: skipping notify, the notification handler isn't available\n", v.name.c_str());
+    } else {
+        std::vector<tai_attribute_t> attrs(3);
+        attrs[0].id = TAI_MODULE_ATTR_OPER_STATUS;
+        attrs[0].value.u32 = 1;
+        attrs[1].id = TAI_MODULE_ATTR_TEMP;
+        attrs[1].value.flt = 40.0;
+        attrs[2].id = TAI_MODULE_ATTR_POWER;
+        attrs[2].value.flt = 3.3;
+        auto ns = bench::measure(NUM_NOTIFICATIONS, [&](uint64_t) {
+            handler.notify(handler.context, real_id, attrs.size(), attrs.data());
+        });
+        bench::report("notify", v.name, attrs.size(), ns);
+        bench::do_not_optimize(received);
+        notify.value.notification.notify = nullptr;
+        lib.module->set_module_attributes(module_id, 1, &notify);
+    }
+
+    if ( netif_id != TAI_NULL_OBJECT_ID ) {
+        lib.netif->remove_network_interface(netif_id);
+    }
+    lib.module->remove_module(module_id);
+    lib.uninitialize();
+    return 0;
+}
+
+int main() {
+    char dir[] = "/tmp/mux_bench.XXXXXX";
+    if ( mkdtemp(dir) == nullptr ) {
+        return 1;
+    }
+    s_dir = dir;
+
+    std::vector<Variant> variants = {
+        {"direct", false, "", "", false},
+        {"static", true, "static", "", false},
+        {"exec", true, "exec", "", false},
+        {"exec-coprocess", true, "exec", "coprocess", false},
+        {"static-isolated", true, "static", "", true},
+    };
+    for ( const auto& v : variants ) {
+        for ( auto n : STARTUP_LOCATIONS ) {
+            isolated([&]{ return startup(v, n); });
+        }
+        isolated([&]{ return hot_path(v); });
+    }
+
+    unlink((s_dir + "/static.json").c_str());
+    unlink((s_dir + "/exec.sh").c_str());
+    rmdir(s_dir.c_str());
+    return 0;
+}
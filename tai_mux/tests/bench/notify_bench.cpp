@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+
+#include "bench.hpp"
+#include "platform_adapter.hpp"
+#include "module_adapter.hpp"
+
+// measures the notifications/sec PlatformAdapter::notify can forward.
+// "legacy" is the former implementation which deep copied every attribute,
+// "notify" is the current one.
+//
+// the TAI library is only loaded for its metadata, no module is created.
+// set TAI_BENCH_LIBRARY to choose it (default: libtai-a.so)
+
+using namespace tai::mux;
+
+static const uint64_t NUM_NOTIFICATIONS = 1000000;
+
+class BenchPlatformAdapter : public PlatformAdapter {
+    public:
+        BenchPlatformAdapter(S_ModuleAdapter adapter) : m_adapter(adapter) {}
+        S_ModuleAdapter get_module_adapter(const std::string& location) {
+            m_adapter->acquire();
+            return m_adapter;
+        }
+        const std::unordered_set<S_ModuleAdapter> list_module_adapters() {
+            return {m_adapter};
+        }
+        tai_mux_platform_adapter_type_t type() const {
+            return TAI_MUX_PLATFORM_ADAPTER_TYPE_UNKNOWN;
+        }
+
+        void legacy_notify(NotificationContext* ctx, tai_object_id_t real_oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
+            auto oid = ctx->muxed_oid;
+            std::vector<S_Attribute> attrs;
+            S_ModuleAdapter adapter;
+            if ( get_mapping(oid, &adapter, nullptr) < 0 ) {
+                return;
+            }
+            for (int i = 0; i < static_cast<int>(attr_count); i++) {
+                auto src = attr_list[i];
+                auto meta = adapter->get_attr_metadata(ctx->object_type, src.id);
+                if ( meta == nullptr ) {
+                    continue;
+                }
+                auto dst = std::make_shared<Attribute>(meta, src);
+                if ( convert_oid(ctx->object_type, oid, dst, dst, true) != TAI_STATUS_SUCCESS ) {
+                    continue;
+                }
+                attrs.emplace_back(dst);
+            }
+            std::vector<tai_attribute_t> raw_attrs;
+            std::transform(attrs.begin(), attrs.end(), std::back_inserter(raw_attrs), [](S_Attribute a) { return *a->raw(); });
+            std::unique_lock<std::mutex> lk(ctx->mutex);
+            ctx->real_handler.notify(ctx->real_handler.context, oid, raw_attrs.size(), raw_attrs.data());
+        }
+    private:
+        S_ModuleAdapter m_adapter;
+};
+
+static void handler(void* context, tai_object_id_t oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
+    auto count = static_cast<uint64_t*>(context);
+    (*count) += attr_count;
+}
+
+int main() {
+    std::string lib = "libtai-a.so";
+    auto e = std::getenv("TAI_BENCH_LIBRARY");
+    if ( e != nullptr ) {
+        lib = e;
+    }
+    tai_service_method_table_t services{};
+    auto adapter = std::make_shared<ModuleAdapter>(lib, 0, &services);
+    BenchPlatformAdapter pa(adapter);
+
+    const tai_object_id_t real_module_id = 1;
+    tai_object_id_t module_id;
+    if ( pa.create_mapping(&module_id, TAI_OBJECT_TYPE_MODULE, adapter, real_module_id) != 0 ) {
+        return 1;
+    }
+
+    uint64_t received = 0;
+    NotificationContext ctx;
+    ctx.pa = &pa;
+    ctx.real_handler = {&received, handler};
+    ctx.muxed_oid = module_id;
+    ctx.object_type = TAI_OBJECT_TYPE_MODULE;
+
+    // a typical PM style notification, no OIDs
+    std::vector<tai_attribute_t> scalars(3);
+    scalars[0].id = TAI_MODULE_ATTR_OPER_STATUS;
+    scalars[0].value.u32 = 1;
+    scalars[1].id = TAI_MODULE_ATTR_TEMP;
+    scalars[1].value.flt = 40.0;
+    scalars[2].id = TAI_MODULE_ATTR_POWER;
+    scalars[2].value.flt = 3.3;
+
+    // the same with an attribute which needs OID translation
+    auto with_oid = scalars;
+    tai_attribute_t oid_attr;
+    oid_attr.id = TAI_MODULE_ATTR_MUX_REAL_OID;
+    oid_attr.value.oid = real_module_id;
+    with_oid.emplace_back(oid_attr);
+
+    for ( auto& c : std::vector<std::pair<std::string, std::vector<tai_attribute_t>*>>{{"scalar", &scalars}, {"with_oid", &with_oid}} ) {
+        auto& attrs = *c.second;
+        auto ns = bench::measure(NUM_NOTIFICATIONS, [&](uint64_t) {
+            pa.legacy_notify(&ctx, real_module_id, attrs.size(), attrs.data());
+        });
+        bench::report("notify_" + c.first, "legacy", attrs.size(), ns);
+
+        ns = bench::measure(NUM_NOTIFICATIONS, [&](uint64_t) {
+            pa.notify(&ctx, real_module_id, attrs.size(), attrs.data());
+        });
+        bench::report("notify_" + c.first, "notify", attrs.size(), ns);
+    }
+    bench::do_not_optimize(received);
+    return 0;
+}
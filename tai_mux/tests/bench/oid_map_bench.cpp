@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <memory>
+
+#include "bench.hpp"
+#include "oid_map.hpp"
+
+// compares the reverse lookup (adapter, real OID) -> muxed OID of the
+// linear scan formerly used by PlatformAdapter with OIDMapping
+
+struct FakeAdapter {};
+using S_FakeAdapter = std::shared_ptr<FakeAdapter>;
+
+static const int NUM_ADAPTERS = 4;
+static const uint64_t NUM_ITERATIONS = 200000;
+
+static tai_object_id_t linear_reverse(const std::map<tai_object_id_t, std::pair<tai_object_id_t, S_FakeAdapter>>& m, tai_object_id_t real_id, S_FakeAdapter adapter) {
+    for ( auto p : m ) {
+        if ( p.second.first == real_id && p.second.second == adapter ) {
+            return p.first;
+        }
+    }
+    return TAI_NULL_OBJECT_ID;
+}
+
+static void run(uint64_t objects) {
+    std::vector<S_FakeAdapter> adapters;
+    for ( int i = 0; i < NUM_ADAPTERS; i++ ) {
+        adapters.emplace_back(std::make_shared<FakeAdapter>());
+    }
+
+    std::map<tai_object_id_t, std::pair<tai_object_id_t, S_FakeAdapter>> linear;
+    tai::mux::OIDMapping<FakeAdapter> indexed;
+
+    for ( uint64_t i = 1; i <= objects; i++ ) {
+        auto& adapter = adapters[i % NUM_ADAPTERS];
+        tai_object_id_t real_id = 0x1000 + i;
+        linear[i] = {real_id, adapter};
+        indexed.insert(i, adapter, real_id);
+    }
+
+    // the linear scan is O(n), scale iterations down to keep runtime sane
+    auto n = std::max<uint64_t>(NUM_ITERATIONS / objects, 100);
+    auto ns = bench::measure(n, [&](uint64_t i) {
+        auto k = (i * 7919) % objects + 1;
+        bench::do_not_optimize(linear_reverse(linear, 0x1000 + k, adapters[k % NUM_ADAPTERS]));
+    });
+    bench::report("oid_reverse_lookup", "linear_map", objects, ns);
+
+    ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto k = (i * 7919) % objects + 1;
+        bench::do_not_optimize(indexed.find_reverse(0x1000 + k, adapters[k % NUM_ADAPTERS].get()));
+    });
+    bench::report("oid_reverse_lookup", "oid_mapping", objects, ns);
+
+    ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto k = (i * 7919) % objects + 1;
+        auto it = linear.find(k);
+        bench::do_not_optimize(it->second.first);
+    });
+    bench::report("oid_forward_lookup", "linear_map", objects, ns);
+
+    ns = bench::measure(NUM_ITERATIONS, [&](uint64_t i) {
+        auto k = (i * 7919) % objects + 1;
+        tai_object_id_t real_id;
+        indexed.find(k, &real_id, nullptr);
+        bench::do_not_optimize(real_id);
+    });
+    bench::report("oid_forward_lookup", "oid_mapping", objects, ns);
+}
+
+int main() {
+    for ( uint64_t objects : {256, 1024, 4096, 16384} ) {
+        run(objects);
+    }
+    return 0;
+}
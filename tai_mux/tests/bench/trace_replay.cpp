@@ -0,0 +1,291 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "trace.hpp"
+
+// replays a trace recorded with TAI_MUX_TRACE_FILE against a TAI library,
+// libtai-mux.so by default.
+//
+// usage: trace_replay [-l library] [-s speed] trace
+//
+// -s 1 (default) keeps the original timing between the calls, -s 2 replays
+// twice as fast and -s 0 as fast as possible. OIDs in the trace are mapped to
+// the ones of the objects created by the replay, and calls for objects whose
+// creation wasn't replayed are skipped. creations which failed and gets which
+// failed since the buffer was too small are skipped as well, they can't be
+// replayed as they were. the processes which appended to the trace are
+// replayed one after another.
+//
+// the latency per API is printed as one JSON object per line, followed by the
+// total time and the number of calls whose result differed from the recorded one.
+
+using namespace tai::mux;
+
+static std::atomic<uint64_t> s_notifications {0};
+
+static void module_presence(bool present, char* location) {}
+
+static void notification_handler(void* context, tai_object_id_t oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
+    s_notifications.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct Api {
+    tai_module_api_t* module;
+    tai_network_interface_api_t* netif;
+    tai_host_interface_api_t* hostif;
+};
+
+struct Stat {
+    uint64_t calls = 0;
+    uint64_t ns = 0;
+    uint64_t mismatched = 0;
+};
+
+static tai_status_t call(const Api& api, TraceRecord& r, tai_object_id_t oid, tai_object_id_t module_id, tai_object_id_t* created) {
+    auto count = static_cast<uint32_t>(r.attrs.size());
+    auto attrs = r.attrs.data();
+    switch (r.api) {
+    case TraceApi::CREATE:
+        switch (r.object_type) {
+        case TAI_OBJECT_TYPE_MODULE:
+            return api.module->create_module(created, count, attrs);
+        case TAI_OBJECT_TYPE_NETWORKIF:
+            return api.netif->create_network_interface(created, module_id, count, attrs);
+        case TAI_OBJECT_TYPE_HOSTIF:
+            return api.hostif->create_host_interface(created, module_id, count, attrs);
+        default:
+            return TAI_STATUS_NOT_SUPPORTED;
+        }
+    case TraceApi::REMOVE:
+        switch (r.object_type) {
+        case TAI_OBJECT_TYPE_MODULE:
+            return api.module->remove_module(oid);
+        case TAI_OBJECT_TYPE_NETWORKIF:
+            return api.netif->remove_network_interface(oid);
+        case TAI_OBJECT_TYPE_HOSTIF:
+            return api.hostif->remove_host_interface(oid);
+        default:
+            return TAI_STATUS_NOT_SUPPORTED;
+        }
+    case TraceApi::GET:
+        switch (r.object_type) {
+        case TAI_OBJECT_TYPE_MODULE:
+            return api.module->get_module_attributes(oid, count, attrs);
+        case TAI_OBJECT_TYPE_NETWORKIF:
+            return api.netif->get_network_interface_attributes(oid, count, attrs);
+        case TAI_OBJECT_TYPE_HOSTIF:
+            return api.hostif->get_host_interface_attributes(oid, count, attrs);
+        default:
+            return TAI_STATUS_NOT_SUPPORTED;
+        }
+    case TraceApi::SET:
+        switch (r.object_type) {
+        case TAI_OBJECT_TYPE_MODULE:
+            return api.module->set_module_attributes(oid, count, attrs);
+        case TAI_OBJECT_TYPE_NETWORKIF:
+            return api.netif->set_network_interface_attributes(oid, count, attrs);
+        case TAI_OBJECT_TYPE_HOSTIF:
+            return api.hostif->set_host_interface_attributes(oid, count, attrs);
+        default:
+            return TAI_STATUS_NOT_SUPPORTED;
+        }
+    case TraceApi::GET_CAPABILITIES:
+        {
+            std::vector<tai_attribute_capability_t> caps(count);
+            for ( uint32_t i = 0; i < count; i++ ) {
+                caps[i].id = attrs[i].id;
+            }
+            switch (r.object_type) {
+            case TAI_OBJECT_TYPE_MODULE:
+                return api.module->get_module_capabilities(oid, count, caps.data());
+            case TAI_OBJECT_TYPE_NETWORKIF:
+                return api.netif->get_network_interface_capabilities(oid, count, caps.data());
+            case TAI_OBJECT_TYPE_HOSTIF:
+                return api.hostif->get_host_interface_capabilities(oid, count, caps.data());
+            default:
+                return TAI_STATUS_NOT_SUPPORTED;
+            }
+        }
+    }
+    return TAI_STATUS_NOT_SUPPORTED;
+}
+
+int main(int argc, char* argv[]) {
+    std::string library = "libtai-mux.so";
+    double speed = 1.0;
+    int opt;
+    while ( (opt = getopt(argc, argv, "l:s:")) != -1 ) {
+        switch (opt) {
+        case 'l':
+            library = optarg;
+            break;
+        case 's':
+            speed = std::atof(optarg);
+            break;
+        default:
+            std::fprintf(stderr, "usage: %s [-l library] [-s speed] trace\n", argv[0]);
+            return 1;
+        }
+    }
+    if ( optind >= argc ) {
+        std::fprintf(stderr, "usage: %s [-l library] [-s speed] trace\n", argv[0]);
+        return 1;
+    }
+
+    TraceReader reader;
+    if ( reader.open(argv[optind]) != 0 ) {
+        std::fprintf(stderr, "failed to open trace %s\n", argv[optind]);
+        return 1;
+    }
+
+    // the library is loaded at runtime so that the same binary can replay
+    // against libtai-mux.so or a TAI library directly
+    auto lib = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if ( lib == nullptr ) {
+        std::fprintf(stderr, "failed to load %s: %s\n", library.c_str(), dlerror());
+        return 1;
+    }
+    auto initialize = reinterpret_cast<tai_status_t (*)(uint64_t, const tai_service_method_table_t*)>(dlsym(lib, "tai_api_initialize"));
+    auto query = reinterpret_cast<tai_status_t (*)(tai_api_t, void**)>(dlsym(lib, "tai_api_query"));
+    auto uninitialize = reinterpret_cast<tai_status_t (*)(void)>(dlsym(lib, "tai_api_uninitialize"));
+    if ( initialize == nullptr || query == nullptr || uninitialize == nullptr ) {
+        std::fprintf(stderr, "%s is not a TAI library\n", library.c_str());
+        return 1;
+    }
+
+    tai_service_method_table_t services = {};
+    services.module_presence = module_presence;
+    if ( initialize(0, &services) != TAI_STATUS_SUCCESS ) {
+        std::fprintf(stderr, "failed to initialize %s\n", library.c_str());
+        return 1;
+    }
+    Api api = {};
+    if ( query(TAI_API_MODULE, reinterpret_cast<void**>(&api.module)) != TAI_STATUS_SUCCESS ||
+         query(TAI_API_NETWORKIF, reinterpret_cast<void**>(&api.netif)) != TAI_STATUS_SUCCESS ||
+         query(TAI_API_HOSTIF, reinterpret_cast<void**>(&api.hostif)) != TAI_STATUS_SUCCESS ) {
+        std::fprintf(stderr, "failed to query the APIs of %s\n", library.c_str());
+        return 1;
+    }
+
+    static const char* names[] = {"create", "remove", "get", "set", "get_capabilities"};
+    std::map<TraceApi, Stat> stats;
+    std::unordered_map<tai_object_id_t, tai_object_id_t> oids; // recorded -> replayed
+    uint64_t skipped = 0, recorded_ns = 0;
+
+    auto map = [&](tai_object_id_t oid, bool* ok) -> tai_object_id_t {
+        auto it = oids.find(oid);
+        if ( it == oids.end() ) {
+            *ok = false;
+            return TAI_NULL_OBJECT_ID;
+        }
+        return it->second;
+    };
+
+    TraceRecord r;
+    auto begin = bench::clock::now();
+    auto session = begin;
+    uint64_t first_ns = 0;
+    while ( reader.next(r) ) {
+        // the time before the first call of a process isn't replayed, and
+        // the OIDs of one process mean nothing to the next one
+        if ( r.first ) {
+            session = bench::clock::now();
+            first_ns = r.start_ns;
+            oids.clear();
+        }
+        if ( speed > 0 && r.start_ns > first_ns ) {
+            std::this_thread::sleep_until(session + std::chrono::nanoseconds(static_cast<uint64_t>((r.start_ns - first_ns) / speed)));
+        }
+        recorded_ns += r.duration_ns;
+
+        // a failed creation recorded no OID to map, and the buffer of an
+        // overflowed get is sized to what the TAI library asked for
+        bool ok = !( r.api == TraceApi::CREATE && r.status != TAI_STATUS_SUCCESS ) &&
+                  !( r.api == TraceApi::GET && r.status == TAI_STATUS_BUFFER_OVERFLOW );
+        tai_object_id_t oid = TAI_NULL_OBJECT_ID, module_id = TAI_NULL_OBJECT_ID;
+        if ( r.api == TraceApi::CREATE ) {
+            if ( r.object_type != TAI_OBJECT_TYPE_MODULE ) {
+                module_id = map(r.module_id, &ok);
+            }
+        } else {
+            oid = map(r.oid, &ok);
+        }
+        // OIDs in the values given to the TAI library are mapped as well.
+        // values of a get are overwritten, so they are left as they are
+        for ( size_t i = 0; ok && r.api != TraceApi::GET && i < r.attrs.size(); i++ ) {
+            auto& v = r.attrs[i].value;
+            switch (r.value_types[i]) {
+            case TAI_ATTR_VALUE_TYPE_OID:
+                if ( v.oid != TAI_NULL_OBJECT_ID ) {
+                    v.oid = map(v.oid, &ok);
+                }
+                break;
+            case TAI_ATTR_VALUE_TYPE_OBJLIST:
+                for ( uint32_t j = 0; j < v.objlist.count; j++ ) {
+                    v.objlist.list[j] = map(v.objlist.list[j], &ok);
+                }
+                break;
+            case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+                for ( uint32_t j = 0; j < v.objmaplist.count; j++ ) {
+                    auto& m = v.objmaplist.list[j];
+                    m.key = map(m.key, &ok);
+                    for ( uint32_t k = 0; k < m.value.count; k++ ) {
+                        m.value.list[k] = map(m.value.list[k], &ok);
+                    }
+                }
+                break;
+            case TAI_ATTR_VALUE_TYPE_NOTIFICATION:
+                if ( v.notification.context != nullptr ) {
+                    v.notification.context = nullptr;
+                    v.notification.notify = notification_handler;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        if ( !ok ) {
+            skipped++;
+            continue;
+        }
+
+        tai_object_id_t created = TAI_NULL_OBJECT_ID;
+        auto start = bench::clock::now();
+        auto ret = call(api, r, oid, module_id, &created);
+        auto& stat = stats[r.api];
+        stat.calls++;
+        stat.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(bench::clock::now() - start).count();
+        if ( ret != r.status ) {
+            stat.mismatched++;
+        }
+        if ( r.api == TraceApi::CREATE && ret == TAI_STATUS_SUCCESS ) {
+            oids[r.oid] = created;
+        } else if ( r.api == TraceApi::REMOVE && ret == TAI_STATUS_SUCCESS ) {
+            oids.erase(r.oid);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench::clock::now() - begin).count();
+
+    uint64_t mismatched = 0;
+    for ( const auto& v : stats ) {
+        auto& s = v.second;
+        std::printf("{\"bench\": \"trace_replay\", \"api\": \"%s\", \"calls\": %lu, \"ns_per_op\": %.2f}\n",
+                names[static_cast<int>(v.first)], static_cast<unsigned long>(s.calls), double(s.ns) / double(s.calls));
+        mismatched += s.mismatched;
+    }
+    std::printf("{\"bench\": \"trace_replay\", \"elapsed_ns\": %lu, \"recorded_call_ns\": %lu, \"skipped\": %lu, \"mismatched\": %lu, \"notifications\": %lu}\n",
+            static_cast<unsigned long>(elapsed), static_cast<unsigned long>(recorded_ns), static_cast<unsigned long>(skipped),
+            static_cast<unsigned long>(mismatched), static_cast<unsigned long>(s_notifications.load()));
+
+    uninitialize();
+    return 0;
+}
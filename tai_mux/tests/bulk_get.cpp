@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "tai.h"
+#include "tai_mux.h"
+#include "custom_attrs/mux_module.h"
+
+// drives tai_mux_get_attributes_bulk() for TestBulkGet in test.py
+//
+// usage: bulk_get <location>...
+//
+// loads libtai-mux.so (TAI_TEST_MUX_LIBRARY, default: libtai.so) and creates
+// a module at every location, then removes the last one again. the location
+// and the loaded TAI library of every module, the removed one included, and of
+// an OID which never existed are got in one bulk call. the result of each
+// request is printed as a JSON line in the order of the requests
+
+typedef tai_status_t (*tai_api_initialize_fn) (uint64_t, const tai_service_method_table_t *);
+typedef tai_status_t (*tai_api_query_fn) (tai_api_t, void**);
+typedef tai_status_t (*tai_api_uninitialize_fn) (void);
+
+static const uint32_t BUFFER_SIZE = 128;
+
+static void module_presence(bool present, char* location) {}
+
+struct Request {
+    std::string location;
+    std::vector<char> location_buf;
+    std::vector<char> library_buf;
+    std::vector<tai_attribute_t> attrs;
+
+    Request(const std::string& location) : location(location), location_buf(BUFFER_SIZE), library_buf(BUFFER_SIZE), attrs(2) {
+        attrs[0].id = TAI_MODULE_ATTR_LOCATION;
+        attrs[0].value.charlist.count = location_buf.size();
+        attrs[0].value.charlist.list = location_buf.data();
+        attrs[1].id = TAI_MODULE_ATTR_MUX_CURRENT_LOADED_TAI_LIBRARY;
+        attrs[1].value.charlist.count = library_buf.size();
+        attrs[1].value.charlist.list = library_buf.data();
+    }
+};
+
+static std::string value(const tai_attribute_t& attr) {
+    return std::string(attr.value.charlist.list, attr.value.charlist.count);
+}
+
+int main(int argc, char* argv[]) {
+    auto e = std::getenv("TAI_TEST_MUX_LIBRARY");
+    std::string name = e != nullptr ? e : "libtai.so";
+    auto dl = dlopen(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if ( dl == nullptr ) {
+        std::fprintf(stderr, "failed to load %s: %s\n", name.c_str(), dlerror());
+        return 1;
+    }
+    auto initialize = reinterpret_cast<tai_api_initialize_fn>(dlsym(dl, "tai_api_initialize"));
+    auto query = reinterpret_cast<tai_api_query_fn>(dlsym(dl, "tai_api_query"));
+    auto uninitialize = reinterpret_cast<tai_api_uninitialize_fn>(dlsym(dl, "tai_api_uninitialize"));
+    auto bulk = reinterpret_cast<tai_mux_get_attributes_bulk_fn>(dlsym(dl, "tai_mux_get_attributes_bulk"));
+    if ( initialize == nullptr || query == nullptr || uninitialize == nullptr || bulk == nullptr ) {
+        std::fprintf(stderr, "%s is not libtai-mux.so\n", name.c_str());
+        return 1;
+    }
+    tai_service_method_table_t services = {};
+    services.module_presence = module_presence;
+    if ( initialize(0, &services) != TAI_STATUS_SUCCESS ) {
+        std::fprintf(stderr, "failed to initialize %s\n", name.c_str());
+        return 1;
+    }
+    tai_module_api_t* module = nullptr;
+    if ( query(TAI_API_MODULE, reinterpret_cast<void**>(&module)) != TAI_STATUS_SUCCESS || module == nullptr ) {
+        return 1;
+    }
+
+    if ( argc < 2 ) {
+        std::fprintf(stderr, "usage: %s <location>...\n", argv[0]);
+        return 1;
+    }
+    // the attributes point into the requests, they must not move
+    std::vector<Request> requests;
+    requests.reserve(argc);
+    std::vector<tai_object_id_t> oids;
+    for ( int i = 1; i < argc; i++ ) {
+        std::string location = argv[i];
+        tai_attribute_t attr;
+        attr.id = TAI_MODULE_ATTR_LOCATION;
+        attr.value.charlist.count = location.size();
+        attr.value.charlist.list = const_cast<char*>(location.c_str());
+        tai_object_id_t oid;
+        auto ret = module->create_module(&oid, 1, &attr);
+        if ( ret != TAI_STATUS_SUCCESS ) {
+            std::fprintf(stderr, "failed to create a module at %s: %d\n", location.c_str(), ret);
+            return 1;
+        }
+        requests.emplace_back(location);
+        oids.emplace_back(oid);
+    }
+    if ( module->remove_module(oids.back()) != TAI_STATUS_SUCCESS ) {
+        std::fprintf(stderr, "failed to remove the module at %s\n", requests.back().location.c_str());
+        return 1;
+    }
+    requests.emplace_back("none");
+    oids.emplace_back(TAI_NULL_OBJECT_ID);
+
+    std::vector<tai_mux_get_request_t> bulk_requests(requests.size());
+    for ( size_t i = 0; i < requests.size(); i++ ) {
+        bulk_requests[i].oid = oids[i];
+        bulk_requests[i].attr_count = requests[i].attrs.size();
+        bulk_requests[i].attr_list = requests[i].attrs.data();
+        bulk_requests[i].status = TAI_STATUS_FAILURE;
+    }
+    auto ret = bulk(bulk_requests.size(), bulk_requests.data());
+    if ( ret != TAI_STATUS_SUCCESS ) {
+        std::fprintf(stderr, "tai_mux_get_attributes_bulk failed: %d\n", ret);
+        return 1;
+    }
+
+    for ( size_t i = 0; i < requests.size(); i++ ) {
+        auto& r = requests[i];
+        auto status = bulk_requests[i].status;
+        std::printf("{\"request\": \"%s\", \"status\": %d", r.location.c_str(), status);
+        if ( status == TAI_STATUS_SUCCESS ) {
+            std::printf(", \"location\": \"%s\", \"library\": \"%s\"", value(r.attrs[0]).c_str(), value(r.attrs[1]).c_str());
+        }
+        std::printf("}\n");
+    }
+
+    for ( size_t i = 0; i + 2 < oids.size(); i++ ) {
+        module->remove_module(oids[i]);
+    }
+    uninitialize();
+    return 0;
+}
@@ -30,6 +30,15 @@ typedef enum _basic_module_attr_t
      */
     TAI_MODULE_ATTR_CUSTOM_LIST,
 
+    /**
+     * @brief Custom OID attribute example
+     *
+     * @type tai_object_id_t
+     * @objects TAI_OBJECT_TYPE_NETWORKIF
+     * @flags CREATE_AND_SET
+     */
+    TAI_MODULE_ATTR_CUSTOM_OID,
+
 } basic_module_attr_t;
 
 #endif
@@ -1,8 +1,65 @@
 #!/usr/bin/env python
 
+import os
 import sys
 import time
 
+LOCATIONS = [str(v) for v in range(1, 8)]
+
+# seconds a resolution takes, to mimic a script which probes the module
+RESOLVE_DELAY = float(os.environ.get("TAI_TEST_EXEC_RESOLVE_DELAY", "0.05"))
+
+
+def listing():
+    # a location can be followed by what identifies the module in it, so that
+    # a module swapped for another one is noticed
+    return ["{} serial-{}".format(location, location) for location in LOCATIONS]
+
+
+def resolve(location):
+    time.sleep(RESOLVE_DELAY)
+    return "libtai-a.so"
+
+
+def serve():
+    # the interpreter startup and the discovery cost are paid only once
+    cache = {}
+    for line in sys.stdin:
+        req = line.split()
+        if not req:
+            continue
+        if req[0] == "list":
+            for line in listing():
+                print(line)
+            print(".")
+        elif req[0] == "list-changed":
+            # any string which changes with the modules can be the token
+            token = "-".join(LOCATIONS)
+            if len(req) == 2 and req[1] == token:
+                print("unchanged")
+            else:
+                print("changed {}".format(token))
+                for line in listing():
+                    print(line)
+            print(".")
+        elif req[0] == "resolve-all":
+            for location in LOCATIONS:
+                if location not in cache:
+                    cache[location] = resolve(location)
+                print("{} {}".format(location, cache[location]))
+            print(".")
+        elif req[0] == "resolve" and len(req) == 2:
+            location = req[1]
+            if location not in LOCATIONS:
+                print("err no module in {}".format(location))
+            else:
+                if location not in cache:
+                    cache[location] = resolve(location)
+                print("ok {}".format(cache[location]))
+        else:
+            print("err unknown request: {}".format(line.strip()))
+        sys.stdout.flush()
+
 
 def main():
     if len(sys.argv) != 2:
@@ -11,12 +68,14 @@ def main():
     arg = sys.argv[1]
 
     if arg == "list":
-        print("\n".join(str(v) for v in range(1, 8)))
+        print("\n".join(listing()))
         return
 
-    time.sleep(0.5)
+    if arg == "serve":
+        serve()
+        return
 
-    print("libtai-a.so")
+    print(resolve(arg))
 
 
 if __name__ == "__main__":
@@ -2,6 +2,10 @@ import unittest
 import subprocess as sp
 import threading
 import os
+import json
+import shutil
+import signal
+import tempfile
 import time
 import taish
 import asyncio
@@ -22,18 +26,43 @@ TAI_TEST_NO_LOCAL_TAISH_SERVER = (
     True if os.environ.get("TAI_TEST_NO_LOCAL_TAISH_SERVER", "") else False
 )
 
+TAI_TEST_HOST_PROGRAM = os.environ.get(
+    "TAI_TEST_HOST_PROGRAM",
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "host", "tai-mux-host"),
+)
+
+# built by 'make bulk_get'
+TAI_TEST_BULK_GET_PROGRAM = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), "bulk_get"
+)
+
+TAI_STATUS_SUCCESS = 0
+TAI_STATUS_ITEM_NOT_FOUND = -7
 
-def output_reader(proc):
+
+def output_reader(proc, output):
     for line in iter(proc.stdout.readline, b""):
-        print("taish-server: {}".format(line.decode("utf-8")), end="")
+        line = line.decode("utf-8")
+        output.append(line)
+        print("taish-server: {}".format(line), end="")
+
 
+class TaishServerTestCase(unittest.IsolatedAsyncioTestCase):
+    # environment variables of the local taish server
+    ENV = {}
 
-class TestTAI(unittest.IsolatedAsyncioTestCase):
     def setUp(self):
         if TAI_TEST_NO_LOCAL_TAISH_SERVER:
+            if self.ENV:
+                self.skipTest("needs a local taish server")
             return
-        proc = sp.Popen(["taish_server", "-v", "-n"], stderr=sp.STDOUT, stdout=sp.PIPE)
-        self.d = threading.Thread(target=output_reader, args=(proc,))
+        env = dict(os.environ, **self.ENV)
+        proc = sp.Popen(
+            ["taish_server", "-v", "-n"], stderr=sp.STDOUT, stdout=sp.PIPE, env=env
+        )
+        # the lines the server and libtai-mux.so logged
+        self.output = []
+        self.d = threading.Thread(target=output_reader, args=(proc, self.output))
         self.d.start()
         self.proc = proc
         time.sleep(5)  # wait for the server to be ready
@@ -46,6 +75,39 @@ class TestTAI(unittest.IsolatedAsyncioTestCase):
         self.d.join()
         self.proc.stdout.close()
 
+    async def client(self):
+        cli = taish.AsyncClient(
+            TAI_TEST_TAISH_SERVER_ADDRESS, TAI_TEST_TAISH_SERVER_PORT
+        )
+        self.addAsyncCleanup(cli.close)
+        return cli
+
+    async def wait_until(self, f, timeout=5):
+        # polls the coroutine function f until it returns True
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if await f():
+                return
+            await asyncio.sleep(0.05)
+        self.fail("timed out")
+
+    async def monitor(self, module, attr, callback):
+        # subscribes to a notification attribute until the returned task is cancelled
+        task = asyncio.create_task(module.monitor(attr, callback, json=True))
+
+        async def cancel():
+            task.cancel()
+            try:
+                await task
+            except asyncio.CancelledError:
+                pass
+
+        self.addAsyncCleanup(cancel)
+        await asyncio.sleep(0.5)  # wait for the handler to be set
+        return cancel
+
+
+class TestTAI(TaishServerTestCase):
     async def test_create_and_remove(self):
         cli = taish.AsyncClient(
             TAI_TEST_TAISH_SERVER_ADDRESS, TAI_TEST_TAISH_SERVER_PORT
@@ -54,3 +116,496 @@ class TestTAI(unittest.IsolatedAsyncioTestCase):
         v = await asyncio.gather(*(cli.create_module(k) for k in m.keys()))
         await asyncio.gather(*(cli.remove(v.oid) for v in v))
         await cli.close()
+
+
+class TestAttributeCache(TaishServerTestCase):
+    ENV = {"TAI_MUX_ATTR_CACHE_TTL_MS": "60000"}
+
+    async def counters(self, module):
+        v = await asyncio.gather(
+            *(
+                module.get("mux-attribute-cache-" + k)
+                for k in ("hit", "partial-hit", "miss")
+            )
+        )
+        return tuple(int(x) for x in v)
+
+    async def test_invalidate_on_set(self):
+        cli = await self.client()
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+
+        await module.get("oper-status")
+        await module.get("location")
+        hit, partial, miss = await self.counters(module)
+
+        # both are cached now
+        await module.get("oper-status")
+        await module.get("location")
+        self.assertEqual(await self.counters(module), (hit + 2, partial, miss))
+
+        # a set discards the READ_ONLY attributes but keeps the CREATE_ONLY ones
+        await module.set("custom", "true")
+        await module.get("oper-status")
+        await module.get("location")
+        self.assertEqual(await self.counters(module), (hit + 3, partial, miss + 1))
+
+        # nothing of a removed object is served from the cache
+        await cli.remove(module.oid)
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+        hit, partial, miss = await self.counters(module)
+        await module.get("location")
+        self.assertEqual(await self.counters(module), (hit, partial, miss + 1))
+
+
+class TestIsolatedLibrary(TaishServerTestCase):
+    ENV = {
+        "TAI_MUX_ISOLATED_LIBRARIES": "libtai-a.so",
+        "TAI_MUX_HOST_PROGRAM": TAI_TEST_HOST_PROGRAM,
+        "TAI_MUX_HOST_CALL_TIMEOUT_MS": "1000",
+    }
+
+    def host_pid(self):
+        p = sp.run(["pgrep", "-f", "tai-mux-host libtai-a.so"], stdout=sp.PIPE)
+        pids = p.stdout.split()
+        return int(pids[0]) if pids else None
+
+    async def wait_restarted(self, pid):
+        for _ in range(100):
+            v = self.host_pid()
+            if v is not None and v != pid:
+                return
+            await asyncio.sleep(0.1)
+        self.fail("the host process wasn't restarted")
+
+    async def test_restart_after_crash(self):
+        cli = await self.client()
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+        await module.set("custom", "true")
+
+        pid = self.host_pid()
+        self.assertIsNotNone(pid)
+        os.kill(pid, signal.SIGKILL)
+        await self.wait_restarted(pid)
+
+        # the module is created again with the attributes it was set with
+        self.assertEqual(await module.get("custom"), "true")
+
+    async def test_restart_after_stall(self):
+        cli = await self.client()
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+        await module.set("custom", "true")
+
+        pid = self.host_pid()
+        self.assertIsNotNone(pid)
+        os.kill(pid, signal.SIGSTOP)
+        start = time.time()
+        with self.assertRaises(Exception):
+            await module.get("custom")
+        # failed by TAI_MUX_HOST_CALL_TIMEOUT_MS instead of hanging
+        self.assertLess(time.time() - start, 5)
+
+        await self.wait_restarted(pid)
+        self.assertEqual(await module.get("custom"), "true")
+
+
+class TestNotificationContexts(TaishServerTestCase):
+    ENV = {"TAI_MUX_NOTIFICATION_GRACE_PERIOD_MS": "1000"}
+
+    async def pending(self, module):
+        return int(await module.get("mux-notification-contexts-pending"))
+
+    async def pending_is(self, module, n):
+        return await self.pending(module) == n
+
+    async def test_freed_after_grace_period(self):
+        cli = await self.client()
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+        self.assertEqual(await self.pending(module), 0)
+
+        cancel = await self.monitor(module, "notify", lambda *args: None)
+        self.assertEqual(await self.pending(module), 0)
+
+        # clearing the handler retires the context, it is kept for the grace period
+        await cancel()
+        await self.wait_until(lambda: self.pending_is(module, 1))
+        start = time.time()
+        await self.wait_until(lambda: self.pending_is(module, 0))
+        self.assertLess(time.time() - start, 3)
+
+
+class TestNotificationLimiter(TaishServerTestCase):
+    ENV = {"TAI_MUX_NOTIFICATION_RATE_LIMIT": "2", "TAI_MUX_NOTIFICATION_BURST": "1"}
+
+    async def test_rate_limit(self):
+        cli = await self.client()
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+        netif = await module.create_netif(0)
+
+        received = []
+        await self.monitor(netif, "notify", lambda *args: received.append(args))
+
+        # each change of tx-dis is notified by the TAI library
+        start = time.time()
+        for i in range(20):
+            await netif.set("tx-dis", "true" if i % 2 == 0 else "false")
+        await asyncio.sleep(1)
+        elapsed = time.time() - start
+
+        # a burst of 1, then 2 per second. the rest are merged
+        self.assertGreater(len(received), 0)
+        self.assertLessEqual(len(received), 1 + 2 * elapsed + 1)
+        self.assertGreater(int(await module.get("mux-notification-suppressed")), 0)
+
+
+def write_eeprom(path, identifier, vendor_name=b"", vendor_pn=b"", vendor_sn=b""):
+    # CMIS layout (QSFP-DD), the fields are padded with spaces
+    data = bytearray(256)
+    data[0] = identifier
+    for offset, field in ((129, vendor_name), (148, vendor_pn), (166, vendor_sn)):
+        data[offset : offset + 16] = field.ljust(16)
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+class TestEEPROMPlatformAdapter(TaishServerTestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.addCleanup(shutil.rmtree, self.dir)
+        self.eeproms = {l: os.path.join(self.dir, "eeprom" + l) for l in ("1", "2")}
+        write_eeprom(self.eeproms["1"], 0x18, b"ACME", b"ABC-100", b"SN1")
+        write_eeprom(self.eeproms["2"], 0x00)
+        config = os.path.join(self.dir, "eeprom.json")
+        with open(config, "w") as f:
+            json.dump(
+                {
+                    "eeproms": self.eeproms,
+                    "rules": [
+                        {
+                            "identifier": [24, "0x19"],
+                            "vendor-pn": "ABC-*",
+                            "library": "libtai-a.so",
+                        },
+                        {"vendor-name": "ACME", "library": "libtai-b.so"},
+                    ],
+                },
+                f,
+            )
+        self.ENV = {
+            "TAI_MUX_PLATFORM_ADAPTER": "eeprom",
+            "TAI_MUX_EEPROM_CONFIG_FILE": config,
+            "TAI_MUX_EEPROM_PRESENCE_INTERVAL": "1",
+        }
+        super().setUp()
+
+    async def present(self, cli):
+        return {k for k, v in (await cli.list()).items() if v.present}
+
+    async def library(self, cli, location):
+        # the library the rules chose for the module in location
+        module = await cli.create_module(location)
+        try:
+            # the count of the value includes the terminating NUL
+            return (await module.get("mux-current-loaded-tai-library")).rstrip("\0")
+        finally:
+            await cli.remove(module.oid)
+
+    async def test_presence(self):
+        cli = await self.client()
+        self.assertEqual(await self.present(cli), {"1"})
+        # chosen by the part number
+        self.assertEqual(await self.library(cli, "1"), "libtai-a.so")
+
+        # plugged in, chosen by the vendor name
+        write_eeprom(self.eeproms["2"], 0x18, b"ACME", b"XYZ-200", b"SN2")
+        await self.wait_until(lambda: self.present_is(cli, {"1", "2"}))
+        self.assertEqual(await self.library(cli, "2"), "libtai-b.so")
+
+        # pulled out
+        write_eeprom(self.eeproms["1"], 0x00)
+        await self.wait_until(lambda: self.present_is(cli, {"2"}))
+        with self.assertRaises(Exception):
+            await cli.create_module("1")
+
+    async def present_is(self, cli, locations):
+        return await self.present(cli) == locations
+
+    async def test_serial_number_change(self):
+        cli = await self.client()
+        self.assertEqual(await self.library(cli, "1"), "libtai-a.so")
+
+        # the decision is kept as long as the identifier and the serial number
+        # are the same, the rest of the EEPROM isn't read again
+        write_eeprom(self.eeproms["1"], 0x18, b"ACME", b"XYZ-100", b"SN1")
+        self.assertEqual(await self.library(cli, "1"), "libtai-a.so")
+
+        # another module, the rules are evaluated again
+        write_eeprom(self.eeproms["1"], 0x18, b"ACME", b"XYZ-100", b"SN3")
+        self.assertEqual(await self.library(cli, "1"), "libtai-b.so")
+
+
+class TestNotificationCoalescing(TaishServerTestCase):
+    ENV = {
+        "TAI_MUX_NOTIFICATION_QUEUE_SIZE": "1",
+        "TAI_MUX_NOTIFICATION_OVERFLOW_POLICY": "coalesce",
+        # a slow host, so that the queue overflows
+        "TAI_MUX_NOTIFICATION_DISPATCH_DELAY_MS": "50",
+    }
+
+    async def test_latest_value_delivered(self):
+        cli = await self.client()
+        module = await cli.create_module(TAI_TEST_MODULE_LOCATION)
+        netif = await module.create_netif(0)
+        tx_dis = (await netif.get_attribute_metadata("tx-dis")).attr_id
+
+        # the values of tx-dis in the order they were received
+        received = []
+
+        def callback(obj, meta, msg):
+            for a in msg.attrs:
+                if a.attr_id == tx_dis:
+                    received.append(a.value)
+
+        await self.monitor(netif, "notify", callback)
+
+        # more changes than the queue holds, the overflow is merged instead of dropped
+        n = 50
+        values = ["true" if i % 2 == 0 else "false" for i in range(n)]
+        for v in values:
+            await netif.set("tx-dis", v)
+
+        async def coalesced():
+            return int(await module.get("mux-notification-coalesced")) > 0
+
+        await self.wait_until(coalesced)
+        await self.wait_until(
+            lambda: self.queue_drained(module), timeout=n * 0.05 + 5
+        )
+        await asyncio.sleep(0.5)
+
+        self.assertGreater(len(received), 0)
+        self.assertLess(len(received), n)
+        self.assertEqual(received[-1], values[-1])
+        self.assertEqual(int(await module.get("mux-notification-dropped")), 0)
+
+    async def queue_drained(self, module):
+        return int(await module.get("mux-notification-queue-depth")) == 0
+
+
+class TestBulkGet(unittest.TestCase):
+    # libtai-mux.so is loaded by bulk_get.cpp, no taish server is involved
+    LIBRARIES = {
+        "0": "libtai-a.so",
+        "1": "libtai-b.so",
+        "2": "libtai-a.so",
+        "3": "libtai-b.so",
+    }
+
+    def setUp(self):
+        if not os.path.exists(TAI_TEST_BULK_GET_PROGRAM):
+            self.skipTest("bulk_get isn't built")
+        self.dir = tempfile.mkdtemp()
+        self.addCleanup(shutil.rmtree, self.dir)
+        self.config = os.path.join(self.dir, "static.json")
+        with open(self.config, "w") as f:
+            json.dump(self.LIBRARIES, f)
+
+    def bulk_get(self, threads):
+        env = dict(
+            os.environ,
+            TAI_MUX_PLATFORM_ADAPTER="static",
+            TAI_MUX_STATIC_CONFIG_FILE=self.config,
+            TAI_MUX_BULK_THREADS=str(threads),
+        )
+        p = sp.run(
+            [TAI_TEST_BULK_GET_PROGRAM] + sorted(self.LIBRARIES),
+            stdout=sp.PIPE,
+            env=env,
+            timeout=30,
+        )
+        self.assertEqual(p.returncode, 0)
+        return [json.loads(line) for line in p.stdout.decode().splitlines()]
+
+    def check(self, results):
+        # bulk_get removes the module at the last location before the call
+        removed = sorted(self.LIBRARIES)[-1]
+        self.assertEqual(
+            [r["request"] for r in results], sorted(self.LIBRARIES) + ["none"]
+        )
+        for r in results:
+            if r["request"] in (removed, "none"):
+                self.assertEqual(r["status"], TAI_STATUS_ITEM_NOT_FOUND)
+                continue
+            # the requests of both TAI libraries are answered by their own library
+            self.assertEqual(r["status"], TAI_STATUS_SUCCESS)
+            self.assertEqual(r["location"], r["request"])
+            self.assertEqual(r["library"], self.LIBRARIES[r["request"]])
+
+    def test_parallel(self):
+        self.check(self.bulk_get(4))
+
+    def test_caller_thread(self):
+        self.check(self.bulk_get(0))
+
+
+class TestPlatformAdapterPlugin(TaishServerTestCase):
+    # libtai-mux-pa-test.so, built from test_platform_adapter.cpp
+    ENV = {"TAI_MUX_PLATFORM_ADAPTER": "test"}
+
+    async def test_load(self):
+        cli = await self.client()
+        self.assertEqual(set((await cli.list()).keys()), {"0", "1"})
+        for location, library in (("0", "libtai-a.so"), ("1", "libtai-b.so")):
+            module = await cli.create_module(location)
+            self.assertEqual(await module.get("mux-platform-adapter-type"), "plugin")
+            self.assertEqual(
+                (await module.get("mux-current-loaded-tai-library")).rstrip("\0"),
+                library,
+            )
+            await cli.remove(module.oid)
+
+
+class TestPlatformAdapterPluginVersion(unittest.TestCase):
+    # libtai-mux.so is initialized by bulk_get.cpp, which fails when the
+    # platform adapter can't be loaded
+    def setUp(self):
+        if not os.path.exists(TAI_TEST_BULK_GET_PROGRAM):
+            self.skipTest("bulk_get isn't built")
+
+    def bulk_get(self, platform_adapter):
+        env = dict(os.environ, TAI_MUX_PLATFORM_ADAPTER=platform_adapter)
+        return sp.run(
+            [TAI_TEST_BULK_GET_PROGRAM, "0", "1"],
+            stdout=sp.PIPE,
+            stderr=sp.PIPE,
+            env=env,
+            timeout=30,
+        )
+
+    def test_same_version(self):
+        p = self.bulk_get("test")
+        self.assertEqual(p.returncode, 0)
+        r = json.loads(p.stdout.decode().splitlines()[0])
+        self.assertEqual(r["status"], TAI_STATUS_SUCCESS)
+        self.assertEqual(r["library"], "libtai-a.so")
+
+    def test_other_version(self):
+        # libtai-mux-pa-test-old.so claims another version of the plugin interface
+        p = self.bulk_get("test-old")
+        self.assertNotEqual(p.returncode, 0)
+        self.assertIn(b"failed to initialize", p.stderr)
+
+
+# an exec script whose modules come from a JSON file, so that the tests can
+# insert, remove and swap modules. {"<location>": ["<serial>", "<library>"]}
+EXEC_PRESENCE_SCRIPT = """#!/usr/bin/env python
+import json
+import sys
+
+STATE = {state!r}
+
+
+def modules():
+    with open(STATE) as f:
+        return json.load(f)
+
+
+def listing():
+    return ["{{}} {{}}".format(l, v[0]) for l, v in sorted(modules().items())]
+
+
+if sys.argv[1] == "list":
+    print("\\n".join(listing()))
+elif sys.argv[1] == "serve":
+    for line in sys.stdin:
+        req = line.split()
+        if req == ["list"]:
+            print("\\n".join(listing() + ["."]), flush=True)
+        elif len(req) == 2 and req[0] == "resolve":
+            m = modules().get(req[1])
+            print("ok {{}}".format(m[1]) if m else "err no module", flush=True)
+        else:
+            print("err unsupported", flush=True)
+else:
+    m = modules().get(sys.argv[1])
+    if not m:
+        sys.exit("no module in {{}}".format(sys.argv[1]))
+    print(m[1])
+"""
+
+
+class TestExecPresence(TaishServerTestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.addCleanup(shutil.rmtree, self.dir)
+        self.state = os.path.join(self.dir, "modules.json")
+        self.write_state(
+            {"1": ["serial-1", "libtai-a.so"], "2": ["serial-2", "libtai-a.so"]}
+        )
+        script = os.path.join(self.dir, "exec.py")
+        with open(script, "w") as f:
+            f.write(EXEC_PRESENCE_SCRIPT.format(state=self.state))
+        os.chmod(script, 0o755)
+        # TAI_MUX_EXEC_MODE is inherited, so both modes are covered
+        self.ENV = {
+            "TAI_MUX_PLATFORM_ADAPTER": "exec",
+            "TAI_MUX_EXEC_SCRIPT": script,
+            "TAI_MUX_EXEC_PRESENCE_INTERVAL": "1",
+        }
+        super().setUp()
+
+    def write_state(self, modules):
+        # replaced at once so that the script never reads a partial file
+        tmp = self.state + ".tmp"
+        with open(tmp, "w") as f:
+            json.dump(modules, f)
+        os.rename(tmp, self.state)
+
+    async def present_is(self, cli, locations):
+        return {k for k, v in (await cli.list()).items() if v.present} == locations
+
+    async def library(self, cli, location):
+        module = await cli.create_module(location)
+        try:
+            # the count of the value includes the terminating NUL
+            return (await module.get("mux-current-loaded-tai-library")).rstrip("\\0")
+        finally:
+            await cli.remove(module.oid)
+
+    async def test_removed(self):
+        cli = await self.client()
+        await self.wait_until(lambda: self.present_is(cli, {"1", "2"}))
+        self.assertEqual(await self.library(cli, "2"), "libtai-a.so")
+
+        self.write_state({"1": ["serial-1", "libtai-a.so"]})
+        await self.wait_until(lambda: self.present_is(cli, {"1"}))
+        with self.assertRaises(Exception):
+            await cli.create_module("2")
+
+        # inserted again with another kind of module, the cached library is gone
+        self.write_state(
+            {"1": ["serial-1", "libtai-a.so"], "2": ["serial-3", "libtai-b.so"]}
+        )
+        await self.wait_until(lambda: self.present_is(cli, {"1", "2"}))
+        self.assertEqual(await self.library(cli, "2"), "libtai-b.so")
+
+    async def test_swapped(self):
+        cli = await self.client()
+        await self.wait_until(lambda: self.present_is(cli, {"1", "2"}))
+        self.assertEqual(await self.library(cli, "1"), "libtai-a.so")
+
+        # the location stays listed, only the serial number tells the swap.
+        # it is reported absent and present again within one listing
+        swaps = lambda: sum("modules: 1 removed, 1 added" in l for l in self.output)
+        n = swaps()
+        self.write_state(
+            {"1": ["serial-9", "libtai-b.so"], "2": ["serial-2", "libtai-a.so"]}
+        )
+
+        async def swapped():
+            return swaps() > n
+
+        await self.wait_until(swapped)
+        self.assertTrue(await self.present_is(cli, {"1", "2"}))
+        self.assertEqual(await self.library(cli, "1"), "libtai-b.so")
+        # the module which wasn't swapped keeps its library
+        self.assertEqual(await self.library(cli, "2"), "libtai-a.so")
@@ -0,0 +1,90 @@
+#include "platform_adapter_plugin.hpp"
+#include "module_adapter.hpp"
+
+#include <map>
+#include <mutex>
+#include <unordered_set>
+
+// a minimal platform adapter plugin, loaded by test.py as
+// TAI_MUX_PLATFORM_ADAPTER=test. the modules are fixed: location "0" uses
+// libtai-a.so and location "1" libtai-b.so, like static.json
+//
+// built with -DTAI_TEST_PLUGIN_VERSION=<version> it claims that version of the
+// plugin interface instead of the one of the headers, so that libtai-mux.so
+// refuses it
+
+using namespace tai::mux;
+
+static const std::map<std::string, std::string> LIBRARIES = {
+    {"0", "libtai-a.so"},
+    {"1", "libtai-b.so"},
+};
+
+class TestPlatformAdapter : public PlatformAdapter {
+    public:
+        TestPlatformAdapter(uint64_t flags, const tai_service_method_table_t* services) : m_loader(flags, &m_services) {
+            // the TAI libraries don't report presence, the plugin does
+            m_services.module_presence = nullptr;
+            m_services.get_module_io_handler = nullptr;
+            if ( services == nullptr ) {
+                return;
+            }
+            m_services.get_module_io_handler = services->get_module_io_handler;
+            if ( services->module_presence != nullptr ) {
+                for ( const auto& v : LIBRARIES ) {
+                    services->module_presence(true, const_cast<char*>(v.first.c_str()));
+                }
+            }
+        }
+
+        ~TestPlatformAdapter() {
+            for ( auto& ma : list_module_adapters() ) {
+                ma->tai_api_uninitialize();
+            }
+        }
+
+        S_ModuleAdapter get_module_adapter(const std::string& location) {
+            auto it = LIBRARIES.find(location);
+            if ( it == LIBRARIES.end() ) {
+                return nullptr;
+            }
+            S_ModuleAdapter ma;
+            try {
+                ma = m_loader.load(it->second);
+            } catch (const std::exception& e) {
+                TAI_ERROR("failed to load %s: %s", it->second.c_str(), e.what());
+                return nullptr;
+            }
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_adapters.emplace(ma);
+            ma->acquire();
+            return ma;
+        }
+
+        const std::unordered_set<S_ModuleAdapter> list_module_adapters() {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            return m_adapters;
+        }
+
+        tai_mux_platform_adapter_type_t type() const {
+            return TAI_MUX_PLATFORM_ADAPTER_TYPE_PLUGIN;
+        }
+
+    private:
+        tai_service_method_table_t m_services;
+        ModuleAdapterLoader m_loader;
+        std::mutex m_mutex;
+        std::unordered_set<S_ModuleAdapter> m_adapters;
+};
+
+#ifdef TAI_TEST_PLUGIN_VERSION
+extern "C" uint32_t tai_mux_platform_adapter_version(void) {
+    return TAI_TEST_PLUGIN_VERSION;
+}
+
+extern "C" PlatformAdapter* tai_mux_platform_adapter_create(uint64_t flags, const tai_service_method_table_t* services) {
+    return new TestPlatformAdapter(flags, services);
+}
+#else
+TAI_MUX_PLATFORM_ADAPTER_PLUGIN(TestPlatformAdapter)
+#endif
@@ -0,0 +1,176 @@
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "unit.hpp"
+#include "notification_dispatcher.hpp"
+
+// checks the notification path of libtai-mux.so without loading a TAI library
+
+using namespace tai::mux;
+
+static tai_attr_metadata_t make_meta(tai_attr_id_t id, tai_attr_value_type_t type) {
+    tai_attr_metadata_t meta{};
+    meta.objecttype = TAI_OBJECT_TYPE_MODULE;
+    meta.attrid = id;
+    meta.attrvaluetype = type;
+    return meta;
+}
+
+// what a handler of the host received
+struct Received {
+    std::mutex mutex;
+    std::vector<std::map<tai_attr_id_t, uint32_t>> notifications; // u32 or the first element of a u32 list
+    std::atomic<bool> block {false};
+    std::atomic<int> blocked {0};
+};
+
+static void handler(void* context, tai_object_id_t oid, uint32_t attr_count, tai_attribute_t const * const attr_list) {
+    auto r = static_cast<Received*>(context);
+    if ( r->block ) {
+        r->blocked++;
+        while ( r->block ) {
+            std::this_thread::yield();
+        }
+    }
+    std::map<tai_attr_id_t, uint32_t> n;
+    for ( uint32_t i = 0; i < attr_count; i++ ) {
+        auto& a = attr_list[i];
+        n[a.id] = a.id == TAI_MODULE_ATTR_CUSTOM_RANGE_START + 2 ? a.value.u32list.list[0] : a.value.u32;
+    }
+    std::unique_lock<std::mutex> lk(r->mutex);
+    r->notifications.emplace_back(n);
+}
+
+// two notification attributes of one object are merged separately while the
+// queue is full, and each handler only gets the attributes sent through it
+static void dispatcher_coalesces_per_notification_attribute() {
+    const tai_attr_id_t notify_a = TAI_MODULE_ATTR_NOTIFY;
+    const tai_attr_id_t notify_b = TAI_MODULE_ATTR_CUSTOM_RANGE_START + 100;
+    const tai_attr_id_t attr_a = TAI_MODULE_ATTR_CUSTOM_RANGE_START;
+    const tai_attr_id_t attr_b = TAI_MODULE_ATTR_CUSTOM_RANGE_START + 1;
+    const tai_attr_id_t attr_list = TAI_MODULE_ATTR_CUSTOM_RANGE_START + 2;
+    auto meta_a = make_meta(attr_a, TAI_ATTR_VALUE_TYPE_U32);
+    auto meta_b = make_meta(attr_b, TAI_ATTR_VALUE_TYPE_U32);
+    auto meta_list = make_meta(attr_list, TAI_ATTR_VALUE_TYPE_U32LIST);
+    const tai_object_id_t oid = 1;
+
+    Received ra, rb;
+    tai_notification_handler_t ha{&ra, handler}, hb{&rb, handler};
+
+    NotificationDispatcher d(2, OverflowPolicy::COALESCE);
+
+    auto send = [&](tai_attr_id_t notify_id, const tai_notification_handler_t& h, uint32_t value) {
+        std::vector<uint32_t> list{value};
+        tai_attribute_t attrs[2];
+        const tai_attr_metadata_t* metas[2];
+        attrs[0].id = notify_id == notify_a ? attr_a : attr_b;
+        attrs[0].value.u32 = value;
+        metas[0] = notify_id == notify_a ? &meta_a : &meta_b;
+        attrs[1].id = attr_list;
+        attrs[1].value.u32list.count = list.size();
+        attrs[1].value.u32list.list = list.data();
+        metas[1] = &meta_list;
+        d.enqueue(notify_id, h, oid, 2, attrs, metas);
+        list[0] = 0; // the dispatcher must have its own copy
+    };
+
+    // stall the dispatcher in the first delivery so that the rest overflows
+    ra.block = true;
+    send(notify_a, ha, 1);
+    UNIT_CHECK(unit::wait_for([&]{ return ra.blocked == 1; }));
+    for ( uint32_t i = 2; i <= 10; i++ ) {
+        send(notify_a, ha, i);
+        send(notify_b, hb, 100 + i);
+    }
+    UNIT_CHECK(d.coalesced() > 0);
+    ra.block = false;
+
+    UNIT_CHECK(unit::wait_for([&]{
+        std::unique_lock<std::mutex> la(ra.mutex), lb(rb.mutex);
+        return !ra.notifications.empty() && ra.notifications.back().at(attr_a) == 10 &&
+               !rb.notifications.empty() && rb.notifications.back().at(attr_b) == 110;
+    }));
+    for ( auto& n : ra.notifications ) {
+        UNIT_CHECK(n.count(attr_b) == 0);
+        UNIT_CHECK(n.at(attr_list) == n.at(attr_a));
+    }
+    for ( auto& n : rb.notifications ) {
+        UNIT_CHECK(n.count(attr_a) == 0);
+        UNIT_CHECK(n.at(attr_list) == n.at(attr_b));
+    }
+}
+
+// what is queued or merged for a forgotten notification attribute or object
+// isn't delivered, and forget() returns only after the delivery in progress
+static void dispatcher_forgets() {
+    const tai_attr_id_t notify_a = TAI_MODULE_ATTR_NOTIFY;
+    const tai_attr_id_t notify_b = TAI_MODULE_ATTR_CUSTOM_RANGE_START + 100;
+    const tai_attr_id_t attr = TAI_MODULE_ATTR_CUSTOM_RANGE_START;
+    auto meta = make_meta(attr, TAI_ATTR_VALUE_TYPE_U32);
+    const tai_object_id_t oid = 1, other = 2, removed = 3;
+
+    Received ra, rb, rc;
+    tai_notification_handler_t ha{&ra, handler}, hb{&rb, handler}, hc{&rc, handler};
+
+    for ( auto policy : {OverflowPolicy::DROP_OLDEST, OverflowPolicy::COALESCE} ) {
+        NotificationDispatcher d(4, policy);
+        for ( auto r : {&ra, &rb, &rc} ) {
+            r->notifications.clear();
+            r->blocked = 0;
+        }
+
+        auto send = [&](tai_attr_id_t notify_id, const tai_notification_handler_t& h, tai_object_id_t o, uint32_t value) {
+            tai_attribute_t a;
+            const tai_attr_metadata_t* m = &meta;
+            a.id = attr;
+            a.value.u32 = value;
+            d.enqueue(notify_id, h, o, 1, &a, &m);
+        };
+
+        ra.block = true;
+        send(notify_a, ha, oid, 1);
+        UNIT_CHECK(unit::wait_for([&]{ return ra.blocked == 1; }));
+        for ( uint32_t i = 2; i <= 3; i++ ) {
+            send(notify_a, ha, oid, i);
+            send(notify_b, hb, removed, 100 + i);
+            send(notify_a, hc, other, 200 + i);
+        }
+
+        // doesn't wait, nothing of removed is being delivered
+        d.forget(removed);
+
+        // waits for the delivery of 1 to return
+        std::atomic<bool> forgotten {false};
+        std::thread t([&]{
+            d.forget(oid, notify_a);
+            forgotten = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        UNIT_CHECK(!forgotten);
+        ra.block = false;
+        t.join();
+
+        UNIT_CHECK(unit::wait_for([&]{
+            std::unique_lock<std::mutex> lk(rc.mutex);
+            return !rc.notifications.empty() && rc.notifications.back().at(attr) == 203;
+        }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        UNIT_CHECK(ra.notifications.size() == 1 && ra.notifications[0].at(attr) == 1);
+        UNIT_CHECK(rb.notifications.empty());
+
+        // the ones enqueued afterwards are delivered
+        send(notify_a, ha, oid, 4);
+        UNIT_CHECK(unit::wait_for([&]{
+            std::unique_lock<std::mutex> lk(ra.mutex);
+            return ra.notifications.size() == 2 && ra.notifications[1].at(attr) == 4;
+        }));
+    }
+}
+
+int main() {
+    unit::run("dispatcher_coalesces_per_notification_attribute", dispatcher_coalesces_per_notification_attribute);
+    unit::run("dispatcher_forgets", dispatcher_forgets);
+    return 0;
+}
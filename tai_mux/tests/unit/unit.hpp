@@ -0,0 +1,40 @@
+#ifndef __UNIT_HPP__
+#define __UNIT_HPP__
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+
+namespace unit {
+
+    // aborts the test program with the failed condition
+    #define UNIT_CHECK(cond) do { \
+        if ( !(cond) ) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+    // polls cond until it holds or timeout expires
+    inline bool wait_for(std::function<bool()> cond, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while ( !cond() ) {
+            if ( std::chrono::steady_clock::now() > deadline ) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    inline void run(const char* name, std::function<void()> fn) {
+        fn();
+        std::printf("ok: %s\n", name);
+        std::fflush(stdout);
+    }
+
+};
+
+#endif
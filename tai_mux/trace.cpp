@@ -0,0 +1,294 @@
+#include "trace.hpp"
+#include "logger.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+namespace tai::mux {
+
+    template<typename T>
+    static void put(std::string& buf, const T& v) {
+        buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    template<typename L>
+    static void put_list(std::string& buf, const L& l, bool elements) {
+        uint32_t count = l.list != nullptr ? l.count : 0;
+        put(buf, count);
+        if ( elements && count > 0 ) {
+            buf.append(reinterpret_cast<const char*>(l.list), sizeof(*l.list) * count);
+        }
+    }
+
+    static void put_value(std::string& buf, tai_attr_value_type_t type, const tai_attribute_value_t& value, bool elements) {
+        switch (type) {
+        case TAI_ATTR_VALUE_TYPE_UNSPECIFIED:
+        case TAI_ATTR_VALUE_TYPE_ATTRLIST:
+            break;
+        case TAI_ATTR_VALUE_TYPE_NOTIFICATION:
+            put(buf, uint8_t(value.notification.notify != nullptr ? 1 : 0));
+            break;
+        case TAI_ATTR_VALUE_TYPE_OBJLIST:
+            put_list(buf, value.objlist, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_CHARLIST:
+            put_list(buf, value.charlist, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_U8LIST:
+            put_list(buf, value.u8list, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_S8LIST:
+            put_list(buf, value.s8list, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_U16LIST:
+            put_list(buf, value.u16list, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_S16LIST:
+            put_list(buf, value.s16list, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_U32LIST:
+            put_list(buf, value.u32list, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_S32LIST:
+            put_list(buf, value.s32list, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_FLOATLIST:
+            put_list(buf, value.floatlist, elements);
+            break;
+        case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+            {
+                auto& l = value.objmaplist;
+                uint32_t count = l.list != nullptr ? l.count : 0;
+                put(buf, count);
+                if ( !elements ) {
+                    break;
+                }
+                for ( uint32_t i = 0; i < count; i++ ) {
+                    put(buf, l.list[i].key);
+                    put_list(buf, l.list[i].value, true);
+                }
+            }
+            break;
+        default:
+            put(buf, value);
+            break;
+        }
+    }
+
+    TraceWriter::TraceWriter(FILE* fp) : m_fp(fp), m_start(clock::now()) {
+        std::fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, m_fp);
+        std::fwrite(&TRACE_VERSION, sizeof(TRACE_VERSION), 1, m_fp);
+    }
+
+    TraceWriter::~TraceWriter() {
+        std::fclose(m_fp);
+    }
+
+    std::unique_ptr<TraceWriter> TraceWriter::from_env() {
+        auto path = std::getenv(TAI_MUX_TRACE_FILE.c_str());
+        if ( path == nullptr || path[0] == '\0' ) {
+            return nullptr;
+        }
+        auto fp = std::fopen(path, "abe");
+        if ( fp == nullptr ) {
+            TAI_ERROR("failed to open trace file %s: %s", path, std::strerror(errno));
+            return nullptr;
+        }
+        TAI_INFO("recording forwarded calls to %s", path);
+        return std::make_unique<TraceWriter>(fp);
+    }
+
+    void TraceWriter::write(TraceApi api, tai_object_type_t type, tai_object_id_t oid, tai_object_id_t module_id, tai_status_t status, clock::time_point start, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_value_type_t* const types) {
+        auto end = clock::now();
+        auto elements = api != TraceApi::GET || status == TAI_STATUS_SUCCESS;
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_buffer.clear();
+        put(m_buffer, static_cast<uint8_t>(api));
+        put(m_buffer, static_cast<uint32_t>(type));
+        put(m_buffer, oid);
+        put(m_buffer, module_id);
+        put(m_buffer, static_cast<int32_t>(status));
+        put(m_buffer, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_start).count()));
+        put(m_buffer, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+        put(m_buffer, count);
+        for ( uint32_t i = 0; i < count; i++ ) {
+            put(m_buffer, static_cast<uint32_t>(attrs[i].id));
+            put(m_buffer, static_cast<uint32_t>(types[i]));
+            put_value(m_buffer, types[i], attrs[i].value, elements);
+        }
+        // flushed per record so that the trace is complete up to the last
+        // call when the process dies
+        if ( std::fwrite(m_buffer.data(), m_buffer.size(), 1, m_fp) != 1 || std::fflush(m_fp) != 0 ) {
+            TAI_WARN("failed to write to the trace file");
+        }
+    }
+
+    TraceReader::~TraceReader() {
+        if ( m_fp != nullptr ) {
+            std::fclose(m_fp);
+        }
+    }
+
+    int TraceReader::open(const std::string& path) {
+        m_fp = std::fopen(path.c_str(), "rbe");
+        if ( m_fp == nullptr ) {
+            return -1;
+        }
+        char magic;
+        if ( !read(&magic, sizeof(magic)) || magic != TRACE_MAGIC[0] || !read_header() ) {
+            return -1;
+        }
+        return 0;
+    }
+
+    bool TraceReader::read(void* buf, size_t size) {
+        return size == 0 || std::fread(buf, size, 1, m_fp) == 1;
+    }
+
+    // the first byte of the magic has been read
+    bool TraceReader::read_header() {
+        char magic[sizeof(TRACE_MAGIC) - 1];
+        uint32_t version;
+        if ( !read(magic, sizeof(magic)) || std::memcmp(magic, TRACE_MAGIC + 1, sizeof(magic)) != 0 ) {
+            return false;
+        }
+        if ( !read(&version, sizeof(version)) || version != TRACE_VERSION ) {
+            return false;
+        }
+        m_first = true;
+        return true;
+    }
+
+    bool TraceReader::reserve(size_t size) {
+        if ( size > m_left ) {
+            return false;
+        }
+        m_left -= size;
+        return true;
+    }
+
+    bool TraceReader::read_value(TraceRecord& record, bool elements, tai_attribute_t& attr) {
+        auto& value = attr.value;
+        // the list gets storage for count elements even when they weren't
+        // recorded, so that it can be used as the buffer of a get
+        auto list = [&](auto& l) {
+            using T = std::remove_pointer_t<decltype(l.list)>;
+            if ( !read(&l.count, sizeof(l.count)) || !reserve(sizeof(T) * size_t(l.count)) ) {
+                return false;
+            }
+            record.buffers.emplace_back(new uint8_t[sizeof(T) * l.count + 1]());
+            l.list = reinterpret_cast<T*>(record.buffers.back().get());
+            return !elements || read(l.list, sizeof(T) * l.count);
+        };
+        switch (record.value_types.back()) {
+        case TAI_ATTR_VALUE_TYPE_UNSPECIFIED:
+        case TAI_ATTR_VALUE_TYPE_ATTRLIST:
+            return true;
+        case TAI_ATTR_VALUE_TYPE_NOTIFICATION:
+            {
+                uint8_t set;
+                if ( !read(&set, sizeof(set)) ) {
+                    return false;
+                }
+                // the handler of the host can't be recorded, mark it as set
+                // and leave it to the reader to install its own
+                value.notification.notify = nullptr;
+                value.notification.context = reinterpret_cast<void*>(uintptr_t(set));
+                return true;
+            }
+        case TAI_ATTR_VALUE_TYPE_OBJLIST:
+            return list(value.objlist);
+        case TAI_ATTR_VALUE_TYPE_CHARLIST:
+            return list(value.charlist);
+        case TAI_ATTR_VALUE_TYPE_U8LIST:
+            return list(value.u8list);
+        case TAI_ATTR_VALUE_TYPE_S8LIST:
+            return list(value.s8list);
+        case TAI_ATTR_VALUE_TYPE_U16LIST:
+            return list(value.u16list);
+        case TAI_ATTR_VALUE_TYPE_S16LIST:
+            return list(value.s16list);
+        case TAI_ATTR_VALUE_TYPE_U32LIST:
+            return list(value.u32list);
+        case TAI_ATTR_VALUE_TYPE_S32LIST:
+            return list(value.s32list);
+        case TAI_ATTR_VALUE_TYPE_FLOATLIST:
+            return list(value.floatlist);
+        case TAI_ATTR_VALUE_TYPE_OBJMAPLIST:
+            {
+                auto& l = value.objmaplist;
+                if ( !read(&l.count, sizeof(l.count)) || !reserve(sizeof(tai_object_map_t) * size_t(l.count)) ) {
+                    return false;
+                }
+                record.buffers.emplace_back(new uint8_t[sizeof(tai_object_map_t) * l.count + 1]());
+                l.list = reinterpret_cast<tai_object_map_t*>(record.buffers.back().get());
+                if ( !elements ) {
+                    return true;
+                }
+                for ( uint32_t i = 0; i < l.count; i++ ) {
+                    if ( !read(&l.list[i].key, sizeof(l.list[i].key)) || !list(l.list[i].value) ) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        default:
+            return read(&value, sizeof(value));
+        }
+    }
+
+    bool TraceReader::next(TraceRecord& record) {
+        if ( m_fp == nullptr ) {
+            return false;
+        }
+        uint8_t api;
+        uint32_t type, count;
+        int32_t status;
+        if ( !read(&api, sizeof(api)) ) {
+            return false;
+        }
+        // a header of the next process which appended to the file
+        if ( api == static_cast<uint8_t>(TRACE_MAGIC[0]) && ( !read_header() || !read(&api, sizeof(api)) ) ) {
+            return false;
+        }
+        if ( !read(&type, sizeof(type)) ||
+             !read(&record.oid, sizeof(record.oid)) || !read(&record.module_id, sizeof(record.module_id)) ||
+             !read(&status, sizeof(status)) || !read(&record.start_ns, sizeof(record.start_ns)) ||
+             !read(&record.duration_ns, sizeof(record.duration_ns)) || !read(&count, sizeof(count)) ) {
+            return false;
+        }
+        record.api = static_cast<TraceApi>(api);
+        record.object_type = static_cast<tai_object_type_t>(type);
+        record.status = status;
+        record.first = m_first;
+        m_first = false;
+        record.attrs.clear();
+        record.value_types.clear();
+        record.buffers.clear();
+        // the counts come from the file, a corrupted one mustn't make the reader allocate without bound
+        m_left = TRACE_MAX_RECORD_SIZE;
+        if ( !reserve(sizeof(tai_attribute_t) * size_t(count)) ) {
+            return false;
+        }
+        record.attrs.reserve(count);
+        record.value_types.reserve(count);
+        auto elements = record.api != TraceApi::GET || record.status == TAI_STATUS_SUCCESS;
+        for ( uint32_t i = 0; i < count; i++ ) {
+            tai_attribute_t attr = {};
+            uint32_t id, value_type;
+            if ( !read(&id, sizeof(id)) || !read(&value_type, sizeof(value_type)) ) {
+                return false;
+            }
+            attr.id = id;
+            record.value_types.emplace_back(static_cast<tai_attr_value_type_t>(value_type));
+            if ( !read_value(record, elements, attr) ) {
+                return false;
+            }
+            record.attrs.emplace_back(attr);
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,114 @@
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tai.h"
+
+namespace tai::mux {
+
+    // when set, the calls forwarded to the TAI libraries are recorded to this file
+    const std::string TAI_MUX_TRACE_FILE = "TAI_MUX_TRACE_FILE";
+
+    // trace file format. integers are in host byte order
+    //
+    // header:    "TAIMUXTR" | u32 version
+    // record:    u8 api | u32 object type | u64 oid | u64 module oid | i32 status
+    //            | u64 start ns | u64 duration ns | u32 count | attribute * count
+    // attribute: u32 id | u32 value type | value
+    //
+    // lists are u32 count followed by the elements, and an object map list is
+    // u32 count followed by u64 key | u32 count | u64 oid * count per entry.
+    // a notification is u8 1 when a handler is set and 0 otherwise. nested
+    // attribute lists and unknown attributes have no value. the other types are
+    // the whole tai_attribute_value_t. the elements of the lists of a get which
+    // didn't succeed are not written, only the count.
+    //
+    // OIDs are the ones seen by the TAI adapter host. start is relative to the
+    // time the trace file was opened.
+    //
+    // the file is appended to, every process writes a header followed by its
+    // records. OIDs and start times of different processes are unrelated.
+    const char TRACE_MAGIC[8] = {'T', 'A', 'I', 'M', 'U', 'X', 'T', 'R'};
+    const uint32_t TRACE_VERSION = 1;
+
+    // the reader takes a record which needs more memory than this as corrupted
+    const size_t TRACE_MAX_RECORD_SIZE = 64 << 20;
+
+    enum class TraceApi : uint8_t {
+        CREATE,
+        REMOVE,
+        GET,
+        SET,
+        GET_CAPABILITIES, // only the attribute ids are recorded
+    };
+
+    struct TraceRecord {
+        TraceApi api;
+        tai_object_type_t object_type;
+        tai_object_id_t oid;
+        tai_object_id_t module_id; // the module a network or host interface is created on
+        bool first; // the first record written by a process
+        tai_status_t status;
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        // a notification which the host had set is read back with a null
+        // notify and a non-null context
+        std::vector<tai_attribute_t> attrs;
+        std::vector<tai_attr_value_type_t> value_types;
+        // hold the lists of attrs
+        std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    };
+
+    class TraceWriter {
+        public:
+            using clock = std::chrono::steady_clock;
+
+            // takes the ownership of fp
+            TraceWriter(FILE* fp);
+            ~TraceWriter();
+
+            // returns nullptr unless TAI_MUX_TRACE_FILE is set
+            static std::unique_ptr<TraceWriter> from_env();
+
+            // types are the value types of attrs, attrs can be null when count is 0.
+            // the record is flushed to the file before it returns
+            void write(TraceApi api, tai_object_type_t type, tai_object_id_t oid, tai_object_id_t module_id, tai_status_t status, clock::time_point start, uint32_t count, const tai_attribute_t* const attrs, const tai_attr_value_type_t* const types);
+
+        private:
+            std::mutex m_mutex; // guards m_fp and m_buffer
+            FILE* m_fp;
+            clock::time_point m_start;
+            std::string m_buffer; // a record is encoded here and written at once
+    };
+
+    class TraceReader {
+        public:
+            TraceReader() : m_fp(nullptr) {}
+            ~TraceReader();
+
+            // returns -1 when the file can't be opened or isn't a trace
+            int open(const std::string& path);
+
+            // returns false at the end of the trace or when it is truncated or corrupted
+            bool next(TraceRecord& record);
+
+        private:
+            bool read(void* buf, size_t size);
+            bool read_header();
+            bool read_value(TraceRecord& record, bool elements, tai_attribute_t& attr);
+            // takes size bytes from what is left for the current record
+            bool reserve(size_t size);
+            FILE* m_fp;
+            bool m_first = false;
+            size_t m_left = 0;
+    };
+
+};
+
+#endif